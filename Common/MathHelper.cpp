@@ -5,6 +5,7 @@
 #include "MathHelper.h"
 #include <float.h>
 #include <cmath>
+#include <atomic>
 
 using namespace DirectX;
 
@@ -35,48 +36,169 @@ float MathHelper::AngleFromXY(float x, float y)
 
 XMVECTOR MathHelper::RandUnitVec3()
 {
-	XMVECTOR One  = XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f);
-	XMVECTOR Zero = XMVectorZero();
+	return RandStream().NextUnitVec3();
+}
+
+XMVECTOR MathHelper::RandHemisphereUnitVec3(XMVECTOR n)
+{
+	return RandStream().NextHemisphereUnitVec3(n);
+}
+
+namespace
+{
+	std::atomic<std::uint64_t> gRandSeed(1);
+	std::atomic<std::uint32_t> gRandThreads(0);
 
-	// Keep trying until we get a point on/in the hemisphere.
-	while(true)
+	std::uint64_t SplitMix64(std::uint64_t& x)
 	{
-		// Generate random point in the cube [-1,1]^3.
-		XMVECTOR v = XMVectorSet(MathHelper::RandF(-1.0f, 1.0f), MathHelper::RandF(-1.0f, 1.0f), MathHelper::RandF(-1.0f, 1.0f), 0.0f);
+		std::uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	RandomStream MakeThreadStream()
+	{
+		RandomStream stream(gRandSeed.load());
+		for(std::uint32_t i = gRandThreads++; i > 0; --i)
+			stream.Jump();
+		return stream;
+	}
+}
+
+RandomStream& MathHelper::RandStream()
+{
+	thread_local RandomStream stream = MakeThreadStream();
+	return stream;
+}
+
+void MathHelper::SeedRand(std::uint64_t seed)
+{
+	gRandSeed = seed;
+	gRandThreads = 1;
+	RandStream().Seed(seed);
+}
+
+RandomStream::RandomStream(std::uint64_t seed)
+{
+	Seed(seed);
+}
+
+void RandomStream::Seed(std::uint64_t seed)
+{
+	// SplitMix64 spreads the seed over the whole state, which must not be all zero.
+	for(int i = 0; i < 4; ++i)
+		mState[i] = SplitMix64(seed);
+}
+
+XMVECTOR RandomStream::NextUnitVec3()
+{
+	// Over a unit sphere z is uniform in [-1, 1] (Archimedes' hat-box theorem).
+	float z = NextFloat(-1.0f, 1.0f);
+	float phi = NextFloat(0.0f, 2.0f*MathHelper::Pi);
+	float r = sqrtf(MathHelper::Max(0.0f, 1.0f - z*z));
 
-		// Ignore points outside the unit sphere in order to get an even distribution 
-		// over the unit sphere.  Otherwise points will clump more on the sphere near 
-		// the corners of the cube.
+	return XMVectorSet(r*cosf(phi), r*sinf(phi), z, 0.0f);
+}
+
+XMVECTOR RandomStream::NextHemisphereUnitVec3(FXMVECTOR n)
+{
+	XMVECTOR v = NextUnitVec3();
 
-		if( XMVector3Greater( XMVector3LengthSq(v), One) )
-			continue;
+	// Mirror points in the bottom hemisphere.
+	if(XMVector3Less(XMVector3Dot(n, v), XMVectorZero()))
+		v = XMVectorNegate(v);
 
-		return XMVector3Normalize(v);
+	return v;
+}
+
+XMVECTOR RandomStream::NextFloat4()
+{
+	// 23 random bits under the exponent of 1.0 make a float in [1, 2) without an int to
+	// float conversion.  Two draws give the four words.
+	std::uint64_t r0 = NextU64();
+	std::uint64_t r1 = NextU64();
+	XMVECTOR bits = XMVectorSetInt((std::uint32_t)r0, (std::uint32_t)(r0 >> 32), (std::uint32_t)r1, (std::uint32_t)(r1 >> 32));
+
+	XMVECTOR one = XMVectorSplatOne();
+	XMVECTOR v = XMVectorOrInt(XMVectorAndInt(bits, XMVectorReplicateInt(0x007fffff)), one);
+	return XMVectorSubtract(v, one);
+}
+
+void RandomStream::NextFloats(float* out, std::size_t count, float a, float b)
+{
+	const XMVECTOR scale = XMVectorReplicate(b - a);
+	const XMVECTOR offset = XMVectorReplicate(a);
+
+	std::size_t i = 0;
+	for(; i + 4 <= count; i += 4)
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out + i), XMVectorMultiplyAdd(NextFloat4(), scale, offset));
+
+	if(i < count)
+	{
+		XMFLOAT4 tail;
+		XMStoreFloat4(&tail, XMVectorMultiplyAdd(NextFloat4(), scale, offset));
+		for(std::size_t j = 0; i + j < count; ++j)
+			out[i + j] = (&tail.x)[j];
 	}
 }
 
-XMVECTOR MathHelper::RandHemisphereUnitVec3(XMVECTOR n)
+void RandomStream::NextUnitVec3s(XMFLOAT3* out, std::size_t count)
 {
-	XMVECTOR One  = XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f);
-	XMVECTOR Zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR minusOne = XMVectorNegate(one);
+	const XMVECTOR two = XMVectorReplicate(2.0f);
+	const XMVECTOR twoPi = XMVectorReplicate(2.0f*MathHelper::Pi);
 
-	// Keep trying until we get a point on/in the hemisphere.
-	while(true)
+	for(std::size_t i = 0; i < count; i += 4)
 	{
-		// Generate random point in the cube [-1,1]^3.
-		XMVECTOR v = XMVectorSet(MathHelper::RandF(-1.0f, 1.0f), MathHelper::RandF(-1.0f, 1.0f), MathHelper::RandF(-1.0f, 1.0f), 0.0f);
+		// Same mapping as NextUnitVec3(), four at a time.
+		XMVECTOR z = XMVectorMultiplyAdd(NextFloat4(), two, minusOne);
+		XMVECTOR phi = XMVectorMultiply(NextFloat4(), twoPi);
 
-		// Ignore points outside the unit sphere in order to get an even distribution 
-		// over the unit sphere.  Otherwise points will clump more on the sphere near 
-		// the corners of the cube.
-		
-		if( XMVector3Greater( XMVector3LengthSq(v), One) )
-			continue;
+		XMVECTOR sinPhi, cosPhi;
+		XMVectorSinCos(&sinPhi, &cosPhi, phi);
 
-		// Ignore points in the bottom hemisphere.
-		if( XMVector3Less( XMVector3Dot(n, v), Zero ) )
-			continue;
+		XMVECTOR r = XMVectorSqrt(XMVectorMax(XMVectorZero(), XMVectorNegativeMultiplySubtract(z, z, one)));
 
-		return XMVector3Normalize(v);
+		XMFLOAT4A x, y, zs;
+		XMStoreFloat4A(&x, XMVectorMultiply(r, cosPhi));
+		XMStoreFloat4A(&y, XMVectorMultiply(r, sinPhi));
+		XMStoreFloat4A(&zs, z);
+
+		for(std::size_t j = 0; j < 4 && i + j < count; ++j)
+			out[i + j] = XMFLOAT3((&x.x)[j], (&y.x)[j], (&zs.x)[j]);
 	}
-}
\ No newline at end of file
+}
+
+void RandomStream::Jump()
+{
+	static const std::uint64_t jump[] =
+	{
+		0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull
+	};
+
+	std::uint64_t s[4] = { 0, 0, 0, 0 };
+	for(std::uint64_t word : jump)
+	{
+		for(int b = 0; b < 64; ++b)
+		{
+			if(word & (1ull << b))
+			{
+				for(int i = 0; i < 4; ++i)
+					s[i] ^= mState[i];
+			}
+			NextU64();
+		}
+	}
+
+	for(int i = 0; i < 4; ++i)
+		mState[i] = s[i];
+}
+
+RandomStream RandomStream::Split()
+{
+	RandomStream copy = *this;
+	Jump();
+	return copy;
+}
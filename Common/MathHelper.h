@@ -9,14 +9,107 @@
 #include <Windows.h>
 #include <DirectXMath.h>
 #include <cstdint>
+#include <cstddef>
+
+// Seeded xoshiro256** random number generator.  A stream gives the same sequence for the
+// same seed on every platform.  Streams are not thread-safe; give each worker its own
+// with Split().
+class RandomStream
+{
+public:
+	explicit RandomStream(std::uint64_t seed = 1);
+
+	void Seed(std::uint64_t seed);
+
+	std::uint64_t NextU64()
+	{
+		const std::uint64_t result = Rotl(mState[1]*5, 7)*9;
+		const std::uint64_t t = mState[1] << 17;
+
+		mState[2] ^= mState[0];
+		mState[3] ^= mState[1];
+		mState[1] ^= mState[2];
+		mState[0] ^= mState[3];
+		mState[2] ^= t;
+		mState[3] = Rotl(mState[3], 45);
+
+		return result;
+	}
+
+	std::uint32_t NextU32()
+	{
+		return (std::uint32_t)(NextU64() >> 32);
+	}
+
+	// Returns random float in [0, 1).
+	float NextFloat()
+	{
+		return (NextU64() >> 40) * (1.0f / 16777216.0f);
+	}
+
+	// Returns random float in [a, b).
+	float NextFloat(float a, float b)
+	{
+		return a + NextFloat()*(b - a);
+	}
+
+	// Returns random int in [a, b].
+	int NextInt(int a, int b)
+	{
+		// Scaling 32 random bits onto the range avoids the low-bit bias of %.
+		const std::uint64_t range = (std::uint64_t)((std::int64_t)b - a) + 1;
+		return (int)(a + (std::int64_t)((NextU32()*range) >> 32));
+	}
+
+	int NextSign()
+	{
+		return (NextU64() >> 63) != 0 ? 1 : -1;
+	}
+
+	// Uniform over the sphere, and over the half facing n.
+	DirectX::XMVECTOR NextUnitVec3();
+	DirectX::XMVECTOR NextHemisphereUnitVec3(DirectX::FXMVECTOR n);
+
+	// Fill count values four at a time with SIMD.  They are drawn from this stream, so
+	// they are reproducible, but are not the values NextFloat() would give in a loop.
+	void NextFloats(float* out, std::size_t count, float a = 0.0f, float b = 1.0f);
+	void NextUnitVec3s(DirectX::XMFLOAT3* out, std::size_t count);
+
+	// Advances the stream as far as 2^128 calls to NextU64() would.
+	void Jump();
+
+	// Returns a copy of this stream and jumps this one ahead, so the two never overlap.
+	// Split once per worker before a parallel loop.
+	RandomStream Split();
+
+private:
+	static std::uint64_t Rotl(std::uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	// Four random floats in [0, 1).
+	DirectX::XMVECTOR NextFloat4();
+
+	std::uint64_t mState[4];
+};
 
 class MathHelper
 {
 public:
+	// The calling thread's random stream.  Every thread has its own, so the Rand functions
+	// are safe to call anywhere.  Threads other than the first draw from the seed jumped
+	// ahead once per thread in the order they first call this.
+	static RandomStream& RandStream();
+
+	// Reseeds the calling thread's stream and the streams of threads that have not used
+	// theirs yet.
+	static void SeedRand(std::uint64_t seed);
+
 	// Returns random float in [0, 1).
 	static float RandF()
 	{
-		return (float)(rand()) / (float)RAND_MAX;
+		return RandStream().NextFloat();
 	}
 
 	// Returns random float in [a, b).
@@ -25,17 +118,15 @@ public:
 		return a + RandF()*(b-a);
 	}
 
-    static int Rand(int a, int b)
-    {
-        return a + rand() % ((b - a) + 1);
-    }
+	// Returns random int in [a, b].
+	static int Rand(int a, int b)
+	{
+		return RandStream().NextInt(a, b);
+	}
 
-	static int RandSign() {
-		float f = RandF();
-		if (f < 0.50f)
-			return -1;
-		else
-			return 1;
+	static int RandSign()
+	{
+		return RandStream().NextSign();
 	}
 
 	template<typename T>
@@ -121,6 +121,9 @@ public:
         UINT64 byteSize,
         Microsoft::WRL::ComPtr<ID3D12Resource>& uploadBuffer);
 
+	// Flags CompileShader passes to the compiler for this build configuration.
+	static UINT ShaderCompileFlags();
+
 	static Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(
 		const std::wstring& filename,
 		const D3D_SHADER_MACRO* defines,
@@ -0,0 +1,2188 @@
+//***************************************************************************************
+// Benchmarks.cpp
+//***************************************************************************************
+
+#include "Benchmarks.h"
+#include "Vegetation.h"
+#include "VegetationStreamer.h"
+#include "HeightField.h"
+#include "Terrain.h"
+#include "MazeGenerator.h"
+#include "Navigation.h"
+#include "CollisionWorld.h"
+#include "OcclusionBuffer.h"
+#include "VisibilitySets.h"
+#include "PortalVisibility.h"
+#include "TriangleBvh.h"
+#include "LightBaker.h"
+#include "RayScene.h"
+#include "ModelLoader.h"
+#include "GeometryAllocator.h"
+#include "FramePipeline.h"
+#include "SlotMap.h"
+#include "ShaderCache.h"
+#include "PipelineKey.h"
+#include "../../Common/MathHelper.h"
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cfloat>
+#include <cstdlib>
+#include <thread>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+using namespace DirectX;
+
+namespace
+{
+	bool gFailed = false;
+
+	// Marks the run failed and says why in the report.
+	void Fail(std::ostringstream& out, const char* what)
+	{
+		gFailed = true;
+		out << "FAILED: " << what << "\n";
+	}
+
+	// Scatters about a million trees with the spacing used to fill the grounds at full
+	// density, with the castle and maze grounds cut out.
+	void BenchVegetationScatter(std::ostringstream& out)
+	{
+		VegetationScatter scatter;
+		scatter.AddExclusionBox(-98.0f, -90.1f, 306.0f, 90.1f);
+
+		VegetationScatterDesc desc;
+		desc.MinX = -615.0f;
+		desc.MinZ = -615.0f;
+		desc.MaxX = 615.0f;
+		desc.MaxZ = 615.0f;
+		desc.MinDistance = 1.0f;
+		desc.Seed = 1;
+
+		std::vector<XMFLOAT2> points = scatter.Generate(desc);
+
+		out << "VegetationScatter: " << points.size() << " instances in "
+			<< std::fixed << std::setprecision(3) << scatter.LastGenerateSeconds() << " s ("
+			<< std::setprecision(2) << (points.size() / scatter.LastGenerateSeconds()) / 1.0e6f
+			<< " M/s)\n";
+	}
+
+	// Flies the camera in a circle over a large forest and times the per-frame chunk
+	// selection.  Chunks are filled with a jittered grid so building them costs little and
+	// the numbers are dominated by streaming and culling.
+	void BenchVegetationStreaming(std::ostringstream& out)
+	{
+		VegetationStreamerDesc desc;
+		desc.MinX = -4096.0f;
+		desc.MinZ = -4096.0f;
+		desc.MaxX = 4096.0f;
+		desc.MaxZ = 4096.0f;
+		desc.ChunkSize = 64.0f;
+		desc.MaxChunkBuildsPerUpdate = 8;
+
+		auto buildChunk = [](float minX, float minZ, float maxX, float maxZ,
+			std::vector<VegetationInstance>& instances)
+		{
+			const int n = 16;
+			instances.resize(n*n);
+			for(int j = 0; j < n; ++j)
+			{
+				for(int i = 0; i < n; ++i)
+				{
+					VegetationInstance& inst = instances[j*n + i];
+					inst.Pos.x = minX + (maxX - minX)*(i + MathHelper::RandF()) / n;
+					inst.Pos.y = 8.0f;
+					inst.Pos.z = minZ + (maxZ - minZ)*(j + MathHelper::RandF()) / n;
+					inst.Size = XMFLOAT2(20.0f, 20.0f);
+				}
+			}
+		};
+
+		VegetationStreamer streamer(desc, buildChunk);
+
+		BoundingFrustum frustumV;
+		BoundingFrustum::CreateFromMatrix(frustumV,
+			XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f));
+
+		const int frameCount = 2000;
+		double streamSeconds = 0.0;
+		double selectSeconds = 0.0;
+		std::uint64_t visibleChunks = 0;
+		std::uint64_t residentChunks = 0;
+		std::uint64_t chunksBuilt = 0;
+
+		for(int frame = 0; frame < frameCount; ++frame)
+		{
+			// Walk a circle of radius 2500 looking along the direction of travel.
+			float t = 2.0f*MathHelper::Pi*frame / frameCount;
+			XMFLOAT3 eyePos(2500.0f*cosf(t), 2.0f, 2500.0f*sinf(t));
+			float heading = -t;
+
+			XMMATRIX world = XMMatrixRotationY(heading) *
+				XMMatrixTranslation(eyePos.x, eyePos.y, eyePos.z);
+
+			BoundingFrustum frustumW;
+			frustumV.Transform(frustumW, world);
+
+			streamer.Update(eyePos, frustumW);
+
+			const VegetationStreamerStats& stats = streamer.Stats();
+			streamSeconds += stats.StreamSeconds;
+			selectSeconds += stats.SelectSeconds;
+			visibleChunks += stats.VisibleChunks;
+			residentChunks += stats.ResidentChunks;
+			chunksBuilt += stats.ChunksBuilt;
+		}
+
+		out << "VegetationStreamer: " << frameCount << " frames, "
+			<< residentChunks / frameCount << " resident / "
+			<< visibleChunks / frameCount << " visible chunks avg, "
+			<< chunksBuilt << " chunks built, select "
+			<< std::fixed << std::setprecision(3) << 1000.0*selectSeconds / frameCount << " ms/frame, stream "
+			<< 1000.0*streamSeconds / frameCount << " ms/frame\n";
+	}
+
+	// Times per-point queries against the batch ones for both height field backends over
+	// four million random points, and reports the largest difference between the two.
+	template<typename Field>
+	void BenchHeightField(std::ostringstream& out, const char* name, const Field& field,
+		const std::vector<XMFLOAT2>& points)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		const std::size_t n = points.size();
+
+		std::vector<float> scalarHeights(n);
+		std::vector<float> batchHeights(n);
+		std::vector<XMFLOAT3> scalarNormals(n);
+		std::vector<XMFLOAT3> batchNormals(n);
+
+		auto t0 = Clock::now();
+		for(std::size_t i = 0; i < n; ++i)
+			scalarHeights[i] = field.GetHeight(points[i].x, points[i].y);
+		auto t1 = Clock::now();
+		field.SampleHeights(points.data(), batchHeights.data(), n);
+		auto t2 = Clock::now();
+		for(std::size_t i = 0; i < n; ++i)
+			scalarNormals[i] = field.GetNormal(points[i].x, points[i].y);
+		auto t3 = Clock::now();
+		field.SampleNormals(points.data(), batchNormals.data(), n);
+		auto t4 = Clock::now();
+
+		float heightError = 0.0f;
+		float normalError = 0.0f;
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			heightError = MathHelper::Max(heightError, fabsf(scalarHeights[i] - batchHeights[i]));
+			normalError = MathHelper::Max(normalError, fabsf(scalarNormals[i].x - batchNormals[i].x));
+			normalError = MathHelper::Max(normalError, fabsf(scalarNormals[i].y - batchNormals[i].y));
+			normalError = MathHelper::Max(normalError, fabsf(scalarNormals[i].z - batchNormals[i].z));
+		}
+
+		auto mps = [n](Clock::time_point a, Clock::time_point b)
+		{
+			return n / std::chrono::duration<double>(b - a).count() / 1.0e6;
+		};
+
+		out << name << ": heights " << std::fixed << std::setprecision(1)
+			<< mps(t0, t1) << " -> " << mps(t1, t2) << " M/s, normals "
+			<< mps(t2, t3) << " -> " << mps(t3, t4) << " M/s, max error "
+			<< std::scientific << std::setprecision(1) << heightError << " / " << normalError
+			<< std::defaultfloat << "\n";
+	}
+
+	void BenchHeightQueries(std::ostringstream& out)
+	{
+		std::vector<XMFLOAT2> points(4 * 1024 * 1024);
+		for(XMFLOAT2& p : points)
+			p = XMFLOAT2(MathHelper::RandF(-196.0f, 404.0f), MathHelper::RandF(-150.0f, 150.0f));
+
+		BenchHeightField(out, "HillsHeightField", HillsHeightField(), points);
+
+		TerrainDesc desc;
+		desc.HeightmapFilename = L"../../Textures/terrain.raw";
+		desc.HeightmapWidth = 257;
+		desc.HeightmapHeight = 129;
+		desc.MinX = -196.0f;
+		desc.MinZ = -150.0f;
+		desc.Width = 600.0f;
+		desc.Depth = 300.0f;
+		Terrain terrain(desc);
+
+		BenchHeightField(out, "Terrain", terrain, points);
+	}
+
+	// Generates a 1000x1000 cell maze and merges its walls into boxes.
+	void BenchMazeGenerator(std::ostringstream& out)
+	{
+		MazeDesc desc;
+		desc.Width = 1000;
+		desc.Depth = 1000;
+		desc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(desc);
+
+		std::vector<MazeWallRun> runs;
+		maze.MergeWalls(runs);
+
+		std::uint64_t segments = 0;
+		for(const MazeWallRun& run : runs)
+			segments += (run.X1 - run.X0) + (run.Z1 - run.Z0);
+
+		out << "MazeGenerator: " << desc.Width << "x" << desc.Depth << " cells, generate "
+			<< std::fixed << std::setprecision(1) << 1000.0f*maze.LastGenerateSeconds() << " ms, merge "
+			<< 1000.0f*maze.LastMergeSeconds() << " ms, " << segments << " wall segments in "
+			<< runs.size() << " boxes\n";
+	}
+
+	// The walls of a maze laid out cellSize to a cell from the origin, merged into boxes
+	// half a unit thick and six high.
+	std::vector<BoundingBox> MazeWallBoxes(const MazeGenerator& maze, float cellSize)
+	{
+		std::vector<MazeWallRun> runs;
+		maze.MergeWalls(runs);
+
+		std::vector<BoundingBox> walls;
+		walls.reserve(runs.size());
+		for(const MazeWallRun& run : runs)
+		{
+			XMFLOAT3 center(0.5f*(run.X0 + run.X1)*cellSize, 3.0f, 0.5f*(run.Z0 + run.Z1)*cellSize);
+			XMFLOAT3 extents(0.5f*(run.X1 - run.X0)*cellSize + 0.25f, 3.0f, 0.5f*(run.Z1 - run.Z0)*cellSize + 0.25f);
+			walls.push_back(BoundingBox(center, extents));
+		}
+		return walls;
+	}
+
+	bool OnScreen(FXMVECTOR p, CXMMATRIX viewProj)
+	{
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector3Transform(p, viewProj));
+		return clip.z >= 0.0f && fabsf(clip.x) <= clip.w && fabsf(clip.y) <= clip.w;
+	}
+
+	// The culling benchmarks' reference: whether a ray from eye to any corner of box gets
+	// there without hitting one of walls, found by testing every wall.  Given viewProj,
+	// only corners on screen count.
+	bool BoxSeenFrom(const XMFLOAT3& eye, const BoundingBox& box, const std::vector<BoundingBox>& walls,
+		const XMMATRIX* viewProj = nullptr)
+	{
+		const XMVECTOR origin = XMLoadFloat3(&eye);
+
+		XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+		box.GetCorners(corners);
+		for(const XMFLOAT3& corner : corners)
+		{
+			// Just inside the corner, so rays do not graze the box's own edges.
+			XMVECTOR target = XMVectorLerp(XMLoadFloat3(&box.Center), XMLoadFloat3(&corner), 0.99f);
+			if(viewProj != nullptr && !OnScreen(target, *viewProj))
+				continue;
+
+			XMVECTOR toTarget = XMVectorSubtract(target, origin);
+			float distance = XMVectorGetX(XMVector3Length(toTarget));
+			XMVECTOR rayDir = XMVectorScale(toTarget, 1.0f / distance);
+
+			bool blocked = false;
+			for(const BoundingBox& wall : walls)
+			{
+				float hit;
+				if(wall.Intersects(origin, rayDir, hit) && hit < distance)
+				{
+					blocked = true;
+					break;
+				}
+			}
+
+			if(!blocked)
+				return true;
+		}
+
+		return false;
+	}
+
+	// A subdivided box, each face a grid of quads no bigger than step on a side, with
+	// vertices of its own so each has its face's normal.
+	void AddBenchBox(const BoundingBox& box, float step, std::vector<XMFLOAT3>& positions,
+		std::vector<XMFLOAT3>& normals, std::vector<std::uint32_t>& indices)
+	{
+		const XMFLOAT3 c = box.Center;
+		const XMFLOAT3 e = box.Extents;
+		const float size[3] = { 2.0f*e.x, 2.0f*e.y, 2.0f*e.z };
+
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			const int uAxis = (axis + 1) % 3;
+			const int vAxis = (axis + 2) % 3;
+			const int nu = MathHelper::Max(1, (int)ceilf(size[uAxis] / step));
+			const int nv = MathHelper::Max(1, (int)ceilf(size[vAxis] / step));
+
+			for(int side = -1; side <= 1; side += 2)
+			{
+				const std::uint32_t first = (std::uint32_t)positions.size();
+				for(int j = 0; j <= nv; ++j)
+				{
+					for(int i = 0; i <= nu; ++i)
+					{
+						float p[3];
+						p[axis] = side*(&e.x)[axis];
+						p[uAxis] = -(&e.x)[uAxis] + size[uAxis]*i / nu;
+						p[vAxis] = -(&e.x)[vAxis] + size[vAxis]*j / nv;
+						positions.push_back(XMFLOAT3(c.x + p[0], c.y + p[1], c.z + p[2]));
+
+						float n[3] = { 0.0f, 0.0f, 0.0f };
+						n[axis] = (float)side;
+						normals.push_back(XMFLOAT3(n[0], n[1], n[2]));
+					}
+				}
+
+				for(int j = 0; j < nv; ++j)
+				{
+					for(int i = 0; i < nu; ++i)
+					{
+						const std::uint32_t a = first + j*(nu + 1) + i;
+						const std::uint32_t quad[6] = { a, a + 1, a + nu + 2, a, a + nu + 2, a + nu + 1 };
+						indices.insert(indices.end(), quad, quad + 6);
+					}
+				}
+			}
+		}
+	}
+
+	// Paths across a 100x100 cell maze rasterized four grid cells to a maze cell, with A*
+	// and JPS one query at a time, JPS as a parallel batch, and one full flow field.
+	void BenchNavigation(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		MazeDesc mazeDesc;
+		mazeDesc.Width = 100;
+		mazeDesc.Depth = 100;
+		mazeDesc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(mazeDesc);
+
+		const float cellSize = 4.0f;
+		NavGridDesc gridDesc;
+		gridDesc.MaxX = mazeDesc.Width*cellSize + 1.0f;
+		gridDesc.MaxZ = mazeDesc.Depth*cellSize + 1.0f;
+		NavGrid grid(gridDesc);
+
+		// Half a unit into the grid and a quarter thicker each side, so walls cover whole
+		// grid cells.
+		for(BoundingBox wall : MazeWallBoxes(maze, cellSize))
+		{
+			wall.Center.x += 0.5f;
+			wall.Center.z += 0.5f;
+			wall.Extents.x += 0.25f;
+			wall.Extents.z += 0.25f;
+			grid.BlockBox(wall);
+		}
+
+		// Queries between the centers of random maze cells, which are always open.
+		const std::size_t queryCount = 2000;
+		std::vector<NavQuery> queries(queryCount);
+		for(NavQuery& q : queries)
+		{
+			q.Start = XMFLOAT2((MathHelper::Rand(0, mazeDesc.Width - 1) + 0.5f)*cellSize + 0.5f,
+				(MathHelper::Rand(0, mazeDesc.Depth - 1) + 0.5f)*cellSize + 0.5f);
+			q.Goal = XMFLOAT2((MathHelper::Rand(0, mazeDesc.Width - 1) + 0.5f)*cellSize + 0.5f,
+				(MathHelper::Rand(0, mazeDesc.Depth - 1) + 0.5f)*cellSize + 0.5f);
+		}
+
+		NavPathfinder pathfinder(grid);
+		NavPath path;
+		std::uint64_t expanded[2] = { 0, 0 };
+		double seconds[2];
+
+		for(int a = 0; a < 2; ++a)
+		{
+			NavAlgorithm algorithm = a == 0 ? NavAlgorithm::AStar : NavAlgorithm::JumpPoint;
+			auto t0 = Clock::now();
+			for(const NavQuery& q : queries)
+			{
+				pathfinder.FindPath(q.Start, q.Goal, algorithm, path);
+				expanded[a] += path.ExpandedNodes;
+			}
+			seconds[a] = std::chrono::duration<double>(Clock::now() - t0).count();
+		}
+
+		std::vector<NavPath> paths(queryCount);
+		auto t0 = Clock::now();
+		pathfinder.FindPaths(queries.data(), queryCount, NavAlgorithm::JumpPoint, paths.data());
+		double batchSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+		t0 = Clock::now();
+		int goalX, goalZ;
+		grid.WorldToCell(queries[0].Goal, goalX, goalZ);
+		NavFlowField flowField(grid, goalX, goalZ);
+		flowField.Expand(0);
+		double flowSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+		out << "Navigation: " << grid.Width() << "x" << grid.Depth() << " grid, A* "
+			<< std::fixed << std::setprecision(0) << queryCount / seconds[0] << " paths/s ("
+			<< expanded[0] / queryCount << " nodes), JPS " << queryCount / seconds[1] << " paths/s ("
+			<< expanded[1] / queryCount << " nodes), JPS batch " << queryCount / batchSeconds
+			<< " paths/s, flow field " << std::setprecision(1) << 1000.0*flowSeconds << " ms\n";
+	}
+
+	// Camera sized spheres moving a frame's worth at a time through a 200x200 cell maze
+	// of axis aligned walls scattered with rotated crates.
+	void BenchCollision(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		MazeDesc mazeDesc;
+		mazeDesc.Width = 200;
+		mazeDesc.Depth = 200;
+		mazeDesc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(mazeDesc);
+
+		const float cellSize = 4.0f;
+		const float size = mazeDesc.Width*cellSize;
+
+		CollisionWorld world;
+		for(const BoundingBox& wall : MazeWallBoxes(maze, cellSize))
+			world.AddBox(wall);
+
+		for(int i = 0; i < 20000; ++i)
+		{
+			BoundingOrientedBox crate;
+			crate.Center = XMFLOAT3(MathHelper::RandF(0.0f, size), 0.5f, MathHelper::RandF(0.0f, size));
+			crate.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+			XMStoreFloat4(&crate.Orientation,
+				XMQuaternionRotationRollPitchYaw(0.0f, MathHelper::RandF(0.0f, XM_2PI), 0.0f));
+			world.AddBox(crate);
+		}
+
+		auto t0 = Clock::now();
+		world.Build();
+		double buildSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+		// About one frame of flying at the demo's camera speed.
+		const std::size_t queryCount = 200000;
+		const float radius = 1.0f;
+		std::vector<XMFLOAT3> starts(queryCount);
+		std::vector<XMFLOAT3> moves(queryCount);
+		for(std::size_t i = 0; i < queryCount; ++i)
+		{
+			starts[i] = XMFLOAT3(MathHelper::RandF(0.0f, size), MathHelper::RandF(0.0f, 4.0f), MathHelper::RandF(0.0f, size));
+			moves[i] = XMFLOAT3(MathHelper::RandF(-0.7f, 0.7f), MathHelper::RandF(-0.2f, 0.2f), MathHelper::RandF(-0.7f, 0.7f));
+		}
+
+		std::size_t hits = 0;
+		t0 = Clock::now();
+		for(std::size_t i = 0; i < queryCount; ++i)
+		{
+			CollisionHit hit;
+			if(world.SweepSphere(starts[i], radius, moves[i], hit))
+				++hits;
+		}
+		double sweepSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+		std::vector<XMFLOAT3> ends(queryCount);
+		t0 = Clock::now();
+		for(std::size_t i = 0; i < queryCount; ++i)
+			ends[i] = world.MoveSphere(starts[i], radius, moves[i]);
+		double moveSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+		// Moves that did not get all the way.
+		std::size_t blocked = 0;
+		for(std::size_t i = 0; i < queryCount; ++i)
+		{
+			if(fabsf(ends[i].x - starts[i].x - moves[i].x) + fabsf(ends[i].y - starts[i].y - moves[i].y) +
+				fabsf(ends[i].z - starts[i].z - moves[i].z) > 1.0e-4f)
+				++blocked;
+		}
+
+		out << "CollisionWorld: " << world.ColliderCount() << " colliders built in "
+			<< std::fixed << std::setprecision(1) << 1000.0*buildSeconds << " ms, sweep "
+			<< std::setprecision(2) << 1.0e6*sweepSeconds / queryCount << " us ("
+			<< 100*hits / queryCount << "% hit), slide " << 1.0e6*moveSeconds / queryCount << " us ("
+			<< 100*blocked / queryCount << "% blocked)\n";
+	}
+
+	// The C rand() the Rand helpers used to wrap against a random stream one value at a
+	// time and in batches, for uniform floats and for unit vectors.
+	void BenchRandom(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		const std::size_t n = 4 * 1024 * 1024;
+
+		std::vector<float> floats(n);
+		std::vector<XMFLOAT3> vectors(n);
+		RandomStream stream(1);
+
+		auto t0 = Clock::now();
+		for(std::size_t i = 0; i < n; ++i)
+			floats[i] = (float)rand() / (float)RAND_MAX;
+		auto t1 = Clock::now();
+		for(std::size_t i = 0; i < n; ++i)
+			floats[i] = stream.NextFloat();
+		auto t2 = Clock::now();
+		stream.NextFloats(floats.data(), n);
+		auto t3 = Clock::now();
+
+		// The rejection loop RandUnitVec3 used.
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			XMVECTOR v;
+			do
+			{
+				v = XMVectorSet((float)rand() / RAND_MAX*2.0f - 1.0f, (float)rand() / RAND_MAX*2.0f - 1.0f,
+					(float)rand() / RAND_MAX*2.0f - 1.0f, 0.0f);
+			} while(XMVectorGetX(XMVector3LengthSq(v)) > 1.0f);
+			XMStoreFloat3(&vectors[i], XMVector3Normalize(v));
+		}
+		auto t4 = Clock::now();
+		for(std::size_t i = 0; i < n; ++i)
+			XMStoreFloat3(&vectors[i], stream.NextUnitVec3());
+		auto t5 = Clock::now();
+		stream.NextUnitVec3s(vectors.data(), n);
+		auto t6 = Clock::now();
+
+		auto mps = [n](Clock::time_point a, Clock::time_point b)
+		{
+			return n / std::chrono::duration<double>(b - a).count() / 1.0e6;
+		};
+
+		out << "Random: floats rand() " << std::fixed << std::setprecision(0) << mps(t0, t1)
+			<< " -> stream " << mps(t1, t2) << " -> batch " << mps(t2, t3)
+			<< " M/s, unit vectors rejection " << mps(t3, t4) << " -> stream " << mps(t4, t5)
+			<< " -> batch " << mps(t5, t6) << " M/s\n";
+	}
+
+	// Churns a 4M element arena with mesh sized allocations, the way streaming models in
+	// and out of the geometry pool would, then packs what is left.
+	void BenchGeometryAllocator(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		const std::uint32_t capacity = 4 * 1024 * 1024;
+		const std::size_t operations = 1000000;
+
+		GeometryAllocator allocator(capacity);
+		RandomStream stream(1);
+
+		// Mostly small props with the odd large model.
+		auto meshSize = [&]()
+		{
+			return stream.NextInt(0, 15) == 0 ? (std::uint32_t)stream.NextInt(4096, 65536) :
+				(std::uint32_t)stream.NextInt(24, 2048);
+		};
+
+		std::vector<std::uint32_t> live;
+		std::size_t failed = 0;
+
+		auto t0 = Clock::now();
+		for(std::size_t i = 0; i < operations; ++i)
+		{
+			// Keep the arena about three quarters full.
+			bool allocate = live.empty() || (allocator.UsedCount() < capacity / 4 * 3 && stream.NextInt(0, 1) == 0);
+			if(allocate)
+			{
+				std::uint32_t handle = allocator.Allocate(meshSize());
+				if(handle != GeometryAllocator::Invalid)
+					live.push_back(handle);
+				else
+					++failed;
+			}
+			else
+			{
+				std::size_t j = (std::size_t)stream.NextInt(0, (int)live.size() - 1);
+				allocator.Free(live[j]);
+				live[j] = live.back();
+				live.pop_back();
+			}
+		}
+		auto t1 = Clock::now();
+
+		std::uint32_t freeCount = allocator.Capacity() - allocator.UsedCount();
+		std::uint32_t largestBefore = allocator.LargestFree();
+
+		std::vector<GeometryAllocator::Move> moves = allocator.Defragment(capacity);
+		auto t2 = Clock::now();
+
+		out << "GeometryAllocator: " << std::fixed << std::setprecision(1)
+			<< std::chrono::duration<double, std::nano>(t1 - t0).count() / operations << " ns per operation, "
+			<< failed << " failed, " << live.size() << " live ranges, largest free "
+			<< 100.0 * largestBefore / freeCount << "% of free space; defragment "
+			<< std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms, " << moves.size() << " copies\n";
+	}
+
+	// Stands in for CastleApp's RenderItem: the same transforms and draw arguments, and
+	// the instance vectors that make it expensive to move.
+	struct BenchRenderItem
+	{
+		XMFLOAT4X4 World;
+		XMFLOAT4X4 TexTransform;
+		int NumFramesDirty = 3;
+		std::uint32_t ObjIndex = 0;
+		void* Mat = nullptr;
+		void* Geo = nullptr;
+		std::uint32_t IndexCount = 36;
+		std::uint32_t StartIndexLocation = 0;
+		int BaseVertexLocation = 0;
+		std::vector<XMFLOAT4X4> Instances;
+		std::vector<BoundingBox> InstanceBounds;
+	};
+
+	// Packs the object constants of every item the way UpdateObjectData does.
+	template<typename Items>
+	void PackObjectConstants(const Items& items, std::vector<XMFLOAT4X4>& constants)
+	{
+		for(const auto& item : items)
+		{
+			const BenchRenderItem& ri = *item;
+			XMStoreFloat4x4(&constants[2*ri.ObjIndex], XMMatrixTranspose(XMLoadFloat4x4(&ri.World)));
+			XMStoreFloat4x4(&constants[2*ri.ObjIndex + 1], XMMatrixTranspose(XMLoadFloat4x4(&ri.TexTransform)));
+		}
+	}
+
+	// Render items made one heap allocation at a time among the other allocations a scene
+	// build makes, with layers of pointers, against a SlotMap with layers of handles.
+	// Times a pass over every item's constants, a pass over a layer's draw arguments, and
+	// removing and re-adding items.
+	void BenchSlotMap(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		const std::size_t itemCount = 100000;
+		const int passes = 50;
+
+		RandomStream stream(1);
+
+		std::vector<std::unique_ptr<BenchRenderItem>> heapItems;
+		std::vector<BenchRenderItem*> heapLayer;
+		std::vector<std::unique_ptr<char[]>> clutter;
+		SlotMap<BenchRenderItem> slotItems;
+		std::vector<SlotHandle> slotLayer;
+
+		for(std::size_t i = 0; i < itemCount; ++i)
+		{
+			BenchRenderItem item;
+			XMStoreFloat4x4(&item.World, XMMatrixTranslation(stream.NextFloat(-500.0f, 500.0f), 0.0f,
+				stream.NextFloat(-500.0f, 500.0f)));
+			XMStoreFloat4x4(&item.TexTransform, XMMatrixIdentity());
+			item.ObjIndex = (std::uint32_t)i;
+			item.StartIndexLocation = (std::uint32_t)stream.NextInt(0, 1000);
+
+			heapItems.push_back(std::make_unique<BenchRenderItem>(item));
+			clutter.push_back(std::unique_ptr<char[]>(new char[stream.NextInt(16, 512)]));
+
+			SlotHandle handle = slotItems.Add(item);
+			slotItems[handle].ObjIndex = handle.Index;
+
+			// Half the items go in the layer.
+			if(i % 2 == 0)
+			{
+				heapLayer.push_back(heapItems.back().get());
+				InsertHandle(slotLayer, handle);
+			}
+		}
+
+		// Builds free some of what they allocate along the way.
+		for(std::size_t i = 0; i < clutter.size(); i += 2)
+			clutter[i].reset();
+
+		std::vector<XMFLOAT4X4> constants(2*itemCount);
+
+		auto t0 = Clock::now();
+		for(int pass = 0; pass < passes; ++pass)
+			PackObjectConstants(heapItems, constants);
+		auto t1 = Clock::now();
+
+		// A pointer to each item, in dense order, so the same template walks the SlotMap.
+		struct DenseRange
+		{
+			const SlotMap<BenchRenderItem>& Map;
+			struct Iterator
+			{
+				SlotMap<BenchRenderItem>::const_iterator It;
+				const BenchRenderItem* operator*()const { return &*It; }
+				Iterator& operator++() { ++It; return *this; }
+				bool operator!=(const Iterator& rhs)const { return It != rhs.It; }
+			};
+			Iterator begin()const { return Iterator{ Map.begin() }; }
+			Iterator end()const { return Iterator{ Map.end() }; }
+		};
+		for(int pass = 0; pass < passes; ++pass)
+			PackObjectConstants(DenseRange{ slotItems }, constants);
+		auto t2 = Clock::now();
+
+		auto nsPerItem = [](Clock::time_point a, Clock::time_point b, std::size_t items)
+		{
+			return std::chrono::duration<double, std::nano>(b - a).count() / items;
+		};
+
+		// Each layer walk counts its fastest pass, and the two take turns, so a busy moment
+		// on the machine does not land on only one of them.
+		auto walkHeapLayer = [&]()
+		{
+			std::uint64_t sum = 0;
+			for(const BenchRenderItem* ri : heapLayer)
+				sum += ri->StartIndexLocation + ri->IndexCount;
+			return sum;
+		};
+		auto walkSlotLayer = [&]()
+		{
+			std::uint64_t sum = 0;
+			for(SlotHandle handle : slotLayer)
+			{
+				const BenchRenderItem& ri = slotItems[handle];
+				sum += ri.StartIndexLocation + ri.IndexCount;
+			}
+			return sum;
+		};
+
+		std::uint64_t heapSum = 0;
+		std::uint64_t slotSum = 0;
+		double heapLayerNs = 1e30;
+		double slotLayerNs = 1e30;
+		for(int pass = 0; pass < passes; ++pass)
+		{
+			auto a = Clock::now();
+			heapSum += walkHeapLayer();
+			auto b = Clock::now();
+			slotSum += walkSlotLayer();
+			auto c = Clock::now();
+			heapLayerNs = std::min(heapLayerNs, nsPerItem(a, b, heapLayer.size()));
+			slotLayerNs = std::min(slotLayerNs, nsPerItem(b, c, slotLayer.size()));
+		}
+		auto t3 = Clock::now();
+
+		// Remove items in the layer and add new ones to it, as RemoveRenderItem() and
+		// AddRenderItem() do, then walk the layer again.  Freed slots are reused, so the
+		// layer only stays in order if the new handles are put in their place.
+		const std::size_t layerChurn = 10000;
+		std::size_t layerStale = 0;
+		std::size_t layerMissing = 0;
+		for(std::size_t i = 0; i < layerChurn; ++i)
+		{
+			SlotHandle old = slotLayer[(std::size_t)stream.NextInt(0, (int)slotLayer.size() - 1)];
+			slotItems.Remove(old);
+			if(!EraseHandle(slotLayer, old))
+				++layerMissing;
+			if(slotItems.Get(old) != nullptr)
+				++layerStale;
+
+			BenchRenderItem item;
+			item.StartIndexLocation = (std::uint32_t)stream.NextInt(0, 1000);
+			SlotHandle handle = slotItems.Add(item);
+			slotItems[handle].ObjIndex = handle.Index;
+			InsertHandle(slotLayer, handle);
+		}
+		auto t4 = Clock::now();
+
+		std::uint64_t churnedSum = 0;
+		double churnedLayerNs = 1e30;
+		for(int pass = 0; pass < passes; ++pass)
+		{
+			auto a = Clock::now();
+			churnedSum += walkSlotLayer();
+			churnedLayerNs = std::min(churnedLayerNs, nsPerItem(a, Clock::now(), slotLayer.size()));
+		}
+
+		std::uint64_t expectedSum = 0;
+		for(std::size_t i = 0; i < slotLayer.size(); ++i)
+		{
+			const BenchRenderItem* ri = slotItems.Get(slotLayer[i]);
+			if(ri == nullptr || (i > 0 && !(slotLayer[i - 1] < slotLayer[i])))
+			{
+				++layerMissing;
+				continue;
+			}
+			expectedSum += ri->StartIndexLocation + ri->IndexCount;
+		}
+		if(layerStale > 0 || layerMissing > 0 || slotLayer.size() != heapLayer.size() ||
+			churnedSum != passes*expectedSum)
+		{
+			Fail(out, "SlotMap layer lost track of its render items");
+		}
+		auto t5 = Clock::now();
+
+		// Remove a random item and add a new one in its place, keeping the count steady.
+		const std::size_t churn = 1000000;
+		std::vector<SlotHandle> live;
+		for(std::size_t i = 0; i < slotItems.Size(); ++i)
+			live.push_back(slotItems.HandleAt(i));
+		std::size_t stale = 0;
+		for(std::size_t i = 0; i < churn; ++i)
+		{
+			std::size_t j = (std::size_t)stream.NextInt(0, (int)live.size() - 1);
+			SlotHandle old = live[j];
+			slotItems.Remove(old);
+			live[j] = slotItems.Add(BenchRenderItem());
+			if(slotItems.Get(old) == nullptr)
+				++stale;
+		}
+		auto t6 = Clock::now();
+
+		out << "SlotMap: " << itemCount << " render items, constants " << std::fixed << std::setprecision(2)
+			<< nsPerItem(t0, t1, passes*itemCount) << " -> " << nsPerItem(t1, t2, passes*itemCount)
+			<< " ns/item, layer " << heapLayerNs << " -> " << slotLayerNs << " ns/item ("
+			<< churnedLayerNs << " after " << layerChurn << " layer remove+adds at "
+			<< nsPerItem(t3, t4, layerChurn) << " ns), remove+add "
+			<< nsPerItem(t5, t6, churn) << " ns, " << (stale == churn ? "" : "STALE HANDLE RESOLVED, ")
+			<< (heapSum == slotSum ? "" : "LAYERS DIFFER, ") << slotItems.SlotCount() << " slots\n";
+	}
+
+	// Draws the walls of a 40x40 cell maze into the occlusion buffer from eye height at
+	// random places and tests crate sized boxes scattered through it.  A sample of the
+	// culled boxes is checked by casting rays from the eye to their corners; any corner a
+	// ray reaches on screen means the box was culled wrongly.
+	void BenchOcclusion(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		MazeDesc mazeDesc;
+		mazeDesc.Width = 40;
+		mazeDesc.Depth = 40;
+		mazeDesc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(mazeDesc);
+
+		const float cellSize = 4.0f;
+		const float size = mazeDesc.Width*cellSize;
+
+		OcclusionBuffer occlusion;
+		const std::vector<BoundingBox> walls = MazeWallBoxes(maze, cellSize);
+		for(const BoundingBox& wall : walls)
+			occlusion.AddOccluder(wall);
+
+		RandomStream stream(1);
+		const std::size_t boxCount = 20000;
+		std::vector<BoundingBox> boxes(boxCount);
+		for(BoundingBox& box : boxes)
+		{
+			box.Center = XMFLOAT3(stream.NextFloat(0.0f, size), stream.NextFloat(0.5f, 2.0f), stream.NextFloat(0.0f, size));
+			box.Extents = XMFLOAT3(0.5f, 0.5f, 0.5f);
+		}
+		std::vector<std::uint8_t> visible(boxCount);
+
+		const XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f*XM_PI, 16.0f / 9.0f, 1.0f, 1000.0f);
+		const int viewCount = 32;
+		const std::size_t checksPerView = 200;
+
+		double renderSeconds = 0.0;
+		double testSeconds = 0.0;
+		std::size_t triangles = 0;
+		std::size_t inView = 0;
+		std::size_t culledInView = 0;
+		std::size_t checked = 0;
+		std::size_t wrong = 0;
+
+		for(int v = 0; v < viewCount; ++v)
+		{
+			// From the middle of a cell, which is always open, along a random heading.
+			const float heading = stream.NextFloat(0.0f, XM_2PI);
+			XMVECTOR eye = XMVectorSet((stream.NextInt(0, mazeDesc.Width - 1) + 0.5f)*cellSize, 1.7f,
+				(stream.NextInt(0, mazeDesc.Depth - 1) + 0.5f)*cellSize, 1.0f);
+			XMVECTOR dir = XMVectorSet(cosf(heading), 0.0f, sinf(heading), 0.0f);
+			XMMATRIX viewProj = XMMatrixLookAtLH(eye, XMVectorAdd(eye, dir), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))*proj;
+
+			auto t0 = Clock::now();
+			occlusion.Render(viewProj);
+			auto t1 = Clock::now();
+			occlusion.TestBoxes(boxes.data(), boxCount, visible.data());
+			auto t2 = Clock::now();
+
+			renderSeconds += std::chrono::duration<double>(t1 - t0).count();
+			testSeconds += std::chrono::duration<double>(t2 - t1).count();
+			triangles += occlusion.LastTrianglesDrawn();
+
+			XMFLOAT3 eyePos;
+			XMStoreFloat3(&eyePos, eye);
+
+			std::size_t viewChecked = 0;
+			for(std::size_t i = 0; i < boxCount; ++i)
+			{
+				if(!OnScreen(XMLoadFloat3(&boxes[i].Center), viewProj))
+					continue;
+
+				++inView;
+				if(visible[i])
+					continue;
+
+				++culledInView;
+				if(viewChecked == checksPerView)
+					continue;
+				++viewChecked;
+				++checked;
+
+				wrong += BoxSeenFrom(eyePos, boxes[i], walls, &viewProj);
+			}
+		}
+
+		out << "Occlusion: " << occlusion.Width() << "x" << occlusion.Height() << " buffer, "
+			<< occlusion.OccluderCount() << " walls, " << triangles / viewCount << " triangles drawn in "
+			<< std::fixed << std::setprecision(3) << 1000.0*renderSeconds / viewCount << " ms, "
+			<< std::setprecision(1) << 1.0e9*testSeconds / (viewCount*boxCount) << " ns/box tested, "
+			<< 100.0*culledInView / MathHelper::Max((std::size_t)1, inView) << "% of boxes in view culled, "
+			<< wrong << " of " << checked << " culled boxes seen by rays\n";
+	}
+
+	// Bakes the sets of a 16x16 cell maze for crate sized boxes scattered through it, one
+	// set cell per maze cell, then times finding and testing against them.  Random eyes
+	// check the sets: rays from the eye to the corners of boxes left out of the eye's set,
+	// against every wall, find boxes the bake missed, and any fails the run.
+	void BenchVisibilitySets(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		MazeDesc mazeDesc;
+		mazeDesc.Width = 16;
+		mazeDesc.Depth = 16;
+		mazeDesc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(mazeDesc);
+
+		const float cellSize = 4.0f;
+		const float size = mazeDesc.Width*cellSize;
+
+		VisibilityBaker baker;
+		const std::vector<BoundingBox> walls = MazeWallBoxes(maze, cellSize);
+		for(const BoundingBox& wall : walls)
+			baker.AddOccluder(wall);
+
+		// Added a maze cell at a time, as a level's items would be, so items near each other
+		// share words of the sets.
+		RandomStream stream(1);
+		const int boxesPerCell = 4;
+		const std::uint32_t boxCount = mazeDesc.Width*mazeDesc.Depth*boxesPerCell;
+		std::vector<BoundingBox> boxes;
+		for(int z = 0; z < mazeDesc.Depth; ++z)
+		{
+			for(int x = 0; x < mazeDesc.Width; ++x)
+			{
+				for(int i = 0; i < boxesPerCell; ++i)
+				{
+					XMFLOAT3 center((x + stream.NextFloat(0.2f, 0.8f))*cellSize, stream.NextFloat(0.5f, 2.0f),
+						(z + stream.NextFloat(0.2f, 0.8f))*cellSize);
+					boxes.push_back(BoundingBox(center, XMFLOAT3(0.5f, 0.5f, 0.5f)));
+					baker.AddItem(boxes.back());
+				}
+			}
+		}
+
+		VisibilityBakeDesc desc;
+		desc.MinX = 0.0f;
+		desc.MinZ = 0.0f;
+		desc.MaxX = size;
+		desc.MaxZ = size;
+		desc.MinY = 1.0f;
+		desc.MaxY = 2.5f;
+		desc.CellSize = cellSize;
+
+		VisibilitySets sets;
+		baker.Bake(desc, sets);
+
+		// Lookups from random eyes, and every box tested against each eye's set.
+		const std::size_t eyeCount = 4096;
+		std::vector<XMFLOAT3> eyes(eyeCount);
+		for(XMFLOAT3& eye : eyes)
+			eye = XMFLOAT3(stream.NextFloat(0.0f, size), stream.NextFloat(1.0f, 2.5f), stream.NextFloat(0.0f, size));
+
+		std::vector<const std::uint64_t*> found(eyeCount);
+		auto t0 = Clock::now();
+		for(std::size_t i = 0; i < eyeCount; ++i)
+			found[i] = sets.Find(eyes[i]);
+		auto t1 = Clock::now();
+		std::size_t inSets = 0;
+		for(std::size_t i = 0; i < eyeCount; ++i)
+		{
+			for(std::uint32_t box = 0; box < boxCount; ++box)
+				inSets += sets.Contains(found[i], box);
+		}
+		auto t2 = Clock::now();
+
+		const std::size_t checkEyes = 512;
+		std::size_t checked = 0;
+		std::size_t missed = 0;
+		for(std::size_t i = 0; i < checkEyes; ++i)
+		{
+			for(std::uint32_t box = 0; box < boxCount; ++box)
+			{
+				if(sets.Contains(found[i], box))
+					continue;
+				++checked;
+				missed += BoxSeenFrom(eyes[i], boxes[box], walls);
+			}
+		}
+
+		out << "VisibilitySets: " << walls.size() << " walls, " << boxCount << " boxes, " << sets.CellCount()
+			<< " cells baked in " << std::fixed << std::setprecision(2) << sets.BakeSeconds() << " s ("
+			<< std::setprecision(1) << sets.RaysCast() / 1.0e6 / MathHelper::Max(1.0e-6f, sets.BakeSeconds())
+			<< " M rays/s), " << sets.SetCount() << " distinct sets, " << sets.Bytes() / 1024 << " KB vs "
+			<< sets.UncompressedBytes() / 1024 << " KB uncompressed, " << 100.0f*sets.VisibleFraction()
+			<< "% visible, find " << std::setprecision(2)
+			<< 1.0e9*std::chrono::duration<double>(t1 - t0).count() / eyeCount << " ns, test "
+			<< 1.0e9*std::chrono::duration<double>(t2 - t1).count() / (eyeCount*boxCount) << " ns/box, "
+			<< missed << " of " << checked << " boxes left out seen by rays"
+			<< (inSets == 0 ? ", NOTHING VISIBLE" : "") << "\n";
+
+		// The sets are meant to be conservative, so a box seen from outside them is a bug.
+		if(missed > 0)
+			Fail(out, "VisibilitySets left out boxes that rays reach");
+	}
+
+	// Zones and portals laid out like the demo's: a walled courtyard with a gate and a
+	// roofless top, and a walled maze yard with an opening at each end, in the open.  From
+	// random eyes inside and out, boxes scattered over all three are tested against what
+	// the portals let through.  A sample of the boxes culled while on screen is checked by
+	// casting rays to their corners against the walls.
+	void BenchPortals(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		std::vector<BoundingBox> walls =
+		{
+			// Courtyard, x and z -45.5..45.5 inside, 16 high, with a 30 wide, 14 high gate
+			// in the +x wall.
+			BoundingBox(XMFLOAT3(0.0f, 8.0f, -59.0f), XMFLOAT3(72.5f, 8.0f, 13.5f)),
+			BoundingBox(XMFLOAT3(0.0f, 8.0f, 59.0f), XMFLOAT3(72.5f, 8.0f, 13.5f)),
+			BoundingBox(XMFLOAT3(-59.0f, 8.0f, 0.0f), XMFLOAT3(13.5f, 8.0f, 45.5f)),
+			BoundingBox(XMFLOAT3(59.0f, 8.0f, -30.25f), XMFLOAT3(13.5f, 8.0f, 15.25f)),
+			BoundingBox(XMFLOAT3(59.0f, 8.0f, 30.25f), XMFLOAT3(13.5f, 8.0f, 15.25f)),
+			BoundingBox(XMFLOAT3(59.0f, 15.0f, 0.0f), XMFLOAT3(13.5f, 1.0f, 15.0f)),
+
+			// Maze yard, x 174..290.25 and z -69.95..69.95 inside, 25 high, with a 28.5 wide
+			// opening at each end.
+			BoundingBox(XMFLOAT3(232.0f, 12.5f, -70.7f), XMFLOAT3(58.5f, 12.5f, 0.75f)),
+			BoundingBox(XMFLOAT3(232.0f, 12.5f, 70.7f), XMFLOAT3(58.5f, 12.5f, 0.75f)),
+			BoundingBox(XMFLOAT3(173.25f, 12.5f, -42.1f), XMFLOAT3(0.75f, 12.5f, 27.85f)),
+			BoundingBox(XMFLOAT3(173.25f, 12.5f, 42.1f), XMFLOAT3(0.75f, 12.5f, 27.85f)),
+			BoundingBox(XMFLOAT3(291.0f, 12.5f, -42.1f), XMFLOAT3(0.75f, 12.5f, 27.85f)),
+			BoundingBox(XMFLOAT3(291.0f, 12.5f, 42.1f), XMFLOAT3(0.75f, 12.5f, 27.85f))
+		};
+
+		PortalVisibility portals;
+		const std::uint32_t castle = portals.AddZone(BoundingBox(XMFLOAT3(0.0f, 7.5f, 0.0f), XMFLOAT3(45.5f, 8.5f, 45.5f)));
+		const std::uint32_t maze = portals.AddZone(BoundingBox(XMFLOAT3(232.125f, 12.0f, 0.0f), XMFLOAT3(58.125f, 13.0f, 69.95f)));
+
+		auto addQuad = [&](std::uint32_t zone, XMFLOAT3 a, XMFLOAT3 b, XMFLOAT3 c, XMFLOAT3 d)
+		{
+			const XMFLOAT3 corners[4] = { a, b, c, d };
+			portals.AddPortal(zone, PortalVisibility::Outside, corners, 4);
+		};
+		addQuad(castle, XMFLOAT3(45.5f, -1.0f, -15.0f), XMFLOAT3(45.5f, -1.0f, 15.0f),
+			XMFLOAT3(45.5f, 14.0f, 15.0f), XMFLOAT3(45.5f, 14.0f, -15.0f));
+		addQuad(castle, XMFLOAT3(-45.5f, 16.0f, -45.5f), XMFLOAT3(45.5f, 16.0f, -45.5f),
+			XMFLOAT3(45.5f, 16.0f, 45.5f), XMFLOAT3(-45.5f, 16.0f, 45.5f));
+		addQuad(maze, XMFLOAT3(174.0f, -1.0f, -14.25f), XMFLOAT3(174.0f, -1.0f, 14.25f),
+			XMFLOAT3(174.0f, 25.0f, 14.25f), XMFLOAT3(174.0f, 25.0f, -14.25f));
+		addQuad(maze, XMFLOAT3(290.25f, -1.0f, -14.25f), XMFLOAT3(290.25f, -1.0f, 14.25f),
+			XMFLOAT3(290.25f, 25.0f, 14.25f), XMFLOAT3(290.25f, 25.0f, -14.25f));
+		addQuad(maze, XMFLOAT3(174.0f, 25.0f, -69.95f), XMFLOAT3(290.25f, 25.0f, -69.95f),
+			XMFLOAT3(290.25f, 25.0f, 69.95f), XMFLOAT3(174.0f, 25.0f, 69.95f));
+
+		auto inWall = [&](const XMFLOAT3& p)
+		{
+			for(const BoundingBox& wall : walls)
+			{
+				if(fabsf(p.x - wall.Center.x) <= wall.Extents.x + 0.5f && fabsf(p.y - wall.Center.y) <= wall.Extents.y + 0.5f &&
+					fabsf(p.z - wall.Center.z) <= wall.Extents.z + 0.5f)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		// A third of the boxes in each zone.
+		RandomStream stream(1);
+		const std::size_t boxCount = 3000;
+		std::vector<BoundingBox> boxes;
+		std::vector<std::uint32_t> zones;
+		while(boxes.size() < boxCount)
+		{
+			XMFLOAT3 center;
+			switch(boxes.size() % 3)
+			{
+			case 0: center = XMFLOAT3(stream.NextFloat(-44.0f, 44.0f), 0.0f, stream.NextFloat(-44.0f, 44.0f)); break;
+			case 1: center = XMFLOAT3(stream.NextFloat(175.0f, 289.0f), 0.0f, stream.NextFloat(-69.0f, 69.0f)); break;
+			default: center = XMFLOAT3(stream.NextFloat(-200.0f, 450.0f), 0.0f, stream.NextFloat(-250.0f, 250.0f)); break;
+			}
+			center.y = stream.NextFloat(1.0f, 10.0f);
+
+			BoundingBox box(center, XMFLOAT3(0.5f, 0.5f, 0.5f));
+			if(inWall(center) || portals.ZoneOf(box) == PortalVisibility::NoZone)
+				continue;
+			boxes.push_back(box);
+			zones.push_back(portals.ZoneOf(box));
+		}
+
+		const XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f*XM_PI, 16.0f / 9.0f, 1.0f, 1000.0f);
+		const int viewCount = 3000;
+		const std::size_t checksPerView = 20;
+
+		double updateSeconds = 0.0;
+		double testSeconds = 0.0;
+		std::size_t views = 0;
+		std::size_t reached = 0;
+		std::size_t inView = 0;
+		std::size_t culledInView = 0;
+		std::size_t checked = 0;
+		std::size_t wrong = 0;
+		std::vector<std::uint8_t> visible(boxCount);
+
+		for(int v = 0; v < viewCount; ++v)
+		{
+			// A third of the eyes in each zone, low down or above the walls.
+			XMFLOAT3 eyePos;
+			do
+			{
+				switch(v % 3)
+				{
+				case 0: eyePos = XMFLOAT3(stream.NextFloat(-44.0f, 44.0f), 0.0f, stream.NextFloat(-44.0f, 44.0f)); break;
+				case 1: eyePos = XMFLOAT3(stream.NextFloat(175.0f, 289.0f), 0.0f, stream.NextFloat(-69.0f, 69.0f)); break;
+				default: eyePos = XMFLOAT3(stream.NextFloat(-150.0f, 400.0f), 0.0f, stream.NextFloat(-200.0f, 200.0f)); break;
+				}
+				eyePos.y = stream.NextFloat(0.0f, 1.0f) < 0.75f ? stream.NextFloat(2.0f, 10.0f) : stream.NextFloat(10.0f, 40.0f);
+			} while(inWall(eyePos));
+
+			const float heading = stream.NextFloat(0.0f, XM_2PI);
+			const float pitch = stream.NextFloat(-0.4f, 0.2f);
+			XMVECTOR eye = XMLoadFloat3(&eyePos);
+			XMVECTOR dir = XMVectorSet(cosf(heading)*cosf(pitch), sinf(pitch), sinf(heading)*cosf(pitch), 0.0f);
+			XMMATRIX viewProj = XMMatrixLookAtLH(eye, XMVectorAdd(eye, dir), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))*proj;
+
+			auto t0 = Clock::now();
+			portals.Update(eyePos, viewProj);
+			auto t1 = Clock::now();
+			for(std::size_t i = 0; i < boxCount; ++i)
+				visible[i] = portals.IsVisible(zones[i], boxes[i]);
+			auto t2 = Clock::now();
+
+			updateSeconds += std::chrono::duration<double>(t1 - t0).count();
+			testSeconds += std::chrono::duration<double>(t2 - t1).count();
+			views += portals.LastViews();
+			reached += portals.LastZonesReached();
+
+			std::size_t viewChecked = 0;
+			for(std::size_t i = 0; i < boxCount; ++i)
+			{
+				if(!OnScreen(XMLoadFloat3(&boxes[i].Center), viewProj))
+					continue;
+
+				++inView;
+				if(visible[i])
+					continue;
+
+				++culledInView;
+				if(viewChecked == checksPerView)
+					continue;
+				++viewChecked;
+				++checked;
+
+				wrong += BoxSeenFrom(eyePos, boxes[i], walls, &viewProj);
+			}
+		}
+
+		out << "Portals: " << portals.ZoneCount() << " zones, " << portals.PortalCount() << " portals, "
+			<< std::fixed << std::setprecision(2) << (double)reached / viewCount << " zones and "
+			<< (double)views / viewCount << " frustums per view in " << 1.0e6*updateSeconds / viewCount << " us, "
+			<< 1.0e9*testSeconds / (viewCount*boxCount) << " ns/box tested, " << std::setprecision(1)
+			<< 100.0*culledInView / MathHelper::Max((std::size_t)1, inView) << "% of boxes in view culled, "
+			<< wrong << " of " << checked << " culled boxes seen by rays\n";
+	}
+
+	// A maze of subdivided walls on a floor, lit by point lights above it, baked at every
+	// vertex.  Rays from random points are first cast one at a time and as packets, checked
+	// against each other, and nearest hits are checked against testing every triangle.
+	void BenchLightBaker(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		MazeDesc mazeDesc;
+		mazeDesc.Width = 16;
+		mazeDesc.Depth = 16;
+		mazeDesc.Seed = 1;
+
+		MazeGenerator maze;
+		maze.Generate(mazeDesc);
+
+		const float cellSize = 4.0f;
+		const float size = mazeDesc.Width*cellSize;
+
+		std::vector<XMFLOAT3> positions;
+		std::vector<XMFLOAT3> normals;
+		std::vector<std::uint32_t> indices;
+		AddBenchBox(BoundingBox(XMFLOAT3(0.5f*size, -0.5f, 0.5f*size), XMFLOAT3(0.5f*size + 1.0f, 0.5f, 0.5f*size + 1.0f)),
+			1.0f, positions, normals, indices);
+		for(const BoundingBox& wall : MazeWallBoxes(maze, cellSize))
+			AddBenchBox(wall, 1.0f, positions, normals, indices);
+
+		const std::size_t triangleCount = indices.size() / 3;
+		TriangleBvh bvh;
+		bvh.Build(positions.data(), positions.size(), indices.data(), triangleCount);
+
+		// Rays from random points in the maze to random points within reach.
+		RandomStream stream(1);
+		const std::size_t rayCount = 1 << 18;
+		std::vector<XMFLOAT3> origins(rayCount);
+		std::vector<XMFLOAT3> directions(rayCount);
+		std::vector<float> distances(rayCount, 1.0f);
+		for(std::size_t i = 0; i < rayCount; ++i)
+		{
+			origins[i] = XMFLOAT3(stream.NextFloat(0.0f, size), stream.NextFloat(0.1f, 5.9f), stream.NextFloat(0.0f, size));
+			directions[i] = XMFLOAT3(stream.NextFloat(-8.0f, 8.0f), stream.NextFloat(-4.0f, 4.0f), stream.NextFloat(-8.0f, 8.0f));
+		}
+
+		std::vector<std::uint8_t> single(rayCount);
+		auto t0 = Clock::now();
+		for(std::size_t i = 0; i < rayCount; ++i)
+			single[i] = bvh.Occluded(origins[i], directions[i], distances[i]) ? 1 : 0;
+		auto t1 = Clock::now();
+
+		// Packets of rays from one point, as the baker casts them.
+		std::vector<std::uint8_t> packed(rayCount);
+		for(std::size_t i = 0; i < rayCount; i += 4)
+		{
+			XMFLOAT3 packetOrigins[4] = { origins[i], origins[i], origins[i], origins[i] };
+			const int blocked = bvh.Occluded4(packetOrigins, &directions[i], &distances[i]);
+			for(int k = 0; k < 4; ++k)
+				packed[i + k] = (std::uint8_t)((blocked >> k) & 1);
+		}
+		auto t2 = Clock::now();
+
+		std::size_t blocked = 0;
+		std::size_t disagree = 0;
+		for(std::size_t i = 0; i < rayCount; i += 4)
+		{
+			for(int k = 0; k < 4; ++k)
+			{
+				blocked += single[i + k];
+				disagree += bvh.Occluded(origins[i], directions[i + k], distances[i + k]) != (packed[i + k] != 0);
+			}
+		}
+
+		// Nearest hits against every triangle, for a sample of the rays.
+		const std::size_t checkCount = 512;
+		std::size_t wrong = 0;
+		for(std::size_t i = 0; i < checkCount; ++i)
+		{
+			XMVECTOR o = XMLoadFloat3(&origins[i]);
+			XMVECTOR d = XMLoadFloat3(&directions[i]);
+			const float length = XMVectorGetX(XMVector3Length(d));
+			XMVECTOR unit = XMVectorScale(d, 1.0f / length);
+
+			float nearest = FLT_MAX;
+			for(std::size_t t = 0; t < triangleCount; ++t)
+			{
+				float hit;
+				if(TriangleTests::Intersects(o, unit, XMLoadFloat3(&positions[indices[3*t]]), XMLoadFloat3(&positions[indices[3*t + 1]]),
+					XMLoadFloat3(&positions[indices[3*t + 2]]), hit) && hit <= length)
+				{
+					nearest = MathHelper::Min(nearest, hit / length);
+				}
+			}
+
+			BvhHit hit;
+			const bool found = bvh.Intersect(origins[i], directions[i], 1.0f, hit);
+			if(found != (nearest != FLT_MAX) || (found && fabsf(hit.Distance - nearest) > 1.0e-4f))
+				++wrong;
+		}
+
+		// Lights over the maze, about as far apart as the courtyard's.
+		LightBaker baker(bvh);
+		for(int z = 0; z < 3; ++z)
+		{
+			for(int x = 0; x < 3; ++x)
+			{
+				BakedLight light;
+				light.Strength = XMFLOAT3(10.0f, 10.0f, 4.0f);
+				light.FalloffStart = 0.0f;
+				light.FalloffEnd = 25.0f;
+				light.Position = XMFLOAT3((x + 0.5f)*size / 3.0f, 8.0f, (z + 0.5f)*size / 3.0f);
+				baker.AddLight(light);
+			}
+		}
+
+		LightBakeDesc desc;
+		desc.OcclusionRays = 64;
+		desc.OcclusionDistance = 8.0f;
+
+		std::vector<XMFLOAT4> baked(positions.size());
+		baker.Bake(desc, positions.data(), normals.data(), positions.size(), baked.data());
+
+		float occlusion = 0.0f;
+		for(const XMFLOAT4& b : baked)
+			occlusion += b.w;
+
+		const double singleSeconds = std::chrono::duration<double>(t1 - t0).count();
+		const double packetSeconds = std::chrono::duration<double>(t2 - t1).count();
+		out << "LightBaker: " << triangleCount << " triangles, BVH of " << bvh.NodeCount() << " nodes, "
+			<< bvh.Bytes() / 1024 << " KB built in " << std::fixed << std::setprecision(1) << bvh.BuildMs()
+			<< " ms, one thread " << std::setprecision(2) << rayCount / 1.0e6 / singleSeconds << " M rays/s single, "
+			<< rayCount / 1.0e6 / packetSeconds << " M rays/s in packets of 4 (" << std::setprecision(1)
+			<< 100.0*blocked / rayCount << "% blocked, " << disagree << " disagree), " << wrong << " of "
+			<< checkCount << " nearest hits wrong; " << positions.size() << " vertices, " << baker.LightCount()
+			<< " lights, " << desc.OcclusionRays << " AO rays baked in " << std::setprecision(2) << baker.LastBakeSeconds()
+			<< " s on " << std::thread::hardware_concurrency() << " threads (" << std::setprecision(1)
+			<< baker.LastRaysCast() / 1.0e6 / MathHelper::Max(1.0e-6f, baker.LastBakeSeconds()) << " M rays/s), average AO "
+			<< std::setprecision(2) << occlusion / baked.size() << "\n";
+	}
+
+	// A field of skulls from Models/skull.txt and subdivided boxes, each mesh built once
+	// and placed many times.  Rays from a camera over the field, all going the same way,
+	// are cast on one thread and then as a batch over every core, and so are rays from
+	// random points in random directions.  A sample of hits is checked against casting
+	// into every instance, and the skull's tree against testing every triangle.
+	void BenchRayScene(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		ModelData skull;
+		if(!LoadTextModel("Models/skull.txt", skull))
+		{
+			out << "RayScene: Models/skull.txt not found, skipped\n";
+			return;
+		}
+
+		std::vector<XMFLOAT3> boxPositions;
+		std::vector<XMFLOAT3> boxNormals;
+		std::vector<std::uint32_t> boxIndices;
+		AddBenchBox(BoundingBox(XMFLOAT3(0.0f, 0.5f, 0.0f), XMFLOAT3(0.5f, 0.5f, 0.5f)), 0.125f,
+			boxPositions, boxNormals, boxIndices);
+
+		RayScene scene;
+		const std::uint32_t skullMesh = scene.AddMesh(skull.Positions.data(), skull.Positions.size(),
+			skull.Indices.data(), skull.Indices.size() / 3);
+		const std::uint32_t boxMesh = scene.AddMesh(boxPositions.data(), boxPositions.size(),
+			boxIndices.data(), boxIndices.size() / 3);
+		const float meshMs = scene.Mesh(skullMesh).BuildMs() + scene.Mesh(boxMesh).BuildMs();
+
+		const int fieldSize = 16;
+		const float spacing = 10.0f;
+		const float extent = fieldSize*spacing;
+		std::vector<XMFLOAT4X4> worlds;
+		RandomStream stream(1);
+		for(int z = 0; z < fieldSize; ++z)
+		{
+			for(int x = 0; x < fieldSize; ++x)
+			{
+				const bool isSkull = ((x + z) & 1) == 0;
+				const float scale = stream.NextFloat(0.75f, 1.25f);
+				XMMATRIX world = isSkull ? XMMatrixScaling(scale, scale, scale) : XMMatrixScaling(3.0f*scale, 6.0f*scale, 3.0f*scale);
+				world = world * XMMatrixRotationY(stream.NextFloat(0.0f, 2.0f*MathHelper::Pi))
+					* XMMatrixTranslation((x + 0.5f)*spacing, 0.0f, (z + 0.5f)*spacing);
+
+				XMFLOAT4X4 w;
+				XMStoreFloat4x4(&w, world);
+				scene.AddInstance(isSkull ? skullMesh : boxMesh, w);
+				worlds.push_back(w);
+			}
+		}
+
+		auto t0 = Clock::now();
+		scene.Build();
+		auto t1 = Clock::now();
+
+		// One ray per pixel of a 512x512 view from above the near edge of the field.
+		const int viewSize = 512;
+		const std::size_t rayCount = (std::size_t)viewSize*viewSize;
+		const XMVECTOR eye = XMVectorSet(0.5f*extent, 40.0f, -20.0f, 1.0f);
+		const XMVECTOR forward = XMVector3Normalize(XMVectorSubtract(XMVectorSet(0.5f*extent, 0.0f, 0.5f*extent, 1.0f), eye));
+		const XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), forward));
+		const XMVECTOR up = XMVector3Cross(forward, right);
+		std::vector<SceneRay> viewRays(rayCount);
+		for(int j = 0; j < viewSize; ++j)
+		{
+			for(int i = 0; i < viewSize; ++i)
+			{
+				const float u = (2.0f*(i + 0.5f) / viewSize - 1.0f)*0.6f;
+				const float v = (1.0f - 2.0f*(j + 0.5f) / viewSize)*0.6f;
+				SceneRay& ray = viewRays[(std::size_t)j*viewSize + i];
+				XMStoreFloat3(&ray.Origin, eye);
+				XMStoreFloat3(&ray.Direction, XMVectorAdd(forward, XMVectorAdd(XMVectorScale(right, u), XMVectorScale(up, v))));
+				ray.MaxDistance = 1000.0f;
+			}
+		}
+
+		// From random points among the instances, in random directions, up to 30 away.
+		std::vector<SceneRay> randomRays(rayCount);
+		for(SceneRay& ray : randomRays)
+		{
+			ray.Origin = XMFLOAT3(stream.NextFloat(0.0f, extent), stream.NextFloat(0.1f, 6.0f), stream.NextFloat(0.0f, extent));
+			XMVECTOR d = XMVector3Normalize(XMVectorSet(stream.NextFloat(-1.0f, 1.0f), stream.NextFloat(-1.0f, 1.0f),
+				stream.NextFloat(-1.0f, 1.0f), 0.0f));
+			XMStoreFloat3(&ray.Direction, d);
+			ray.MaxDistance = 30.0f;
+		}
+
+		std::vector<SceneHit> singleHits(rayCount);
+		std::vector<std::uint8_t> singleFound(rayCount);
+		auto t2 = Clock::now();
+		for(std::size_t i = 0; i < rayCount; ++i)
+			singleFound[i] = scene.Intersect(viewRays[i], singleHits[i]) ? 1 : 0;
+		auto t3 = Clock::now();
+
+		std::vector<SceneHit> viewHits(rayCount);
+		scene.IntersectBatch(viewRays.data(), rayCount, viewHits.data());
+		auto t4 = Clock::now();
+
+		std::vector<SceneHit> randomHits(rayCount);
+		scene.IntersectBatch(randomRays.data(), rayCount, randomHits.data());
+		auto t5 = Clock::now();
+
+		std::size_t viewHitCount = 0;
+		std::size_t randomHitCount = 0;
+		std::size_t disagree = 0;
+		for(std::size_t i = 0; i < rayCount; ++i)
+		{
+			const bool batchFound = viewHits[i].Instance != RayScene::NoInstance;
+			viewHitCount += batchFound ? 1 : 0;
+			randomHitCount += randomHits[i].Instance != RayScene::NoInstance ? 1 : 0;
+			if(batchFound != (singleFound[i] != 0) || (batchFound && (viewHits[i].Instance != singleHits[i].Instance ||
+				viewHits[i].Distance != singleHits[i].Distance)))
+			{
+				++disagree;
+			}
+		}
+
+		// The instance tree against casting into every instance in turn.
+		const std::size_t checkCount = 1024;
+		std::size_t wrong = 0;
+		for(std::size_t c = 0; c < checkCount; ++c)
+		{
+			const std::size_t i = (c*7919) % rayCount;
+			const SceneRay& ray = c % 2 == 0 ? viewRays[i] : randomRays[i];
+			const SceneHit& hit = c % 2 == 0 ? viewHits[i] : randomHits[i];
+
+			float nearest = ray.MaxDistance;
+			bool found = false;
+			for(std::uint32_t k = 0; k < (std::uint32_t)scene.InstanceCount(); ++k)
+			{
+				XMMATRIX world = XMLoadFloat4x4(&worlds[k]);
+				XMVECTOR det = XMMatrixDeterminant(world);
+				XMMATRIX invWorld = XMMatrixInverse(&det, world);
+				XMFLOAT3 origin;
+				XMFLOAT3 direction;
+				XMStoreFloat3(&origin, XMVector3TransformCoord(XMLoadFloat3(&ray.Origin), invWorld));
+				XMStoreFloat3(&direction, XMVector3TransformNormal(XMLoadFloat3(&ray.Direction), invWorld));
+
+				BvhHit meshHit;
+				if(scene.Mesh(scene.InstanceMesh(k)).Intersect(origin, direction, nearest, meshHit))
+				{
+					nearest = meshHit.Distance;
+					found = true;
+				}
+			}
+
+			const bool sceneFound = hit.Instance != RayScene::NoInstance;
+			if(found != sceneFound || (found && fabsf(hit.Distance - nearest) > 1.0e-4f*MathHelper::Max(1.0f, nearest)))
+				++wrong;
+		}
+
+		// The skull's own tree against testing every triangle.
+		const TriangleBvh& skullBvh = scene.Mesh(skullMesh);
+		const std::size_t skullChecks = 128;
+		std::size_t skullWrong = 0;
+		for(std::size_t c = 0; c < skullChecks; ++c)
+		{
+			XMFLOAT3 origin(stream.NextFloat(-6.0f, 6.0f), stream.NextFloat(-3.0f, 10.0f), stream.NextFloat(-7.0f, 8.0f));
+			XMFLOAT3 target(stream.NextFloat(-3.0f, 3.0f), stream.NextFloat(0.0f, 7.0f), stream.NextFloat(-4.0f, 5.0f));
+			XMFLOAT3 direction(target.x - origin.x, target.y - origin.y, target.z - origin.z);
+
+			XMVECTOR o = XMLoadFloat3(&origin);
+			XMVECTOR d = XMLoadFloat3(&direction);
+			const float length = XMVectorGetX(XMVector3Length(d));
+			XMVECTOR unit = XMVectorScale(d, 1.0f / length);
+
+			float nearest = FLT_MAX;
+			for(std::size_t t = 0; t < skull.Indices.size(); t += 3)
+			{
+				float distance;
+				if(TriangleTests::Intersects(o, unit, XMLoadFloat3(&skull.Positions[skull.Indices[t]]),
+					XMLoadFloat3(&skull.Positions[skull.Indices[t + 1]]), XMLoadFloat3(&skull.Positions[skull.Indices[t + 2]]),
+					distance) && distance <= 2.0f*length)
+				{
+					nearest = MathHelper::Min(nearest, distance / length);
+				}
+			}
+
+			BvhHit hit;
+			const bool found = skullBvh.Intersect(origin, direction, 2.0f, hit);
+			if(found != (nearest != FLT_MAX) || (found && fabsf(hit.Distance - nearest) > 1.0e-4f))
+				++skullWrong;
+		}
+
+		const double singleSeconds = std::chrono::duration<double>(t3 - t2).count();
+		const double viewSeconds = std::chrono::duration<double>(t4 - t3).count();
+		const double randomSeconds = std::chrono::duration<double>(t5 - t4).count();
+		out << "RayScene: " << scene.MeshCount() << " meshes of " << scene.MeshTriangleCount() << " triangles built in "
+			<< std::fixed << std::setprecision(1) << meshMs << " ms, " << scene.InstanceCount() << " instances ("
+			<< scene.WorldTriangleCount() / 1000 << "K triangles placed) in " << std::setprecision(3)
+			<< std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms, " << scene.Bytes() / 1024
+			<< " KB; view rays " << std::setprecision(2) << rayCount / 1.0e6 / singleSeconds << " M rays/s on one thread, "
+			<< rayCount / 1.0e6 / viewSeconds << " M rays/s batched on " << std::thread::hardware_concurrency()
+			<< " threads (" << std::setprecision(1) << 100.0*viewHitCount / rayCount << "% hit, " << disagree
+			<< " disagree), random rays " << std::setprecision(2) << rayCount / 1.0e6 / randomSeconds << " M rays/s batched ("
+			<< std::setprecision(1) << 100.0*randomHitCount / rayCount << "% hit); " << wrong << " of " << checkCount
+			<< " hits wrong against every instance, " << skullWrong << " of " << skullChecks
+			<< " against every skull triangle\n";
+	}
+
+	void WriteBenchFile(const std::string& file, const std::string& text)
+	{
+		std::ofstream fout(file, std::ios::binary | std::ios::trunc);
+		fout << text;
+	}
+
+	bool BenchFileExists(const std::string& file)
+	{
+		return std::ifstream(file, std::ios::binary).good();
+	}
+
+	// Runs the shader cache against a stand-in compiler over a few generated sources: a
+	// shader including a header that includes a second one, which includes the first
+	// back.  Checks that a miss is followed by hits, that editing the nested include or
+	// any part of the desc changes the key, that the include cycle ends and that a failed
+	// compile leaves nothing behind, then times lookups that hit.
+	void BenchShaderCache(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		const std::string directory = "BenchShaderCache";
+		const std::string mainFile = "BenchShaderCache_Main.hlsl";
+		const std::string commonFile = "BenchShaderCache_Common.hlsli";
+		const std::string lightingFile = "BenchShaderCache_Lighting.hlsli";
+
+		WriteBenchFile(mainFile, "#include \"" + commonFile + "\"\nfloat4 PS() : SV_Target { return Light(); }\n");
+		WriteBenchFile(commonFile, "#ifndef COMMON\n#define COMMON\n#include \"" + lightingFile + "\"\n#endif\n");
+		WriteBenchFile(lightingFile, "#include \"" + commonFile + "\"\nfloat4 Light() { return 1.0f; }\n");
+
+		// Writes the entry point as its bytecode and fails for "Broken".
+		int compiles = 0;
+		auto compile = [&compiles](const ShaderDesc& desc, std::vector<char>& bytecode)
+		{
+			++compiles;
+			if(desc.EntryPoint == "Broken")
+				return false;
+			bytecode.assign(desc.EntryPoint.begin(), desc.EntryPoint.end());
+			return true;
+		};
+
+		ShaderDesc desc;
+		desc.File = mainFile;
+		desc.Defines = { { "FOG", "1" }, { "ALPHA_TEST", "1" } };
+		desc.EntryPoint = "PS";
+		desc.Target = "ps_5_1";
+		desc.Flags = 1;
+
+		ShaderDesc broken = desc;
+		broken.EntryPoint = "Broken";
+
+		std::size_t checkCount = 0;
+		std::vector<std::string> failed;
+		auto check = [&checkCount, &failed](bool passed, const char* name)
+		{
+			++checkCount;
+			if(!passed)
+				failed.push_back(name);
+		};
+
+		std::vector<std::string> blobs;
+		{
+			ShaderCache cache(directory, compile);
+
+			// Blobs left by an earlier run would turn the first lookup into a hit.
+			std::remove(cache.BlobPath(cache.Key(desc)).c_str());
+
+			const std::uint64_t key = cache.Key(desc);
+			check(key != 0, "include cycle");
+
+			const std::string path = cache.Get(desc);
+			check(!path.empty() && cache.Misses() == 1 && cache.Hits() == 0 && compiles == 1, "first get misses");
+			check(cache.Get(desc) == path && cache.Hits() == 1 && compiles == 1, "second get hits");
+			blobs.push_back(path);
+
+			ShaderDesc changed = desc;
+			changed.Defines[0].Value = "0";
+			check(cache.Key(changed) != key, "define value");
+			changed = desc;
+			changed.Defines.pop_back();
+			check(cache.Key(changed) != key, "define removed");
+			changed = desc;
+			changed.EntryPoint = "PSMain";
+			check(cache.Key(changed) != key, "entry point");
+			changed = desc;
+			changed.Target = "ps_6_0";
+			check(cache.Key(changed) != key, "target");
+			changed = desc;
+			changed.Flags = 2;
+			check(cache.Key(changed) != key, "flags");
+
+			const std::string brokenPath = cache.BlobPath(cache.Key(broken));
+			std::remove(brokenPath.c_str());
+			bool leftovers = cache.Get(broken) != "" || BenchFileExists(brokenPath);
+			for(int i = 0; i < 4; ++i)
+				leftovers = leftovers || BenchFileExists(brokenPath + "." + std::to_string(i) + ".tmp") ||
+					BenchFileExists(path + "." + std::to_string(i) + ".tmp");
+			check(!leftovers && cache.Misses() == 1, "failed compile leaves nothing");
+		}
+
+		// Sources are remembered per cache, so a new one stands in for the next run.
+		std::uint64_t warmKey = 0;
+		{
+			ShaderCache cache(directory, compile);
+			warmKey = cache.Key(desc);
+			check(cache.Get(desc) == blobs[0] && cache.Hits() == 1 && compiles == 2, "warm start hits");
+		}
+
+		WriteBenchFile(lightingFile, "#include \"" + commonFile + "\"\nfloat4 Light() { return 0.5f; }\n");
+
+		double hitMicroseconds = 0.0;
+		{
+			ShaderCache cache(directory, compile);
+			const std::uint64_t key = cache.Key(desc);
+			check(key != warmKey, "nested include edit");
+
+			std::remove(cache.BlobPath(key).c_str());
+			const std::string path = cache.Get(desc);
+			check(!path.empty() && path != blobs[0] && cache.Misses() == 1 && compiles == 3, "edit recompiles");
+			blobs.push_back(path);
+
+			const int lookups = 1000;
+			auto t0 = Clock::now();
+			for(int i = 0; i < lookups; ++i)
+				cache.Get(desc);
+			auto t1 = Clock::now();
+			hitMicroseconds = std::chrono::duration<double, std::micro>(t1 - t0).count() / lookups;
+		}
+
+		for(const std::string& blob : blobs)
+			std::remove(blob.c_str());
+		std::remove(mainFile.c_str());
+		std::remove(commonFile.c_str());
+		std::remove(lightingFile.c_str());
+
+		out << "ShaderCache: " << checkCount - failed.size() << " of " << checkCount << " checks passed";
+		for(std::size_t i = 0; i < failed.size(); ++i)
+			out << (i == 0 ? " (FAILED: " : ", ") << failed[i] << (i + 1 == failed.size() ? ")" : "");
+		out << ", hit " << std::fixed << std::setprecision(1) << hitMicroseconds << " us\n";
+	}
+
+	// Stands in for D3D12_GRAPHICS_PIPELINE_STATE_DESC and the structs it holds, with the
+	// same field names and the same small fields that leave padding behind them.
+	struct BenchShaderBytecode { const void* pShaderBytecode; std::size_t BytecodeLength; };
+	struct BenchSODeclarationEntry
+	{
+		std::uint32_t Stream; const char* SemanticName; std::uint32_t SemanticIndex;
+		std::uint8_t StartComponent; std::uint8_t ComponentCount; std::uint8_t OutputSlot;
+	};
+	struct BenchStreamOutputDesc
+	{
+		const BenchSODeclarationEntry* pSODeclaration; std::uint32_t NumEntries;
+		const std::uint32_t* pBufferStrides; std::uint32_t NumStrides; std::uint32_t RasterizedStream;
+	};
+	struct BenchRenderTargetBlendDesc
+	{
+		int BlendEnable; int LogicOpEnable; int SrcBlend; int DestBlend; int BlendOp;
+		int SrcBlendAlpha; int DestBlendAlpha; int BlendOpAlpha; int LogicOp; std::uint8_t RenderTargetWriteMask;
+	};
+	struct BenchBlendDesc { int AlphaToCoverageEnable; int IndependentBlendEnable; BenchRenderTargetBlendDesc RenderTarget[8]; };
+	struct BenchRasterizerDesc
+	{
+		int FillMode; int CullMode; int FrontCounterClockwise; int DepthBias; float DepthBiasClamp;
+		float SlopeScaledDepthBias; int DepthClipEnable; int MultisampleEnable; int AntialiasedLineEnable;
+		std::uint32_t ForcedSampleCount; int ConservativeRaster;
+	};
+	struct BenchDepthStencilOpDesc { int StencilFailOp; int StencilDepthFailOp; int StencilPassOp; int StencilFunc; };
+	struct BenchDepthStencilDesc
+	{
+		int DepthEnable; int DepthWriteMask; int DepthFunc; int StencilEnable; std::uint8_t StencilReadMask;
+		std::uint8_t StencilWriteMask; BenchDepthStencilOpDesc FrontFace; BenchDepthStencilOpDesc BackFace;
+	};
+	struct BenchInputElementDesc
+	{
+		const char* SemanticName; std::uint32_t SemanticIndex; int Format; std::uint32_t InputSlot;
+		std::uint32_t AlignedByteOffset; int InputSlotClass; std::uint32_t InstanceDataStepRate;
+	};
+	struct BenchInputLayoutDesc { const BenchInputElementDesc* pInputElementDescs; std::uint32_t NumElements; };
+	struct BenchSampleDesc { std::uint32_t Count; std::uint32_t Quality; };
+	struct BenchCachedPipelineState { const void* pCachedBlob; std::size_t CachedBlobSizeInBytes; };
+	struct BenchPipelineStateDesc
+	{
+		void* pRootSignature;
+		BenchShaderBytecode VS, PS, DS, HS, GS;
+		BenchStreamOutputDesc StreamOutput;
+		BenchBlendDesc BlendState;
+		std::uint32_t SampleMask;
+		BenchRasterizerDesc RasterizerState;
+		BenchDepthStencilDesc DepthStencilState;
+		BenchInputLayoutDesc InputLayout;
+		int IBStripCutValue;
+		int PrimitiveTopologyType;
+		std::uint32_t NumRenderTargets;
+		int RTVFormats[8];
+		int DSVFormat;
+		BenchSampleDesc SampleDesc;
+		std::uint32_t NodeMask;
+		BenchCachedPipelineState CachedPSO;
+		int Flags;
+	};
+
+	// Everything a BenchPipelineStateDesc points at, so two copies can live apart.
+	struct BenchPipelineSources
+	{
+		std::vector<unsigned char> SignedShader;
+		std::vector<unsigned char> UnsignedShader;
+		std::string Position;
+		std::string Normal;
+		std::string Stream;
+		std::vector<BenchInputElementDesc> Elements;
+		std::vector<BenchSODeclarationEntry> Entries;
+		std::vector<std::uint32_t> Strides;
+	};
+
+	// Fills desc the way the app fills its opaque PSO desc, after first filling every byte,
+	// padding and unused fields included, with garbage.
+	void FillBenchPipelineDesc(BenchPipelineStateDesc& desc, BenchPipelineSources& sources, unsigned char garbage)
+	{
+		std::memset(&desc, garbage, sizeof(desc));
+
+		// A signed DXBC container, keyed by its digest, and an unsigned blob keyed in full.
+		sources.SignedShader.assign(64, 0x5a);
+		std::memcpy(sources.SignedShader.data(), "DXBC", 4);
+		for(int i = 0; i < 16; ++i)
+			sources.SignedShader[4 + i] = (unsigned char)(17*i + 1);
+		sources.UnsignedShader.assign(48, 0x3c);
+
+		sources.Position = "POSITION";
+		sources.Normal = "NORMAL";
+		sources.Stream = "SV_POSITION";
+
+		BenchInputElementDesc position = { sources.Position.c_str(), 0, 6, 0, 0, 0, 0 };
+		BenchInputElementDesc normal = { sources.Normal.c_str(), 0, 6, 0, 12, 0, 0 };
+		sources.Elements = { position, normal };
+
+		BenchSODeclarationEntry entry;
+		std::memset(&entry, garbage, sizeof(entry));
+		entry.Stream = 0;
+		entry.SemanticName = sources.Stream.c_str();
+		entry.SemanticIndex = 0;
+		entry.StartComponent = 0;
+		entry.ComponentCount = 4;
+		entry.OutputSlot = 0;
+		sources.Entries = { entry };
+		sources.Strides = { 16 };
+
+		desc.pRootSignature = &sources;
+		desc.VS = { sources.SignedShader.data(), sources.SignedShader.size() };
+		desc.PS = { sources.UnsignedShader.data(), sources.UnsignedShader.size() };
+		desc.DS = { nullptr, 0 };
+		desc.HS = { nullptr, 0 };
+		desc.GS = { nullptr, 0 };
+		desc.StreamOutput = { sources.Entries.data(), 1, sources.Strides.data(), 1, 0 };
+
+		desc.BlendState.AlphaToCoverageEnable = 0;
+		desc.BlendState.IndependentBlendEnable = 0;
+		BenchRenderTargetBlendDesc& rt = desc.BlendState.RenderTarget[0];
+		rt.BlendEnable = 1;
+		rt.LogicOpEnable = 0;
+		rt.SrcBlend = 5;
+		rt.DestBlend = 6;
+		rt.BlendOp = 1;
+		rt.SrcBlendAlpha = 2;
+		rt.DestBlendAlpha = 1;
+		rt.BlendOpAlpha = 1;
+		rt.LogicOp = 4;
+		rt.RenderTargetWriteMask = 15;
+
+		desc.SampleMask = 0xffffffff;
+		desc.RasterizerState = { 3, 3, 0, 0, 0.0f, 0.0f, 1, 0, 0, 0, 0 };
+
+		desc.DepthStencilState.DepthEnable = 1;
+		desc.DepthStencilState.DepthWriteMask = 1;
+		desc.DepthStencilState.DepthFunc = 2;
+		desc.DepthStencilState.StencilEnable = 0;
+		desc.DepthStencilState.StencilReadMask = 0xff;
+		desc.DepthStencilState.StencilWriteMask = 0xff;
+		desc.DepthStencilState.FrontFace = { 1, 1, 1, 8 };
+		desc.DepthStencilState.BackFace = { 1, 1, 1, 8 };
+
+		desc.InputLayout = { sources.Elements.data(), (std::uint32_t)sources.Elements.size() };
+		desc.IBStripCutValue = 0;
+		desc.PrimitiveTopologyType = 3;
+		desc.NumRenderTargets = 1;
+		desc.RTVFormats[0] = 28;
+		desc.DSVFormat = 20;
+		desc.SampleDesc = { 1, 0 };
+		desc.NodeMask = 0;
+		desc.Flags = 0;
+	}
+
+	// Checks PipelineKey without D3D: descs that say the same thing but differ in padding,
+	// unused fields, pointers, root signature objects and cached PSO blobs must dedupe to
+	// one entry, while changing any one field that reaches the driver, or a byte of the
+	// serialized root signature, must give a key and hash of their own.  Then times
+	// building a key.
+	void BenchPipelineKey(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		typedef std::unordered_map<PipelineKey, int, PipelineKey::Hasher> KeyMap;
+
+		std::vector<unsigned char> rootSignature(256);
+		for(std::size_t i = 0; i < rootSignature.size(); ++i)
+			rootSignature[i] = (unsigned char)(i*7 + 3);
+		const std::string blob(rootSignature.begin(), rootSignature.end());
+
+		BenchPipelineSources sourcesA;
+		BenchPipelineSources sourcesB;
+		BenchPipelineStateDesc descA;
+		BenchPipelineStateDesc descB;
+		FillBenchPipelineDesc(descA, sourcesA, 0x00);
+		FillBenchPipelineDesc(descB, sourcesB, 0xcd);
+
+		PipelineKey base;
+		base.Write(descA, blob);
+
+		// A second root signature object made from the same blob, in a buffer of its own.
+		PipelineKey same;
+		same.Write(descB, std::string(blob.begin(), blob.end()));
+
+		KeyMap keys;
+		keys.emplace(base, 0);
+		keys.emplace(same, 1);
+		const bool deduped = same == base && same.Hash() == base.Hash() && keys.size() == 1;
+
+		std::string changedBlob = blob;
+		changedBlob[100] ^= 1;
+		PipelineKey rootChanged;
+		rootChanged.Write(descA, changedBlob);
+		const bool rootKeyed = rootChanged != base && rootChanged.Hash() != base.Hash();
+
+		// One change per field the driver compiles from.
+		typedef std::function<void(BenchPipelineStateDesc&, BenchPipelineSources&)> Change;
+		const std::vector<Change> changes =
+		{
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.SignedShader[9] ^= 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.UnsignedShader[40] ^= 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.PS.BytecodeLength -= 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DS = { s.UnsignedShader.data(), s.UnsignedShader.size() }; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.HS = { s.UnsignedShader.data(), s.UnsignedShader.size() }; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.GS = { s.UnsignedShader.data(), s.UnsignedShader.size() }; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.StreamOutput.NumEntries = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Entries[0].Stream = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Stream[3] = 'Q'; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Entries[0].SemanticIndex = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Entries[0].StartComponent = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Entries[0].ComponentCount = 3; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Entries[0].OutputSlot = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.StreamOutput.NumStrides = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Strides[0] = 32; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.StreamOutput.RasterizedStream = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.AlphaToCoverageEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.IndependentBlendEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].BlendEnable = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].LogicOpEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].SrcBlend = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].DestBlend = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].BlendOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].SrcBlendAlpha = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].DestBlendAlpha = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].BlendOpAlpha = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].LogicOp = 5; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.BlendState.RenderTarget[0].RenderTargetWriteMask = 7; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.SampleMask = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.FillMode = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.CullMode = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.FrontCounterClockwise = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.DepthBias = 100; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.DepthBiasClamp = 1.0f; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.SlopeScaledDepthBias = 1.0f; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.DepthClipEnable = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.MultisampleEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.AntialiasedLineEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.ForcedSampleCount = 4; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RasterizerState.ConservativeRaster = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.DepthEnable = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.DepthWriteMask = 0; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.DepthFunc = 4; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.StencilEnable = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.StencilReadMask = 0x0f; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.StencilWriteMask = 0x0f; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.FrontFace.StencilFailOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.FrontFace.StencilDepthFailOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.FrontFace.StencilPassOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.FrontFace.StencilFunc = 3; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.BackFace.StencilFailOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.BackFace.StencilDepthFailOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.BackFace.StencilPassOp = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DepthStencilState.BackFace.StencilFunc = 3; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.InputLayout.NumElements = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Normal[0] = 'M'; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].SemanticIndex = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].Format = 2; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].InputSlot = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].AlignedByteOffset = 16; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].InputSlotClass = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { s.Elements[1].InstanceDataStepRate = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.IBStripCutValue = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.PrimitiveTopologyType = 4; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.NumRenderTargets = 2; d.RTVFormats[1] = 28; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.RTVFormats[0] = 87; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.DSVFormat = 40; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.SampleDesc.Count = 4; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.SampleDesc.Quality = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.NodeMask = 1; },
+			[](BenchPipelineStateDesc& d, BenchPipelineSources& s) { d.Flags = 1; },
+		};
+
+		std::size_t unchanged = 0;
+		for(std::size_t i = 0; i < changes.size(); ++i)
+		{
+			BenchPipelineSources sources;
+			BenchPipelineStateDesc desc;
+			FillBenchPipelineDesc(desc, sources, 0x00);
+			changes[i](desc, sources);
+
+			PipelineKey key;
+			key.Write(desc, blob);
+			if(key == base || key.Hash() == base.Hash())
+				++unchanged;
+			keys.emplace(key, (int)i + 2);
+		}
+
+		const int builds = 100000;
+		std::uint64_t sum = 0;
+		auto t0 = Clock::now();
+		for(int i = 0; i < builds; ++i)
+		{
+			PipelineKey key;
+			key.Write(descA, blob);
+			sum += key.Hash();
+		}
+		auto t1 = Clock::now();
+
+		out << "PipelineKey: " << base.Data().size() << " bytes per key, built in " << std::fixed << std::setprecision(2)
+			<< std::chrono::duration<double, std::micro>(t1 - t0).count() / builds << " us; "
+			<< (deduped ? "" : "GARBAGE OR PADDING CHANGED THE KEY, ")
+			<< (rootKeyed ? "" : "ROOT SIGNATURE BLOB NOT KEYED, ") << unchanged << " of " << changes.size()
+			<< " single field changes left the key alone, " << keys.size() << " distinct keys"
+			<< (sum == builds*base.Hash() ? "" : ", KEYS UNSTABLE") << "\n";
+	}
+
+	// What the game stage of the headless frame loop hands to the render stage.
+	struct BenchFrame
+	{
+		XMFLOAT4X4 ViewProj;
+		std::vector<TerrainNode> TerrainNodes;
+		std::vector<VegetationInstance> Trees;
+		std::vector<XMFLOAT4X4> Instances;
+	};
+
+	// The demo's frame loop without the GPU: the game stage flies the camera over a large
+	// terrain and forest, streams and selects what is visible and culls a field of
+	// instances; the render stage turns that into the constants and vertices it would
+	// upload.  The same frames are run with the stages one after the other and through a
+	// FramePipeline with the render stage on a thread of its own.
+	void BenchFramePipeline(std::ostringstream& out)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+
+		TerrainDesc terrainDesc;
+		terrainDesc.HeightmapFilename = L"../../Textures/terrain.raw";
+		terrainDesc.HeightmapWidth = 257;
+		terrainDesc.HeightmapHeight = 129;
+		terrainDesc.MinX = -4096.0f;
+		terrainDesc.MinZ = -4096.0f;
+		terrainDesc.Width = 8192.0f;
+		terrainDesc.Depth = 8192.0f;
+		Terrain terrain(terrainDesc);
+
+		VegetationStreamerDesc vegetationDesc;
+		vegetationDesc.MinX = -4096.0f;
+		vegetationDesc.MinZ = -4096.0f;
+		vegetationDesc.MaxX = 4096.0f;
+		vegetationDesc.MaxZ = 4096.0f;
+		vegetationDesc.ChunkSize = 64.0f;
+		vegetationDesc.MaxChunkBuildsPerUpdate = 8;
+
+		auto buildChunk = [](float minX, float minZ, float maxX, float maxZ,
+			std::vector<VegetationInstance>& instances)
+		{
+			const int n = 16;
+			instances.resize(n*n);
+			for(int j = 0; j < n; ++j)
+			{
+				for(int i = 0; i < n; ++i)
+				{
+					VegetationInstance& inst = instances[j*n + i];
+					inst.Pos = XMFLOAT3(minX + (maxX - minX)*(i + 0.5f) / n, 8.0f, minZ + (maxZ - minZ)*(j + 0.5f) / n);
+					inst.Size = XMFLOAT2(20.0f, 20.0f);
+				}
+			}
+		};
+
+		RandomStream stream(1);
+		std::vector<XMFLOAT4X4> worlds(50000);
+		std::vector<BoundingBox> bounds(worlds.size());
+		for(std::size_t i = 0; i < worlds.size(); ++i)
+		{
+			XMFLOAT3 pos(stream.NextFloat(-3000.0f, 3000.0f), 1.0f, stream.NextFloat(-3000.0f, 3000.0f));
+			XMStoreFloat4x4(&worlds[i], XMMatrixRotationY(stream.NextFloat(0.0f, XM_2PI)) *
+				XMMatrixTranslation(pos.x, pos.y, pos.z));
+			bounds[i] = BoundingBox(pos, XMFLOAT3(1.0f, 1.0f, 1.0f));
+		}
+
+		BoundingFrustum frustumV;
+		XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f);
+		BoundingFrustum::CreateFromMatrix(frustumV, proj);
+
+		const int frameCount = 1000;
+
+		// Each run gets a streamer of its own so both start from nothing resident.
+		auto game = [&](VegetationStreamer& streamer, int frame, BenchFrame& f)
+		{
+			float t = 2.0f*MathHelper::Pi*frame / frameCount;
+			XMFLOAT3 eyePos(2500.0f*cosf(t), 20.0f, 2500.0f*sinf(t));
+
+			XMMATRIX world = XMMatrixRotationY(-t) * XMMatrixTranslation(eyePos.x, eyePos.y, eyePos.z);
+			XMMATRIX view = XMMatrixInverse(nullptr, world);
+			XMStoreFloat4x4(&f.ViewProj, XMMatrixTranspose(view*proj));
+
+			BoundingFrustum frustumW;
+			frustumV.Transform(frustumW, world);
+
+			terrain.Select(eyePos, frustumW, f.TerrainNodes);
+
+			streamer.Update(eyePos, frustumW);
+			f.Trees.clear();
+			for(VegetationLod lod : { VegetationLod::Full, VegetationLod::Billboard })
+				f.Trees.insert(f.Trees.end(), streamer.Instances(lod).begin(), streamer.Instances(lod).end());
+
+			f.Instances.clear();
+			for(std::size_t i = 0; i < worlds.size(); ++i)
+			{
+				if(frustumW.Contains(bounds[i]) != DISJOINT)
+					f.Instances.push_back(worlds[i]);
+			}
+		};
+
+		// Stands in for copying into the frame resource's upload buffers.
+		std::vector<XMFLOAT4X4> instanceUpload(worlds.size());
+		std::vector<XMFLOAT4> treeUpload;
+		std::vector<XMFLOAT4> terrainUpload;
+		double checksum = 0.0;
+		auto render = [&](const BenchFrame& f)
+		{
+			for(std::size_t i = 0; i < f.Instances.size(); ++i)
+				XMStoreFloat4x4(&instanceUpload[i], XMMatrixTranspose(XMLoadFloat4x4(&f.Instances[i])));
+
+			treeUpload.resize(f.Trees.size());
+			for(std::size_t i = 0; i < f.Trees.size(); ++i)
+			{
+				const VegetationInstance& inst = f.Trees[i];
+				treeUpload[i] = XMFLOAT4(inst.Pos.x, inst.Pos.y, inst.Pos.z, inst.Size.x);
+			}
+
+			terrainUpload.resize(f.TerrainNodes.size());
+			for(std::size_t i = 0; i < f.TerrainNodes.size(); ++i)
+			{
+				const TerrainNode& node = f.TerrainNodes[i];
+				terrainUpload[i] = XMFLOAT4(node.MinX, node.MinZ, node.Size, node.MorphEnd > node.MorphStart ?
+					1.0f / (node.MorphEnd - node.MorphStart) : 0.0f);
+			}
+
+			checksum += f.Instances.size() + f.Trees.size() + f.TerrainNodes.size() + f.ViewProj(0, 0);
+		};
+
+		double serialSeconds;
+		double serialChecksum;
+		{
+			VegetationStreamer streamer(vegetationDesc, buildChunk);
+			BenchFrame frame;
+			checksum = 0.0;
+
+			auto t0 = Clock::now();
+			for(int i = 0; i < frameCount; ++i)
+			{
+				game(streamer, i, frame);
+				render(frame);
+			}
+			serialSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+			serialChecksum = checksum;
+		}
+
+		double pipelinedSeconds;
+		{
+			VegetationStreamer streamer(vegetationDesc, buildChunk);
+			FramePipeline<BenchFrame> pipeline;
+			checksum = 0.0;
+
+			auto t0 = Clock::now();
+			std::thread renderThread([&]()
+			{
+				while(const BenchFrame* frame = pipeline.BeginRead())
+				{
+					render(*frame);
+					pipeline.EndRead();
+				}
+			});
+
+			for(int i = 0; i < frameCount; ++i)
+			{
+				BenchFrame* frame = pipeline.BeginWrite();
+				game(streamer, i, *frame);
+				pipeline.EndWrite();
+			}
+
+			pipeline.Close();
+			renderThread.join();
+			pipelinedSeconds = std::chrono::duration<double>(Clock::now() - t0).count();
+		}
+
+		out << "FramePipeline: " << frameCount << " frames on " << std::thread::hardware_concurrency()
+			<< " hardware threads, serial " << std::fixed << std::setprecision(0) << frameCount / serialSeconds
+			<< " frames/s, pipelined " << frameCount / pipelinedSeconds << " frames/s ("
+			<< std::setprecision(2) << serialSeconds / pipelinedSeconds << "x)"
+			<< (checksum == serialChecksum ? "" : ", OUTPUT DIFFERS") << "\n";
+	}
+}
+
+std::string Benchmarks::RunAll()
+{
+	std::ostringstream out;
+	gFailed = false;
+
+	BenchVegetationScatter(out);
+	BenchVegetationStreaming(out);
+	BenchHeightQueries(out);
+	BenchMazeGenerator(out);
+	BenchNavigation(out);
+	BenchCollision(out);
+	BenchRandom(out);
+	BenchGeometryAllocator(out);
+	BenchSlotMap(out);
+	BenchOcclusion(out);
+	BenchVisibilitySets(out);
+	BenchPortals(out);
+	BenchLightBaker(out);
+	BenchRayScene(out);
+	BenchShaderCache(out);
+	BenchPipelineKey(out);
+	BenchFramePipeline(out);
+
+	return out.str();
+}
+
+bool Benchmarks::Failed()
+{
+	return gFailed;
+}
+
+std::string Benchmarks::RunFramePipeline()
+{
+	std::ostringstream out;
+	BenchFramePipeline(out);
+	return out.str();
+}
@@ -0,0 +1,26 @@
+//***************************************************************************************
+// Benchmarks.h
+//
+// CPU-side benchmarks for the castle demo's systems.  They are run instead of the demo
+// when the program is started with the -bench switch, and the report is written to the
+// debugger output and to benchmarks.txt in the working directory, and the program exits
+// with 1 if a benchmark's correctness check failed.  -headless runs only the frame
+// pipeline benchmark and writes headless.txt.
+//***************************************************************************************
+
+#pragma once
+
+#include <string>
+
+namespace Benchmarks
+{
+	// Runs every benchmark and returns the report, one result per line.
+	std::string RunAll();
+
+	// Whether a check in the last RunAll() failed.  The report says which.
+	bool Failed();
+
+	// Times the demo's frame loop without a GPU, with the game and render stages run one
+	// after the other and then pipelined on two threads.
+	std::string RunFramePipeline();
+}
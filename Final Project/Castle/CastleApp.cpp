@@ -8,8 +8,42 @@
 #include "../../Common/GeometryGenerator.h"
 #include "FrameResource.h"
 #include "Waves.h"
+#include "WaveSimulation.h"
+#include "Vegetation.h"
+#include "VegetationStreamer.h"
+#include "Terrain.h"
+#include "MazeGenerator.h"
+#include "Navigation.h"
+#include "CollisionWorld.h"
+#include "OcclusionBuffer.h"
+#include "VisibilitySets.h"
+#include "PortalVisibility.h"
+#include "LightBaker.h"
+#include "RayScene.h"
+#include "ModelLoader.h"
+#include "ShaderCache.h"
+#include "ShaderPermutations.h"
+#include "PipelineCache.h"
+#include "PipelineLibrary.h"
+#include "StagingRing.h"
+#include "GeometryPool.h"
+#include "TaskGraph.h"
+#include "FramePipeline.h"
+#include "InputQueue.h"
+#include "SlotMap.h"
+#include "Benchmarks.h"
 #include "../../Common/Camera.h"
 #include <time.h>
+#include <fstream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <ppl.h>
 
 
 using Microsoft::WRL::ComPtr;
@@ -21,6 +55,13 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
+//lights set up by BuildLights, in the order the shaders expect them.  The lit
+//shaders are compiled for exactly these counts.
+const int gNumDirLights = 1;
+const int gNumPointLights = 6;
+const int gNumSpotLights = 1;
+static_assert(gNumDirLights + gNumPointLights + gNumSpotLights <= MaxLights, "too many lights for the pass constants");
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
@@ -34,14 +75,13 @@ struct RenderItem
 
 	XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 
-	// Dirty flag indicating the object data has changed and we need to update the constant buffer.
-	// Because we have an object cbuffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify obect data we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = gNumFrameResources;
+	// Set when World, TexTransform or BakedOffset change.  The game thread copies the
+	// item's object constants into the next frame's snapshot and clears it; the render
+	// thread then writes them to each frame resource in turn.
+	bool Dirty = true;
 
-	// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-	UINT ObjCBIndex = -1;
+	// Index of this render item's data in the frame resource's ObjectBuffer.
+	UINT ObjIndex = -1;
 
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
@@ -53,26 +93,84 @@ struct RenderItem
 	UINT IndexCount = 0;
 	UINT StartIndexLocation = 0;
 	int BaseVertexLocation = 0;
+
+	// Instanced render items draw all of their visible instances with one call.  Each
+	// instance has world space bounds for culling.  The visible ones go in the frame's
+	// snapshot, and from there to the frame's instance buffer.
+	std::vector<InstanceData> Instances;
+	std::vector<BoundingBox> InstanceBounds;
+
+	// World space bounds, for culling.  AddRenderItem() sets them from the bounds of the
+	// submesh drawn.
+	BoundingBox Bounds;
+
+	// The item's index in the maze's visibility sets, or of its first instance, whose
+	// others follow on.  -1 for items the sets do not cover, which are never culled by them.
+	UINT PvsIndex = -1;
+
+	// The portal zone that holds the whole item, all of its instances if it has any.
+	UINT Zone = PortalVisibility::NoZone;
+
+	// Where the item's vertices start in the baked lighting buffer.  -1 for items lit by
+	// every light as they are drawn.
+	UINT BakedOffset = -1;
 };
 
 enum class RenderLayer : int
 {
 	Opaque = 0,
+	OpaqueInstanced,
 	Transparent,
 	AlphaTested,
 	AlphaTestedTreeSprites,
+	Terrain,
 	Count
 };
 
+// Everything the render thread needs from the game thread to draw one frame.  The game
+// thread fills it in and does not touch it again until the render thread is done, so the
+// two can work on consecutive frames at the same time.
+struct FrameSnapshot
+{
+	PassConstants Pass;
+
+	// The object constants of the render items that changed since the last frame, by
+	// ObjIndex.  The render thread never reads the items' own transforms.
+	std::vector<std::pair<UINT, ObjectConstants>> DirtyObjects;
+
+	// Materials whose constants changed this frame.
+	std::vector<std::pair<Material*, XMFLOAT4X4>> MaterialTransforms;
+
+	std::vector<TerrainNode> TerrainNodes;
+	std::vector<TreeSpriteVertex> TreeSprites;
+
+	// The visible instances of each OpaqueInstanced render item, one after another, and
+	// where each item's instances go in the instance buffer and how many there are, in
+	// the order of the layer.
+	std::vector<InstanceData> Instances;
+	std::vector<std::pair<UINT, UINT>> InstanceRanges;
+
+	// The Opaque render items that are in view and not hidden behind the walls, those
+	// with baked lighting apart, as they are drawn with a PSO of their own.
+	std::vector<SlotHandle> Opaque;
+	std::vector<SlotHandle> OpaqueBaked;
+
+	// The time the waves are drawn at, on the wave simulation's clock.
+	double WaveTime = 0.0;
+};
+
 class CastleApp : public D3DApp
 {
 public:
-	CastleApp(HINSTANCE hInstance);
+	// With pipelined set, frames are drawn on a render thread while the next one is
+	// updated; otherwise Draw() draws each frame straight after its Update().
+	CastleApp(HINSTANCE hInstance, bool pipelined = true);
 	CastleApp(const CastleApp& rhs) = delete;
 	CastleApp& operator=(const CastleApp& rhs) = delete;
 	~CastleApp();
 
 	virtual bool Initialize()override;
+	virtual LRESULT MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)override;
 
 private:
 	virtual void OnResize()override;
@@ -83,40 +181,86 @@ private:
 	virtual void OnMouseUp(WPARAM btnState, int x, int y)override;
 	virtual void OnMouseMove(WPARAM btnState, int x, int y)override;
 
+	// Game thread: fill in mGameSnapshot.
+	void ConsumeInput();
+	void OnMouseDrag(WPARAM btnState, int x, int y);
+	void Pick(int x, int y);
 	void OnKeyboardInput(const GameTimer& gt);
 	void UpdateCamera(const GameTimer& gt);
 	void AnimateMaterials(const GameTimer& gt);
-	void UpdateObjectCBs(const GameTimer& gt);
-	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
-	void UpdateWaves(const GameTimer& gt);
+	void UpdateTreeSprites(const GameTimer& gt);
+	void UpdateTerrain(const GameTimer& gt);
+	void UpdateNavigation(const GameTimer& gt);
+	void RenderOcclusion();
+	void UpdatePortals();
+	void CullOpaque();
+	void UpdateInstanceData(const GameTimer& gt);
+	void UpdateObjectConstants();
+
+	// Render thread: copy mRenderSnapshot into the frame resource and draw it.
+	void RenderLoop();
+	void RenderFrame(const FrameSnapshot& snapshot);
+	void NextFrameResource();
+	void UpdateObjectData();
+	void UpdateMaterialCBs();
+	void UploadPassCB();
+	void UpdateWaves();
+	void UploadTreeSprites();
+	void UploadInstanceData();
+	void DrawFrame();
+	void StartRenderThread();
+	void StopRenderThread();
 
 	void LoadTextures();
+	void BuildTerrain();
+	void BuildPipelineCache();
 	void BuildRootSignature();
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayouts();
+	ComPtr<ID3DBlob> LoadShader(std::uint32_t program, const ShaderPermutation& permutation);
 	void BuildLandGeometry();
 	void BuildWavesGeometry();
 	void BuildShapeGeometry();
+	void BuildSkullGeometry();
 	void BuildTreeSpritesGeometry();
+	void AddGeometry(std::unique_ptr<MeshGeometry> geo, const Vertex* vertices, UINT vertexCount,
+		const std::vector<std::uint32_t>& indices);
 	void BuildPSOs();
 	void BuildFrameResources();
 	void BuildMaterials();
 
 	void BuildRenderItems();
+	SlotHandle AddRenderItem(RenderItem item, RenderLayer layer);
+	void RemoveRenderItem(SlotHandle handle);
 	void BuildWaves();
 	void BuildWalls();
+	void AddWall(const BoundingOrientedBox& bounds);
 	void BuildTowers();
 	void BuildRailings();
 	void BuildRailAndSpikes(float posX, float posY, float posZ, int dirX, int dirZ);
 	void BuildInner();
 	void BuildMaze();
-
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+	void BuildNavigation();
+	void BakeVisibility();
+	void BuildPortals();
+	void BuildLights();
+	void BakeLighting();
+	void BuildRayScene();
+	void BuildFrameGraph();
+	void BuildRenderGraph();
+
+	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems);
+	void DrawTerrain(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems);
+	void DrawInstancedRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems,
+		const std::vector<std::pair<UINT, UINT>>& ranges);
+	void SetGeometry(ID3D12GraphicsCommandList* cmdList, const RenderItem* ri);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
 	float GetHillsHeight(float x, float z)const;
+	BoundingBox GetBoxBounds(const XMFLOAT4X4& world)const;
+	BoundingOrientedBox GetBoxOrientedBounds(const XMFLOAT4X4& world)const;
 	XMFLOAT3 GetHillsNormal(float x, float z)const;
 
 private:
@@ -132,24 +276,167 @@ private:
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
+	std::unique_ptr<StagingRing> mStaging;
+	std::unique_ptr<GeometryPool> mGeometryPool;
+
+	//guards the staging ring, geometry pool, mGeometries and mTextures while the startup
+	//tasks run side by side.
+	std::mutex mLoadMutex;
+
+	//time-to-first-frame is measured from the start of Initialize to the first Present.
+	std::chrono::high_resolution_clock::time_point mStartTime;
+	bool mFirstFrameDone = false;
+
+	//the per-frame updates, ordered by the data each one reads and writes.
+	std::unique_ptr<TaskGraph> mFrameGraph;
+	std::wstring mBaseCaption;
+	float mFrameGraphReportTime = 0.0f;
+
+	//the game thread fills mGameSnapshot while the render thread draws mRenderSnapshot.
+	bool mPipelined = true;
+	FramePipeline<FrameSnapshot> mFramePipeline;
+	FrameSnapshot* mGameSnapshot = nullptr;
+	const FrameSnapshot* mRenderSnapshot = nullptr;
+	std::unique_ptr<TaskGraph> mRenderGraph;
+	std::thread mRenderThread;
+	std::exception_ptr mRenderException;
+	std::atomic<float> mRenderMs{ 0.0f };
+	std::chrono::high_resolution_clock::time_point mRenderReportTime;
+
+	//render thread: the latest constants of each object slot, how many frame resources
+	//still need them written, and the slots that have any left.
+	std::vector<ObjectConstants> mObjectConstants;
+	std::vector<int> mObjectFramesDirty;
+	std::vector<UINT> mDirtyObjects;
+
+	//object data written since the last render report.
+	std::uint64_t mObjectsWritten = 0;
+	UINT mObjectDataFrames = 0;
+
+	//the water's texture transform as the game thread animates it.
+	XMFLOAT4X4 mWaterTransform = MathHelper::Identity4x4();
+
+	//update jobs that run on worker threads draw from streams of their own, so the
+	//numbers they get don't depend on which thread picks them up.
+	RandomStream mNavRandom;
+
+	//what is bound to the input assembler, so draws that share it skip setting it again.
+	D3D12_GPU_VIRTUAL_ADDRESS mBoundVertexBuffer = 0;
+	D3D12_GPU_VIRTUAL_ADDRESS mBoundIndexBuffer = 0;
+	D3D12_PRIMITIVE_TOPOLOGY mBoundTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
+	std::unique_ptr<ShaderCache> mShaderCache;
+	std::unique_ptr<ShaderPermutations> mShaderPermutations;
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
+	std::unique_ptr<PipelineLibrary> mPipelineLibrary;
+	std::unique_ptr<PipelineCache> mPipelineCache;
 
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mStdInputLayout;
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mTreeSpriteInputLayout;
 
-	RenderItem* mWavesRitem = nullptr;
+	SlotHandle mWavesRitem;
+	SlotHandle mTreeSpritesRitem;
 
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+	// All the render items, packed together.  Each one's slot index is its ObjIndex.
+	SlotMap<RenderItem> mRenderItems;
 
-	// Render items divided by PSO.
-	std::vector<RenderItem*> mRitemLayer[(int)RenderLayer::Count];
+	// Render items divided by PSO, each layer sorted by slot index (see InsertHandle()).
+	std::vector<SlotHandle> mRitemLayer[(int)RenderLayer::Count];
 
 	std::unique_ptr<Waves> mWaves;
 
+	//steps mWaves on its own thread; declared after it so it stops first.
+	std::unique_ptr<WaveSimulation> mWaveSim;
+
+	// Trees are streamed in by chunk around the camera.  The per-frame tree sprite VB
+	// holds at most mMaxTreeSprites visible trees.
+	std::unique_ptr<VegetationStreamer> mVegetation;
+	std::uint32_t mTreeSeed = 0;
+	std::uint32_t mMazeSeed = 0;
+
+	// World space bounds of every maze wall, for navigation and collision.
+	std::vector<BoundingBox> mMazeWallBounds;
+
+	// Walls the camera slides along instead of flying through.  The radius keeps the near
+	// plane, whose corners are about 1.3 from the eye, out of the walls.
+	std::unique_ptr<CollisionWorld> mCollision;
+	float mCameraRadius = 1.5f;
+
+	// The walls drawn into a small depth buffer on the CPU each frame, so whatever they
+	// hide is not drawn.  The counts cover the frames since the last report.
+	std::unique_ptr<OcclusionBuffer> mOcclusion;
+	std::vector<SlotHandle> mOpaqueInView;
+	std::vector<BoundingBox> mOpaqueBounds;
+	std::vector<std::uint8_t> mOpaqueVisible;
+	double mOcclusionMs = 0.0;
+	UINT mOcclusionFrames = 0;
+	std::atomic<std::uint64_t> mOcclusionTested{ 0 };
+	std::atomic<std::uint64_t> mOcclusionCulled{ 0 };
+
+	// What can be seen from each part of the maze, baked at startup from the walls.  Items
+	// left out of the set of the camera's cell are skipped before any other test.
+	std::unique_ptr<VisibilitySets> mVisibility;
+	std::vector<BoundingOrientedBox> mCastleWallBounds;
+	XMFLOAT2 mMazeMin = { 0.0f, 0.0f };
+	XMFLOAT2 mMazeMax = { 0.0f, 0.0f };
+	float mMazeWallHeight = 0.0f;
+	SlotHandle mMazeWallsRitem;
+	std::atomic<std::uint64_t> mPvsCulled{ 0 };
+
+	// CPU copies of the meshes added to the geometry pool, and where in it they went.
+	struct StaticMesh
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<std::uint32_t> Indices;
+		INT BaseVertexLocation = 0;
+		UINT StartIndexLocation = 0;
+	};
+	std::unordered_map<const MeshGeometry*, StaticMesh> mStaticMeshes;
+	const StaticMesh* FindStaticSubmesh(const RenderItem& ri, INT& baseVertex, UINT& firstIndex, UINT& vertexCount)const;
+
+	// The Opaque items and the maze walls as triangles for rays to hit, for picking and
+	// anything else that asks what a ray runs into.  Each ray scene instance is an item,
+	// or one instance of an instanced item.
+	struct RayTarget
+	{
+		SlotHandle Item;
+		UINT Instance = -1;
+	};
+	std::unique_ptr<RayScene> mRayScene;
+	std::vector<RayTarget> mRayTargets;
+
+	// The point and spot lights and the ambient occlusion on the Opaque items, per
+	// vertex, baked at startup.  None of them move, so it holds for as long as they last.
+	ComPtr<ID3D12Resource> mBakedLighting;
+
+	// The courtyard and the maze as zones of their own, seen into from outside only through
+	// the gate, the maze's openings and their open tops.
+	std::unique_ptr<PortalVisibility> mPortals;
+	double mPortalMicros = 0.0;
+	std::atomic<std::uint64_t> mPortalCulled{ 0 };
+
+	// Agents walking through the maze from the entrance to the goal on a shared flow field.
+	struct NavAgent
+	{
+		XMFLOAT2 Pos;
+		float Speed;
+	};
+
+	std::unique_ptr<NavGrid> mNavGrid;
+	std::unique_ptr<NavFlowFieldCache> mFlowFields;
+	std::vector<NavAgent> mNavAgents;
+	std::vector<XMFLOAT2> mNavAgentPositions;
+	std::vector<float> mNavAgentHeights;
+	SlotHandle mNavAgentsRitem;
+	XMFLOAT2 mNavEntrance = { 165.0f, 0.0f };
+	XMFLOAT2 mNavGoal = { 300.0f, 0.0f };
+	UINT mMaxTreeSprites = 16384;
+
+	// Ground heightmap.  The nodes to draw are picked into each frame's snapshot.
+	std::unique_ptr<Terrain> mTerrain;
+
 	PassConstants mMainPassCB;
 
 	//My eye position
@@ -162,11 +449,15 @@ private:
 	float mRadius = 50.0f;
 
 	Camera mCamera;
-
+	BoundingFrustum mCamFrustum;
+	BoundingFrustum mWorldFrustum;
+
+	//the window procedure only queues input; the update applies it.
+	InputQueue mInput;
+	std::vector<InputEvent> mInputBatch;
+	InputLatency mInputLatency;
+	bool mKeyDown[256] = {};
 	POINT mLastMousePos;
-
-	//new counter, incremented for each new primitive obj
-	UINT objCBIndex = 0;
 };
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
@@ -177,9 +468,45 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	// -bench runs the CPU benchmarks instead of the demo.
+	if (cmdLine != nullptr && strstr(cmdLine, "-bench") != nullptr)
+	{
+		std::string report = Benchmarks::RunAll();
+		OutputDebugStringA(report.c_str());
+
+		std::ofstream fout("benchmarks.txt");
+		fout << report;
+		return Benchmarks::Failed() ? 1 : 0;
+	}
+
+	// -headless only measures how much the game/render pipeline gains over running the two
+	// stages one after the other.
+	if (cmdLine != nullptr && strstr(cmdLine, "-headless") != nullptr)
+	{
+		std::string report = Benchmarks::RunFramePipeline();
+		OutputDebugStringA(report.c_str());
+
+		std::ofstream fout("headless.txt");
+		fout << report;
+		return 0;
+	}
+
+	// -serial draws each frame on the main thread straight after updating it.
+	const bool pipelined = cmdLine == nullptr || strstr(cmdLine, "-serial") == nullptr;
+
+	// Each run gets a fresh castle unless -seed <n> asks for a particular one.  The seed is
+	// logged so a run can be repeated.
+	std::uint64_t seed = (std::uint64_t)time(NULL);
+	const char* seedArg = cmdLine != nullptr ? strstr(cmdLine, "-seed ") : nullptr;
+	if (seedArg != nullptr)
+		seed = _strtoui64(seedArg + 6, nullptr, 10);
+
+	MathHelper::SeedRand(seed);
+	OutputDebugStringA(("Seed: " + std::to_string(seed) + "\n").c_str());
+
 	try
 	{
-		CastleApp theApp(hInstance);
+		CastleApp theApp(hInstance, pipelined);
 		if (!theApp.Initialize())
 			return 0;
 
@@ -192,19 +519,23 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 	}
 }
 
-CastleApp::CastleApp(HINSTANCE hInstance)
-	: D3DApp(hInstance)
+CastleApp::CastleApp(HINSTANCE hInstance, bool pipelined)
+	: D3DApp(hInstance), mPipelined(pipelined)
 {
 }
 
 CastleApp::~CastleApp()
 {
+	StopRenderThread();
+
 	if (md3dDevice != nullptr)
 		FlushCommandQueue();
 }
 
 bool CastleApp::Initialize()
 {
+	mStartTime = std::chrono::high_resolution_clock::now();
+
 	if (!D3DApp::Initialize())
 		return false;
 
@@ -215,23 +546,59 @@ bool CastleApp::Initialize()
 	// so we have to query this information.
 	mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
+	//static vertex, index and heightmap data all goes up through one upload heap instead of
+	//one upload buffer each.
+	mStaging = std::make_unique<StagingRing>(md3dDevice.Get(), 8 * 1024 * 1024);
+
+	//static meshes share one vertex and one index buffer, so most draws keep them bound.
+	mGeometryPool = std::make_unique<GeometryPool>(md3dDevice.Get(), *mStaging, (UINT)sizeof(Vertex),
+		128 * 1024, 1024 * 1024);
+
 	mCamera.SetPosition(350.0f, 2.0f, 0.0f);
 
 	mWaves = std::make_unique<Waves>(128, 128, 1.0f, 0.03f, 4.0f, 0.2f);
-	srand(time(NULL));
-
-	LoadTextures();
-	BuildRootSignature();
-	BuildDescriptorHeaps();
-	BuildShadersAndInputLayouts();
-	BuildLandGeometry();
-	BuildWavesGeometry();
-	BuildShapeGeometry();
-	BuildTreeSpritesGeometry();
-	BuildMaterials();
-	BuildRenderItems();
-	BuildFrameResources();
-	BuildPSOs();
+
+	//drawn here so the trees come out the same whichever thread builds them.
+	mTreeSeed = MathHelper::RandStream().NextU32();
+
+	//the lights never change, and the baker needs them before the first frame.
+	BuildLights();
+
+	//the startup steps run as soon as what they need is built.  LoadTextures records on
+	//mCommandList and BuildRenderItems draws from this thread's random stream, so both
+	//stay on this thread.
+	TaskGraph startup;
+	auto loadTextures = startup.Add("LoadTextures", [this]() { LoadTextures(); }, {}, true);
+	auto terrain = startup.Add("BuildTerrain", [this]() { BuildTerrain(); });
+	auto pipelineCache = startup.Add("BuildPipelineCache", [this]() { BuildPipelineCache(); });
+	auto rootSignature = startup.Add("BuildRootSignature", [this]() { BuildRootSignature(); }, { pipelineCache });
+	auto descriptorHeaps = startup.Add("BuildDescriptorHeaps", [this]() { BuildDescriptorHeaps(); }, { loadTextures, terrain });
+	auto shaders = startup.Add("BuildShadersAndInputLayouts", [this]() { BuildShadersAndInputLayouts(); });
+	auto land = startup.Add("BuildLandGeometry", [this]() { BuildLandGeometry(); }, { terrain });
+	auto waves = startup.Add("BuildWavesGeometry", [this]() { BuildWavesGeometry(); });
+	auto shapes = startup.Add("BuildShapeGeometry", [this]() { BuildShapeGeometry(); });
+	auto skull = startup.Add("BuildSkullGeometry", [this]() { BuildSkullGeometry(); });
+	auto treeSprites = startup.Add("BuildTreeSpritesGeometry", [this]() { BuildTreeSpritesGeometry(); }, { terrain });
+	auto materials = startup.Add("BuildMaterials", [this]() { BuildMaterials(); });
+	auto renderItems = startup.Add("BuildRenderItems", [this]() { BuildRenderItems(); },
+		{ land, waves, shapes, skull, treeSprites, materials }, true);
+	startup.Add("BuildFrameResources", [this]() { BuildFrameResources(); }, { renderItems });
+	startup.Add("BakeVisibility", [this]() { BakeVisibility(); }, { renderItems });
+	startup.Add("BakeLighting", [this]() { BakeLighting(); }, { renderItems });
+	startup.Add("BuildRayScene", [this]() { BuildRayScene(); }, { renderItems });
+	startup.Add("BuildPSOs", [this]() { BuildPSOs(); }, { rootSignature, shaders });
+	startup.Run();
+
+	OutputDebugStringA(startup.Report("Startup").c_str());
+
+	mNavRandom = MathHelper::RandStream().Split();
+	mBaseCaption = mMainWndCaption;
+	mWaterTransform = mMaterials["water"]->MatTransform;
+	BuildFrameGraph();
+	BuildRenderGraph();
+
+	//FlushCommandQueue signals the next fence value.
+	mStaging->Flush(mCommandList.Get(), mCurrentFence + 1);
 
 	// Execute the initialization commands.
 	ThrowIfFailed(mCommandList->Close());
@@ -241,24 +608,103 @@ bool CastleApp::Initialize()
 	// Wait until initialization is complete.
 	FlushCommandQueue();
 
+	//the copies are done, so the staging memory can go.
+	mStaging->Reclaim(mFence->GetCompletedValue());
+	for (auto& e : mTextures)
+		e.second->UploadHeap = nullptr;
+
+	std::ostringstream log;
+	log << "Staging: " << mStaging->Uploads() << " uploads in " << mStaging->Copies() << " copies, peak "
+		<< mStaging->PeakBytes() / 1024 << " KB of " << mStaging->Capacity() / 1024 << " KB, "
+		<< mStaging->Overflows() << " overflowed\n";
+	log << "Geometry pool: " << mGeometryPool->VertexCount() << " of " << mGeometryPool->VertexCapacity()
+		<< " vertices, " << mGeometryPool->IndexCount() << " of " << mGeometryPool->IndexCapacity() << " indices\n";
+	OutputDebugStringA(log.str().c_str());
+
+	//the water now runs at its own rate, apart from the frame rate.
+	mWaveSim = std::make_unique<WaveSimulation>(*mWaves, MathHelper::RandStream().Split());
+	mWaveSim->Start();
+
+	StartRenderThread();
+
 	return true;
 }
 
 void CastleApp::OnResize()
 {
+	//the render thread uses the swap chain buffers, so it has to be stopped while they
+	//are recreated.
+	StopRenderThread();
+
 	D3DApp::OnResize();
 
 	mCamera.SetLens(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
+	BoundingFrustum::CreateFromMatrix(mCamFrustum, mCamera.GetProj());
 	// The window resized, so update the aspect ratio and recompute the projection matrix.
 	XMMATRIX P = XMMatrixPerspectiveFovLH(0.25f*MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
 	XMStoreFloat4x4(&mProj, P);
+
+	StartRenderThread();
 }
 
 void CastleApp::Update(const GameTimer& gt)
 {
-	OnKeyboardInput(gt);
-	UpdateCamera(gt);
+	//waits while the render thread is a full pipeline behind.  There is no slot once the
+	//render thread has stopped on an error, which is then passed on from here.
+	mGameSnapshot = mFramePipeline.BeginWrite();
+	if (mGameSnapshot == nullptr)
+	{
+		if (mRenderException)
+			std::rethrow_exception(mRenderException);
+		return;
+	}
 
+	mGameSnapshot->WaveTime = mWaveSim->Now();
+	mFrameGraph->Run();
+
+	mFramePipeline.EndWrite();
+	mGameSnapshot = nullptr;
+
+	//the critical path is as short as this frame's update can get however many threads run
+	//it; the rest of the total is waiting for a thread or for the GPU.
+	std::wostringstream caption;
+	caption << mBaseCaption << std::fixed << std::setprecision(2) << L"    update: " << mFrameGraph->TotalMs()
+		<< L" ms   critical path: " << mFrameGraph->CriticalPathMs() << L" ms   render: "
+		<< mRenderMs.load() << L" ms   waves: " << mWaveSim->StepMs() << L" ms/step   input: "
+		<< mInputLatency.AverageMs() << L" ms avg, " << mInputLatency.MaxMs() << L" ms max";
+	mMainWndCaption = caption.str();
+
+	if (gt.TotalTime() - mFrameGraphReportTime >= 1.0f)
+	{
+		mFrameGraphReportTime = gt.TotalTime();
+		mInputLatency.EndWindow();
+
+		std::ostringstream log;
+		log << mFrameGraph->Report("Update") << std::fixed << std::setprecision(2) << "Input: "
+			<< mInputLatency.Events() << " events, " << mInputLatency.AverageMs() << " ms avg, "
+			<< mInputLatency.MaxMs() << " ms max wait, " << mInput.Dropped() << " dropped in total\n";
+
+		const UINT frames = MathHelper::Max(1u, mOcclusionFrames);
+		const std::uint64_t tested = mOcclusionTested.exchange(0);
+		const std::uint64_t culled = mOcclusionCulled.exchange(0);
+		log << "Occlusion: " << mOcclusion->LastOccludersDrawn() << " of " << mOcclusion->OccluderCount()
+			<< " walls drawn (" << mOcclusion->LastTrianglesDrawn() << " triangles) in " << mOcclusionMs / frames
+			<< " ms, " << (double)culled / frames << " of " << (double)tested / frames << " items in view culled, "
+			<< (double)mPvsCulled.exchange(0) / frames << " items culled by the visibility sets\n";
+		log << "Portals: " << mPortals->LastZonesReached() << " of " << mPortals->ZoneCount() << " zones reached through "
+			<< mPortals->LastViews() << " frustums in " << mPortalMicros / frames << " us, "
+			<< (double)mPortalCulled.exchange(0) / frames << " items culled\n";
+		OutputDebugStringA(log.str().c_str());
+
+		mOcclusionMs = 0.0;
+		mPortalMicros = 0.0;
+		mOcclusionFrames = 0;
+	}
+}
+
+// Moves on to the next frame resource, waiting until the GPU is done with it.
+void CastleApp::NextFrameResource()
+{
 	// Cycle through the circular frame resource array.
 	mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
 	mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
@@ -272,15 +718,94 @@ void CastleApp::Update(const GameTimer& gt)
 		WaitForSingleObject(eventHandle, INFINITE);
 		CloseHandle(eventHandle);
 	}
-
-	AnimateMaterials(gt);
-	UpdateObjectCBs(gt);
-	UpdateMaterialCBs(gt);
-	UpdateMainPassCB(gt);
-	UpdateWaves(gt);
 }
 
 void CastleApp::Draw(const GameTimer& gt)
+{
+	//with the render thread running, frames are drawn there.
+	if (mPipelined)
+		return;
+
+	const FrameSnapshot* snapshot = mFramePipeline.BeginRead();
+	if (snapshot == nullptr)
+		return;
+
+	RenderFrame(*snapshot);
+	mFramePipeline.EndRead();
+}
+
+// Takes frames from the game thread and draws them until the pipeline is closed.
+void CastleApp::RenderLoop()
+{
+	try
+	{
+		while (const FrameSnapshot* snapshot = mFramePipeline.BeginRead())
+		{
+			RenderFrame(*snapshot);
+			mFramePipeline.EndRead();
+		}
+	}
+	catch (...)
+	{
+		//closing the pipeline stops Update() waiting on this thread; it rethrows.
+		mRenderException = std::current_exception();
+		mFramePipeline.Close();
+	}
+}
+
+void CastleApp::RenderFrame(const FrameSnapshot& snapshot)
+{
+	mRenderSnapshot = &snapshot;
+	mRenderGraph->Run();
+	mRenderSnapshot = nullptr;
+
+	mRenderMs = (float)mRenderGraph->TotalMs();
+
+	auto now = std::chrono::high_resolution_clock::now();
+	if (now - mRenderReportTime >= std::chrono::seconds(1))
+	{
+		mRenderReportTime = now;
+
+		//the same items as 256-byte constant buffer elements would have spread the writes
+		//over twice the memory.
+		const double perFrame = mObjectDataFrames > 0 ? (double)mObjectsWritten / mObjectDataFrames : 0.0;
+		const UINT64 slots = mRenderItems.SlotCount();
+		std::ostringstream log;
+		log << mRenderGraph->Report("Render") << std::fixed << std::setprecision(1) << "Object data: "
+			<< perFrame << " items, " << perFrame*sizeof(ObjectConstants) << " bytes written per frame, buffer "
+			<< slots*sizeof(ObjectConstants) / 1024.0 << " KB (was "
+			<< slots*d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants)) / 1024.0 << " KB as constant buffers)\n";
+		OutputDebugStringA(log.str().c_str());
+
+		mObjectsWritten = 0;
+		mObjectDataFrames = 0;
+	}
+}
+
+void CastleApp::StartRenderThread()
+{
+	//OnResize() runs before the render graph is built, and again once it is running.
+	if (!mPipelined || mRenderGraph == nullptr || mRenderThread.joinable() || mRenderException)
+		return;
+
+	mRenderThread = std::thread([this]() { RenderLoop(); });
+}
+
+// Lets the render thread draw what the game thread has already handed over, then stops it.
+void CastleApp::StopRenderThread()
+{
+	if (!mRenderThread.joinable())
+		return;
+
+	mFramePipeline.Close();
+	mRenderThread.join();
+
+	//a render thread that stopped on an error leaves the pipeline closed for Update().
+	if (!mRenderException)
+		mFramePipeline.Reopen();
+}
+
+void CastleApp::DrawFrame()
 {
 	auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
 
@@ -292,6 +817,11 @@ void CastleApp::Draw(const GameTimer& gt)
 	// Reusing the command list reuses memory.
 	ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
 
+	//a reset command list has nothing bound.
+	mBoundVertexBuffer = 0;
+	mBoundIndexBuffer = 0;
+	mBoundTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
 	mCommandList->RSSetViewports(1, &mScreenViewport);
 	mCommandList->RSSetScissorRects(1, &mScissorRect);
 
@@ -300,7 +830,7 @@ void CastleApp::Draw(const GameTimer& gt)
 		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
 
 	// Clear the back buffer and depth buffer.
-	mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mMainPassCB.FogColor, 0, nullptr);
+	mCommandList->ClearRenderTargetView(CurrentBackBufferView(), (float*)&mRenderSnapshot->Pass.FogColor, 0, nullptr);
 	mCommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
 
 	// Specify the buffers we are going to render to.
@@ -314,7 +844,23 @@ void CastleApp::Draw(const GameTimer& gt)
 	auto passCB = mCurrFrameResource->PassCB->Resource();
 	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
 
-	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Opaque]);
+	auto objectBuffer = mCurrFrameResource->ObjectBuffer->Resource();
+	mCommandList->SetGraphicsRootShaderResourceView(7, objectBuffer->GetGPUVirtualAddress());
+
+	if (mBakedLighting)
+		mCommandList->SetGraphicsRootShaderResourceView(8, mBakedLighting->GetGPUVirtualAddress());
+
+	DrawRenderItems(mCommandList.Get(), mRenderSnapshot->Opaque);
+
+	mCommandList->SetPipelineState(mPSOs["opaqueBaked"].Get());
+	DrawRenderItems(mCommandList.Get(), mRenderSnapshot->OpaqueBaked);
+
+	mCommandList->SetPipelineState(mPSOs["opaqueInstanced"].Get());
+	DrawInstancedRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::OpaqueInstanced],
+		mRenderSnapshot->InstanceRanges);
+
+	mCommandList->SetPipelineState(mPSOs["terrain"].Get());
+	DrawTerrain(mCommandList.Get(), mRitemLayer[(int)RenderLayer::Terrain]);
 
 	mCommandList->SetPipelineState(mPSOs["alphaTested"].Get());
 	DrawRenderItems(mCommandList.Get(), mRitemLayer[(int)RenderLayer::AlphaTested]);
@@ -340,6 +886,13 @@ void CastleApp::Draw(const GameTimer& gt)
 	ThrowIfFailed(mSwapChain->Present(0, 0));
 	mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
 
+	if (!mFirstFrameDone)
+	{
+		mFirstFrameDone = true;
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - mStartTime).count();
+		OutputDebugStringA(("Time to first frame: " + std::to_string(ms) + " ms\n").c_str());
+	}
+
 	// Advance the fence value to mark commands up to this fence point.
 	mCurrFrameResource->Fence = ++mCurrentFence;
 
@@ -349,20 +902,108 @@ void CastleApp::Draw(const GameTimer& gt)
 	mCommandQueue->Signal(mFence.Get(), mCurrentFence);
 }
 
-void CastleApp::OnMouseDown(WPARAM btnState, int x, int y)
+LRESULT CastleApp::MsgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
-	mLastMousePos.x = x;
-	mLastMousePos.y = y;
+	InputEvent e;
+	switch (msg)
+	{
+	case WM_KEYDOWN:
+	case WM_KEYUP:
+		e.Type = msg == WM_KEYDOWN ? InputEventType::KeyDown : InputEventType::KeyUp;
+		e.Key = (std::uint32_t)wParam;
+
+		//both shift keys come as VK_SHIFT; the scan code tells them apart.
+		if (wParam == VK_SHIFT)
+			e.Key = MapVirtualKey((lParam >> 16) & 0xff, MAPVK_VSC_TO_VK_EX);
+
+		mInput.Push(e);
+		break;
+
+	case WM_ACTIVATE:
+		if (LOWORD(wParam) == WA_INACTIVE)
+		{
+			e.Type = InputEventType::FocusLost;
+			mInput.Push(e);
+		}
+		break;
+	}
+
+	return D3DApp::MsgProc(hwnd, msg, wParam, lParam);
+}
 
+void CastleApp::OnMouseDown(WPARAM btnState, int x, int y)
+{
 	SetCapture(mhMainWnd);
+
+	InputEvent e;
+	e.Type = InputEventType::MouseDown;
+	e.Key = (std::uint32_t)btnState;
+	e.X = x;
+	e.Y = y;
+	mInput.Push(e);
 }
 
 void CastleApp::OnMouseUp(WPARAM btnState, int x, int y)
 {
 	ReleaseCapture();
+
+	InputEvent e;
+	e.Type = InputEventType::MouseUp;
+	e.Key = (std::uint32_t)btnState;
+	e.X = x;
+	e.Y = y;
+	mInput.Push(e);
 }
 
 void CastleApp::OnMouseMove(WPARAM btnState, int x, int y)
+{
+	InputEvent e;
+	e.Type = InputEventType::MouseMove;
+	e.Key = (std::uint32_t)btnState;
+	e.X = x;
+	e.Y = y;
+	mInput.Push(e);
+}
+
+// Applies the input queued since the last frame, in the order it happened.
+void CastleApp::ConsumeInput()
+{
+	mInputBatch.clear();
+	mInput.PopAll(mInputBatch);
+	mInputLatency.Record(mInputBatch, InputEvent::Clock::now());
+
+	for (const InputEvent& e : mInputBatch)
+	{
+		switch (e.Type)
+		{
+		case InputEventType::KeyDown:
+		case InputEventType::KeyUp:
+			if (e.Key < 256)
+				mKeyDown[e.Key] = e.Type == InputEventType::KeyDown;
+			break;
+
+		case InputEventType::FocusLost:
+			std::fill(std::begin(mKeyDown), std::end(mKeyDown), false);
+			break;
+
+		case InputEventType::MouseDown:
+			mLastMousePos.x = e.X;
+			mLastMousePos.y = e.Y;
+			if ((e.Key & MK_RBUTTON) != 0)
+				Pick(e.X, e.Y);
+			break;
+
+		case InputEventType::MouseMove:
+			OnMouseDrag(e.Key, e.X, e.Y);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+void CastleApp::OnMouseDrag(WPARAM btnState, int x, int y)
 {
 	if ((btnState & MK_LBUTTON) != 0)
 	{
@@ -397,29 +1038,77 @@ void CastleApp::OnMouseMove(WPARAM btnState, int x, int y)
 	mLastMousePos.y = y;
 }
 
+// Casts a ray from the eye through the pixel at (x, y) and reports the nearest triangle
+// of the Opaque items and maze walls it hits.
+void CastleApp::Pick(int x, int y)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	//the ray's direction has a view space z of 1, so distances along it are depths.
+	XMFLOAT4X4 P = mCamera.GetProj4x4f();
+	float vx = (+2.0f*x / mClientWidth - 1.0f) / P(0, 0);
+	float vy = (-2.0f*y / mClientHeight + 1.0f) / P(1, 1);
+
+	XMMATRIX view = mCamera.GetView();
+	XMVECTOR det = XMMatrixDeterminant(view);
+	XMMATRIX invView = XMMatrixInverse(&det, view);
+
+	SceneRay ray;
+	XMStoreFloat3(&ray.Origin, XMVector3TransformCoord(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), invView));
+	XMStoreFloat3(&ray.Direction, XMVector3TransformNormal(XMVectorSet(vx, vy, 1.0f, 0.0f), invView));
+	ray.MaxDistance = 1000.0f;
+
+	SceneHit hit;
+	const bool found = mRayScene->Intersect(ray, hit);
+	double micros = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	std::ostringstream log;
+	log << std::fixed << std::setprecision(1);
+	if (!found)
+	{
+		log << "Picked nothing (" << micros << " us)\n";
+	}
+	else
+	{
+		const RayTarget& target = mRayTargets[hit.Instance];
+		const RenderItem& ri = mRenderItems[target.Item];
+		log << "Picked " << ri.Geo->Name << " item " << ri.ObjIndex;
+		if (target.Instance != (UINT)-1)
+			log << " instance " << target.Instance;
+		log << ", triangle " << hit.Triangle << " at depth " << hit.Distance << " (" << micros << " us)\n";
+	}
+	OutputDebugStringA(log.str().c_str());
+}
+
 void CastleApp::OnKeyboardInput(const GameTimer& gt)
 {
 	const float dt = gt.DeltaTime();
+	const XMFLOAT3 oldPos = mCamera.GetPosition3f();
 
 	//WASD for movement, Space/Shift for vert movement
-	if (GetAsyncKeyState('W') & 0x8000)
+	if (mKeyDown['W'])
 		mCamera.Walk(40.0f*dt);
 
-	if (GetAsyncKeyState('S') & 0x8000)
+	if (mKeyDown['S'])
 		mCamera.Walk(-40.0f*dt);
 
-	if (GetAsyncKeyState('A') & 0x8000)
+	if (mKeyDown['A'])
 		mCamera.Strafe(-40.0f*dt);
 
-	if (GetAsyncKeyState('D') & 0x8000)
+	if (mKeyDown['D'])
 		mCamera.Strafe(40.0f*dt);
 
-	if (GetAsyncKeyState(VK_SPACE) & 0x8000)
+	if (mKeyDown[VK_SPACE])
 		mCamera.Rise(40.0f*dt);
 
-	if (GetAsyncKeyState(VK_LSHIFT) & 0x8000)
+	if (mKeyDown[VK_LSHIFT])
 		mCamera.Lower(40.0f*dt);
 
+	//replay the move against the walls so the camera slides along them.
+	XMFLOAT3 newPos = mCamera.GetPosition3f();
+	XMFLOAT3 move(newPos.x - oldPos.x, newPos.y - oldPos.y, newPos.z - oldPos.z);
+	mCamera.SetPosition(mCollision->MoveSphere(oldPos, mCameraRadius, move));
+
 	mCamera.UpdateViewMatrix();
 }
 
@@ -438,16 +1127,22 @@ void CastleApp::UpdateCamera(const GameTimer& gt)
 
 	XMMATRIX view = XMMatrixLookAtLH(pos, target, up);
 	XMStoreFloat4x4(&mView, view);
+
+	// World space view frustum used for culling.
+	XMMATRIX camView = mCamera.GetView();
+	XMMATRIX invCamView = XMMatrixInverse(&XMMatrixDeterminant(camView), camView);
+	mCamFrustum.Transform(mWorldFrustum, invCamView);
 }
 
 void CastleApp::AnimateMaterials(const GameTimer& gt)
 {
-	// Scroll the water material texture coordinates.
-	auto waterMat = mMaterials["water"].get();
+	// Scroll the water material texture coordinates.  The material itself belongs to the
+	// render thread, which picks the new transform up from the snapshot.
+	Material* waterMat = mMaterials.at("water").get();
 
 	//tiling u & v
-	float& tu = waterMat->MatTransform(3, 0);
-	float& tv = waterMat->MatTransform(3, 1);
+	float& tu = mWaterTransform(3, 0);
+	float& tv = mWaterTransform(3, 1);
 
 	tu += 0.1f * gt.DeltaTime();
 	tv += 0.02f * gt.DeltaTime();
@@ -458,39 +1153,61 @@ void CastleApp::AnimateMaterials(const GameTimer& gt)
 	if(tv >= 1.0f)
 		tv -= 1.0f;
 
-	waterMat->MatTransform(3, 0) = tu;
-	waterMat->MatTransform(3, 1) = tv;
-
-	// Material has changed, so need to update cbuffer.
-	waterMat->NumFramesDirty = gNumFrameResources;
+	mGameSnapshot->MaterialTransforms.clear();
+	mGameSnapshot->MaterialTransforms.push_back({ waterMat, mWaterTransform });
 }
 
-void CastleApp::UpdateObjectCBs(const GameTimer& gt)
+// Writes the object constants that changed to the frame's object buffer, a range of
+// objects per task.  Each is written once to every frame resource, as the snapshot holds
+// only what changed since the last frame.  The buffer is dense, so only the
+// sizeof(ObjectConstants) bytes each object uses are written and touched.
+void CastleApp::UpdateObjectData()
 {
-	auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-	for (auto& e : mAllRitems)
+	for (const auto& e : mRenderSnapshot->DirtyObjects)
 	{
-		// Only update the cbuffer data if the constants have changed.  
-		// This needs to be tracked per frame resource.
-		if (e->NumFramesDirty > 0)
-		{
-			XMMATRIX world = XMLoadFloat4x4(&e->World);
-			XMMATRIX texTransform = XMLoadFloat4x4(&e->TexTransform);
+		if (mObjectFramesDirty[e.first] == 0)
+			mDirtyObjects.push_back(e.first);
+		mObjectConstants[e.first] = e.second;
+		mObjectFramesDirty[e.first] = gNumFrameResources;
+	}
+
+	const size_t itemsPerTask = 256;
+	const size_t count = mDirtyObjects.size();
+	const size_t taskCount = (count + itemsPerTask - 1) / itemsPerTask;
 
-			ObjectConstants objConstants;
-			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
-			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+	auto currObjectBuffer = mCurrFrameResource->ObjectBuffer.get();
 
-			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
+	concurrency::parallel_for(size_t(0), taskCount, [&](size_t task)
+	{
+		const size_t first = task*itemsPerTask;
+		const size_t last = MathHelper::Min(count, first + itemsPerTask);
+		for (size_t i = first; i < last; ++i)
+		{
+			const UINT index = mDirtyObjects[i];
+			currObjectBuffer->CopyData(index, mObjectConstants[index]);
 
 			// Next FrameResource need to be updated too.
-			e->NumFramesDirty--;
+			mObjectFramesDirty[index]--;
 		}
-	}
+	});
+
+	//objects now written to every frame resource drop out.
+	mDirtyObjects.erase(std::remove_if(mDirtyObjects.begin(), mDirtyObjects.end(),
+		[this](UINT index) { return mObjectFramesDirty[index] == 0; }), mDirtyObjects.end());
+
+	mObjectsWritten += count;
+	++mObjectDataFrames;
 }
 
-void CastleApp::UpdateMaterialCBs(const GameTimer& gt)
+void CastleApp::UpdateMaterialCBs()
 {
+	// Material has changed, so need to update cbuffer.
+	for (const auto& e : mRenderSnapshot->MaterialTransforms)
+	{
+		e.first->MatTransform = e.second;
+		e.first->NumFramesDirty = gNumFrameResources;
+	}
+
 	auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
 	for (auto& e : mMaterials)
 	{
@@ -538,70 +1255,23 @@ void CastleApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.FarZ = 1000.0f;
 	mMainPassCB.TotalTime = gt.TotalTime();
 	mMainPassCB.DeltaTime = gt.DeltaTime();
-	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
-	//Directional light
-	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
-	mMainPassCB.Lights[0].Strength = { 0.6f, 0.6f, 0.6f };
-	//Point light 1
-	mMainPassCB.Lights[1].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[1].FalloffStart = 0.0f;
-	mMainPassCB.Lights[1].FalloffEnd = 25.0f;
-	mMainPassCB.Lights[1].Position = { 0.0f, 19.0f, -15.0f };
-	//Point light 2
-	mMainPassCB.Lights[2].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[2].FalloffStart = 0.0f;
-	mMainPassCB.Lights[2].FalloffEnd = 25.0f;
-	mMainPassCB.Lights[2].Position = { 0.0f, 19.0f, 15.0f };
-	//Point light 3
-	mMainPassCB.Lights[3].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[3].FalloffStart = 0.0f;
-	mMainPassCB.Lights[3].FalloffEnd = 25.0f;
-	mMainPassCB.Lights[3].Position = { 30.0f, 19.0f, -15.0f };
-	//Point light 4
-	mMainPassCB.Lights[4].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[4].FalloffStart = 0.0f;
-	mMainPassCB.Lights[4].FalloffEnd = 22.0f;
-	mMainPassCB.Lights[4].Position = { -30.0f, 19.0f, -15.0f };
-	//Point light 5
-	mMainPassCB.Lights[5].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[5].FalloffStart = 0.0f;
-	mMainPassCB.Lights[5].FalloffEnd = 25.0f;
-	mMainPassCB.Lights[5].Position = { 30.0f, 19.0f, 15.0f };
-	//Point light 6
-	mMainPassCB.Lights[6].Strength = { 10.f, 10.0f, 4.0f };
-	mMainPassCB.Lights[6].FalloffStart = 0.0f;
-	mMainPassCB.Lights[6].FalloffEnd = 22.0f;
-	mMainPassCB.Lights[6].Position = { -30.0f, 19.0f, 15.0f };
-	//Spot light
-	mMainPassCB.Lights[7].Strength = { 10.f, 0.0f, 0.0f };
-	mMainPassCB.Lights[7].Position = { -36.0f, 15.0f, 0.0f };
-	mMainPassCB.Lights[7].SpotPower = 5.0f;
-	mMainPassCB.Lights[7].FalloffStart = 0.0f;
-	mMainPassCB.Lights[7].FalloffEnd = 30.0f;
 
+	mGameSnapshot->Pass = mMainPassCB;
+}
 
+void CastleApp::UploadPassCB()
+{
 	auto currPassCB = mCurrFrameResource->PassCB.get();
-	currPassCB->CopyData(0, mMainPassCB);
+	currPassCB->CopyData(0, mRenderSnapshot->Pass);
 }
 
-void CastleApp::UpdateWaves(const GameTimer& gt)
+void CastleApp::UpdateWaves()
 {
-	// Every quarter second, generate a random wave.
-	static float t_base = 0.0f;
-	if ((mTimer.TotalTime() - t_base) >= 0.25f)
-	{
-		t_base += 0.25f;
-
-		int i = MathHelper::Rand(4, mWaves->RowCount() - 5);
-		int j = MathHelper::Rand(4, mWaves->ColumnCount() - 5);
-
-		float r = MathHelper::RandF(0.1f, 0.25f);
-
-		mWaves->Disturb(i, j, r);
-	}
-
-	// Update the wave simulation.
-	mWaves->Update(gt.DeltaTime());
+	//the simulation thread steps and disturbs the waves; here the newest two steps are
+	//blended for the time the game thread stamped the frame with.
+	const WaveFrame& frame = mWaveSim->Latest();
+	const float blend = mWaveSim->Blend(frame, mRenderSnapshot->WaveTime);
+	const std::vector<XMFLOAT2>& gridXZ = mWaveSim->GridXZ();
 
 	// Update the wave vertex buffer with the new solution.
 	auto currWavesVB = mCurrFrameResource->WavesVB.get();
@@ -609,8 +1279,12 @@ void CastleApp::UpdateWaves(const GameTimer& gt)
 	{
 		Vertex v;
 
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
+		v.Pos.x = gridXZ[i].x;
+		v.Pos.y = MathHelper::Lerp(frame.PrevHeights[i], frame.Heights[i], blend);
+		v.Pos.z = gridXZ[i].y;
+
+		XMVECTOR n = XMVectorLerp(XMLoadFloat3(&frame.PrevNormals[i]), XMLoadFloat3(&frame.Normals[i]), blend);
+		XMStoreFloat3(&v.Normal, XMVector3Normalize(n));
 
 		// Derive tex-coords from position by 
 		// mapping [-w/2,w/2] --> [0,1]
@@ -621,55 +1295,311 @@ void CastleApp::UpdateWaves(const GameTimer& gt)
 	}
 
 	// Set the dynamic VB of the wave renderitem to the current frame VB.
-	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
+	mRenderItems[mWavesRitem].Geo->VertexBufferGPU = currWavesVB->Resource();
 }
 
-// Load all of the textures we are going to use into memory.
-void CastleApp::LoadTextures()
+void CastleApp::UpdateTreeSprites(const GameTimer& gt)
 {
-	// Create "grass" texture
-	auto grassTex = std::make_unique<Texture>();
-	grassTex->Name = "grassTex";
-	grassTex->Filename = L"../../Textures/grass.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), grassTex->Filename.c_str(),
-		grassTex->Resource, grassTex->UploadHeap));
+	mVegetation->Update(mCamera.GetPosition3f(), mWorldFrustum);
 
-	// Create "water" texture
-	auto waterTex = std::make_unique<Texture>();
-	waterTex->Name = "waterTex";
-	waterTex->Filename = L"../../Textures/water1.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), waterTex->Filename.c_str(),
-		waterTex->Resource, waterTex->UploadHeap));
+	// There is no tree mesh, so the full and billboard tiers both go through the sprite
+	// path.  Near trees are written first so they survive if the VB runs out of room.
+	std::vector<TreeSpriteVertex>& sprites = mGameSnapshot->TreeSprites;
+	sprites.clear();
+	for (VegetationLod lod : { VegetationLod::Full, VegetationLod::Billboard })
+	{
+		for (const VegetationInstance& inst : mVegetation->Instances(lod))
+		{
+			if (sprites.size() == mMaxTreeSprites)
+				break;
 
-	// Create "tile" texture
-	auto tileTex = std::make_unique<Texture>();
-	tileTex->Name = "tileTex";
-	tileTex->Filename = L"../../Textures/tile.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), tileTex->Filename.c_str(),
-		tileTex->Resource, tileTex->UploadHeap));
+			TreeSpriteVertex v;
+			v.Pos = inst.Pos;
+			v.Size = inst.Size;
+			sprites.push_back(v);
+		}
+	}
+}
 
-	// Create "wood" texture
-	auto woodTex = std::make_unique<Texture>();
-	woodTex->Name = "woodTex";
-	woodTex->Filename = L"../../Textures/wood.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), woodTex->Filename.c_str(),
-		woodTex->Resource, woodTex->UploadHeap));
+void CastleApp::UploadTreeSprites()
+{
+	const std::vector<TreeSpriteVertex>& sprites = mRenderSnapshot->TreeSprites;
 
-	// Create "metal" texture
-	auto metalTex = std::make_unique<Texture>();
-	metalTex->Name = "metalTex";
-	metalTex->Filename = L"../../Textures/metal.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), metalTex->Filename.c_str(),
-		metalTex->Resource, metalTex->UploadHeap));
+	auto currTreeSpritesVB = mCurrFrameResource->TreeSpritesVB.get();
+	for (size_t i = 0; i < sprites.size(); ++i)
+		currTreeSpritesVB->CopyData((int)i, sprites[i]);
 
-	// Create "glass" texture
-	auto glassTex = std::make_unique<Texture>();
-	glassTex->Name = "glassTex";
+	RenderItem& treeSprites = mRenderItems[mTreeSpritesRitem];
+	treeSprites.IndexCount = (UINT)sprites.size();
+	treeSprites.Geo->VertexBufferGPU = currTreeSpritesVB->Resource();
+}
+
+void CastleApp::UpdateTerrain(const GameTimer& gt)
+{
+	mTerrain->Select(mCamera.GetPosition3f(), mWorldFrustum, mGameSnapshot->TerrainNodes);
+}
+
+void CastleApp::UpdateNavigation(const GameTimer& gt)
+{
+	NavFlowField* flowField = mFlowFields->Get(mNavGoal);
+	if (flowField == nullptr)
+		return;
+
+	// The field is built a slice per frame; agents whose cell isn't reached yet wait.
+	mFlowFields->Expand(8192);
+
+	// A long frame could step an agent through the margin around a wall.
+	const float dt = MathHelper::Min(gt.DeltaTime(), 0.05f);
+	const float agentHeight = 3.0f;
+
+	mNavAgentPositions.resize(mNavAgents.size());
+	mNavAgentHeights.resize(mNavAgents.size());
+
+	for (size_t i = 0; i < mNavAgents.size(); ++i)
+	{
+		NavAgent& agent = mNavAgents[i];
+
+		XMFLOAT2 dir;
+		if (flowField->Direction(agent.Pos, dir))
+		{
+			agent.Pos.x += dir.x*agent.Speed*dt;
+			agent.Pos.y += dir.y*agent.Speed*dt;
+		}
+
+		// Start over at the entrance once the goal is reached.
+		float dx = agent.Pos.x - mNavGoal.x;
+		float dz = agent.Pos.y - mNavGoal.y;
+		if (dx*dx + dz*dz < 1.0f)
+			agent.Pos = XMFLOAT2(mNavEntrance.x, mNavEntrance.y + mNavRandom.NextFloat(-10.0f, 10.0f));
+
+		mNavAgentPositions[i] = agent.Pos;
+	}
+
+	mTerrain->SampleHeights(mNavAgentPositions.data(), mNavAgentHeights.data(), mNavAgentPositions.size());
+
+	RenderItem& agents = mRenderItems[mNavAgentsRitem];
+	for (size_t i = 0; i < mNavAgents.size(); ++i)
+	{
+		const NavAgent& agent = mNavAgents[i];
+		float y = mNavAgentHeights[i] + 0.5f*agentHeight;
+
+		XMMATRIX world = XMMatrixScaling(1.0f, agentHeight, 1.0f / 1.5f) *
+			XMMatrixTranslation(agent.Pos.x, y, agent.Pos.y);
+		XMStoreFloat4x4(&agents.Instances[i].World, XMMatrixTranspose(world));
+		agents.InstanceBounds[i] = BoundingBox(XMFLOAT3(agent.Pos.x, y, agent.Pos.y),
+			XMFLOAT3(0.5f, 0.5f*agentHeight, 0.5f));
+	}
+}
+
+void CastleApp::RenderOcclusion()
+{
+	mOcclusion->Render(mCamera.GetView()*mCamera.GetProj());
+	mOcclusionMs += mOcclusion->LastRenderMs();
+	++mOcclusionFrames;
+}
+
+void CastleApp::UpdatePortals()
+{
+	mPortals->Update(mCamera.GetPosition3f(), mCamera.GetView()*mCamera.GetProj());
+	mPortalMicros += mPortals->LastUpdateMicros();
+}
+
+// Keeps the Opaque render items that can be seen from the camera's maze cell, through the
+// portals, in the frustum and not behind the walls, testing in that order as it is
+// cheapest first.
+void CastleApp::CullOpaque()
+{
+	const std::uint64_t* pvs = mVisibility->Find(mCamera.GetPosition3f());
+	std::uint64_t pvsCulled = 0;
+	std::uint64_t portalCulled = 0;
+
+	mOpaqueInView.clear();
+	mOpaqueBounds.clear();
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		const RenderItem& ri = mRenderItems[handle];
+
+		//the sets are conservative against solid walls (see VisibilitySets.h), so an item
+		//skipped here cannot be seen from anywhere in the camera's cell.
+		if (pvs && ri.PvsIndex != (UINT)-1 && !mVisibility->Contains(pvs, ri.PvsIndex))
+		{
+			++pvsCulled;
+			continue;
+		}
+
+		if (!mPortals->IsVisible(ri.Zone, ri.Bounds))
+		{
+			++portalCulled;
+			continue;
+		}
+
+		const BoundingBox& bounds = ri.Bounds;
+		if (mWorldFrustum.Contains(bounds) != DISJOINT)
+		{
+			mOpaqueInView.push_back(handle);
+			mOpaqueBounds.push_back(bounds);
+		}
+	}
+
+	mOpaqueVisible.resize(mOpaqueBounds.size());
+	size_t visibleCount = mOcclusion->TestBoxes(mOpaqueBounds.data(), mOpaqueBounds.size(), mOpaqueVisible.data());
+
+	std::vector<SlotHandle>& opaque = mGameSnapshot->Opaque;
+	std::vector<SlotHandle>& opaqueBaked = mGameSnapshot->OpaqueBaked;
+	opaque.clear();
+	opaqueBaked.clear();
+	for (size_t i = 0; i < mOpaqueInView.size(); ++i)
+	{
+		if (!mOpaqueVisible[i])
+			continue;
+
+		if (mRenderItems[mOpaqueInView[i]].BakedOffset == (UINT)-1)
+			opaque.push_back(mOpaqueInView[i]);
+		else
+			opaqueBaked.push_back(mOpaqueInView[i]);
+	}
+
+	mOcclusionTested += mOpaqueInView.size();
+	mOcclusionCulled += mOpaqueInView.size() - visibleCount;
+	mPvsCulled += pvsCulled;
+	mPortalCulled += portalCulled;
+}
+
+void CastleApp::UpdateInstanceData(const GameTimer& gt)
+{
+	// The visible instances of all instanced render items go one after another, so they
+	// always fit in an instance buffer sized for every instance.
+	std::vector<InstanceData>& instances = mGameSnapshot->Instances;
+	std::vector<std::pair<UINT, UINT>>& ranges = mGameSnapshot->InstanceRanges;
+	instances.clear();
+	ranges.clear();
+	const std::uint64_t* pvs = mVisibility->Find(mCamera.GetPosition3f());
+	std::uint64_t pvsCulled = 0;
+	std::uint64_t portalCulled = 0;
+	std::uint64_t tested = 0;
+	std::uint64_t culled = 0;
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::OpaqueInstanced])
+	{
+		const RenderItem& e = mRenderItems[handle];
+		UINT start = (UINT)instances.size();
+
+		//none of the instances show if the portals never reach their zone.
+		if (!mPortals->IsReached(e.Zone))
+		{
+			portalCulled += e.Instances.size();
+			ranges.push_back({ start, 0 });
+			continue;
+		}
+
+		for (size_t i = 0; i < e.Instances.size(); ++i)
+		{
+			if (pvs && e.PvsIndex != (UINT)-1 && !mVisibility->Contains(pvs, e.PvsIndex + (UINT)i))
+			{
+				++pvsCulled;
+				continue;
+			}
+
+			if (!mPortals->IsVisible(e.Zone, e.InstanceBounds[i]))
+			{
+				++portalCulled;
+				continue;
+			}
+
+			if (mWorldFrustum.Contains(e.InstanceBounds[i]) == DISJOINT)
+				continue;
+
+			++tested;
+			if (mOcclusion->IsVisible(e.InstanceBounds[i]))
+				instances.push_back(e.Instances[i]);
+			else
+				++culled;
+		}
+
+		ranges.push_back({ start, (UINT)instances.size() - start });
+	}
+
+	mOcclusionTested += tested;
+	mOcclusionCulled += culled;
+	mPvsCulled += pvsCulled;
+	mPortalCulled += portalCulled;
+}
+
+void CastleApp::UploadInstanceData()
+{
+	const std::vector<InstanceData>& instances = mRenderSnapshot->Instances;
+
+	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();
+	for (size_t i = 0; i < instances.size(); ++i)
+		currInstanceBuffer->CopyData((int)i, instances[i]);
+}
+
+// Copies the constants of the render items whose transforms changed into the snapshot,
+// so the render thread writes them from there rather than reading the items.
+void CastleApp::UpdateObjectConstants()
+{
+	std::vector<std::pair<UINT, ObjectConstants>>& dirty = mGameSnapshot->DirtyObjects;
+	dirty.clear();
+	for (RenderItem& e : mRenderItems)
+	{
+		if (!e.Dirty)
+			continue;
+
+		ObjectConstants objData;
+		XMStoreFloat4x4(&objData.World, XMMatrixTranspose(XMLoadFloat4x4(&e.World)));
+		XMStoreFloat4x4(&objData.TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&e.TexTransform)));
+		objData.BakedOffset = e.BakedOffset == (UINT)-1 ? 0 : e.BakedOffset;
+		dirty.push_back({ e.ObjIndex, objData });
+
+		e.Dirty = false;
+	}
+}
+
+// Load all of the textures we are going to use into memory.
+void CastleApp::LoadTextures()
+{
+	// Create "grass" texture
+	auto grassTex = std::make_unique<Texture>();
+	grassTex->Name = "grassTex";
+	grassTex->Filename = L"../../Textures/grass.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), grassTex->Filename.c_str(),
+		grassTex->Resource, grassTex->UploadHeap));
+
+	// Create "water" texture
+	auto waterTex = std::make_unique<Texture>();
+	waterTex->Name = "waterTex";
+	waterTex->Filename = L"../../Textures/water1.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), waterTex->Filename.c_str(),
+		waterTex->Resource, waterTex->UploadHeap));
+
+	// Create "tile" texture
+	auto tileTex = std::make_unique<Texture>();
+	tileTex->Name = "tileTex";
+	tileTex->Filename = L"../../Textures/tile.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), tileTex->Filename.c_str(),
+		tileTex->Resource, tileTex->UploadHeap));
+
+	// Create "wood" texture
+	auto woodTex = std::make_unique<Texture>();
+	woodTex->Name = "woodTex";
+	woodTex->Filename = L"../../Textures/wood.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), woodTex->Filename.c_str(),
+		woodTex->Resource, woodTex->UploadHeap));
+
+	// Create "metal" texture
+	auto metalTex = std::make_unique<Texture>();
+	metalTex->Name = "metalTex";
+	metalTex->Filename = L"../../Textures/metal.dds";
+	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
+		mCommandList.Get(), metalTex->Filename.c_str(),
+		metalTex->Resource, metalTex->UploadHeap));
+
+	// Create "glass" texture
+	auto glassTex = std::make_unique<Texture>();
+	glassTex->Name = "glassTex";
 	glassTex->Filename = L"../../Textures/glass.dds";
 	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
 		mCommandList.Get(), glassTex->Filename.c_str(),
@@ -708,6 +1638,7 @@ void CastleApp::LoadTextures()
 		treeArrayTex->Resource, treeArrayTex->UploadHeap));
 
 	// Add newly created textures into the mTextures list.
+	std::lock_guard<std::mutex> lock(mLoadMutex);
 	mTextures[grassTex->Name] = std::move(grassTex);
 	mTextures[waterTex->Name] = std::move(waterTex);
 	mTextures[tileTex->Name] = std::move(tileTex);
@@ -720,24 +1651,93 @@ void CastleApp::LoadTextures()
 	mTextures[treeArrayTex->Name] = std::move(treeArrayTex);
 }
 
+// Load the ground heightmap and copy it into a texture the terrain vertex shader can read.
+void CastleApp::BuildTerrain()
+{
+	//the terrain covers the same 600x300 area as the old land grid, centered on the castle and maze.
+	TerrainDesc desc;
+	desc.HeightmapFilename = L"../../Textures/terrain.raw";
+	desc.HeightmapWidth = 257;
+	desc.HeightmapHeight = 129;
+	desc.MinX = 104.0f - 300.0f;
+	desc.MinZ = -150.0f;
+	desc.Width = 600.0f;
+	desc.Depth = 300.0f;
+	desc.HeightScale = 60.0f;
+	desc.HeightOffset = 0.0f;
+	desc.PatchSize = 16;
+	desc.LodCount = 5;
+	desc.LeafNodeSize = 18.75f;
+	desc.FirstLodDistance = 40.0f;
+	desc.LodDistanceRatio = 2.0f;
+
+	mTerrain = std::make_unique<Terrain>(desc);
+	if (!mTerrain->HeightmapLoaded())
+		OutputDebugStringA("Terrain heightmap not found, using flat ground.\n");
+
+	auto heightmapTex = std::make_unique<Texture>();
+	heightmapTex->Name = "heightmapTex";
+	heightmapTex->Filename = desc.HeightmapFilename;
+
+	D3D12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R16_UNORM,
+		mTerrain->HeightmapWidth(), mTerrain->HeightmapHeight(), 1, 1);
+
+	ThrowIfFailed(md3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(heightmapTex->Resource.GetAddressOf())));
+
+	D3D12_SUBRESOURCE_DATA subResourceData = {};
+	subResourceData.pData = mTerrain->Heights().data();
+	subResourceData.RowPitch = mTerrain->HeightmapWidth() * sizeof(std::uint16_t);
+	subResourceData.SlicePitch = subResourceData.RowPitch * mTerrain->HeightmapHeight();
+
+	std::lock_guard<std::mutex> lock(mLoadMutex);
+	mStaging->UploadTexture(heightmapTex->Resource.Get(), subResourceData, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	mTextures[heightmapTex->Name] = std::move(heightmapTex);
+}
+
+void CastleApp::BuildPipelineCache()
+{
+	//identical descs share a PSO, and compiled PSOs are kept in a pipeline library so
+	//later runs load them instead of waiting on the driver.
+	mPipelineLibrary = std::make_unique<PipelineLibrary>(md3dDevice.Get(), "PipelineCache.bin");
+	mPipelineCache = std::make_unique<PipelineCache>(
+		[this](const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, const std::wstring& name)
+	{
+		return mPipelineLibrary->Create(desc, name);
+	});
+}
+
 void CastleApp::BuildRootSignature()
 {
 	CD3DX12_DESCRIPTOR_RANGE texTable;
 	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 
+	CD3DX12_DESCRIPTOR_RANGE heightmapTable;
+	heightmapTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
+
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+	CD3DX12_ROOT_PARAMETER slotRootParameter[9];
 
 	// Perfomance TIP: Order from most frequent to least frequent.
 	slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
-	slotRootParameter[1].InitAsConstantBufferView(0);
+	slotRootParameter[1].InitAsConstants(1, 0, 0, D3D12_SHADER_VISIBILITY_VERTEX);
 	slotRootParameter[2].InitAsConstantBufferView(1);
 	slotRootParameter[3].InitAsConstantBufferView(2);
+	slotRootParameter[4].InitAsConstants(sizeof(TerrainConstants) / 4, 3, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[5].InitAsDescriptorTable(1, &heightmapTable, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[6].InitAsShaderResourceView(0, 1, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[7].InitAsShaderResourceView(1, 1, D3D12_SHADER_VISIBILITY_VERTEX);
+	slotRootParameter[8].InitAsShaderResourceView(2, 1, D3D12_SHADER_VISIBILITY_VERTEX);
 
 	auto staticSamplers = GetStaticSamplers();
 
 	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(9, slotRootParameter,
 		(UINT)staticSamplers.size(), staticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -758,6 +1758,10 @@ void CastleApp::BuildRootSignature()
 		serializedRootSig->GetBufferPointer(),
 		serializedRootSig->GetBufferSize(),
 		IID_PPV_ARGS(mRootSignature.GetAddressOf())));
+
+	//PSOs are keyed on what the root signature contains, not where it lives.
+	mPipelineCache->AddRootSignature(mRootSignature.Get(),
+		serializedRootSig->GetBufferPointer(), serializedRootSig->GetBufferSize());
 }
 
 void CastleApp::BuildDescriptorHeaps()
@@ -766,7 +1770,7 @@ void CastleApp::BuildDescriptorHeaps()
 	// Create the SRV heap.
 	//
 	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 10;
+	srvHeapDesc.NumDescriptors = 11;
 	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
@@ -787,6 +1791,7 @@ void CastleApp::BuildDescriptorHeaps()
 	auto stoneTex = mTextures["stoneTex"]->Resource;
 	auto brick2Tex = mTextures["brick2Tex"]->Resource;
 	auto treeArrayTex = mTextures["treeArrayTex"]->Resource;
+	auto heightmapTex = mTextures["heightmapTex"]->Resource;
 
 	// One by one, we offset the descriptor by 1 and add create our shader resource for all of the,
 	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
@@ -856,30 +1861,119 @@ void CastleApp::BuildDescriptorHeaps()
 	srvDesc.Texture2DArray.FirstArraySlice = 0;
 	srvDesc.Texture2DArray.ArraySize = treeArrayTex->GetDesc().DepthOrArraySize;
 	md3dDevice->CreateShaderResourceView(treeArrayTex.Get(), &srvDesc, hDescriptor);
+
+	// next descriptor
+	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
+
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Format = heightmapTex->GetDesc().Format;
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = 1;
+	srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+	md3dDevice->CreateShaderResourceView(heightmapTex.Get(), &srvDesc, hDescriptor);
 }
 
 void CastleApp::BuildShadersAndInputLayouts()
 {
-	const D3D_SHADER_MACRO defines[] =
+	//compiled shaders are cached on disk, so only the first run or one after a shader
+	//changes pays for the compiler.
+	auto compile = [](const ShaderDesc& desc, std::vector<char>& bytecode)
 	{
-		"FOG", "1",
-		NULL, NULL
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const ShaderDefine& define : desc.Defines)
+			macros.push_back({ define.Name.c_str(), define.Value.c_str() });
+		macros.push_back({ nullptr, nullptr });
+
+		ComPtr<ID3DBlob> byteCode;
+		ComPtr<ID3DBlob> errors;
+		HRESULT hr = D3DCompileFromFile(AnsiToWString(desc.File).c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+			desc.EntryPoint.c_str(), desc.Target.c_str(), desc.Flags, 0, &byteCode, &errors);
+
+		if (errors != nullptr)
+			OutputDebugStringA((char*)errors->GetBufferPointer());
+
+		if (FAILED(hr))
+			return false;
+
+		const char* data = (const char*)byteCode->GetBufferPointer();
+		bytecode.assign(data, data + byteCode->GetBufferSize());
+		return true;
 	};
 
-	const D3D_SHADER_MACRO alphaTestDefines[] =
+	mShaderCache = std::make_unique<ShaderCache>("ShaderCache", compile);
+	mShaderPermutations = std::make_unique<ShaderPermutations>(*mShaderCache, d3dUtil::ShaderCompileFlags());
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	//each program lists the features its source checks for, so e.g. the vertex shaders
+	//are not compiled twice just because fog is on.
+	auto addProgram = [&](const char* file, const char* entrypoint, const char* target, std::uint32_t features, bool lit)
 	{
-		"FOG", "1",
-		"ALPHA_TEST", "1",
-		NULL, NULL
+		ShaderProgram program;
+		program.File = file;
+		program.EntryPoint = entrypoint;
+		program.Target = target;
+		program.Features = features;
+		program.Lit = lit;
+		return mShaderPermutations->AddProgram(program);
 	};
 
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_0");
-	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", defines, "PS", "ps_5_0");
-	mShaders["alphaTestedPS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", alphaTestDefines, "PS", "ps_5_0");
+	const std::uint32_t fogAndAlpha = ShaderFeatureFog | ShaderFeatureAlphaTest;
+	std::uint32_t standardVS = addProgram("Shaders\\Default.hlsl", "VS", "vs_5_0", ShaderFeatureBakedLighting, false);
+	std::uint32_t instancedVS = addProgram("Shaders\\Default.hlsl", "VSInstanced", "vs_5_0", 0, false);
+	std::uint32_t standardPS = addProgram("Shaders\\Default.hlsl", "PS", "ps_5_0", fogAndAlpha | ShaderFeatureBakedLighting, true);
+	std::uint32_t terrainVS = addProgram("Shaders\\Terrain.hlsl", "VS", "vs_5_0", 0, false);
+	std::uint32_t terrainPS = addProgram("Shaders\\Terrain.hlsl", "PS", "ps_5_0", ShaderFeatureFog, true);
+	std::uint32_t treeSpriteVS = addProgram("Shaders\\TreeSprite.hlsl", "VS", "vs_5_0", 0, false);
+	std::uint32_t treeSpriteGS = addProgram("Shaders\\TreeSprite.hlsl", "GS", "gs_5_0", 0, false);
+	std::uint32_t treeSpritePS = addProgram("Shaders\\TreeSprite.hlsl", "PS", "ps_5_0", fogAndAlpha, true);
+
+	ShaderPermutation opaque;
+	opaque.Features = ShaderFeatureFog;
+	opaque.DirLights = gNumDirLights;
+	opaque.PointLights = gNumPointLights;
+	opaque.SpotLights = gNumSpotLights;
+
+	ShaderPermutation alphaTested = opaque;
+	alphaTested.Features |= ShaderFeatureAlphaTest;
+
+	//the point and spot lights are baked in, so only the sun is left to light.
+	ShaderPermutation baked = opaque;
+	baked.Features |= ShaderFeatureBakedLighting;
+	baked.PointLights = 0;
+	baked.SpotLights = 0;
+
+	//what each PSO draws with.  Everything is compiled up front on worker threads, then
+	//picked up one at a time below.
+	const std::pair<std::string, std::pair<std::uint32_t, ShaderPermutation>> shaders[] =
+	{
+		{ "standardVS", { standardVS, opaque } },
+		{ "instancedVS", { instancedVS, opaque } },
+		{ "opaquePS", { standardPS, opaque } },
+		{ "alphaTestedPS", { standardPS, alphaTested } },
+		{ "bakedVS", { standardVS, baked } },
+		{ "bakedPS", { standardPS, baked } },
+		{ "terrainVS", { terrainVS, opaque } },
+		{ "terrainPS", { terrainPS, opaque } },
+		{ "treeSpriteVS", { treeSpriteVS, alphaTested } },
+		{ "treeSpriteGS", { treeSpriteGS, alphaTested } },
+		{ "treeSpritePS", { treeSpritePS, alphaTested } },
+	};
+
+	std::vector<std::pair<std::uint32_t, ShaderPermutation>> requests;
+	for (const auto& e : shaders)
+		requests.push_back(e.second);
+	mShaderPermutations->Precompile(requests);
 
-	mShaders["treeSpriteVS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "VS", "vs_5_0");
-	mShaders["treeSpriteGS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", nullptr, "GS", "gs_5_0");
-	mShaders["treeSpritePS"] = d3dUtil::CompileShader(L"Shaders\\TreeSprite.hlsl", alphaTestDefines, "PS", "ps_5_0");
+	for (const auto& e : shaders)
+		mShaders[e.first] = LoadShader(e.second.first, e.second.second);
+
+	//cold starts show up as misses.
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::ostringstream log;
+	log << "Shaders: " << mShaderCache->Hits() << " cached, " << mShaderCache->Misses() << " compiled in "
+		<< std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms\n";
+	log << mShaderPermutations->Report();
+	OutputDebugStringA(log.str().c_str());
 
 	mStdInputLayout =
 	{
@@ -895,31 +1989,67 @@ void CastleApp::BuildShadersAndInputLayouts()
 	};
 }
 
+ComPtr<ID3DBlob> CastleApp::LoadShader(std::uint32_t program, const ShaderPermutation& permutation)
+{
+	const ShaderVariant& variant = mShaderPermutations->Get(program, permutation);
+	const ShaderDesc& desc = variant.Desc;
+
+	//compile without the cache if it can't help, which also reports any errors.
+	if (variant.Path.empty())
+	{
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const ShaderDefine& define : desc.Defines)
+			macros.push_back({ define.Name.c_str(), define.Value.c_str() });
+		macros.push_back({ nullptr, nullptr });
+
+		return d3dUtil::CompileShader(AnsiToWString(desc.File), macros.data(), desc.EntryPoint, desc.Target);
+	}
+
+	return d3dUtil::LoadBinary(AnsiToWString(variant.Path));
+}
+
 void CastleApp::BuildLandGeometry()
 {
-	//Generates vertices for our grid and allows for smooth heights with GetHillsHeight
-	GeometryGenerator geoGen;
-	GeometryGenerator::MeshData grid = geoGen.CreateGrid(100.0f, 100.0f, 50, 50);
+	//Every terrain node is drawn with this one flat patch.  The vertex shader places it
+	//over the node and reads the heights from the heightmap, so only x and z are used
+	//and they run from 0 to 1.
+	const UINT patchSize = mTerrain->Desc().PatchSize;
+	const UINT n = patchSize + 1;
+
+	std::vector<Vertex> vertices(n*n);
+	for (UINT i = 0; i < n; ++i)
+	{
+		for (UINT j = 0; j < n; ++j)
+		{
+			Vertex& v = vertices[i*n + j];
+			v.Pos = XMFLOAT3((float)j / patchSize, 0.0f, (float)i / patchSize);
+			v.Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+			v.TexC = XMFLOAT2(v.Pos.x, v.Pos.z);
+		}
+	}
 
-	//
-	// Extract the vertex elements we are interested and apply the height function to
-	// each vertex.  In addition, color the vertices based on their height so we have
-	// sandy looking beaches, grassy low hills, and snow mountain peaks.
-	//
+	std::vector<std::uint16_t> indices(6 * patchSize*patchSize);
+	assert(vertices.size() < 0x0000ffff);
 
-	std::vector<Vertex> vertices(grid.Vertices.size());
-	for (size_t i = 0; i < grid.Vertices.size(); ++i)
+	// Iterate over each quad.
+	UINT k = 0;
+	for (UINT i = 0; i < patchSize; ++i)
 	{
-		auto& p = grid.Vertices[i].Position;
-		vertices[i].Pos = p;
-		vertices[i].Pos.y = GetHillsHeight(p.x, p.z);
-		vertices[i].Normal = GetHillsNormal(p.x, p.z);
-		vertices[i].TexC = grid.Vertices[i].TexC;
+		for (UINT j = 0; j < patchSize; ++j)
+		{
+			indices[k] = i*n + j;
+			indices[k + 1] = (i + 1)*n + j;
+			indices[k + 2] = i*n + j + 1;
+
+			indices[k + 3] = i*n + j + 1;
+			indices[k + 4] = (i + 1)*n + j;
+			indices[k + 5] = (i + 1)*n + j + 1;
+
+			k += 6; // next quad
+		}
 	}
 
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-
-	std::vector<std::uint16_t> indices = grid.GetIndices16();
 	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
@@ -931,12 +2061,6 @@ void CastleApp::BuildLandGeometry()
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
@@ -947,9 +2071,40 @@ void CastleApp::BuildLandGeometry()
 	submesh.StartIndexLocation = 0;
 	submesh.BaseVertexLocation = 0;
 
-	geo->DrawArgs["grid"] = submesh;
+	geo->DrawArgs["patch"] = submesh;
+
+	AddGeometry(std::move(geo), vertices.data(), (UINT)vertices.size(),
+		std::vector<std::uint32_t>(indices.begin(), indices.end()));
+}
+
+// Puts geo's vertices and indices in the geometry pool, points geo at the pool's buffers
+// and adds it to mGeometries.  vertices may be null for meshes whose vertex buffer is
+// written every frame.  Safe to call from the startup tasks running side by side.
+void CastleApp::AddGeometry(std::unique_ptr<MeshGeometry> geo, const Vertex* vertices, UINT vertexCount,
+	const std::vector<std::uint32_t>& indices)
+{
+	std::lock_guard<std::mutex> lock(mLoadMutex);
+
+	PooledMesh mesh;
+	if (!mGeometryPool->Add(vertices, vertexCount, indices.data(), (UINT)indices.size(), mesh))
+	{
+		OutputDebugStringA(("Geometry pool is full, cannot add " + geo->Name + "\n").c_str());
+		ThrowIfFailed(E_OUTOFMEMORY);
+	}
+
+	mGeometryPool->Place(*geo, mesh);
+
+	//kept for the light baker, which needs the triangles on the CPU.
+	if (vertices != nullptr)
+	{
+		StaticMesh& copy = mStaticMeshes[geo.get()];
+		copy.Vertices.assign(vertices, vertices + vertexCount);
+		copy.Indices = indices;
+		copy.BaseVertexLocation = (INT)mGeometryPool->VertexOffset(mesh);
+		copy.StartIndexLocation = mGeometryPool->IndexOffset(mesh);
+	}
 
-	mGeometries["landGeo"] = std::move(geo);
+	mGeometries[geo->Name] = std::move(geo);
 }
 
 void CastleApp::BuildWavesGeometry()
@@ -990,9 +2145,6 @@ void CastleApp::BuildWavesGeometry()
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
@@ -1005,7 +2157,7 @@ void CastleApp::BuildWavesGeometry()
 
 	geo->DrawArgs["grid"] = submesh;
 
-	mGeometries["waterGeo"] = std::move(geo);
+	AddGeometry(std::move(geo), nullptr, 0, std::vector<std::uint32_t>(indices.begin(), indices.end()));
 }
 
 void CastleApp::BuildShapeGeometry()
@@ -1086,6 +2238,21 @@ void CastleApp::BuildShapeGeometry()
 	torusSubmesh.StartIndexLocation = torusIndexOffset;
 	torusSubmesh.BaseVertexLocation = torusVertexOffset;
 
+	//local space bounds of each shape, which AddRenderItem() places in the world for culling.
+	auto setBounds = [](SubmeshGeometry& submesh, const GeometryGenerator::MeshData& mesh)
+	{
+		BoundingBox::CreateFromPoints(submesh.Bounds, mesh.Vertices.size(), &mesh.Vertices[0].Position,
+			sizeof(GeometryGenerator::Vertex));
+	};
+	setBounds(boxSubmesh, box);
+	setBounds(gridSubmesh, grid);
+	setBounds(sphereSubmesh, sphere);
+	setBounds(cylinderSubmesh, cylinder);
+	setBounds(pyramidSubmesh, pyramid);
+	setBounds(coneSubmesh, cone);
+	setBounds(diamondSubmesh, diamond);
+	setBounds(torusSubmesh, torus);
+
 	//
 	// Extract the vertex elements we are interested in and pack the
 	// vertices of all the meshes into one vertex buffer.
@@ -1178,12 +2345,6 @@ void CastleApp::BuildShapeGeometry()
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
@@ -1199,129 +2360,176 @@ void CastleApp::BuildShapeGeometry()
 	geo->DrawArgs["diamond"] = diamondSubmesh;
 	geo->DrawArgs["torus"] = torusSubmesh;
 
-
-
-	mGeometries[geo->Name] = std::move(geo);
+	AddGeometry(std::move(geo), vertices.data(), (UINT)vertices.size(),
+		std::vector<std::uint32_t>(indices.begin(), indices.end()));
 }
 
-void CastleApp::BuildTreeSpritesGeometry()
+// Loads the skull model, which has positions and normals but no texture coordinates.
+// The courtyard goes without it if the file is missing.
+void CastleApp::BuildSkullGeometry()
 {
-	struct TreeSpriteVertex
+	ModelData model;
+	if (!LoadTextModel("Models/skull.txt", model))
 	{
-		XMFLOAT3 Pos;
-		XMFLOAT2 Size;
-	};
-
-	static const int treeCount = 32;
-	std::array<TreeSpriteVertex, treeCount> vertices;
+		OutputDebugStringA("Could not load Models/skull.txt\n");
+		return;
+	}
 
-	//build an object outside x values -98 > x < 306. midpt = 104, +-202.0f diff
-	//outside z values -90.1 > z < 90.1, midpt = 0. +-90.1f diff
+	std::vector<Vertex> vertices(model.Positions.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		vertices[i].Pos = model.Positions[i];
+		vertices[i].Normal = model.Normals[i];
+		vertices[i].TexC = XMFLOAT2(0.0f, 0.0f);
+	}
 
-	//used to determine if we need to move tree outside of castle
-	bool inXRange;
-	bool inZRange;
+	SubmeshGeometry submesh;
+	submesh.IndexCount = (UINT)model.Indices.size();
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
+	BoundingBox::CreateFromPoints(submesh.Bounds, model.Positions.size(), model.Positions.data(), sizeof(XMFLOAT3));
 
-	for (UINT i = 0; i < treeCount; ++i)
-	{
-		inXRange = false;
-		inZRange = false;
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "skullGeo";
+	geo->VertexByteStride = sizeof(Vertex);
+	geo->DrawArgs["skull"] = submesh;
 
-		//random number along boundaries
-		//makes sures the tree spawns OUTSIDE castle and maze grounds
+	AddGeometry(std::move(geo), vertices.data(), (UINT)vertices.size(), model.Indices);
+}
 
-		//first step is to generate random points.
-		float x = MathHelper::RandF(-98.0f - 20.0f, 306.0f + 20.0f);
-		float z = MathHelper::RandF(-90.1f - 20.0f, 90.1f + 20.0f);
+void CastleApp::BuildTreeSpritesGeometry()
+{
+	//trees grow in a 20 unit band around the castle and maze grounds.
+	//grounds are -98 > x < 306 and -90.1 > z < 90.1
+	VegetationStreamerDesc streamDesc;
+	streamDesc.MinX = -98.0f - 20.0f;
+	streamDesc.MinZ = -90.1f - 20.0f;
+	streamDesc.MaxX = 306.0f + 20.0f;
+	streamDesc.MaxZ = 90.1f + 20.0f;
+	streamDesc.ChunkSize = 64.0f;
+	streamDesc.FullDistance = 150.0f;
+	streamDesc.BillboardDistance = 600.0f;
+	streamDesc.StreamInDistance = 650.0f;
+	streamDesc.StreamOutDistance = 750.0f;
+
+	const float treeSpacing = 14.0f;
+
+	const int chunksX = (int)ceilf((streamDesc.MaxX - streamDesc.MinX) / streamDesc.ChunkSize);
+	const int chunksZ = (int)ceilf((streamDesc.MaxZ - streamDesc.MinZ) / streamDesc.ChunkSize);
+
+	//every chunk is scattered over the whole of its area with a seed of its own, so any
+	//chunk's trees can be worked out again without building it.
+	auto scatterChunk = [this, streamDesc, treeSpacing](int cx, int cz)
+	{
+		VegetationScatter scatter;
+		scatter.AddExclusionBox(-98.0f, -90.1f, 306.0f, 90.1f);
+
+		VegetationScatterDesc desc;
+		desc.MinX = streamDesc.MinX + cx*streamDesc.ChunkSize;
+		desc.MinZ = streamDesc.MinZ + cz*streamDesc.ChunkSize;
+		desc.MaxX = MathHelper::Min(desc.MinX + streamDesc.ChunkSize, streamDesc.MaxX);
+		desc.MaxZ = MathHelper::Min(desc.MinZ + streamDesc.ChunkSize, streamDesc.MaxZ);
+		desc.MinDistance = treeSpacing;
+		desc.Seed = mTreeSeed ^ ((std::uint32_t)(int)floorf(desc.MinX)*73856093u) ^ ((std::uint32_t)(int)floorf(desc.MinZ)*19349663u);
+		return scatter.Generate(desc);
+	};
 
-		//Inside the castle - which axis?
-		if (x > -98.0f && x < 306.0f)
-			inXRange = true;
-		if (z > -90.1f && z < 90.1f)
-			inZRange = true;
+	auto buildChunk = [this, streamDesc, treeSpacing, chunksX, chunksZ, scatterChunk](float minX, float minZ,
+		float maxX, float maxZ, std::vector<VegetationInstance>& instances)
+	{
+		const int cx = (int)floorf((minX - streamDesc.MinX) / streamDesc.ChunkSize + 0.5f);
+		const int cz = (int)floorf((minZ - streamDesc.MinZ) / streamDesc.ChunkSize + 0.5f);
 
-		//if inside castle boundaries (X or Z axis), then move it to the edge and add arbitrary range (20.0f)
-		if (inXRange && !inZRange) {
-			if (x < 104.0f)
-				x = -98.0f - MathHelper::RandF(0.0f, 20.0f);
-			else
-				x = 306.0f + MathHelper::RandF(0.0f, 20.0f);
-		} else if (!inXRange && inZRange) {
-			if (z < 0.0f)
-				z = -90.1f - MathHelper::RandF(0.0f, 20.0f);
-			else
-				z = 90.1f + MathHelper::RandF(0.0f, 20.0f);
-		} else if (inXRange && inZRange) {
-			//if in both boundaries of x & z...
-			//choose which side to push towards
-			//num = (-1) or (+1) - negative or positive integer
-			int num = MathHelper::RandSign();
-			if (num < 0) {
-				if (x < 104.0f)
-					x = -98.0f - MathHelper::RandF(0.0f, 20.0f);
-				else
-					x = 306.0f + MathHelper::RandF(0.0f, 20.0f);
-			} else {
-				if (z < 0.0f)
-					z = -90.1f - MathHelper::RandF(0.0f, 20.0f);
-				else
-					z = 90.1f + MathHelper::RandF(0.0f, 20.0f);
+		//trees closer than treeSpacing across a border belong to two chunks; the one that
+		//comes later in the grid gives way, so borders are neither crowded nor left bare.
+		std::vector<XMFLOAT2> earlier;
+		for (int dz = -1; dz <= 0; ++dz)
+		{
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				const int nx = cx + dx;
+				const int nz = cz + dz;
+				if ((dz == 0 && dx >= 0) || nx < 0 || nz < 0 || nx >= chunksX || nz >= chunksZ)
+					continue;
+
+				std::vector<XMFLOAT2> neighbour = scatterChunk(nx, nz);
+				earlier.insert(earlier.end(), neighbour.begin(), neighbour.end());
 			}
 		}
 
+		std::vector<XMFLOAT2> positions;
+		for (const XMFLOAT2& p : scatterChunk(cx, cz))
+		{
+			bool clear = true;
+			for (size_t i = 0; i < earlier.size() && clear; ++i)
+			{
+				const float dx = p.x - earlier[i].x;
+				const float dz = p.y - earlier[i].y;
+				clear = dx*dx + dz*dz >= treeSpacing*treeSpacing;
+			}
 
-		float y = GetHillsHeight(x, z);
+			if (clear)
+				positions.push_back(p);
+		}
 
-		// Move tree slightly above land height.
-		y += 8.0f;
+		std::vector<float> heights(positions.size());
+		mTerrain->SampleHeights(positions.data(), heights.data(), positions.size());
 
-		vertices[i].Pos = XMFLOAT3(x, y, z);
-		vertices[i].Size = XMFLOAT2(20.0f, 20.0f);
-	}
+		instances.resize(positions.size());
+		for (size_t i = 0; i < positions.size(); ++i)
+		{
+			float x = positions[i].x;
+			float z = positions[i].y;
 
-	std::array<std::uint16_t, 32> indices =
-	{
-		0, 1, 2, 3, 4, 5, 6, 7,
-		8, 9, 10, 11, 12, 13, 14, 15,
-		16, 17, 18, 19, 20, 21, 22, 23,
-		24, 25, 26, 27, 28, 29, 30, 31
+			// Move tree slightly above land height.
+			float y = heights[i] + 8.0f;
+
+			instances[i].Pos = XMFLOAT3(x, y, z);
+			instances[i].Size = XMFLOAT2(20.0f, 20.0f);
+		}
 	};
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(TreeSpriteVertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+	mVegetation = std::make_unique<VegetationStreamer>(streamDesc, buildChunk);
+	mVegetation->Prefetch(mCamera.GetPosition3f());
+
+	// The sprites are written to a dynamic VB every frame, so only the index buffer is
+	// static.  32-bit indices so the tree count is not limited to 65536.
+	std::vector<std::uint32_t> indices(mMaxTreeSprites);
+	for (std::uint32_t i = 0; i < (std::uint32_t)indices.size(); ++i)
+		indices[i] = i;
+
+	const UINT vbByteSize = mMaxTreeSprites * sizeof(TreeSpriteVertex);
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint32_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "treeSpritesGeo";
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	// Set dynamically.
+	geo->VertexBufferCPU = nullptr;
+	geo->VertexBufferGPU = nullptr;
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(TreeSpriteVertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
 	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
+	submesh.IndexCount = 0;
 	submesh.StartIndexLocation = 0;
 	submesh.BaseVertexLocation = 0;
 
 	geo->DrawArgs["points"] = submesh;
 
-	mGeometries["treeSpritesGeo"] = std::move(geo);
+	AddGeometry(std::move(geo), nullptr, 0, indices);
 }
 
 void CastleApp::BuildPSOs()
 {
+	auto t0 = std::chrono::high_resolution_clock::now();
+
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc;
 
 	//
@@ -1350,7 +2558,53 @@ void CastleApp::BuildPSOs()
 	opaquePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
 	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+	mPSOs["opaque"] = mPipelineCache->Get(opaquePsoDesc);
+
+	//
+	// PSO for opaque objects with baked lighting.
+	//
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueBakedPsoDesc = opaquePsoDesc;
+	opaqueBakedPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["bakedVS"]->GetBufferPointer()),
+		mShaders["bakedVS"]->GetBufferSize()
+	};
+	opaqueBakedPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["bakedPS"]->GetBufferPointer()),
+		mShaders["bakedPS"]->GetBufferSize()
+	};
+	mPSOs["opaqueBaked"] = mPipelineCache->Get(opaqueBakedPsoDesc);
+
+	//
+	// PSO for instanced opaque objects.
+	//
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueInstancedPsoDesc = opaquePsoDesc;
+	opaqueInstancedPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["instancedVS"]->GetBufferPointer()),
+		mShaders["instancedVS"]->GetBufferSize()
+	};
+	mPSOs["opaqueInstanced"] = mPipelineCache->Get(opaqueInstancedPsoDesc);
+
+	//
+	// PSO for the terrain
+	//
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC terrainPsoDesc = opaquePsoDesc;
+	terrainPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["terrainVS"]->GetBufferPointer()),
+		mShaders["terrainVS"]->GetBufferSize()
+	};
+	terrainPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["terrainPS"]->GetBufferPointer()),
+		mShaders["terrainPS"]->GetBufferSize()
+	};
+	mPSOs["terrain"] = mPipelineCache->Get(terrainPsoDesc);
 
 	//
 	// PSO for transparent objects
@@ -1371,7 +2625,7 @@ void CastleApp::BuildPSOs()
 	transparencyBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
 
 	transparentPsoDesc.BlendState.RenderTarget[0] = transparencyBlendDesc;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&transparentPsoDesc, IID_PPV_ARGS(&mPSOs["transparent"])));
+	mPSOs["transparent"] = mPipelineCache->Get(transparentPsoDesc);
 
 	//
 	// PSO for alpha tested objects
@@ -1384,7 +2638,7 @@ void CastleApp::BuildPSOs()
 		mShaders["alphaTestedPS"]->GetBufferSize()
 	};
 	alphaTestedPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&alphaTestedPsoDesc, IID_PPV_ARGS(&mPSOs["alphaTested"])));
+	mPSOs["alphaTested"] = mPipelineCache->Get(alphaTestedPsoDesc);
 
 	//
 	// PSO for tree sprites
@@ -1409,16 +2663,33 @@ void CastleApp::BuildPSOs()
 	treeSpritePsoDesc.InputLayout = { mTreeSpriteInputLayout.data(), (UINT)mTreeSpriteInputLayout.size() };
 	treeSpritePsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
 
-	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&treeSpritePsoDesc, IID_PPV_ARGS(&mPSOs["treeSprites"])));
+	mPSOs["treeSprites"] = mPipelineCache->Get(treeSpritePsoDesc);
+
+	mPipelineLibrary->Save();
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::ostringstream log;
+	log << "PSOs: " << mPipelineCache->Requests() << " requested, " << mPipelineCache->UniqueCount() << " unique, "
+		<< mPipelineLibrary->Loaded() << " loaded, " << mPipelineLibrary->Compiled() << " compiled in "
+		<< std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms\n";
+	OutputDebugStringA(log.str().c_str());
 }
 
 void CastleApp::BuildFrameResources()
 {
+	UINT instanceCount = 1;
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::OpaqueInstanced])
+		instanceCount += (UINT)mRenderItems[handle].Instances.size();
+
 	for (int i = 0; i < gNumFrameResources; ++i)
 	{
 		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-			1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(), mWaves->VertexCount()));
+			1, (UINT)mRenderItems.SlotCount(), (UINT)mMaterials.size(), mWaves->VertexCount(), mMaxTreeSprites,
+			instanceCount));
 	}
+
+	mObjectConstants.resize(mRenderItems.SlotCount());
+	mObjectFramesDirty.assign(mRenderItems.SlotCount(), 0);
 }
 
 // Configure and build our textures into materials and prepare to be able to apply them to objects.
@@ -1526,76 +2797,290 @@ void CastleApp::BuildRenderItems()
 {
 
 	//floor
-	auto gridRitem = std::make_unique<RenderItem>();
-	gridRitem->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&gridRitem->World, XMMatrixScaling(6.0f, 1.0, 3.0f)
-		* XMMatrixTranslation(104.0f, 0.0f, 0.0f));
-	XMStoreFloat4x4(&gridRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	gridRitem->ObjCBIndex = objCBIndex++;
-	gridRitem->Mat = mMaterials["grass"].get();
-	gridRitem->Geo = mGeometries["landGeo"].get();
-	gridRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
-	gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gridRitem.get());
-	mAllRitems.push_back(std::move(gridRitem));
+	//the terrain nodes are placed by the vertex shader, so the world matrix is unused.
+	RenderItem gridRitem;
+	gridRitem.World = MathHelper::Identity4x4();
+	XMStoreFloat4x4(&gridRitem.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	gridRitem.Mat = mMaterials["grass"].get();
+	gridRitem.Geo = mGeometries["landGeo"].get();
+	gridRitem.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	gridRitem.IndexCount = gridRitem.Geo->DrawArgs["patch"].IndexCount;
+	gridRitem.StartIndexLocation = gridRitem.Geo->DrawArgs["patch"].StartIndexLocation;
+	gridRitem.BaseVertexLocation = gridRitem.Geo->DrawArgs["patch"].BaseVertexLocation;
+
+	AddRenderItem(std::move(gridRitem), RenderLayer::Terrain);
 
 	//Custom functions to make this area cleaner. Generates castle and maze
+	mCollision = std::make_unique<CollisionWorld>();
+	mOcclusion = std::make_unique<OcclusionBuffer>();
 	BuildWalls();
 	BuildTowers();
 	BuildRailings();
 	BuildInner();
 
 	BuildMaze();
+	BuildNavigation();
+
+	for (const BoundingBox& wall : mMazeWallBounds)
+	{
+		mCollision->AddBox(wall);
+		mOcclusion->AddOccluder(wall);
+	}
+	mCollision->Build();
 
 	BuildWaves();
 
-	auto treeSpritesRitem = std::make_unique<RenderItem>();
-	treeSpritesRitem->World = MathHelper::Identity4x4();
-	treeSpritesRitem->ObjCBIndex = objCBIndex++;
-	treeSpritesRitem->Mat = mMaterials["treeSprites"].get();
-	treeSpritesRitem->Geo = mGeometries["treeSpritesGeo"].get();
-	treeSpritesRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_POINTLIST;
-	treeSpritesRitem->IndexCount = treeSpritesRitem->Geo->DrawArgs["points"].IndexCount;
-	treeSpritesRitem->StartIndexLocation = treeSpritesRitem->Geo->DrawArgs["points"].StartIndexLocation;
-	treeSpritesRitem->BaseVertexLocation = treeSpritesRitem->Geo->DrawArgs["points"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::AlphaTestedTreeSprites].push_back(treeSpritesRitem.get());
-	mAllRitems.push_back(std::move(treeSpritesRitem));
+	RenderItem treeSpritesRitem;
+	treeSpritesRitem.World = MathHelper::Identity4x4();
+	treeSpritesRitem.Mat = mMaterials["treeSprites"].get();
+	treeSpritesRitem.Geo = mGeometries["treeSpritesGeo"].get();
+	treeSpritesRitem.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_POINTLIST;
+	treeSpritesRitem.IndexCount = treeSpritesRitem.Geo->DrawArgs["points"].IndexCount;
+	treeSpritesRitem.StartIndexLocation = treeSpritesRitem.Geo->DrawArgs["points"].StartIndexLocation;
+	treeSpritesRitem.BaseVertexLocation = treeSpritesRitem.Geo->DrawArgs["points"].BaseVertexLocation;
+	mTreeSpritesRitem = AddRenderItem(std::move(treeSpritesRitem), RenderLayer::AlphaTestedTreeSprites);
+
+	BuildPortals();
+}
+
+// Stores the item and draws it with layer's PSO from then on.  The object buffers only
+// have room for the slots there were when the frame resources were built.
+SlotHandle CastleApp::AddRenderItem(RenderItem item, RenderLayer layer)
+{
+	SlotHandle handle = mRenderItems.Add(std::move(item));
+	RenderItem& ri = mRenderItems[handle];
+	ri.ObjIndex = handle.Index;
+
+	for (const auto& e : ri.Geo->DrawArgs)
+	{
+		const SubmeshGeometry& submesh = e.second;
+		if (submesh.StartIndexLocation == ri.StartIndexLocation && submesh.BaseVertexLocation == ri.BaseVertexLocation &&
+			submesh.IndexCount == ri.IndexCount)
+		{
+			submesh.Bounds.Transform(ri.Bounds, XMLoadFloat4x4(&ri.World));
+			break;
+		}
+	}
+
+	InsertHandle(mRitemLayer[(int)layer], handle);
+	return handle;
+}
+
+// Only between frames, while neither the game nor the render thread is using the items.
+// The slot, and with it the object data, go to the next item added.
+void CastleApp::RemoveRenderItem(SlotHandle handle)
+{
+	if (!mRenderItems.Remove(handle))
+		return;
+
+	for (auto& layer : mRitemLayer)
+		EraseHandle(layer, handle);
+}
+
+// The game side of a frame, which fills in mGameSnapshot.  Each update declares what it
+// reads and writes, so e.g. terrain selection, vegetation and navigation run side by side
+// while the pass constants still wait for the camera.  Input comes through mInput, so
+// none of it has to run on the window's thread.
+void CastleApp::BuildFrameGraph()
+{
+	mFrameGraph = std::make_unique<TaskGraph>();
+	TaskGraph& graph = *mFrameGraph;
+
+	graph.AddWithAccess("ConsumeInput", [this]() { ConsumeInput(); },
+		{}, { "Input", "Camera" });
+	graph.AddWithAccess("OnKeyboardInput", [this]() { OnKeyboardInput(mTimer); },
+		{ "Input", "Collision" }, { "Camera" });
+	graph.AddWithAccess("UpdateCamera", [this]() { UpdateCamera(mTimer); },
+		{}, { "Camera", "Frustum" });
+
+	graph.AddWithAccess("AnimateMaterials", [this]() { AnimateMaterials(mTimer); },
+		{}, { "MaterialTransforms" });
+	graph.AddWithAccess("UpdateMainPassCB", [this]() { UpdateMainPassCB(mTimer); },
+		{ "Camera" }, { "Pass" });
+	graph.AddWithAccess("UpdateTreeSprites", [this]() { UpdateTreeSprites(mTimer); },
+		{ "Camera", "Frustum" }, { "Vegetation", "TreeSprites" });
+	graph.AddWithAccess("UpdateTerrain", [this]() { UpdateTerrain(mTimer); },
+		{ "Camera", "Frustum" }, { "TerrainNodes" });
+	graph.AddWithAccess("UpdateNavigation", [this]() { UpdateNavigation(mTimer); },
+		{}, { "NavAgents" });
+	graph.AddWithAccess("RenderOcclusion", [this]() { RenderOcclusion(); },
+		{ "Camera" }, { "Occlusion" });
+	graph.AddWithAccess("UpdatePortals", [this]() { UpdatePortals(); },
+		{ "Camera" }, { "Portals" });
+	graph.AddWithAccess("CullOpaque", [this]() { CullOpaque(); },
+		{ "Camera", "Frustum", "Occlusion", "Portals" }, { "Opaque" });
+	graph.AddWithAccess("UpdateInstanceData", [this]() { UpdateInstanceData(mTimer); },
+		{ "Camera", "Frustum", "Occlusion", "Portals", "NavAgents" }, { "Instances" });
+
+	//an update that moves render items writes "Transforms" and sets their Dirty flags.
+	graph.AddWithAccess("UpdateObjectConstants", [this]() { UpdateObjectConstants(); },
+		{ "Transforms" }, { "ObjectConstants" });
+}
+
+// The render side of a frame, which copies mRenderSnapshot into the next frame resource
+// and records the frame.  The frame resource wait and the command list stay on the
+// thread that runs the graph.
+void CastleApp::BuildRenderGraph()
+{
+	mRenderGraph = std::make_unique<TaskGraph>();
+	TaskGraph& graph = *mRenderGraph;
+
+	graph.AddWithAccess("NextFrameResource", [this]() { NextFrameResource(); },
+		{}, { "FrameResource" }, true);
+
+	graph.AddWithAccess("UpdateObjectData", [this]() { UpdateObjectData(); },
+		{ "FrameResource" }, { "ObjectBuffer" });
+	graph.AddWithAccess("UpdateMaterialCBs", [this]() { UpdateMaterialCBs(); },
+		{ "FrameResource" }, { "Materials", "MaterialCB" });
+	graph.AddWithAccess("UploadPassCB", [this]() { UploadPassCB(); },
+		{ "FrameResource" }, { "PassCB" });
+	graph.AddWithAccess("UpdateWaves", [this]() { UpdateWaves(); },
+		{ "FrameResource" }, { "WavesVB" });
+	graph.AddWithAccess("UploadTreeSprites", [this]() { UploadTreeSprites(); },
+		{ "FrameResource" }, { "TreeSpritesVB" });
+	graph.AddWithAccess("UploadInstanceData", [this]() { UploadInstanceData(); },
+		{ "FrameResource" }, { "InstanceBuffer" });
+
+	graph.AddWithAccess("DrawFrame", [this]() { DrawFrame(); },
+		{ "ObjectBuffer", "MaterialCB", "PassCB", "WavesVB", "TreeSpritesVB", "InstanceBuffer" },
+		{ "CommandList" }, true);
 }
 
-void CastleApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
+void CastleApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems)
 {
-	UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
 	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
 
-	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
 	auto matCB = mCurrFrameResource->MaterialCB->Resource();
 
 	// For each render item...
 	for (size_t i = 0; i < ritems.size(); ++i)
 	{
-		auto ri = ritems[i];
+		const RenderItem* ri = &mRenderItems[ritems[i]];
 
-		cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		SetGeometry(cmdList, ri);
 
 		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
 		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
 
-		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex*objCBByteSize;
 		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
 
 		cmdList->SetGraphicsRootDescriptorTable(0, tex);
-		cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
+		cmdList->SetGraphicsRoot32BitConstant(1, ri->ObjIndex, 0);
 		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
 
 		cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
 	}
 }
 
+// Binds ri's vertex buffer, index buffer and topology, skipping whichever is already bound.
+void CastleApp::SetGeometry(ID3D12GraphicsCommandList* cmdList, const RenderItem* ri)
+{
+	D3D12_VERTEX_BUFFER_VIEW vbv = ri->Geo->VertexBufferView();
+	if (vbv.BufferLocation != mBoundVertexBuffer)
+	{
+		cmdList->IASetVertexBuffers(0, 1, &vbv);
+		mBoundVertexBuffer = vbv.BufferLocation;
+	}
+
+	D3D12_INDEX_BUFFER_VIEW ibv = ri->Geo->IndexBufferView();
+	if (ibv.BufferLocation != mBoundIndexBuffer)
+	{
+		cmdList->IASetIndexBuffer(&ibv);
+		mBoundIndexBuffer = ibv.BufferLocation;
+	}
+
+	if (ri->PrimitiveType != mBoundTopology)
+	{
+		cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+		mBoundTopology = ri->PrimitiveType;
+	}
+}
+
+// Draws each render item's visible instances with one call.  The world and texture
+// transforms come from the instance buffer, so only the material is bound per item.
+void CastleApp::DrawInstancedRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems,
+	const std::vector<std::pair<UINT, UINT>>& ranges)
+{
+	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
+
+	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+	auto instanceBuffer = mCurrFrameResource->InstanceBuffer->Resource();
+
+	for (size_t i = 0; i < ritems.size(); ++i)
+	{
+		const RenderItem* ri = &mRenderItems[ritems[i]];
+		const UINT startInstance = ranges[i].first;
+		const UINT instanceCount = ranges[i].second;
+		if (instanceCount == 0)
+			continue;
+
+		SetGeometry(cmdList, ri);
+
+		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+
+		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+		D3D12_GPU_VIRTUAL_ADDRESS instanceAddress = instanceBuffer->GetGPUVirtualAddress() +
+			startInstance*sizeof(InstanceData);
+
+		cmdList->SetGraphicsRootDescriptorTable(0, tex);
+		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+		cmdList->SetGraphicsRootShaderResourceView(6, instanceAddress);
+
+		cmdList->DrawIndexedInstanced(ri->IndexCount, instanceCount, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+	}
+}
+
+// Draws the selected terrain nodes.  Each node is one draw of the shared patch with its
+// placement and morph range passed as root constants.
+void CastleApp::DrawTerrain(ID3D12GraphicsCommandList* cmdList, const std::vector<SlotHandle>& ritems)
+{
+	UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
+
+	auto matCB = mCurrFrameResource->MaterialCB->Resource();
+
+	const TerrainDesc& desc = mTerrain->Desc();
+
+	TerrainConstants terrainConstants;
+	terrainConstants.TerrainMin = XMFLOAT2(desc.MinX, desc.MinZ);
+	terrainConstants.TerrainSize = XMFLOAT2(desc.Width, desc.Depth);
+	terrainConstants.HeightScale = desc.HeightScale;
+	terrainConstants.HeightOffset = desc.HeightOffset;
+	terrainConstants.PatchSize = (float)desc.PatchSize;
+
+	CD3DX12_GPU_DESCRIPTOR_HANDLE heightmap(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+	heightmap.Offset(10, mCbvSrvDescriptorSize);
+	cmdList->SetGraphicsRootDescriptorTable(5, heightmap);
+
+	for (size_t i = 0; i < ritems.size(); ++i)
+	{
+		const RenderItem* ri = &mRenderItems[ritems[i]];
+
+		SetGeometry(cmdList, ri);
+
+		CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+		tex.Offset(ri->Mat->DiffuseSrvHeapIndex, mCbvSrvDescriptorSize);
+
+		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + ri->Mat->MatCBIndex*matCBByteSize;
+
+		cmdList->SetGraphicsRootDescriptorTable(0, tex);
+		cmdList->SetGraphicsRoot32BitConstant(1, ri->ObjIndex, 0);
+		cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
+
+		for (const TerrainNode& node : mRenderSnapshot->TerrainNodes)
+		{
+			terrainConstants.NodeMin = XMFLOAT2(node.MinX, node.MinZ);
+			terrainConstants.NodeSize = node.Size;
+			terrainConstants.MorphStart = node.MorphStart;
+			terrainConstants.MorphInvRange = node.MorphEnd > node.MorphStart ?
+				1.0f / (node.MorphEnd - node.MorphStart) : 0.0f;
+
+			cmdList->SetGraphicsRoot32BitConstants(4, sizeof(TerrainConstants) / 4, &terrainConstants, 0);
+			cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+		}
+	}
+}
+
 std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> CastleApp::GetStaticSamplers()
 {
 	// Applications usually only need a handful of samplers.  So just define them all up front
@@ -1655,282 +3140,267 @@ std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> CastleApp::GetStaticSamplers()
 
 float CastleApp::GetHillsHeight(float x, float z)const
 {
-	//this function generates the terrain height...
-	//atm we want flat ground so we return 0
-	return 0;
-	//return 0.10f*(z*sinf(0.1f*x) + x*cosf(0.1f*z));
-
+	//this function samples the terrain height...
+	//without a heightmap the terrain is flat at 0
+	return mTerrain->GetHeight(x, z);
 }
 
 XMFLOAT3 CastleApp::GetHillsNormal(float x, float z)const
 {
-	// n = (-df/dx, 1, -df/dz)
-	//atm we want ground to be 0, so we multiple the values by 0.000f...
-	XMFLOAT3 n(
-		-0.000f*z*cosf(0.1f*x) - 0.3f*cosf(0.1f*z),
-		1.0f,
-		-0.00f*sinf(0.1f*x) + 0.03f*x*sinf(0.1f*z));
+	return mTerrain->GetNormal(x, z);
+}
 
-	XMVECTOR unitNormal = XMVector3Normalize(XMLoadFloat3(&n));
-	XMStoreFloat3(&n, unitNormal);
+BoundingBox CastleApp::GetBoxBounds(const XMFLOAT4X4& world)const
+{
+	//world space bounds of a render item drawn with the box submesh, which is 1x1x1.5.
+	BoundingBox bounds(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.5f, 0.5f, 0.75f));
+	bounds.Transform(bounds, XMLoadFloat4x4(&world));
+	return bounds;
+}
 
-	return n;
+BoundingOrientedBox CastleApp::GetBoxOrientedBounds(const XMFLOAT4X4& world)const
+{
+	//same as GetBoxBounds, but stays tight around rotated boxes.
+	BoundingOrientedBox bounds(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.5f, 0.5f, 0.75f), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	bounds.Transform(bounds, XMLoadFloat4x4(&world));
+	return bounds;
 }
 
 void CastleApp::BuildWaves() {
-	auto wavesRitem = std::make_unique<RenderItem>();
-	//wavesRitem->World = MathHelper::Identity4x4();
+	RenderItem wavesRitem;
+	//wavesRitem.World = MathHelper::Identity4x4();
 
-	XMStoreFloat4x4(&wavesRitem->World, XMMatrixScaling(10.0f, 1.0f, 10.0f)
+	XMStoreFloat4x4(&wavesRitem.World, XMMatrixScaling(10.0f, 1.0f, 10.0f)
 		* XMMatrixTranslation(0.0f, -5.0f, 0.0f));
-	XMStoreFloat4x4(&wavesRitem->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wavesRitem->ObjCBIndex = objCBIndex++;
-	wavesRitem->Mat = mMaterials["water"].get();
-	wavesRitem->Geo = mGeometries["waterGeo"].get();
-	wavesRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wavesRitem->IndexCount = wavesRitem->Geo->DrawArgs["grid"].IndexCount;
-	wavesRitem->StartIndexLocation = wavesRitem->Geo->DrawArgs["grid"].StartIndexLocation;
-	wavesRitem->BaseVertexLocation = wavesRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
-
-	mWavesRitem = wavesRitem.get();
-	mRitemLayer[(int)RenderLayer::Transparent].push_back(wavesRitem.get());
-	mAllRitems.push_back(std::move(wavesRitem));
+	XMStoreFloat4x4(&wavesRitem.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wavesRitem.Mat = mMaterials["water"].get();
+	wavesRitem.Geo = mGeometries["waterGeo"].get();
+	wavesRitem.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wavesRitem.IndexCount = wavesRitem.Geo->DrawArgs["grid"].IndexCount;
+	wavesRitem.StartIndexLocation = wavesRitem.Geo->DrawArgs["grid"].StartIndexLocation;
+	wavesRitem.BaseVertexLocation = wavesRitem.Geo->DrawArgs["grid"].BaseVertexLocation;
+
+	mWavesRitem = AddRenderItem(std::move(wavesRitem), RenderLayer::Transparent);
 }
 
 void CastleApp::BuildWalls() {
 	//gates
-	auto gateLeft = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&gateLeft->World, XMMatrixScaling(1.0f, 14.0f, 18.0f)
+	RenderItem gateLeft;
+	XMStoreFloat4x4(&gateLeft.World, XMMatrixScaling(1.0f, 14.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90.0f))
 		* XMMatrixTranslation(77.0f, 7.0f, -15.65f));
-	XMStoreFloat4x4(&gateLeft->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	gateLeft->ObjCBIndex = objCBIndex++;
-	gateLeft->Mat = mMaterials["wood"].get();
-	gateLeft->Geo = mGeometries["shapeGeo"].get();
-	gateLeft->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gateLeft->IndexCount = gateLeft->Geo->DrawArgs["box"].IndexCount;
-	gateLeft->StartIndexLocation = gateLeft->Geo->DrawArgs["box"].StartIndexLocation;
-	gateLeft->BaseVertexLocation = gateLeft->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gateLeft.get());
-	mAllRitems.push_back(std::move(gateLeft));
-
-	auto gateRight = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&gateRight->World, XMMatrixScaling(1.0f, 14.0f, 18.0f)
+	XMStoreFloat4x4(&gateLeft.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	gateLeft.Mat = mMaterials["wood"].get();
+	gateLeft.Geo = mGeometries["shapeGeo"].get();
+	gateLeft.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	gateLeft.IndexCount = gateLeft.Geo->DrawArgs["box"].IndexCount;
+	gateLeft.StartIndexLocation = gateLeft.Geo->DrawArgs["box"].StartIndexLocation;
+	gateLeft.BaseVertexLocation = gateLeft.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(gateLeft.World));
+	AddRenderItem(std::move(gateLeft), RenderLayer::Opaque);
+
+	RenderItem gateRight;
+	XMStoreFloat4x4(&gateRight.World, XMMatrixScaling(1.0f, 14.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90.0f))
 		* XMMatrixTranslation(77.0f, 7.0f, 15.65f));
-	XMStoreFloat4x4(&gateRight->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	gateRight->ObjCBIndex = objCBIndex++;
-	gateRight->Mat = mMaterials["wood"].get();
-	gateRight->Geo = mGeometries["shapeGeo"].get();
-	gateRight->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	gateRight->IndexCount = gateRight->Geo->DrawArgs["box"].IndexCount;
-	gateRight->StartIndexLocation = gateRight->Geo->DrawArgs["box"].StartIndexLocation;
-	gateRight->BaseVertexLocation = gateRight->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(gateRight.get());
-	mAllRitems.push_back(std::move(gateRight));
+	XMStoreFloat4x4(&gateRight.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	gateRight.Mat = mMaterials["wood"].get();
+	gateRight.Geo = mGeometries["shapeGeo"].get();
+	gateRight.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	gateRight.IndexCount = gateRight.Geo->DrawArgs["box"].IndexCount;
+	gateRight.StartIndexLocation = gateRight.Geo->DrawArgs["box"].StartIndexLocation;
+	gateRight.BaseVertexLocation = gateRight.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(gateRight.World));
+	AddRenderItem(std::move(gateRight), RenderLayer::Opaque);
 
 
 	//walls, viewed from gate->back perspective
-	auto wallLeft = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallLeft->World, XMMatrixScaling(100.0f, 16.0f, 18.0f) * XMMatrixTranslation(0.0f, 8.0f, -59.0f));
-	XMStoreFloat4x4(&wallLeft->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallLeft->ObjCBIndex = objCBIndex++;
-	wallLeft->Mat = mMaterials["brick2"].get();
-	wallLeft->Geo = mGeometries["shapeGeo"].get();
-	wallLeft->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallLeft->IndexCount = wallLeft->Geo->DrawArgs["box"].IndexCount;
-	wallLeft->StartIndexLocation = wallLeft->Geo->DrawArgs["box"].StartIndexLocation;
-	wallLeft->BaseVertexLocation = wallLeft->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallLeft.get());
-	mAllRitems.push_back(std::move(wallLeft));
-
-	auto wallRight = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallRight->World, XMMatrixScaling(100.0f, 16.0f, 18.0f)*XMMatrixTranslation(0.0f, 8.0f, 59.0f));
-	XMStoreFloat4x4(&wallRight->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallRight->ObjCBIndex = objCBIndex++;
-	wallRight->Mat = mMaterials["brick2"].get();
-	wallRight->Geo = mGeometries["shapeGeo"].get();
-	wallRight->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallRight->IndexCount = wallRight->Geo->DrawArgs["box"].IndexCount;
-	wallRight->StartIndexLocation = wallRight->Geo->DrawArgs["box"].StartIndexLocation;
-	wallRight->BaseVertexLocation = wallRight->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallRight.get());
-	mAllRitems.push_back(std::move(wallRight));
-
-	auto wallBack = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallBack->World, XMMatrixScaling(100.0f, 16.0f, 18.0f)
+	RenderItem wallLeft;
+	XMStoreFloat4x4(&wallLeft.World, XMMatrixScaling(100.0f, 16.0f, 18.0f) * XMMatrixTranslation(0.0f, 8.0f, -59.0f));
+	XMStoreFloat4x4(&wallLeft.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallLeft.Mat = mMaterials["brick2"].get();
+	wallLeft.Geo = mGeometries["shapeGeo"].get();
+	wallLeft.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallLeft.IndexCount = wallLeft.Geo->DrawArgs["box"].IndexCount;
+	wallLeft.StartIndexLocation = wallLeft.Geo->DrawArgs["box"].StartIndexLocation;
+	wallLeft.BaseVertexLocation = wallLeft.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallLeft.World));
+	AddRenderItem(std::move(wallLeft), RenderLayer::Opaque);
+
+	RenderItem wallRight;
+	XMStoreFloat4x4(&wallRight.World, XMMatrixScaling(100.0f, 16.0f, 18.0f)*XMMatrixTranslation(0.0f, 8.0f, 59.0f));
+	XMStoreFloat4x4(&wallRight.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallRight.Mat = mMaterials["brick2"].get();
+	wallRight.Geo = mGeometries["shapeGeo"].get();
+	wallRight.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallRight.IndexCount = wallRight.Geo->DrawArgs["box"].IndexCount;
+	wallRight.StartIndexLocation = wallRight.Geo->DrawArgs["box"].StartIndexLocation;
+	wallRight.BaseVertexLocation = wallRight.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallRight.World));
+	AddRenderItem(std::move(wallRight), RenderLayer::Opaque);
+
+	RenderItem wallBack;
+	XMStoreFloat4x4(&wallBack.World, XMMatrixScaling(100.0f, 16.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(-59.0f, 8.0f, 0.0f));
-	XMStoreFloat4x4(&wallBack->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallBack->ObjCBIndex = objCBIndex++;
-	wallBack->Mat = mMaterials["brick2"].get();
-	wallBack->Geo = mGeometries["shapeGeo"].get();
-	wallBack->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallBack->IndexCount = wallBack->Geo->DrawArgs["box"].IndexCount;
-	wallBack->StartIndexLocation = wallBack->Geo->DrawArgs["box"].StartIndexLocation;
-	wallBack->BaseVertexLocation = wallBack->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallBack.get());
-	mAllRitems.push_back(std::move(wallBack));
-
-	auto wallFrontL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallFrontL->World, XMMatrixScaling(35.0f, 16.0f, 18.0f)
+	XMStoreFloat4x4(&wallBack.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallBack.Mat = mMaterials["brick2"].get();
+	wallBack.Geo = mGeometries["shapeGeo"].get();
+	wallBack.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallBack.IndexCount = wallBack.Geo->DrawArgs["box"].IndexCount;
+	wallBack.StartIndexLocation = wallBack.Geo->DrawArgs["box"].StartIndexLocation;
+	wallBack.BaseVertexLocation = wallBack.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallBack.World));
+	AddRenderItem(std::move(wallBack), RenderLayer::Opaque);
+
+	RenderItem wallFrontL;
+	XMStoreFloat4x4(&wallFrontL.World, XMMatrixScaling(35.0f, 16.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(59.0f, 8.0f, -32.5f));
-	XMStoreFloat4x4(&wallFrontL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallFrontL->ObjCBIndex = objCBIndex++;
-	wallFrontL->Mat = mMaterials["brick2"].get();
-	wallFrontL->Geo = mGeometries["shapeGeo"].get();
-	wallFrontL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallFrontL->IndexCount = wallFrontL->Geo->DrawArgs["box"].IndexCount;
-	wallFrontL->StartIndexLocation = wallFrontL->Geo->DrawArgs["box"].StartIndexLocation;
-	wallFrontL->BaseVertexLocation = wallFrontL->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallFrontL.get());
-	mAllRitems.push_back(std::move(wallFrontL));
-
-	auto wallFrontR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallFrontR->World, XMMatrixScaling(35.0f, 16.0f, 18.0f)
+	XMStoreFloat4x4(&wallFrontL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallFrontL.Mat = mMaterials["brick2"].get();
+	wallFrontL.Geo = mGeometries["shapeGeo"].get();
+	wallFrontL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallFrontL.IndexCount = wallFrontL.Geo->DrawArgs["box"].IndexCount;
+	wallFrontL.StartIndexLocation = wallFrontL.Geo->DrawArgs["box"].StartIndexLocation;
+	wallFrontL.BaseVertexLocation = wallFrontL.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallFrontL.World));
+	AddRenderItem(std::move(wallFrontL), RenderLayer::Opaque);
+
+	RenderItem wallFrontR;
+	XMStoreFloat4x4(&wallFrontR.World, XMMatrixScaling(35.0f, 16.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(59.0f, 8.0f, 32.5f));
-	XMStoreFloat4x4(&wallFrontR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallFrontR->ObjCBIndex = objCBIndex++;
-	wallFrontR->Mat = mMaterials["brick2"].get();
-	wallFrontR->Geo = mGeometries["shapeGeo"].get();
-	wallFrontR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallFrontR->IndexCount = wallFrontR->Geo->DrawArgs["box"].IndexCount;
-	wallFrontR->StartIndexLocation = wallFrontR->Geo->DrawArgs["box"].StartIndexLocation;
-	wallFrontR->BaseVertexLocation = wallFrontR->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallFrontR.get());
-	mAllRitems.push_back(std::move(wallFrontR));
-
-	auto wallFrontM = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallFrontM->World, XMMatrixScaling(35.0f, 2.0f, 18.0f)
+	XMStoreFloat4x4(&wallFrontR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallFrontR.Mat = mMaterials["brick2"].get();
+	wallFrontR.Geo = mGeometries["shapeGeo"].get();
+	wallFrontR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallFrontR.IndexCount = wallFrontR.Geo->DrawArgs["box"].IndexCount;
+	wallFrontR.StartIndexLocation = wallFrontR.Geo->DrawArgs["box"].StartIndexLocation;
+	wallFrontR.BaseVertexLocation = wallFrontR.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallFrontR.World));
+	AddRenderItem(std::move(wallFrontR), RenderLayer::Opaque);
+
+	RenderItem wallFrontM;
+	XMStoreFloat4x4(&wallFrontM.World, XMMatrixScaling(35.0f, 2.0f, 18.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(59.0f, 15.0f, 0.0f));
-	XMStoreFloat4x4(&wallFrontM->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallFrontM->ObjCBIndex = objCBIndex++;
-	wallFrontM->Mat = mMaterials["brick2"].get();
-	wallFrontM->Geo = mGeometries["shapeGeo"].get();
-	wallFrontM->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallFrontM->IndexCount = wallFrontM->Geo->DrawArgs["box"].IndexCount;
-	wallFrontM->StartIndexLocation = wallFrontM->Geo->DrawArgs["box"].StartIndexLocation;
-	wallFrontM->BaseVertexLocation = wallFrontM->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallFrontM.get());
-	mAllRitems.push_back(std::move(wallFrontM));
+	XMStoreFloat4x4(&wallFrontM.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallFrontM.Mat = mMaterials["brick2"].get();
+	wallFrontM.Geo = mGeometries["shapeGeo"].get();
+	wallFrontM.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallFrontM.IndexCount = wallFrontM.Geo->DrawArgs["box"].IndexCount;
+	wallFrontM.StartIndexLocation = wallFrontM.Geo->DrawArgs["box"].StartIndexLocation;
+	wallFrontM.BaseVertexLocation = wallFrontM.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddWall(GetBoxOrientedBounds(wallFrontM.World));
+	AddRenderItem(std::move(wallFrontM), RenderLayer::Opaque);
+}
+
+// Walls block both the camera and the view.
+void CastleApp::AddWall(const BoundingOrientedBox& bounds)
+{
+	mCollision->AddBox(bounds);
+	mOcclusion->AddOccluder(bounds);
+	mCastleWallBounds.push_back(bounds);
 }
 
 void CastleApp::BuildTowers() {
 	//viewed from front perspective
-	auto cylinderFrontL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderFrontL->World, XMMatrixScaling(20.0, 33.0f, 20.0)
+	RenderItem cylinderFrontL;
+	XMStoreFloat4x4(&cylinderFrontL.World, XMMatrixScaling(20.0, 33.0f, 20.0)
 		* XMMatrixTranslation(59.0f, 16.5f, -59.0f));
-	XMStoreFloat4x4(&cylinderFrontL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderFrontL->ObjCBIndex = objCBIndex++;
-	cylinderFrontL->Mat = mMaterials["brick2"].get();
-	cylinderFrontL->Geo = mGeometries["shapeGeo"].get();
-	cylinderFrontL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderFrontL->IndexCount = cylinderFrontL->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderFrontL->StartIndexLocation = cylinderFrontL->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderFrontL->BaseVertexLocation = cylinderFrontL->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinderFrontL.get());
-	mAllRitems.push_back(std::move(cylinderFrontL));
-
-	auto coneFrontL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneFrontL->World, XMMatrixScaling(20.0, 38.0f, 20.0)
+	XMStoreFloat4x4(&cylinderFrontL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	cylinderFrontL.Mat = mMaterials["brick2"].get();
+	cylinderFrontL.Geo = mGeometries["shapeGeo"].get();
+	cylinderFrontL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	cylinderFrontL.IndexCount = cylinderFrontL.Geo->DrawArgs["cylinder"].IndexCount;
+	cylinderFrontL.StartIndexLocation = cylinderFrontL.Geo->DrawArgs["cylinder"].StartIndexLocation;
+	cylinderFrontL.BaseVertexLocation = cylinderFrontL.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+	AddRenderItem(std::move(cylinderFrontL), RenderLayer::Opaque);
+
+	RenderItem coneFrontL;
+	XMStoreFloat4x4(&coneFrontL.World, XMMatrixScaling(20.0, 38.0f, 20.0)
 		* XMMatrixTranslation(59.0f, 52.0f, -59.0f));
-	XMStoreFloat4x4(&coneFrontL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneFrontL->ObjCBIndex = objCBIndex++;
-	coneFrontL->Mat = mMaterials["wood"].get();
-	coneFrontL->Geo = mGeometries["shapeGeo"].get();
-	coneFrontL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneFrontL->IndexCount = coneFrontL->Geo->DrawArgs["cone"].IndexCount;
-	coneFrontL->StartIndexLocation = coneFrontL->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneFrontL->BaseVertexLocation = coneFrontL->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(coneFrontL.get());
-	mAllRitems.push_back(std::move(coneFrontL));
-
-	auto cylinderFrontR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderFrontR->World, XMMatrixScaling(20.0, 33.0f, 20.0)
+	XMStoreFloat4x4(&coneFrontL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	coneFrontL.Mat = mMaterials["wood"].get();
+	coneFrontL.Geo = mGeometries["shapeGeo"].get();
+	coneFrontL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	coneFrontL.IndexCount = coneFrontL.Geo->DrawArgs["cone"].IndexCount;
+	coneFrontL.StartIndexLocation = coneFrontL.Geo->DrawArgs["cone"].StartIndexLocation;
+	coneFrontL.BaseVertexLocation = coneFrontL.Geo->DrawArgs["cone"].BaseVertexLocation;
+	AddRenderItem(std::move(coneFrontL), RenderLayer::Opaque);
+
+	RenderItem cylinderFrontR;
+	XMStoreFloat4x4(&cylinderFrontR.World, XMMatrixScaling(20.0, 33.0f, 20.0)
 		* XMMatrixTranslation(59.0f, 16.5f, 59.0f));
-	XMStoreFloat4x4(&cylinderFrontR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderFrontR->ObjCBIndex = objCBIndex++;
-	cylinderFrontR->Mat = mMaterials["brick2"].get();
-	cylinderFrontR->Geo = mGeometries["shapeGeo"].get();
-	cylinderFrontR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderFrontR->IndexCount = cylinderFrontR->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderFrontR->StartIndexLocation = cylinderFrontR->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderFrontR->BaseVertexLocation = cylinderFrontR->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinderFrontR.get());
-	mAllRitems.push_back(std::move(cylinderFrontR));
-
-	auto coneFrontR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneFrontR->World, XMMatrixScaling(20.0, 38.0f, 20.0)
+	XMStoreFloat4x4(&cylinderFrontR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	cylinderFrontR.Mat = mMaterials["brick2"].get();
+	cylinderFrontR.Geo = mGeometries["shapeGeo"].get();
+	cylinderFrontR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	cylinderFrontR.IndexCount = cylinderFrontR.Geo->DrawArgs["cylinder"].IndexCount;
+	cylinderFrontR.StartIndexLocation = cylinderFrontR.Geo->DrawArgs["cylinder"].StartIndexLocation;
+	cylinderFrontR.BaseVertexLocation = cylinderFrontR.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+	AddRenderItem(std::move(cylinderFrontR), RenderLayer::Opaque);
+
+	RenderItem coneFrontR;
+	XMStoreFloat4x4(&coneFrontR.World, XMMatrixScaling(20.0, 38.0f, 20.0)
 		* XMMatrixTranslation(59.0f, 52.0f, 59.0f));
-	XMStoreFloat4x4(&coneFrontR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneFrontR->ObjCBIndex = objCBIndex++;
-	coneFrontR->Mat = mMaterials["wood"].get();
-	coneFrontR->Geo = mGeometries["shapeGeo"].get();
-	coneFrontR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneFrontR->IndexCount = coneFrontR->Geo->DrawArgs["cone"].IndexCount;
-	coneFrontR->StartIndexLocation = coneFrontR->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneFrontR->BaseVertexLocation = coneFrontR->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(coneFrontR.get());
-	mAllRitems.push_back(std::move(coneFrontR));
-
-	auto cylinderBackR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderBackR->World, XMMatrixScaling(20.0, 33.0f, 20.0)
+	XMStoreFloat4x4(&coneFrontR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	coneFrontR.Mat = mMaterials["wood"].get();
+	coneFrontR.Geo = mGeometries["shapeGeo"].get();
+	coneFrontR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	coneFrontR.IndexCount = coneFrontR.Geo->DrawArgs["cone"].IndexCount;
+	coneFrontR.StartIndexLocation = coneFrontR.Geo->DrawArgs["cone"].StartIndexLocation;
+	coneFrontR.BaseVertexLocation = coneFrontR.Geo->DrawArgs["cone"].BaseVertexLocation;
+	AddRenderItem(std::move(coneFrontR), RenderLayer::Opaque);
+
+	RenderItem cylinderBackR;
+	XMStoreFloat4x4(&cylinderBackR.World, XMMatrixScaling(20.0, 33.0f, 20.0)
 		* XMMatrixTranslation(-59.0f, 16.5f, 59.0f));
-	XMStoreFloat4x4(&cylinderBackR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderBackR->ObjCBIndex = objCBIndex++;
-	cylinderBackR->Mat = mMaterials["brick2"].get();
-	cylinderBackR->Geo = mGeometries["shapeGeo"].get();
-	cylinderBackR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderBackR->IndexCount = cylinderBackR->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderBackR->StartIndexLocation = cylinderBackR->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderBackR->BaseVertexLocation = cylinderBackR->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinderBackR.get());
-	mAllRitems.push_back(std::move(cylinderBackR));
-
-	auto coneBackR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneBackR->World, XMMatrixScaling(20.0, 38.0f, 20.0)
+	XMStoreFloat4x4(&cylinderBackR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	cylinderBackR.Mat = mMaterials["brick2"].get();
+	cylinderBackR.Geo = mGeometries["shapeGeo"].get();
+	cylinderBackR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	cylinderBackR.IndexCount = cylinderBackR.Geo->DrawArgs["cylinder"].IndexCount;
+	cylinderBackR.StartIndexLocation = cylinderBackR.Geo->DrawArgs["cylinder"].StartIndexLocation;
+	cylinderBackR.BaseVertexLocation = cylinderBackR.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+	AddRenderItem(std::move(cylinderBackR), RenderLayer::Opaque);
+
+	RenderItem coneBackR;
+	XMStoreFloat4x4(&coneBackR.World, XMMatrixScaling(20.0, 38.0f, 20.0)
 		* XMMatrixTranslation(-59.0f, 52.0f, 59.0f));
-	XMStoreFloat4x4(&coneBackR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneBackR->ObjCBIndex = objCBIndex++;
-	coneBackR->Mat = mMaterials["wood"].get();
-	coneBackR->Geo = mGeometries["shapeGeo"].get();
-	coneBackR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneBackR->IndexCount = coneBackR->Geo->DrawArgs["cone"].IndexCount;
-	coneBackR->StartIndexLocation = coneBackR->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneBackR->BaseVertexLocation = coneBackR->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(coneBackR.get());
-	mAllRitems.push_back(std::move(coneBackR));
-
-	auto cylinderBackL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&cylinderBackL->World, XMMatrixScaling(20.0, 33.0f, 20.0)
+	XMStoreFloat4x4(&coneBackR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	coneBackR.Mat = mMaterials["wood"].get();
+	coneBackR.Geo = mGeometries["shapeGeo"].get();
+	coneBackR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	coneBackR.IndexCount = coneBackR.Geo->DrawArgs["cone"].IndexCount;
+	coneBackR.StartIndexLocation = coneBackR.Geo->DrawArgs["cone"].StartIndexLocation;
+	coneBackR.BaseVertexLocation = coneBackR.Geo->DrawArgs["cone"].BaseVertexLocation;
+	AddRenderItem(std::move(coneBackR), RenderLayer::Opaque);
+
+	RenderItem cylinderBackL;
+	XMStoreFloat4x4(&cylinderBackL.World, XMMatrixScaling(20.0, 33.0f, 20.0)
 		* XMMatrixTranslation(-59.0f, 16.5f, -59.0f));
-	XMStoreFloat4x4(&cylinderBackL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	cylinderBackL->ObjCBIndex = objCBIndex++;
-	cylinderBackL->Mat = mMaterials["brick2"].get();
-	cylinderBackL->Geo = mGeometries["shapeGeo"].get();
-	cylinderBackL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	cylinderBackL->IndexCount = cylinderBackL->Geo->DrawArgs["cylinder"].IndexCount;
-	cylinderBackL->StartIndexLocation = cylinderBackL->Geo->DrawArgs["cylinder"].StartIndexLocation;
-	cylinderBackL->BaseVertexLocation = cylinderBackL->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinderBackL.get());
-	mAllRitems.push_back(std::move(cylinderBackL));
-
-	auto coneBackL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&coneBackL->World, XMMatrixScaling(20.0, 38.0f, 20.0)
+	XMStoreFloat4x4(&cylinderBackL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	cylinderBackL.Mat = mMaterials["brick2"].get();
+	cylinderBackL.Geo = mGeometries["shapeGeo"].get();
+	cylinderBackL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	cylinderBackL.IndexCount = cylinderBackL.Geo->DrawArgs["cylinder"].IndexCount;
+	cylinderBackL.StartIndexLocation = cylinderBackL.Geo->DrawArgs["cylinder"].StartIndexLocation;
+	cylinderBackL.BaseVertexLocation = cylinderBackL.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+	AddRenderItem(std::move(cylinderBackL), RenderLayer::Opaque);
+
+	RenderItem coneBackL;
+	XMStoreFloat4x4(&coneBackL.World, XMMatrixScaling(20.0, 38.0f, 20.0)
 		* XMMatrixTranslation(-59.0f, 52.0f, -59.0f));
-	XMStoreFloat4x4(&coneBackL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	coneBackL->ObjCBIndex = objCBIndex++;
-	coneBackL->Mat = mMaterials["wood"].get();
-	coneBackL->Geo = mGeometries["shapeGeo"].get();
-	coneBackL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	coneBackL->IndexCount = coneBackL->Geo->DrawArgs["cone"].IndexCount;
-	coneBackL->StartIndexLocation = coneBackL->Geo->DrawArgs["cone"].StartIndexLocation;
-	coneBackL->BaseVertexLocation = coneBackL->Geo->DrawArgs["cone"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(coneBackL.get());
-	mAllRitems.push_back(std::move(coneBackL));
+	XMStoreFloat4x4(&coneBackL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	coneBackL.Mat = mMaterials["wood"].get();
+	coneBackL.Geo = mGeometries["shapeGeo"].get();
+	coneBackL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	coneBackL.IndexCount = coneBackL.Geo->DrawArgs["cone"].IndexCount;
+	coneBackL.StartIndexLocation = coneBackL.Geo->DrawArgs["cone"].StartIndexLocation;
+	coneBackL.BaseVertexLocation = coneBackL.Geo->DrawArgs["cone"].BaseVertexLocation;
+	AddRenderItem(std::move(coneBackL), RenderLayer::Opaque);
 
 }
 
@@ -1965,111 +3435,97 @@ void CastleApp::BuildRailAndSpikes(float posX, float posY, float posZ, int dirX,
 	//i.e. if aligning along x axis, dirX = 1, dirZ = 0. multiplied into rotation
 
 	//the railing
-	auto railFrontO = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&railFrontO->World, XMMatrixScaling(100.0f, 2.0f, 1.0f)
+	RenderItem railFrontO;
+	XMStoreFloat4x4(&railFrontO.World, XMMatrixScaling(100.0f, 2.0f, 1.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90 * dirZ))
 		* XMMatrixTranslation(posX, posY, posZ));
-	XMStoreFloat4x4(&railFrontO->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	railFrontO->ObjCBIndex = objCBIndex++;
-	railFrontO->Mat = mMaterials["wood"].get();
-	railFrontO->Geo = mGeometries["shapeGeo"].get();
-	railFrontO->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	railFrontO->IndexCount = railFrontO->Geo->DrawArgs["box"].IndexCount;
-	railFrontO->StartIndexLocation = railFrontO->Geo->DrawArgs["box"].StartIndexLocation;
-	railFrontO->BaseVertexLocation = railFrontO->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(railFrontO.get());
-	mAllRitems.push_back(std::move(railFrontO));
+	XMStoreFloat4x4(&railFrontO.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	railFrontO.Mat = mMaterials["wood"].get();
+	railFrontO.Geo = mGeometries["shapeGeo"].get();
+	railFrontO.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	railFrontO.IndexCount = railFrontO.Geo->DrawArgs["box"].IndexCount;
+	railFrontO.StartIndexLocation = railFrontO.Geo->DrawArgs["box"].StartIndexLocation;
+	railFrontO.BaseVertexLocation = railFrontO.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddRenderItem(std::move(railFrontO), RenderLayer::Opaque);
 
 	//loop: @i=0, build middle point. @i = 1, build 1st spike to left and right, and so on for a total of 9 spikes
 	//  4 3 2 1 0 1 2 3 4  placement
 	for (int i = 0; i < 5; i++) {
 		if (i == 0) {
 			//the middle 'point' of the railing
-			auto block = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&block->World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
+			RenderItem block;
+			XMStoreFloat4x4(&block.World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
 				* XMMatrixTranslation(posX + i*10.0f*dirX, posY + 1.0f, posZ + i*10.0f*dirZ));
-			XMStoreFloat4x4(&block->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			block->ObjCBIndex = objCBIndex++;
-			block->Mat = mMaterials["stone"].get();
-			block->Geo = mGeometries["shapeGeo"].get();
-			block->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			block->IndexCount = block->Geo->DrawArgs["box"].IndexCount;
-			block->StartIndexLocation = block->Geo->DrawArgs["box"].StartIndexLocation;
-			block->BaseVertexLocation = block->Geo->DrawArgs["box"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(block.get());
-			mAllRitems.push_back(std::move(block));
-
-			auto pyramid = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&pyramid->World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
+			XMStoreFloat4x4(&block.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			block.Mat = mMaterials["stone"].get();
+			block.Geo = mGeometries["shapeGeo"].get();
+			block.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			block.IndexCount = block.Geo->DrawArgs["box"].IndexCount;
+			block.StartIndexLocation = block.Geo->DrawArgs["box"].StartIndexLocation;
+			block.BaseVertexLocation = block.Geo->DrawArgs["box"].BaseVertexLocation;
+			AddRenderItem(std::move(block), RenderLayer::Opaque);
+
+			RenderItem pyramid;
+			XMStoreFloat4x4(&pyramid.World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
 				* XMMatrixTranslation(posX + i*10.0f*dirX, posY + 3.0f, posZ + i*10.0f*dirZ));
-			XMStoreFloat4x4(&pyramid->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			pyramid->ObjCBIndex = objCBIndex++;
-			pyramid->Mat = mMaterials["stone"].get();
-			pyramid->Geo = mGeometries["shapeGeo"].get();
-			pyramid->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			pyramid->IndexCount = pyramid->Geo->DrawArgs["pyramid"].IndexCount;
-			pyramid->StartIndexLocation = pyramid->Geo->DrawArgs["pyramid"].StartIndexLocation;
-			pyramid->BaseVertexLocation = pyramid->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(pyramid.get());
-			mAllRitems.push_back(std::move(pyramid));
+			XMStoreFloat4x4(&pyramid.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			pyramid.Mat = mMaterials["stone"].get();
+			pyramid.Geo = mGeometries["shapeGeo"].get();
+			pyramid.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			pyramid.IndexCount = pyramid.Geo->DrawArgs["pyramid"].IndexCount;
+			pyramid.StartIndexLocation = pyramid.Geo->DrawArgs["pyramid"].StartIndexLocation;
+			pyramid.BaseVertexLocation = pyramid.Geo->DrawArgs["pyramid"].BaseVertexLocation;
+			AddRenderItem(std::move(pyramid), RenderLayer::Opaque);
 		}
 		else {
 			
-			auto block = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&block->World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
+			RenderItem block;
+			XMStoreFloat4x4(&block.World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
 				* XMMatrixTranslation(posX + i*10.0f*dirX, posY + 1.0f, posZ + i*10.0f*dirZ));
-			XMStoreFloat4x4(&block->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			block->ObjCBIndex = objCBIndex++;
-			block->Mat = mMaterials["stone"].get();
-			block->Geo = mGeometries["shapeGeo"].get();
-			block->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			block->IndexCount = block->Geo->DrawArgs["box"].IndexCount;
-			block->StartIndexLocation = block->Geo->DrawArgs["box"].StartIndexLocation;
-			block->BaseVertexLocation = block->Geo->DrawArgs["box"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(block.get());
-			mAllRitems.push_back(std::move(block));
-
-			auto pyramid = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&pyramid->World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
+			XMStoreFloat4x4(&block.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			block.Mat = mMaterials["stone"].get();
+			block.Geo = mGeometries["shapeGeo"].get();
+			block.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			block.IndexCount = block.Geo->DrawArgs["box"].IndexCount;
+			block.StartIndexLocation = block.Geo->DrawArgs["box"].StartIndexLocation;
+			block.BaseVertexLocation = block.Geo->DrawArgs["box"].BaseVertexLocation;
+			AddRenderItem(std::move(block), RenderLayer::Opaque);
+
+			RenderItem pyramid;
+			XMStoreFloat4x4(&pyramid.World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
 				* XMMatrixTranslation(posX + i*10.0f*dirX, posY + 3.0f, posZ + i*10.0f*dirZ));
-			XMStoreFloat4x4(&pyramid->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			pyramid->ObjCBIndex = objCBIndex++;
-			pyramid->Mat = mMaterials["stone"].get();
-			pyramid->Geo = mGeometries["shapeGeo"].get();
-			pyramid->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			pyramid->IndexCount = pyramid->Geo->DrawArgs["pyramid"].IndexCount;
-			pyramid->StartIndexLocation = pyramid->Geo->DrawArgs["pyramid"].StartIndexLocation;
-			pyramid->BaseVertexLocation = pyramid->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(pyramid.get());
-			mAllRitems.push_back(std::move(pyramid));
-
-			auto block2 = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&block2->World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
+			XMStoreFloat4x4(&pyramid.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			pyramid.Mat = mMaterials["stone"].get();
+			pyramid.Geo = mGeometries["shapeGeo"].get();
+			pyramid.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			pyramid.IndexCount = pyramid.Geo->DrawArgs["pyramid"].IndexCount;
+			pyramid.StartIndexLocation = pyramid.Geo->DrawArgs["pyramid"].StartIndexLocation;
+			pyramid.BaseVertexLocation = pyramid.Geo->DrawArgs["pyramid"].BaseVertexLocation;
+			AddRenderItem(std::move(pyramid), RenderLayer::Opaque);
+
+			RenderItem block2;
+			XMStoreFloat4x4(&block2.World, XMMatrixScaling(2.0f, 4.0f, 2.0f)
 				* XMMatrixTranslation(posX - i*10.0f*dirX, posY + 1.0f, posZ - i*10.0f*dirZ));
-			XMStoreFloat4x4(&block2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			block2->ObjCBIndex = objCBIndex++;
-			block2->Mat = mMaterials["stone"].get();
-			block2->Geo = mGeometries["shapeGeo"].get();
-			block2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			block2->IndexCount = block2->Geo->DrawArgs["box"].IndexCount;
-			block2->StartIndexLocation = block2->Geo->DrawArgs["box"].StartIndexLocation;
-			block2->BaseVertexLocation = block2->Geo->DrawArgs["box"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(block2.get());
-			mAllRitems.push_back(std::move(block2));
-
-			auto pyramid2 = std::make_unique<RenderItem>();
-			XMStoreFloat4x4(&pyramid2->World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
+			XMStoreFloat4x4(&block2.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			block2.Mat = mMaterials["stone"].get();
+			block2.Geo = mGeometries["shapeGeo"].get();
+			block2.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			block2.IndexCount = block2.Geo->DrawArgs["box"].IndexCount;
+			block2.StartIndexLocation = block2.Geo->DrawArgs["box"].StartIndexLocation;
+			block2.BaseVertexLocation = block2.Geo->DrawArgs["box"].BaseVertexLocation;
+			AddRenderItem(std::move(block2), RenderLayer::Opaque);
+
+			RenderItem pyramid2;
+			XMStoreFloat4x4(&pyramid2.World, XMMatrixScaling(3.0f, 3.0f, 3.0f)
 				* XMMatrixTranslation(posX - i*10.0f*dirX, posY + 3.0f, posZ - i*10.0f*dirZ));
-			XMStoreFloat4x4(&pyramid2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-			pyramid2->ObjCBIndex = objCBIndex++;
-			pyramid2->Mat = mMaterials["stone"].get();
-			pyramid2->Geo = mGeometries["shapeGeo"].get();
-			pyramid2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			pyramid2->IndexCount = pyramid2->Geo->DrawArgs["pyramid"].IndexCount;
-			pyramid2->StartIndexLocation = pyramid2->Geo->DrawArgs["pyramid"].StartIndexLocation;
-			pyramid2->BaseVertexLocation = pyramid2->Geo->DrawArgs["pyramid"].BaseVertexLocation;
-			mRitemLayer[(int)RenderLayer::Opaque].push_back(pyramid2.get());
-			mAllRitems.push_back(std::move(pyramid2));
+			XMStoreFloat4x4(&pyramid2.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+			pyramid2.Mat = mMaterials["stone"].get();
+			pyramid2.Geo = mGeometries["shapeGeo"].get();
+			pyramid2.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			pyramid2.IndexCount = pyramid2.Geo->DrawArgs["pyramid"].IndexCount;
+			pyramid2.StartIndexLocation = pyramid2.Geo->DrawArgs["pyramid"].StartIndexLocation;
+			pyramid2.BaseVertexLocation = pyramid2.Geo->DrawArgs["pyramid"].BaseVertexLocation;
+			AddRenderItem(std::move(pyramid2), RenderLayer::Opaque);
 		}
 	}
 }
@@ -2077,383 +3533,673 @@ void CastleApp::BuildRailAndSpikes(float posX, float posY, float posZ, int dirX,
 void CastleApp::BuildInner() {
 
 	//path
-	auto floor = std::make_unique<RenderItem>();
-	floor->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&floor->World, XMMatrixScaling(230.0f, 1.0, 30.0f)
+	RenderItem floor;
+	floor.World = MathHelper::Identity4x4();
+	XMStoreFloat4x4(&floor.World, XMMatrixScaling(230.0f, 1.0, 30.0f)
 		* XMMatrixTranslation(60.0f, 0.1f, 0.0f));
-	XMStoreFloat4x4(&floor->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	floor->ObjCBIndex = objCBIndex++;
-	floor->Mat = mMaterials["tile"].get();
-	floor->Geo = mGeometries["shapeGeo"].get();
-	floor->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	floor->IndexCount = floor->Geo->DrawArgs["grid"].IndexCount;
-	floor->StartIndexLocation = floor->Geo->DrawArgs["grid"].StartIndexLocation;
-	floor->BaseVertexLocation = floor->Geo->DrawArgs["grid"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(floor.get());
-	mAllRitems.push_back(std::move(floor));
+	XMStoreFloat4x4(&floor.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	floor.Mat = mMaterials["tile"].get();
+	floor.Geo = mGeometries["shapeGeo"].get();
+	floor.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	floor.IndexCount = floor.Geo->DrawArgs["grid"].IndexCount;
+	floor.StartIndexLocation = floor.Geo->DrawArgs["grid"].StartIndexLocation;
+	floor.BaseVertexLocation = floor.Geo->DrawArgs["grid"].BaseVertexLocation;
+	AddRenderItem(std::move(floor), RenderLayer::Opaque);
 
 	//pillars
 	//xyz = 0, 0, -15, dX of 30. 
 	//x values of -30, 0, 30. z values = -15 or 15
 	for (int i = 0; i < 3; i++) {
-		auto cylinder = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&cylinder->World, XMMatrixScaling(1.0f, 15.0f, 1.0f)
+		RenderItem cylinder;
+		XMStoreFloat4x4(&cylinder.World, XMMatrixScaling(1.0f, 15.0f, 1.0f)
 			* XMMatrixTranslation(-30.0f + 30.0f*i, 7.5f, -15.0f));
-		XMStoreFloat4x4(&cylinder->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		cylinder->ObjCBIndex = objCBIndex++;
-		cylinder->Mat = mMaterials["metal"].get();
-		cylinder->Geo = mGeometries["shapeGeo"].get();
-		cylinder->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		cylinder->IndexCount = cylinder->Geo->DrawArgs["cylinder"].IndexCount;
-		cylinder->StartIndexLocation = cylinder->Geo->DrawArgs["cylinder"].StartIndexLocation;
-		cylinder->BaseVertexLocation = cylinder->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinder.get());
-		mAllRitems.push_back(std::move(cylinder));
-
-		auto sphere = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&sphere->World, XMMatrixScaling(2.0f, 2.0f, 2.0f)
+		XMStoreFloat4x4(&cylinder.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+		cylinder.Mat = mMaterials["metal"].get();
+		cylinder.Geo = mGeometries["shapeGeo"].get();
+		cylinder.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		cylinder.IndexCount = cylinder.Geo->DrawArgs["cylinder"].IndexCount;
+		cylinder.StartIndexLocation = cylinder.Geo->DrawArgs["cylinder"].StartIndexLocation;
+		cylinder.BaseVertexLocation = cylinder.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		AddRenderItem(std::move(cylinder), RenderLayer::Opaque);
+
+		RenderItem sphere;
+		XMStoreFloat4x4(&sphere.World, XMMatrixScaling(2.0f, 2.0f, 2.0f)
 			* XMMatrixTranslation(-30.0f + 30.0f*i, 16.5f, -15.0f));
-		XMStoreFloat4x4(&sphere->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		sphere->ObjCBIndex = objCBIndex++;
-		sphere->Mat = mMaterials["glass"].get();
-		sphere->Geo = mGeometries["shapeGeo"].get();
-		sphere->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		sphere->IndexCount = sphere->Geo->DrawArgs["sphere"].IndexCount;
-		sphere->StartIndexLocation = sphere->Geo->DrawArgs["sphere"].StartIndexLocation;
-		sphere->BaseVertexLocation = sphere->Geo->DrawArgs["sphere"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(sphere.get());
-		mAllRitems.push_back(std::move(sphere));
-
-
-		cylinder = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&cylinder->World, XMMatrixScaling(1.0f, 15.0f, 1.0f)
+		XMStoreFloat4x4(&sphere.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+		sphere.Mat = mMaterials["glass"].get();
+		sphere.Geo = mGeometries["shapeGeo"].get();
+		sphere.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		sphere.IndexCount = sphere.Geo->DrawArgs["sphere"].IndexCount;
+		sphere.StartIndexLocation = sphere.Geo->DrawArgs["sphere"].StartIndexLocation;
+		sphere.BaseVertexLocation = sphere.Geo->DrawArgs["sphere"].BaseVertexLocation;
+		AddRenderItem(std::move(sphere), RenderLayer::Opaque);
+
+
+		cylinder = RenderItem();
+		XMStoreFloat4x4(&cylinder.World, XMMatrixScaling(1.0f, 15.0f, 1.0f)
 			* XMMatrixTranslation(-30.0f + 30.0f*i, 7.5f, 15.0f));
-		XMStoreFloat4x4(&cylinder->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		cylinder->ObjCBIndex = objCBIndex++;
-		cylinder->Mat = mMaterials["metal"].get();
-		cylinder->Geo = mGeometries["shapeGeo"].get();
-		cylinder->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		cylinder->IndexCount = cylinder->Geo->DrawArgs["cylinder"].IndexCount;
-		cylinder->StartIndexLocation = cylinder->Geo->DrawArgs["cylinder"].StartIndexLocation;
-		cylinder->BaseVertexLocation = cylinder->Geo->DrawArgs["cylinder"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(cylinder.get());
-		mAllRitems.push_back(std::move(cylinder));
-
-		sphere = std::make_unique<RenderItem>();
-		XMStoreFloat4x4(&sphere->World, XMMatrixScaling(2.0f, 2.0f, 2.0f)
+		XMStoreFloat4x4(&cylinder.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+		cylinder.Mat = mMaterials["metal"].get();
+		cylinder.Geo = mGeometries["shapeGeo"].get();
+		cylinder.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		cylinder.IndexCount = cylinder.Geo->DrawArgs["cylinder"].IndexCount;
+		cylinder.StartIndexLocation = cylinder.Geo->DrawArgs["cylinder"].StartIndexLocation;
+		cylinder.BaseVertexLocation = cylinder.Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		AddRenderItem(std::move(cylinder), RenderLayer::Opaque);
+
+		sphere = RenderItem();
+		XMStoreFloat4x4(&sphere.World, XMMatrixScaling(2.0f, 2.0f, 2.0f)
 			* XMMatrixTranslation(-30.0f + 30.0f*i, 16.5f, 15.0f));
-		XMStoreFloat4x4(&sphere->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-		sphere->ObjCBIndex = objCBIndex++;
-		sphere->Mat = mMaterials["glass"].get();
-		sphere->Geo = mGeometries["shapeGeo"].get();
-		sphere->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		sphere->IndexCount = sphere->Geo->DrawArgs["sphere"].IndexCount;
-		sphere->StartIndexLocation = sphere->Geo->DrawArgs["sphere"].StartIndexLocation;
-		sphere->BaseVertexLocation = sphere->Geo->DrawArgs["sphere"].BaseVertexLocation;
-		mRitemLayer[(int)RenderLayer::Opaque].push_back(sphere.get());
-		mAllRitems.push_back(std::move(sphere));
+		XMStoreFloat4x4(&sphere.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+		sphere.Mat = mMaterials["glass"].get();
+		sphere.Geo = mGeometries["shapeGeo"].get();
+		sphere.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		sphere.IndexCount = sphere.Geo->DrawArgs["sphere"].IndexCount;
+		sphere.StartIndexLocation = sphere.Geo->DrawArgs["sphere"].StartIndexLocation;
+		sphere.BaseVertexLocation = sphere.Geo->DrawArgs["sphere"].BaseVertexLocation;
+		AddRenderItem(std::move(sphere), RenderLayer::Opaque);
 	}
 
 	//altar
 
-	auto altarLower = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&altarLower->World, XMMatrixScaling(15.0f, 1.0f, 15.0f) * XMMatrixTranslation(-35.0f, 0.6f, 0.0f));
-	XMStoreFloat4x4(&altarLower->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	altarLower->ObjCBIndex = objCBIndex++;
-	altarLower->Mat = mMaterials["stone"].get();
-	altarLower->Geo = mGeometries["shapeGeo"].get();
-	altarLower->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	altarLower->IndexCount = altarLower->Geo->DrawArgs["box"].IndexCount;
-	altarLower->StartIndexLocation = altarLower->Geo->DrawArgs["box"].StartIndexLocation;
-	altarLower->BaseVertexLocation = altarLower->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(altarLower.get());
-	mAllRitems.push_back(std::move(altarLower));
-
-
-	auto altarUpper = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&altarUpper->World, XMMatrixScaling(11.0f, 1.0f, 11.0f) * XMMatrixTranslation(-35.0f, 1.6f, 0.0f));
-	XMStoreFloat4x4(&altarUpper->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	altarUpper->ObjCBIndex = objCBIndex++;
-	altarUpper->Mat = mMaterials["stone"].get();
-	altarUpper->Geo = mGeometries["shapeGeo"].get();
-	altarUpper->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	altarUpper->IndexCount = altarUpper->Geo->DrawArgs["box"].IndexCount;
-	altarUpper->StartIndexLocation = altarUpper->Geo->DrawArgs["box"].StartIndexLocation;
-	altarUpper->BaseVertexLocation = altarUpper->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(altarUpper.get());
-	mAllRitems.push_back(std::move(altarUpper));
+	RenderItem altarLower;
+	XMStoreFloat4x4(&altarLower.World, XMMatrixScaling(15.0f, 1.0f, 15.0f) * XMMatrixTranslation(-35.0f, 0.6f, 0.0f));
+	XMStoreFloat4x4(&altarLower.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	altarLower.Mat = mMaterials["stone"].get();
+	altarLower.Geo = mGeometries["shapeGeo"].get();
+	altarLower.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	altarLower.IndexCount = altarLower.Geo->DrawArgs["box"].IndexCount;
+	altarLower.StartIndexLocation = altarLower.Geo->DrawArgs["box"].StartIndexLocation;
+	altarLower.BaseVertexLocation = altarLower.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddRenderItem(std::move(altarLower), RenderLayer::Opaque);
+
+
+	RenderItem altarUpper;
+	XMStoreFloat4x4(&altarUpper.World, XMMatrixScaling(11.0f, 1.0f, 11.0f) * XMMatrixTranslation(-35.0f, 1.6f, 0.0f));
+	XMStoreFloat4x4(&altarUpper.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	altarUpper.Mat = mMaterials["stone"].get();
+	altarUpper.Geo = mGeometries["shapeGeo"].get();
+	altarUpper.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	altarUpper.IndexCount = altarUpper.Geo->DrawArgs["box"].IndexCount;
+	altarUpper.StartIndexLocation = altarUpper.Geo->DrawArgs["box"].StartIndexLocation;
+	altarUpper.BaseVertexLocation = altarUpper.Geo->DrawArgs["box"].BaseVertexLocation;
+	AddRenderItem(std::move(altarUpper), RenderLayer::Opaque);
 
 	//the 'goal'
-	auto torus = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&torus->World, XMMatrixScaling(2.0f, 2.0f, 2.0f) * XMMatrixTranslation(-35.0f, 3.8f, 0.0f));
-	XMStoreFloat4x4(&torus->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	torus->ObjCBIndex = objCBIndex++;
-	torus->Mat = mMaterials["ice"].get();
-	torus->Geo = mGeometries["shapeGeo"].get();
-	torus->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	torus->IndexCount = torus->Geo->DrawArgs["torus"].IndexCount;
-	torus->StartIndexLocation = torus->Geo->DrawArgs["torus"].StartIndexLocation;
-	torus->BaseVertexLocation = torus->Geo->DrawArgs["torus"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(torus.get());
-	mAllRitems.push_back(std::move(torus));
+	RenderItem torus;
+	XMStoreFloat4x4(&torus.World, XMMatrixScaling(2.0f, 2.0f, 2.0f) * XMMatrixTranslation(-35.0f, 3.8f, 0.0f));
+	XMStoreFloat4x4(&torus.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	torus.Mat = mMaterials["ice"].get();
+	torus.Geo = mGeometries["shapeGeo"].get();
+	torus.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	torus.IndexCount = torus.Geo->DrawArgs["torus"].IndexCount;
+	torus.StartIndexLocation = torus.Geo->DrawArgs["torus"].StartIndexLocation;
+	torus.BaseVertexLocation = torus.Geo->DrawArgs["torus"].BaseVertexLocation;
+	AddRenderItem(std::move(torus), RenderLayer::Opaque);
+
+	//the skull, in the middle of the courtyard facing the gate.
+	if (mGeometries.count("skullGeo") != 0)
+	{
+		RenderItem skull;
+		XMStoreFloat4x4(&skull.World, XMMatrixRotationY(-0.5f*MathHelper::Pi) * XMMatrixTranslation(0.0f, 0.2f, 0.0f));
+		XMStoreFloat4x4(&skull.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+		skull.Mat = mMaterials["stone"].get();
+		skull.Geo = mGeometries["skullGeo"].get();
+		skull.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		skull.IndexCount = skull.Geo->DrawArgs["skull"].IndexCount;
+		skull.StartIndexLocation = skull.Geo->DrawArgs["skull"].StartIndexLocation;
+		skull.BaseVertexLocation = skull.Geo->DrawArgs["skull"].BaseVertexLocation;
+		AddRenderItem(std::move(skull), RenderLayer::Opaque);
+	}
 }
 
 void CastleApp::BuildMaze() {
 
 	//floor
-	auto floor = std::make_unique<RenderItem>();
-	floor->World = MathHelper::Identity4x4();
-	XMStoreFloat4x4(&floor->World, XMMatrixScaling(115.0f, 1.0f, 138.0f)
+	RenderItem floor;
+	floor.World = MathHelper::Identity4x4();
+	XMStoreFloat4x4(&floor.World, XMMatrixScaling(115.0f, 1.0f, 138.0f)
 		* XMMatrixTranslation(232.0f, 0.1f, 0.0f));
-	XMStoreFloat4x4(&floor->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	floor->ObjCBIndex = objCBIndex++;
-	floor->Mat = mMaterials["tile"].get();
-	floor->Geo = mGeometries["shapeGeo"].get();
-	floor->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	floor->IndexCount = floor->Geo->DrawArgs["grid"].IndexCount;
-	floor->StartIndexLocation = floor->Geo->DrawArgs["grid"].StartIndexLocation;
-	floor->BaseVertexLocation = floor->Geo->DrawArgs["grid"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(floor.get());
-	mAllRitems.push_back(std::move(floor));
+	XMStoreFloat4x4(&floor.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	floor.Mat = mMaterials["tile"].get();
+	floor.Geo = mGeometries["shapeGeo"].get();
+	floor.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	floor.IndexCount = floor.Geo->DrawArgs["grid"].IndexCount;
+	floor.StartIndexLocation = floor.Geo->DrawArgs["grid"].StartIndexLocation;
+	floor.BaseVertexLocation = floor.Geo->DrawArgs["grid"].BaseVertexLocation;
+	AddRenderItem(std::move(floor), RenderLayer::Opaque);
 
 
 
 	//outer maze walls
-	auto wallLeft = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallLeft->World, XMMatrixScaling(1.5f, 25.0f, 78.0f)
+	RenderItem wallLeft;
+	XMStoreFloat4x4(&wallLeft.World, XMMatrixScaling(1.5f, 25.0f, 78.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(232.0f, 12.5f, -69.2f));
-	XMStoreFloat4x4(&wallLeft->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallLeft->ObjCBIndex = objCBIndex++;
-	wallLeft->Mat = mMaterials["brick2"].get();
-	wallLeft->Geo = mGeometries["shapeGeo"].get();
-	wallLeft->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallLeft->IndexCount = wallLeft->Geo->DrawArgs["box"].IndexCount;
-	wallLeft->StartIndexLocation = wallLeft->Geo->DrawArgs["box"].StartIndexLocation;
-	wallLeft->BaseVertexLocation = wallLeft->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallLeft.get());
-	mAllRitems.push_back(std::move(wallLeft));
-
-	auto wallRight = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallRight->World, XMMatrixScaling(1.5f, 25.0f, 78.0f)
+	XMStoreFloat4x4(&wallLeft.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallLeft.Mat = mMaterials["brick2"].get();
+	wallLeft.Geo = mGeometries["shapeGeo"].get();
+	wallLeft.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallLeft.IndexCount = wallLeft.Geo->DrawArgs["box"].IndexCount;
+	wallLeft.StartIndexLocation = wallLeft.Geo->DrawArgs["box"].StartIndexLocation;
+	wallLeft.BaseVertexLocation = wallLeft.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallLeft.World));
+	AddRenderItem(std::move(wallLeft), RenderLayer::Opaque);
+
+	RenderItem wallRight;
+	XMStoreFloat4x4(&wallRight.World, XMMatrixScaling(1.5f, 25.0f, 78.0f)
 		* XMMatrixRotationY(XMConvertToRadians(90))
 		* XMMatrixTranslation(232.0f, 12.5f, 69.2f));
-	XMStoreFloat4x4(&wallRight->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallRight->ObjCBIndex = objCBIndex++;
-	wallRight->Mat = mMaterials["brick2"].get();
-	wallRight->Geo = mGeometries["shapeGeo"].get();
-	wallRight->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallRight->IndexCount = wallRight->Geo->DrawArgs["box"].IndexCount;
-	wallRight->StartIndexLocation = wallRight->Geo->DrawArgs["box"].StartIndexLocation;
-	wallRight->BaseVertexLocation = wallRight->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallRight.get());
-	mAllRitems.push_back(std::move(wallRight));
+	XMStoreFloat4x4(&wallRight.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallRight.Mat = mMaterials["brick2"].get();
+	wallRight.Geo = mGeometries["shapeGeo"].get();
+	wallRight.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallRight.IndexCount = wallRight.Geo->DrawArgs["box"].IndexCount;
+	wallRight.StartIndexLocation = wallRight.Geo->DrawArgs["box"].StartIndexLocation;
+	wallRight.BaseVertexLocation = wallRight.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallRight.World));
+	AddRenderItem(std::move(wallRight), RenderLayer::Opaque);
 
 	//ratio  54 (unity) -> 37 (code) = 0.68518
-	auto wallBackL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallBackL->World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
+	RenderItem wallBackL;
+	XMStoreFloat4x4(&wallBackL.World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
 		* XMMatrixTranslation(174.75f, 12.5f, -42.0f));
-	XMStoreFloat4x4(&wallBackL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallBackL->ObjCBIndex = objCBIndex++;
-	wallBackL->Mat = mMaterials["brick2"].get();
-	wallBackL->Geo = mGeometries["shapeGeo"].get();
-	wallBackL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallBackL->IndexCount = wallBackL->Geo->DrawArgs["box"].IndexCount;
-	wallBackL->StartIndexLocation = wallBackL->Geo->DrawArgs["box"].StartIndexLocation;
-	wallBackL->BaseVertexLocation = wallBackL->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallBackL.get());
-	mAllRitems.push_back(std::move(wallBackL));
-
-	auto wallBackR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallBackR->World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
+	XMStoreFloat4x4(&wallBackL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallBackL.Mat = mMaterials["brick2"].get();
+	wallBackL.Geo = mGeometries["shapeGeo"].get();
+	wallBackL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallBackL.IndexCount = wallBackL.Geo->DrawArgs["box"].IndexCount;
+	wallBackL.StartIndexLocation = wallBackL.Geo->DrawArgs["box"].StartIndexLocation;
+	wallBackL.BaseVertexLocation = wallBackL.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallBackL.World));
+	AddRenderItem(std::move(wallBackL), RenderLayer::Opaque);
+
+	RenderItem wallBackR;
+	XMStoreFloat4x4(&wallBackR.World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
 		* XMMatrixTranslation(174.75f, 12.5f, 42.0f));
-	XMStoreFloat4x4(&wallBackR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallBackR->ObjCBIndex = objCBIndex++;
-	wallBackR->Mat = mMaterials["brick2"].get();
-	wallBackR->Geo = mGeometries["shapeGeo"].get();
-	wallBackR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallBackR->IndexCount = wallBackR->Geo->DrawArgs["box"].IndexCount;
-	wallBackR->StartIndexLocation = wallBackR->Geo->DrawArgs["box"].StartIndexLocation;
-	wallBackR->BaseVertexLocation = wallBackR->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallBackR.get());
-	mAllRitems.push_back(std::move(wallBackR));
-
-	auto wallFrontL = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallFrontL->World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
+	XMStoreFloat4x4(&wallBackR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallBackR.Mat = mMaterials["brick2"].get();
+	wallBackR.Geo = mGeometries["shapeGeo"].get();
+	wallBackR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallBackR.IndexCount = wallBackR.Geo->DrawArgs["box"].IndexCount;
+	wallBackR.StartIndexLocation = wallBackR.Geo->DrawArgs["box"].StartIndexLocation;
+	wallBackR.BaseVertexLocation = wallBackR.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallBackR.World));
+	AddRenderItem(std::move(wallBackR), RenderLayer::Opaque);
+
+	RenderItem wallFrontL;
+	XMStoreFloat4x4(&wallFrontL.World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
 		* XMMatrixTranslation(289.5f, 12.5f, -42.0f));
-	XMStoreFloat4x4(&wallFrontL->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallFrontL->ObjCBIndex = objCBIndex++;
-	wallFrontL->Mat = mMaterials["brick2"].get();
-	wallFrontL->Geo = mGeometries["shapeGeo"].get();
-	wallFrontL->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallFrontL->IndexCount = wallFrontL->Geo->DrawArgs["box"].IndexCount;
-	wallFrontL->StartIndexLocation = wallFrontL->Geo->DrawArgs["box"].StartIndexLocation;
-	wallFrontL->BaseVertexLocation = wallFrontL->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallFrontL.get());
-	mAllRitems.push_back(std::move(wallFrontL));
-
-	auto wallFrontR = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallFrontR->World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
+	XMStoreFloat4x4(&wallFrontL.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallFrontL.Mat = mMaterials["brick2"].get();
+	wallFrontL.Geo = mGeometries["shapeGeo"].get();
+	wallFrontL.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallFrontL.IndexCount = wallFrontL.Geo->DrawArgs["box"].IndexCount;
+	wallFrontL.StartIndexLocation = wallFrontL.Geo->DrawArgs["box"].StartIndexLocation;
+	wallFrontL.BaseVertexLocation = wallFrontL.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallFrontL.World));
+	AddRenderItem(std::move(wallFrontL), RenderLayer::Opaque);
+
+	RenderItem wallFrontR;
+	XMStoreFloat4x4(&wallFrontR.World, XMMatrixScaling(1.5f, 25.0f, 37.0f)
 		* XMMatrixTranslation(289.5f, 12.5f, 42.0f));
-	XMStoreFloat4x4(&wallFrontR->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallFrontR->ObjCBIndex = objCBIndex++;
-	wallFrontR->Mat = mMaterials["brick2"].get();
-	wallFrontR->Geo = mGeometries["shapeGeo"].get();
-	wallFrontR->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallFrontR->IndexCount = wallFrontR->Geo->DrawArgs["box"].IndexCount;
-	wallFrontR->StartIndexLocation = wallFrontR->Geo->DrawArgs["box"].StartIndexLocation;
-	wallFrontR->BaseVertexLocation = wallFrontR->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallFrontR.get());
-	mAllRitems.push_back(std::move(wallFrontR));
-
-
-	//inner maze, left/right orientation
-	//scale value in Unity / 116 * 78
-	auto wallL1 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallL1->World, XMMatrixScaling(1.5f, 25.0f, 30.95f)
-		* XMMatrixRotationY(XMConvertToRadians(90))
-		* XMMatrixTranslation(197.87f, 12.5f, -15.77f));
-	XMStoreFloat4x4(&wallL1->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallL1->ObjCBIndex = objCBIndex++;
-	wallL1->Mat = mMaterials["brick2"].get();
-	wallL1->Geo = mGeometries["shapeGeo"].get();
-	wallL1->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallL1->IndexCount = wallL1->Geo->DrawArgs["box"].IndexCount;
-	wallL1->StartIndexLocation = wallL1->Geo->DrawArgs["box"].StartIndexLocation;
-	wallL1->BaseVertexLocation = wallL1->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallL1.get());
-	mAllRitems.push_back(std::move(wallL1));
-
-	auto wallL2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallL2->World, XMMatrixScaling(1.5f, 25.0f, 17.48f)
-		* XMMatrixRotationY(XMConvertToRadians(90))
-		* XMMatrixTranslation(207.9f, 12.5f, -43.46f));
-	XMStoreFloat4x4(&wallL2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallL2->ObjCBIndex = objCBIndex++;
-	wallL2->Mat = mMaterials["brick2"].get();
-	wallL2->Geo = mGeometries["shapeGeo"].get();
-	wallL2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallL2->IndexCount = wallL2->Geo->DrawArgs["box"].IndexCount;
-	wallL2->StartIndexLocation = wallL2->Geo->DrawArgs["box"].StartIndexLocation;
-	wallL2->BaseVertexLocation = wallL2->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallL2.get());
-	mAllRitems.push_back(std::move(wallL2));
-
-	auto wallL3 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallL3->World, XMMatrixScaling(1.5f, 25.0f, 21.52f)
-		* XMMatrixRotationY(XMConvertToRadians(90))
-		* XMMatrixTranslation(255.25f, 12.5f, -41.98f));
-	XMStoreFloat4x4(&wallL3->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallL3->ObjCBIndex = objCBIndex++;
-	wallL3->Mat = mMaterials["brick2"].get();
-	wallL3->Geo = mGeometries["shapeGeo"].get();
-	wallL3->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallL3->IndexCount = wallL3->Geo->DrawArgs["box"].IndexCount;
-	wallL3->StartIndexLocation = wallL3->Geo->DrawArgs["box"].StartIndexLocation;
-	wallL3->BaseVertexLocation = wallL3->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallL3.get());
-	mAllRitems.push_back(std::move(wallL3));
-
-	auto wallL4 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallL4->World, XMMatrixScaling(1.5f, 25.0f, 33.62f)
-		* XMMatrixRotationY(XMConvertToRadians(90))
-		* XMMatrixTranslation(264.2f, 12.5f, 15.92f));
-	XMStoreFloat4x4(&wallL4->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallL4->ObjCBIndex = objCBIndex++;
-	wallL4->Mat = mMaterials["brick2"].get();
-	wallL4->Geo = mGeometries["shapeGeo"].get();
-	wallL4->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallL4->IndexCount = wallL4->Geo->DrawArgs["box"].IndexCount;
-	wallL4->StartIndexLocation = wallL4->Geo->DrawArgs["box"].StartIndexLocation;
-	wallL4->BaseVertexLocation = wallL4->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallL4.get());
-	mAllRitems.push_back(std::move(wallL4));
-
-	auto wallL5 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallL5->World, XMMatrixScaling(1.5f, 25.0f, 47.07f)
-		* XMMatrixRotationY(XMConvertToRadians(90))
-		* XMMatrixTranslation(235.79f, 12.5f, 37.07f));
-	XMStoreFloat4x4(&wallL5->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallL5->ObjCBIndex = objCBIndex++;
-	wallL5->Mat = mMaterials["brick2"].get();
-	wallL5->Geo = mGeometries["shapeGeo"].get();
-	wallL5->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallL5->IndexCount = wallL5->Geo->DrawArgs["box"].IndexCount;
-	wallL5->StartIndexLocation = wallL5->Geo->DrawArgs["box"].StartIndexLocation;
-	wallL5->BaseVertexLocation = wallL5->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallL5.get());
-	mAllRitems.push_back(std::move(wallL5));
-
-	//walls perpendicular to front view
-	auto wallF1 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallF1->World, XMMatrixScaling(1.5f, 25.0f, 21.52f)
-		* XMMatrixTranslation(270.5f, 12.5f, -26.68f));
-	XMStoreFloat4x4(&wallF1->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallF1->ObjCBIndex = objCBIndex++;
-	wallF1->Mat = mMaterials["brick2"].get();
-	wallF1->Geo = mGeometries["shapeGeo"].get();
-	wallF1->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallF1->IndexCount = wallF1->Geo->DrawArgs["box"].IndexCount;
-	wallF1->StartIndexLocation = wallF1->Geo->DrawArgs["box"].StartIndexLocation;
-	wallF1->BaseVertexLocation = wallF1->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallF1.get());
-	mAllRitems.push_back(std::move(wallF1));
-
-	auto wallF2 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallF2->World, XMMatrixScaling(1.5f, 25.0f, 39.01f)
-		* XMMatrixTranslation(240.0f, 12.5f, -12.98f));
-	XMStoreFloat4x4(&wallF2->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallF2->ObjCBIndex = objCBIndex++;
-	wallF2->Mat = mMaterials["brick2"].get();
-	wallF2->Geo = mGeometries["shapeGeo"].get();
-	wallF2->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallF2->IndexCount = wallF2->Geo->DrawArgs["box"].IndexCount;
-	wallF2->StartIndexLocation = wallF2->Geo->DrawArgs["box"].StartIndexLocation;
-	wallF2->BaseVertexLocation = wallF2->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallF2.get());
-	mAllRitems.push_back(std::move(wallF2));
-
-	auto wallF3 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallF3->World, XMMatrixScaling(1.5f, 25.0f, 22.19f)
-		* XMMatrixTranslation(220.15f, 12.5f, 0.4f));
-	XMStoreFloat4x4(&wallF3->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallF3->ObjCBIndex = objCBIndex++;
-	wallF3->Mat = mMaterials["brick2"].get();
-	wallF3->Geo = mGeometries["shapeGeo"].get();
-	wallF3->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallF3->IndexCount = wallF3->Geo->DrawArgs["box"].IndexCount;
-	wallF3->StartIndexLocation = wallF3->Geo->DrawArgs["box"].StartIndexLocation;
-	wallF3->BaseVertexLocation = wallF3->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallF3.get());
-	mAllRitems.push_back(std::move(wallF3));
-
-	auto wallF4 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallF4->World, XMMatrixScaling(1.5f, 25.0f, 36.31f)
-		* XMMatrixTranslation(201.0f, 12.5f, 10.87f));
-	XMStoreFloat4x4(&wallF4->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallF4->ObjCBIndex = objCBIndex++;
-	wallF4->Mat = mMaterials["brick2"].get();
-	wallF4->Geo = mGeometries["shapeGeo"].get();
-	wallF4->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallF4->IndexCount = wallF4->Geo->DrawArgs["box"].IndexCount;
-	wallF4->StartIndexLocation = wallF4->Geo->DrawArgs["box"].StartIndexLocation;
-	wallF4->BaseVertexLocation = wallF4->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallF4.get());
-	mAllRitems.push_back(std::move(wallF4));
-
-	auto wallF5 = std::make_unique<RenderItem>();
-	XMStoreFloat4x4(&wallF5->World, XMMatrixScaling(1.5f, 25.0f, 19.5f)
-		* XMMatrixTranslation(195.66, 12.5f, -29.55));
-	XMStoreFloat4x4(&wallF5->TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
-	wallF5->ObjCBIndex = objCBIndex++;
-	wallF5->Mat = mMaterials["brick2"].get();
-	wallF5->Geo = mGeometries["shapeGeo"].get();
-	wallF5->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	wallF5->IndexCount = wallF5->Geo->DrawArgs["box"].IndexCount;
-	wallF5->StartIndexLocation = wallF5->Geo->DrawArgs["box"].StartIndexLocation;
-	wallF5->BaseVertexLocation = wallF5->Geo->DrawArgs["box"].BaseVertexLocation;
-	mRitemLayer[(int)RenderLayer::Opaque].push_back(wallF5.get());
-	mAllRitems.push_back(std::move(wallF5));
-
-
-}
\ No newline at end of file
+	XMStoreFloat4x4(&wallFrontR.TexTransform, XMMatrixScaling(1.0f, 1.0f, 1.0f));
+	wallFrontR.Mat = mMaterials["brick2"].get();
+	wallFrontR.Geo = mGeometries["shapeGeo"].get();
+	wallFrontR.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	wallFrontR.IndexCount = wallFrontR.Geo->DrawArgs["box"].IndexCount;
+	wallFrontR.StartIndexLocation = wallFrontR.Geo->DrawArgs["box"].StartIndexLocation;
+	wallFrontR.BaseVertexLocation = wallFrontR.Geo->DrawArgs["box"].BaseVertexLocation;
+	mMazeWallBounds.push_back(GetBoxBounds(wallFrontR.World));
+	AddRenderItem(std::move(wallFrontR), RenderLayer::Opaque);
+
+
+	//inner maze
+	//generated fresh every run inside the outer walls, which span
+	//x 174.75..289.5 and z -69.2..69.2.  The cells are not square so the grid
+	//fills the whole floor.
+	const float mazeMinX = 174.75f;
+	const float mazeMinZ = -69.2f;
+	const float mazeMaxX = 289.5f;
+	const float mazeMaxZ = 69.2f;
+	const float wallHeight = 25.0f;
+	const float wallThickness = 1.5f;
+
+	mMazeMin = XMFLOAT2(mazeMinX, mazeMinZ);
+	mMazeMax = XMFLOAT2(mazeMaxX, mazeMaxZ);
+	mMazeWallHeight = wallHeight;
+
+	MazeDesc mazeDesc;
+	mazeDesc.Width = 7;
+	mazeDesc.Depth = 8;
+	mazeDesc.Seed = mMazeSeed = MathHelper::RandStream().NextU32();
+	mazeDesc.Border = false;
+
+	MazeGenerator maze;
+	maze.Generate(mazeDesc);
+
+	std::vector<MazeWallRun> wallRuns;
+	maze.MergeWalls(wallRuns);
+
+	const float cellWidth = (mazeMaxX - mazeMinX) / mazeDesc.Width;
+	const float cellDepth = (mazeMaxZ - mazeMinZ) / mazeDesc.Depth;
+
+	//all of the inner walls are instances of one box, drawn with a single call.
+	RenderItem innerWalls;
+	innerWalls.Mat = mMaterials["brick2"].get();
+	innerWalls.Geo = mGeometries["shapeGeo"].get();
+	innerWalls.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	innerWalls.IndexCount = innerWalls.Geo->DrawArgs["box"].IndexCount;
+	innerWalls.StartIndexLocation = innerWalls.Geo->DrawArgs["box"].StartIndexLocation;
+	innerWalls.BaseVertexLocation = innerWalls.Geo->DrawArgs["box"].BaseVertexLocation;
+
+	for (const MazeWallRun& run : wallRuns)
+	{
+		//extend each run by half the wall thickness at both ends so corners are closed.
+		float x0 = mazeMinX + run.X0*cellWidth - 0.5f*wallThickness;
+		float z0 = mazeMinZ + run.Z0*cellDepth - 0.5f*wallThickness;
+		float x1 = mazeMinX + run.X1*cellWidth + 0.5f*wallThickness;
+		float z1 = mazeMinZ + run.Z1*cellDepth + 0.5f*wallThickness;
+
+		XMFLOAT3 center(0.5f*(x0 + x1), 0.5f*wallHeight, 0.5f*(z0 + z1));
+		XMFLOAT3 extents(0.5f*(x1 - x0), 0.5f*wallHeight, 0.5f*(z1 - z0));
+
+		//the box mesh is 1.5 deep.
+		XMMATRIX world = XMMatrixScaling(2.0f*extents.x, 2.0f*extents.y, 2.0f*extents.z / 1.5f)
+			* XMMatrixTranslation(center.x, center.y, center.z);
+
+		InstanceData instance;
+		XMStoreFloat4x4(&instance.World, XMMatrixTranspose(world));
+		XMStoreFloat4x4(&instance.TexTransform, XMMatrixTranspose(XMMatrixScaling(1.0f, 1.0f, 1.0f)));
+
+		innerWalls.Instances.push_back(instance);
+		innerWalls.InstanceBounds.push_back(BoundingBox(center, extents));
+		mMazeWallBounds.push_back(BoundingBox(center, extents));
+	}
+
+	mMazeWallsRitem = AddRenderItem(std::move(innerWalls), RenderLayer::OpaqueInstanced);
+}
+
+// Bakes what can be seen from each part of the maze floor below the top of the walls:
+// the castle's Opaque items and the inner maze walls, hidden by the castle and maze walls.
+// The agents move, so they are left out.  Above the walls there is no set and nothing is
+// culled by them.
+void CastleApp::BakeVisibility()
+{
+	VisibilityBaker baker;
+	for (const BoundingOrientedBox& wall : mCastleWallBounds)
+		baker.AddOccluder(wall);
+	for (const BoundingBox& wall : mMazeWallBounds)
+		baker.AddOccluder(wall);
+
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		RenderItem& ri = mRenderItems[handle];
+		ri.PvsIndex = baker.AddItem(ri.Bounds);
+	}
+
+	RenderItem& mazeWalls = mRenderItems[mMazeWallsRitem];
+	mazeWalls.PvsIndex = (UINT)baker.ItemCount();
+	for (const BoundingBox& bounds : mazeWalls.InstanceBounds)
+		baker.AddItem(bounds);
+
+	VisibilityBakeDesc desc;
+	desc.MinX = mMazeMin.x;
+	desc.MinZ = mMazeMin.y;
+	desc.MaxX = mMazeMax.x;
+	desc.MaxZ = mMazeMax.y;
+	desc.MinY = 1.0f;
+	desc.MaxY = mMazeWallHeight - 1.0f;
+	desc.CellSize = 4.0f;
+	desc.EyeSamplesY = 3;
+	desc.Seed = mMazeSeed;
+
+	mVisibility = std::make_unique<VisibilitySets>();
+	baker.Bake(desc, *mVisibility);
+
+	std::ostringstream log;
+	log << "Visibility sets: " << baker.ItemCount() << " items, " << mVisibility->CellCount() << " cells baked in "
+		<< std::fixed << std::setprecision(1) << 1000.0f*mVisibility->BakeSeconds() << " ms ("
+		<< mVisibility->RaysCast() << " rays), " << mVisibility->SetCount() << " distinct sets in "
+		<< mVisibility->Bytes() << " bytes (" << mVisibility->UncompressedBytes() << " as plain bitsets), "
+		<< 100.0f*mVisibility->VisibleFraction() << "% visible\n";
+	OutputDebugStringA(log.str().c_str());
+}
+
+// The courtyard is closed in by the castle walls and towers, 16 high, apart from the gate
+// in the front wall.  The maze yard is closed in by its outer walls, 25 high, apart from
+// the entrance and exit.  The courtyard zone stops at the inner face of the castle walls,
+// so the gate portal sits at the inner end of the gate passage, x 45.5, and the passage
+// itself is in no zone.  The maze walls are thin and the maze zone takes them in, so its
+// portals sit on their outer faces, x 174 and 290.25.  The agents walk in and out of the
+// maze, so they get no zone.
+void CastleApp::BuildPortals()
+{
+	mPortals = std::make_unique<PortalVisibility>();
+	const UINT castle = mPortals->AddZone(BoundingBox(XMFLOAT3(0.0f, 7.5f, 0.0f), XMFLOAT3(45.5f, 8.5f, 45.5f)));
+	const UINT maze = mPortals->AddZone(BoundingBox(XMFLOAT3(232.125f, 12.0f, 0.0f), XMFLOAT3(58.125f, 13.0f, 69.95f)));
+
+	auto addQuad = [this](UINT zone, XMFLOAT3 a, XMFLOAT3 b, XMFLOAT3 c, XMFLOAT3 d)
+	{
+		const XMFLOAT3 corners[4] = { a, b, c, d };
+		mPortals->AddPortal(zone, PortalVisibility::Outside, corners, 4);
+	};
+
+	//the gate, below wallFrontM, and the top of the courtyard.
+	addQuad(castle, XMFLOAT3(45.5f, -1.0f, -15.0f), XMFLOAT3(45.5f, -1.0f, 15.0f),
+		XMFLOAT3(45.5f, 14.0f, 15.0f), XMFLOAT3(45.5f, 14.0f, -15.0f));
+	addQuad(castle, XMFLOAT3(-45.5f, 16.0f, -45.5f), XMFLOAT3(45.5f, 16.0f, -45.5f),
+		XMFLOAT3(45.5f, 16.0f, 45.5f), XMFLOAT3(-45.5f, 16.0f, 45.5f));
+
+	//the maze entrance and exit, between the back and front wall halves, and the top.
+	addQuad(maze, XMFLOAT3(174.0f, -1.0f, -14.25f), XMFLOAT3(174.0f, -1.0f, 14.25f),
+		XMFLOAT3(174.0f, 25.0f, 14.25f), XMFLOAT3(174.0f, 25.0f, -14.25f));
+	addQuad(maze, XMFLOAT3(290.25f, -1.0f, -14.25f), XMFLOAT3(290.25f, -1.0f, 14.25f),
+		XMFLOAT3(290.25f, 25.0f, 14.25f), XMFLOAT3(290.25f, 25.0f, -14.25f));
+	addQuad(maze, XMFLOAT3(174.0f, 25.0f, -69.95f), XMFLOAT3(290.25f, 25.0f, -69.95f),
+		XMFLOAT3(290.25f, 25.0f, 69.95f), XMFLOAT3(174.0f, 25.0f, 69.95f));
+
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		RenderItem& ri = mRenderItems[handle];
+		ri.Zone = mPortals->ZoneOf(ri.Bounds);
+	}
+
+	//the maze walls all lie inside the maze.
+	RenderItem& mazeWalls = mRenderItems[mMazeWallsRitem];
+	UINT zone = PortalVisibility::NoZone;
+	for (size_t i = 0; i < mazeWalls.InstanceBounds.size(); ++i)
+	{
+		UINT instanceZone = mPortals->ZoneOf(mazeWalls.InstanceBounds[i]);
+		if (i == 0)
+			zone = instanceZone;
+		else if (instanceZone != zone)
+			zone = PortalVisibility::NoZone;
+	}
+	mazeWalls.Zone = zone;
+}
+
+// The CPU copy of the mesh ri draws, with where ri's submesh starts in it and how many of
+// its vertices ri's indices reach.  Null for items drawn from meshes without a copy.
+const CastleApp::StaticMesh* CastleApp::FindStaticSubmesh(const RenderItem& ri, INT& baseVertex, UINT& firstIndex,
+	UINT& vertexCount)const
+{
+	auto it = mStaticMeshes.find(ri.Geo);
+	if (it == mStaticMeshes.end() || ri.PrimitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+		return nullptr;
+
+	const StaticMesh& mesh = it->second;
+	baseVertex = ri.BaseVertexLocation - mesh.BaseVertexLocation;
+	firstIndex = ri.StartIndexLocation - mesh.StartIndexLocation;
+
+	vertexCount = 0;
+	for (UINT i = 0; i < ri.IndexCount; ++i)
+		vertexCount = MathHelper::Max(vertexCount, mesh.Indices[firstIndex + i] + 1);
+	return &mesh;
+}
+
+// Gives each submesh the Opaque items and maze walls draw a tree of its own, once, and
+// places it for every item or instance that draws it.
+void CastleApp::BuildRayScene()
+{
+	mRayScene = std::make_unique<RayScene>();
+	mRayTargets.clear();
+
+	std::map<std::tuple<const MeshGeometry*, UINT, INT, UINT>, std::uint32_t> meshes;
+	auto findMesh = [&](const RenderItem& ri, std::uint32_t& mesh)
+	{
+		auto key = std::make_tuple((const MeshGeometry*)ri.Geo, ri.StartIndexLocation, ri.BaseVertexLocation, ri.IndexCount);
+		auto it = meshes.find(key);
+		if (it != meshes.end())
+		{
+			mesh = it->second;
+			return true;
+		}
+
+		INT baseVertex = 0;
+		UINT firstIndex = 0;
+		UINT vertexCount = 0;
+		const StaticMesh* staticMesh = FindStaticSubmesh(ri, baseVertex, firstIndex, vertexCount);
+		if (staticMesh == nullptr)
+			return false;
+
+		std::vector<XMFLOAT3> positions(vertexCount);
+		for (UINT v = 0; v < vertexCount; ++v)
+			positions[v] = staticMesh->Vertices[baseVertex + v].Pos;
+
+		mesh = mRayScene->AddMesh(positions.data(), positions.size(), &staticMesh->Indices[firstIndex], ri.IndexCount / 3);
+		meshes[key] = mesh;
+		return true;
+	};
+
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		std::uint32_t mesh;
+		if (!findMesh(mRenderItems[handle], mesh))
+			continue;
+
+		mRayScene->AddInstance(mesh, mRenderItems[handle].World);
+		mRayTargets.push_back({ handle, (UINT)-1 });
+	}
+
+	const RenderItem& mazeWalls = mRenderItems[mMazeWallsRitem];
+	std::uint32_t wallMesh;
+	if (findMesh(mazeWalls, wallMesh))
+	{
+		for (UINT i = 0; i < (UINT)mazeWalls.Instances.size(); ++i)
+		{
+			XMFLOAT4X4 world;
+			XMStoreFloat4x4(&world, XMMatrixTranspose(XMLoadFloat4x4(&mazeWalls.Instances[i].World)));
+			mRayScene->AddInstance(wallMesh, world);
+			mRayTargets.push_back({ mMazeWallsRitem, i });
+		}
+	}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	mRayScene->Build();
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	std::ostringstream log;
+	log << "Ray scene: " << mRayScene->MeshCount() << " meshes of " << mRayScene->MeshTriangleCount() << " triangles, "
+		<< mRayScene->InstanceCount() << " instances of " << mRayScene->WorldTriangleCount() << " triangles, "
+		<< mRayScene->Bytes() / 1024 << " KB, instance tree built in " << std::fixed << std::setprecision(2)
+		<< std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms\n";
+	OutputDebugStringA(log.str().c_str());
+}
+
+// The lights are set up once, in mMainPassCB, which UpdateMainPassCB() fills in around
+// them every frame.
+void CastleApp::BuildLights()
+{
+	mMainPassCB.AmbientLight = { 0.25f, 0.25f, 0.35f, 1.0f };
+	//Directional light
+	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
+	mMainPassCB.Lights[0].Strength = { 0.6f, 0.6f, 0.6f };
+	//Point light 1
+	mMainPassCB.Lights[1].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[1].FalloffStart = 0.0f;
+	mMainPassCB.Lights[1].FalloffEnd = 25.0f;
+	mMainPassCB.Lights[1].Position = { 0.0f, 19.0f, -15.0f };
+	//Point light 2
+	mMainPassCB.Lights[2].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[2].FalloffStart = 0.0f;
+	mMainPassCB.Lights[2].FalloffEnd = 25.0f;
+	mMainPassCB.Lights[2].Position = { 0.0f, 19.0f, 15.0f };
+	//Point light 3
+	mMainPassCB.Lights[3].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[3].FalloffStart = 0.0f;
+	mMainPassCB.Lights[3].FalloffEnd = 25.0f;
+	mMainPassCB.Lights[3].Position = { 30.0f, 19.0f, -15.0f };
+	//Point light 4
+	mMainPassCB.Lights[4].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[4].FalloffStart = 0.0f;
+	mMainPassCB.Lights[4].FalloffEnd = 22.0f;
+	mMainPassCB.Lights[4].Position = { -30.0f, 19.0f, -15.0f };
+	//Point light 5
+	mMainPassCB.Lights[5].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[5].FalloffStart = 0.0f;
+	mMainPassCB.Lights[5].FalloffEnd = 25.0f;
+	mMainPassCB.Lights[5].Position = { 30.0f, 19.0f, 15.0f };
+	//Point light 6
+	mMainPassCB.Lights[6].Strength = { 10.f, 10.0f, 4.0f };
+	mMainPassCB.Lights[6].FalloffStart = 0.0f;
+	mMainPassCB.Lights[6].FalloffEnd = 22.0f;
+	mMainPassCB.Lights[6].Position = { -30.0f, 19.0f, 15.0f };
+	//Spot light
+	mMainPassCB.Lights[7].Strength = { 10.f, 0.0f, 0.0f };
+	mMainPassCB.Lights[7].Position = { -36.0f, 15.0f, 0.0f };
+	mMainPassCB.Lights[7].SpotPower = 5.0f;
+	mMainPassCB.Lights[7].FalloffStart = 0.0f;
+	mMainPassCB.Lights[7].FalloffEnd = 30.0f;
+}
+
+// Bakes the point and spot lights and ambient occlusion onto every vertex of the Opaque
+// items, none of which move, in the shadow of those items and the maze walls.  Each item
+// gets the vertices of its own submesh, in the order of its indices' values, so the
+// vertex shader finds a vertex's light at BakedOffset plus SV_VertexID.
+void CastleApp::BakeLighting()
+{
+	std::vector<XMFLOAT3> positions;
+	std::vector<std::uint32_t> indices;
+	std::vector<XMFLOAT3> points;
+	std::vector<XMFLOAT3> normals;
+
+	auto addTriangles = [&](const StaticMesh& mesh, INT baseVertex, UINT firstIndex, UINT indexCount, UINT vertexCount,
+		FXMMATRIX world)
+	{
+		const std::uint32_t first = (std::uint32_t)positions.size();
+		for (UINT v = 0; v < vertexCount; ++v)
+		{
+			XMFLOAT3 p;
+			XMStoreFloat3(&p, XMVector3TransformCoord(XMLoadFloat3(&mesh.Vertices[baseVertex + v].Pos), world));
+			positions.push_back(p);
+		}
+
+		for (UINT i = 0; i < indexCount; ++i)
+			indices.push_back(first + mesh.Indices[firstIndex + i]);
+	};
+
+	for (SlotHandle handle : mRitemLayer[(int)RenderLayer::Opaque])
+	{
+		RenderItem& ri = mRenderItems[handle];
+		INT baseVertex = 0;
+		UINT firstIndex = 0;
+		UINT vertexCount = 0;
+		const StaticMesh* mesh = FindStaticSubmesh(ri, baseVertex, firstIndex, vertexCount);
+		if (mesh == nullptr)
+			continue;
+
+		XMMATRIX world = XMLoadFloat4x4(&ri.World);
+		XMMATRIX normalWorld = MathHelper::InverseTranspose(world);
+		addTriangles(*mesh, baseVertex, firstIndex, ri.IndexCount, vertexCount, world);
+
+		ri.BakedOffset = (UINT)points.size();
+		for (UINT v = 0; v < vertexCount; ++v)
+		{
+			const Vertex& vertex = mesh->Vertices[baseVertex + v];
+			XMFLOAT3 p;
+			XMFLOAT3 n;
+			XMStoreFloat3(&p, XMVector3TransformCoord(XMLoadFloat3(&vertex.Pos), world));
+			XMStoreFloat3(&n, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vertex.Normal), normalWorld)));
+			points.push_back(p);
+			normals.push_back(n);
+		}
+	}
+
+	//the maze walls only cast shadows; their instances are lit as they are drawn.
+	const RenderItem& mazeWalls = mRenderItems[mMazeWallsRitem];
+	INT wallBaseVertex = 0;
+	UINT wallFirstIndex = 0;
+	UINT wallVertexCount = 0;
+	const StaticMesh* wallMesh = FindStaticSubmesh(mazeWalls, wallBaseVertex, wallFirstIndex, wallVertexCount);
+	if (wallMesh != nullptr)
+	{
+		for (const InstanceData& instance : mazeWalls.Instances)
+		{
+			XMMATRIX world = XMMatrixTranspose(XMLoadFloat4x4(&instance.World));
+			addTriangles(*wallMesh, wallBaseVertex, wallFirstIndex, mazeWalls.IndexCount, wallVertexCount, world);
+		}
+	}
+
+	if (points.empty())
+		return;
+
+	TriangleBvh scene;
+	scene.Build(positions.data(), positions.size(), indices.data(), indices.size() / 3);
+
+	LightBaker baker(scene);
+	for (int i = gNumDirLights; i < gNumDirLights + gNumPointLights + gNumSpotLights; ++i)
+	{
+		const Light& light = mMainPassCB.Lights[i];
+
+		BakedLight baked;
+		baked.Strength = light.Strength;
+		baked.FalloffStart = light.FalloffStart;
+		baked.Direction = light.Direction;
+		baked.FalloffEnd = light.FalloffEnd;
+		baked.Position = light.Position;
+		baked.SpotPower = light.SpotPower;
+		baked.Spot = i >= gNumDirLights + gNumPointLights;
+		baker.AddLight(baked);
+	}
+
+	LightBakeDesc desc;
+	desc.Seed = mMazeSeed;
+
+	std::vector<XMFLOAT4> lighting(points.size());
+	baker.Bake(desc, points.data(), normals.data(), points.size(), lighting.data());
+
+	{
+		std::lock_guard<std::mutex> lock(mLoadMutex);
+		mBakedLighting = mStaging->CreateBuffer(lighting.data(), lighting.size() * sizeof(XMFLOAT4),
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	}
+
+	std::ostringstream log;
+	log << "Baked lighting: " << scene.TriangleCount() << " triangles (" << scene.NodeCount() << " nodes built in "
+		<< std::fixed << std::setprecision(1) << scene.BuildMs() << " ms), " << points.size() << " vertices from "
+		<< baker.LightCount() << " lights baked in " << 1000.0f*baker.LastBakeSeconds() << " ms, "
+		<< baker.LastRaysCast() / MathHelper::Max(1.0e-6f, baker.LastBakeSeconds()) / 1.0e6 << " Mrays/s\n";
+	OutputDebugStringA(log.str().c_str());
+}
+
+// Rasterizes the maze walls into a navigation grid and spawns the agents that walk it.
+void CastleApp::BuildNavigation()
+{
+	const float agentRadius = 0.75f;
+	const UINT agentCount = 300;
+
+	NavGridDesc gridDesc;
+	gridDesc.MinX = 155.0f;
+	gridDesc.MinZ = -80.0f;
+	gridDesc.MaxX = 310.0f;
+	gridDesc.MaxZ = 80.0f;
+	gridDesc.CellSize = 1.0f;
+
+	mNavGrid = std::make_unique<NavGrid>(gridDesc);
+	for (const BoundingBox& wall : mMazeWallBounds)
+		mNavGrid->BlockBox(wall, agentRadius);
+
+	mFlowFields = std::make_unique<NavFlowFieldCache>(*mNavGrid);
+
+	RenderItem agents;
+	agents.Mat = mMaterials["stone"].get();
+	agents.Geo = mGeometries["shapeGeo"].get();
+	agents.PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	agents.IndexCount = agents.Geo->DrawArgs["box"].IndexCount;
+	agents.StartIndexLocation = agents.Geo->DrawArgs["box"].StartIndexLocation;
+	agents.BaseVertexLocation = agents.Geo->DrawArgs["box"].BaseVertexLocation;
+	agents.Instances.resize(agentCount);
+	agents.InstanceBounds.resize(agentCount);
+
+	// Different speeds spread the agents out along the way.
+	mNavAgents.resize(agentCount);
+	for (NavAgent& agent : mNavAgents)
+	{
+		agent.Pos = XMFLOAT2(mNavEntrance.x - MathHelper::RandF(0.0f, 8.0f),
+			mNavEntrance.y + MathHelper::RandF(-10.0f, 10.0f));
+		agent.Speed = MathHelper::RandF(4.0f, 8.0f);
+	}
+
+	mNavAgentsRitem = AddRenderItem(std::move(agents), RenderLayer::OpaqueInstanced);
+}
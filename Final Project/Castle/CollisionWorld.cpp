@@ -0,0 +1,441 @@
+//***************************************************************************************
+// CollisionWorld.cpp
+//***************************************************************************************
+
+#include "CollisionWorld.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	float Dot3(const float* a, const float* b)
+	{
+		return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	}
+
+	// First t in [0, 1] where p + t*d is on the sphere.  A ray starting inside hits at 0.
+	bool IntersectRaySphere(const float* p, const float* d, const float* center, float radius, float& t)
+	{
+		float m[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+		float a = Dot3(d, d);
+		float b = Dot3(m, d);
+		float c = Dot3(m, m) - radius*radius;
+
+		// Outside and moving away.
+		if(c > 0.0f && b > 0.0f)
+			return false;
+
+		float disc = b*b - a*c;
+		if(disc < 0.0f || a == 0.0f)
+			return false;
+
+		t = std::max((-b - sqrtf(disc)) / a, 0.0f);
+		return t <= 1.0f;
+	}
+
+	// First t in [0, 1] where p + t*d is on the capsule around the segment from e0 to e1:
+	// the side of the cylinder if the hit is between the ends, else one of the end spheres.
+	bool IntersectRayCapsule(const float* p, const float* d, const float* e0, const float* e1, float radius,
+		float& t)
+	{
+		float axis[3] = { e1[0] - e0[0], e1[1] - e0[1], e1[2] - e0[2] };
+		float m[3] = { p[0] - e0[0], p[1] - e0[1], p[2] - e0[2] };
+
+		float dd = Dot3(axis, axis);
+		float md = Dot3(m, axis);
+		float nd = Dot3(d, axis);
+		float nn = Dot3(d, d);
+		float mn = Dot3(m, d);
+
+		float a = dd*nn - nd*nd;
+		float c = dd*(Dot3(m, m) - radius*radius) - md*md;
+
+		// Skip the side if the ray runs along the axis or starts inside the infinite cylinder;
+		// either way it can only hit the capsule on an end.
+		if(a > 1.0e-6f*dd*nn && c > 0.0f)
+		{
+			float b = dd*mn - nd*md;
+			float disc = b*b - a*c;
+
+			// Missing the infinite cylinder misses the capsule too.
+			if(disc < 0.0f)
+				return false;
+
+			float tc = (-b - sqrtf(disc)) / a;
+			float s = md + tc*nd;
+			if(tc >= 0.0f && tc <= 1.0f && s >= 0.0f && s <= dd)
+			{
+				t = tc;
+				return true;
+			}
+		}
+
+		float t0, t1;
+		bool hit0 = IntersectRaySphere(p, d, e0, radius, t0);
+		bool hit1 = IntersectRaySphere(p, d, e1, radius, t1);
+		if(!hit0 && !hit1)
+			return false;
+
+		t = !hit1 || (hit0 && t0 < t1) ? t0 : t1;
+		return true;
+	}
+}
+
+CollisionWorld::CollisionWorld(float cellSize)
+	: mCellSize(cellSize), mInvCellSize(1.0f / cellSize)
+{
+}
+
+std::uint32_t CollisionWorld::AddBox(const BoundingBox& box)
+{
+	const XMFLOAT3 axis[3] =
+	{
+		XMFLOAT3(1.0f, 0.0f, 0.0f),
+		XMFLOAT3(0.0f, 1.0f, 0.0f),
+		XMFLOAT3(0.0f, 0.0f, 1.0f)
+	};
+
+	return AddCollider(box.Center, box.Extents, axis);
+}
+
+std::uint32_t CollisionWorld::AddBox(const BoundingOrientedBox& box)
+{
+	XMMATRIX rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&box.Orientation));
+
+	XMFLOAT3 axis[3];
+	for(int i = 0; i < 3; ++i)
+		XMStoreFloat3(&axis[i], rotation.r[i]);
+
+	return AddCollider(box.Center, box.Extents, axis);
+}
+
+std::uint32_t CollisionWorld::AddCollider(const XMFLOAT3& center, const XMFLOAT3& extents, const XMFLOAT3 axis[3])
+{
+	Collider c;
+	c.Center = center;
+	c.Extents = extents;
+	for(int i = 0; i < 3; ++i)
+		c.Axis[i] = axis[i];
+
+	// Half the size of the world space bounds along each world axis.
+	const float* e = &extents.x;
+	float r[3];
+	for(int j = 0; j < 3; ++j)
+	{
+		r[j] = 0.0f;
+		for(int i = 0; i < 3; ++i)
+			r[j] += fabsf((&axis[i].x)[j])*e[i];
+	}
+
+	c.BoundsMin = XMFLOAT3(center.x - r[0], center.y - r[1], center.z - r[2]);
+	c.BoundsMax = XMFLOAT3(center.x + r[0], center.y + r[1], center.z + r[2]);
+	for(int j = 0; j < 3; ++j)
+	{
+		c.CellMin[j] = CellCoord((&c.BoundsMin.x)[j]);
+		c.CellMax[j] = CellCoord((&c.BoundsMax.x)[j]);
+	}
+
+	mColliders.push_back(c);
+	return (std::uint32_t)(mColliders.size() - 1);
+}
+
+std::int32_t CollisionWorld::CellCoord(float v)const
+{
+	return (std::int32_t)floorf(v*mInvCellSize);
+}
+
+std::uint32_t CollisionWorld::Bucket(std::int32_t x, std::int32_t y, std::int32_t z)const
+{
+	return ((std::uint32_t)x*73856093u ^ (std::uint32_t)y*19349663u ^ (std::uint32_t)z*83492791u) & mBucketMask;
+}
+
+void CollisionWorld::Build()
+{
+	std::size_t entryCount = 0;
+	for(const Collider& c : mColliders)
+	{
+		entryCount += (std::size_t)(c.CellMax[0] - c.CellMin[0] + 1)
+			*(c.CellMax[1] - c.CellMin[1] + 1)*(c.CellMax[2] - c.CellMin[2] + 1);
+	}
+
+	// At least twice as many buckets as entries keeps most buckets to one cell.
+	std::uint32_t bucketCount = 64;
+	while(bucketCount < 2*entryCount)
+		bucketCount *= 2;
+	mBucketMask = bucketCount - 1;
+
+	// Count the entries per bucket, turn the counts into offsets, then fill the buckets.
+	mBucketStart.assign(bucketCount + 1, 0);
+	for(const Collider& c : mColliders)
+	{
+		for(std::int32_t z = c.CellMin[2]; z <= c.CellMax[2]; ++z)
+			for(std::int32_t y = c.CellMin[1]; y <= c.CellMax[1]; ++y)
+				for(std::int32_t x = c.CellMin[0]; x <= c.CellMax[0]; ++x)
+					++mBucketStart[Bucket(x, y, z) + 1];
+	}
+
+	for(std::uint32_t b = 0; b < bucketCount; ++b)
+		mBucketStart[b + 1] += mBucketStart[b];
+
+	std::vector<std::uint32_t> next(mBucketStart.begin(), mBucketStart.end() - 1);
+	mBucketColliders.resize(entryCount);
+	for(std::uint32_t i = 0; i < (std::uint32_t)mColliders.size(); ++i)
+	{
+		const Collider& c = mColliders[i];
+		for(std::int32_t z = c.CellMin[2]; z <= c.CellMax[2]; ++z)
+			for(std::int32_t y = c.CellMin[1]; y <= c.CellMax[1]; ++y)
+				for(std::int32_t x = c.CellMin[0]; x <= c.CellMax[0]; ++x)
+					mBucketColliders[next[Bucket(x, y, z)]++] = i;
+	}
+}
+
+bool CollisionWorld::SweepSphere(const XMFLOAT3& center, float radius, const XMFLOAT3& delta, CollisionHit& hit)const
+{
+	if(mBucketStart.empty())
+		return false;
+
+	// Bounds of the whole sweep.
+	float sweepMin[3], sweepMax[3];
+	std::int32_t cellMin[3], cellMax[3];
+	for(int j = 0; j < 3; ++j)
+	{
+		float p0 = (&center.x)[j];
+		float p1 = p0 + (&delta.x)[j];
+		sweepMin[j] = std::min(p0, p1) - radius;
+		sweepMax[j] = std::max(p0, p1) + radius;
+		cellMin[j] = CellCoord(sweepMin[j]);
+		cellMax[j] = CellCoord(sweepMax[j]);
+	}
+
+	bool found = false;
+	hit.T = 1.0f;
+
+	for(std::int32_t z = cellMin[2]; z <= cellMax[2]; ++z)
+	{
+		for(std::int32_t y = cellMin[1]; y <= cellMax[1]; ++y)
+		{
+			for(std::int32_t x = cellMin[0]; x <= cellMax[0]; ++x)
+			{
+				std::uint32_t b = Bucket(x, y, z);
+				for(std::uint32_t e = mBucketStart[b]; e < mBucketStart[b + 1]; ++e)
+				{
+					const std::uint32_t i = mBucketColliders[e];
+					const Collider& c = mColliders[i];
+
+					// A collider is in the bucket of every cell it covers, and other cells can
+					// hash to the same bucket.  Test it only from the first cell it shares
+					// with the sweep so it is tested once.
+					if(std::max(c.CellMin[0], cellMin[0]) != x || x > c.CellMax[0] ||
+						std::max(c.CellMin[1], cellMin[1]) != y || y > c.CellMax[1] ||
+						std::max(c.CellMin[2], cellMin[2]) != z || z > c.CellMax[2])
+						continue;
+
+					if(c.BoundsMin.x > sweepMax[0] || c.BoundsMax.x < sweepMin[0] ||
+						c.BoundsMin.y > sweepMax[1] || c.BoundsMax.y < sweepMin[1] ||
+						c.BoundsMin.z > sweepMax[2] || c.BoundsMax.z < sweepMin[2])
+						continue;
+
+					float t;
+					XMFLOAT3 normal;
+					if(SweepCollider(c, center, radius, delta, t, normal) && (!found || t < hit.T))
+					{
+						found = true;
+						hit.T = t;
+						hit.Normal = normal;
+						hit.Collider = i;
+					}
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+bool CollisionWorld::SweepCollider(const Collider& c, const XMFLOAT3& center, float radius, const XMFLOAT3& delta,
+	float& t, XMFLOAT3& normal)const
+{
+	// Work in box space, where the box is [-e, e].
+	const float rel[3] = { center.x - c.Center.x, center.y - c.Center.y, center.z - c.Center.z };
+	const float* e = &c.Extents.x;
+
+	float p[3], d[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		p[i] = Dot3(rel, &c.Axis[i].x);
+		d[i] = Dot3(&delta.x, &c.Axis[i].x);
+	}
+
+	// Already touching: block only the part of the motion going further in.
+	float q[3];
+	for(int i = 0; i < 3; ++i)
+		q[i] = std::min(std::max(p[i], -e[i]), e[i]);
+
+	float away[3] = { p[0] - q[0], p[1] - q[1], p[2] - q[2] };
+	float dist2 = Dot3(away, away);
+	float n[3] = { 0.0f, 0.0f, 0.0f };
+
+	if(dist2 <= radius*radius)
+	{
+		if(dist2 > 1.0e-12f)
+		{
+			float invDist = 1.0f / sqrtf(dist2);
+			for(int i = 0; i < 3; ++i)
+				n[i] = away[i]*invDist;
+		}
+		else
+		{
+			// The center is inside the box, so push out through the nearest face.
+			int axis = 0;
+			for(int i = 1; i < 3; ++i)
+			{
+				if(e[i] - fabsf(p[i]) < e[axis] - fabsf(p[axis]))
+					axis = i;
+			}
+			n[axis] = p[axis] < 0.0f ? -1.0f : 1.0f;
+		}
+
+		if(Dot3(n, d) >= 0.0f)
+			return false;
+
+		t = 0.0f;
+	}
+	else
+	{
+		// Sweeping a sphere against a box is a ray against the box with its faces pushed
+		// out by the radius and its edges and corners rounded.  Clip the ray against the
+		// box grown by the radius first.
+		float tMin = 0.0f;
+		float tMax = 1.0f;
+		for(int i = 0; i < 3; ++i)
+		{
+			float grown = e[i] + radius;
+			if(fabsf(d[i]) < 1.0e-12f)
+			{
+				if(p[i] < -grown || p[i] > grown)
+					return false;
+			}
+			else
+			{
+				float inv = 1.0f / d[i];
+				float t0 = (-grown - p[i])*inv;
+				float t1 = (grown - p[i])*inv;
+				if(t0 > t1)
+					std::swap(t0, t1);
+
+				tMin = std::max(tMin, t0);
+				tMax = std::min(tMax, t1);
+				if(tMin > tMax)
+					return false;
+			}
+		}
+
+		// Where the grown box is entered beyond the box on more than one axis, the
+		// entry point is near an edge or corner of the grown box, which the rounded box
+		// cuts away.  Test the edges meeting at the box corner nearest that point.
+		float h[3];
+		int outside = 0;
+		for(int i = 0; i < 3; ++i)
+		{
+			h[i] = p[i] + tMin*d[i];
+			if(fabsf(h[i]) > e[i])
+				++outside;
+		}
+
+		if(outside <= 1)
+		{
+			t = tMin;
+		}
+		else
+		{
+			float corner[3];
+			for(int i = 0; i < 3; ++i)
+				corner[i] = h[i] < 0.0f ? -e[i] : e[i];
+
+			bool found = false;
+			for(int i = 0; i < 3; ++i)
+			{
+				// With two axes outside only the edge along the third can be hit.
+				if(outside == 2 && fabsf(h[i]) > e[i])
+					continue;
+
+				float end[3] = { corner[0], corner[1], corner[2] };
+				end[i] = -corner[i];
+
+				float edgeT;
+				if(IntersectRayCapsule(p, d, corner, end, radius, edgeT) && (!found || edgeT < t))
+				{
+					found = true;
+					t = edgeT;
+				}
+			}
+
+			if(!found)
+				return false;
+		}
+
+		// The normal points from the closest point on the box to the sphere's center.
+		for(int i = 0; i < 3; ++i)
+		{
+			h[i] = p[i] + t*d[i];
+			n[i] = h[i] - std::min(std::max(h[i], -e[i]), e[i]);
+		}
+
+		float length2 = Dot3(n, n);
+		if(length2 < 1.0e-12f)
+			return false;
+
+		float invLength = 1.0f / sqrtf(length2);
+		for(int i = 0; i < 3; ++i)
+			n[i] *= invLength;
+	}
+
+	// Back to world space.
+	normal.x = n[0]*c.Axis[0].x + n[1]*c.Axis[1].x + n[2]*c.Axis[2].x;
+	normal.y = n[0]*c.Axis[0].y + n[1]*c.Axis[1].y + n[2]*c.Axis[2].y;
+	normal.z = n[0]*c.Axis[0].z + n[1]*c.Axis[1].z + n[2]*c.Axis[2].z;
+
+	return true;
+}
+
+XMFLOAT3 CollisionWorld::MoveSphere(const XMFLOAT3& center, float radius, const XMFLOAT3& delta)const
+{
+	// Stop this far short of whatever is hit so the next sweep does not start inside it.
+	const float skin = 0.01f;
+
+	XMVECTOR pos = XMLoadFloat3(&center);
+	XMVECTOR move = XMLoadFloat3(&delta);
+
+	// A few rounds are enough to slide into a corner where three surfaces meet.
+	for(int i = 0; i < 4; ++i)
+	{
+		if(XMVectorGetX(XMVector3LengthSq(move)) < 1.0e-10f)
+			break;
+
+		XMFLOAT3 moveF;
+		XMFLOAT3 posF;
+		XMStoreFloat3(&moveF, move);
+		XMStoreFloat3(&posF, pos);
+
+		CollisionHit hit;
+		if(!SweepSphere(posF, radius, moveF, hit))
+		{
+			pos = XMVectorAdd(pos, move);
+			break;
+		}
+
+		XMVECTOR n = XMLoadFloat3(&hit.Normal);
+		pos = XMVectorAdd(pos, XMVectorScale(move, hit.T));
+		pos = XMVectorMultiplyAdd(n, XMVectorReplicate(skin), pos);
+
+		// Slide: keep what is left of the move minus the part into the surface.
+		XMVECTOR left = XMVectorScale(move, 1.0f - hit.T);
+		move = XMVectorSubtract(left, XMVectorMultiply(n, XMVector3Dot(left, n)));
+	}
+
+	XMFLOAT3 result;
+	XMStoreFloat3(&result, pos);
+	return result;
+}
@@ -0,0 +1,98 @@
+//***************************************************************************************
+// CollisionWorld.h
+//
+// Static collision geometry for moving the camera through the castle and maze.
+//
+// Colliders are boxes, axis aligned or oriented, that never move once added.  Build()
+// sorts them into a uniform grid of cubic cells that is hashed into a fixed number of
+// buckets, so only the area a query touches is ever looked at, however large the world.
+//
+// Queries sweep a sphere along a straight line and report the first contact.
+// MoveSphere() uses that to slide a sphere along whatever it runs into, which is how the
+// camera walks along walls instead of through them.
+//***************************************************************************************
+
+#ifndef COLLISIONWORLD_H
+#define COLLISIONWORLD_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct CollisionHit
+{
+	// Fraction of the sweep travelled before contact, in [0, 1].
+	float T = 1.0f;
+
+	// Unit surface normal at the contact, pointing out of the collider.
+	DirectX::XMFLOAT3 Normal = { 0.0f, 1.0f, 0.0f };
+
+	std::uint32_t Collider = 0;
+};
+
+class CollisionWorld
+{
+public:
+	// cellSize should be a little more than the largest distance a query travels, so most
+	// queries only touch a handful of cells.
+	CollisionWorld(float cellSize = 8.0f);
+	CollisionWorld(const CollisionWorld& rhs) = delete;
+	CollisionWorld& operator=(const CollisionWorld& rhs) = delete;
+
+	// Returns the index of the new collider.  Colliders added after Build() are not found
+	// by queries until the next Build().
+	std::uint32_t AddBox(const DirectX::BoundingBox& box);
+	std::uint32_t AddBox(const DirectX::BoundingOrientedBox& box);
+
+	void Build();
+
+	std::size_t ColliderCount()const { return mColliders.size(); }
+
+	// Sweeps a sphere from center by delta.  Returns false if it gets all the way.  A sphere
+	// that starts out overlapping a collider only hits it if delta moves it further in.
+	// Queries do not change the world, so any number of threads may query at once.
+	bool SweepSphere(const DirectX::XMFLOAT3& center, float radius, const DirectX::XMFLOAT3& delta,
+		CollisionHit& hit)const;
+
+	// Moves a sphere by delta, sliding along anything it hits on the way, and returns where
+	// it ends up.
+	DirectX::XMFLOAT3 MoveSphere(const DirectX::XMFLOAT3& center, float radius, const DirectX::XMFLOAT3& delta)const;
+
+private:
+	struct Collider
+	{
+		// Box space is centered on the box with the box's edges along its axes.
+		DirectX::XMFLOAT3 Center;
+		DirectX::XMFLOAT3 Extents;
+		DirectX::XMFLOAT3 Axis[3];
+
+		// World space bounds and the range of grid cells they cover.
+		DirectX::XMFLOAT3 BoundsMin;
+		DirectX::XMFLOAT3 BoundsMax;
+		std::int32_t CellMin[3];
+		std::int32_t CellMax[3];
+	};
+
+	std::uint32_t AddCollider(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents,
+		const DirectX::XMFLOAT3 axis[3]);
+
+	std::int32_t CellCoord(float v)const;
+	std::uint32_t Bucket(std::int32_t x, std::int32_t y, std::int32_t z)const;
+
+	bool SweepCollider(const Collider& c, const DirectX::XMFLOAT3& center, float radius,
+		const DirectX::XMFLOAT3& delta, float& t, DirectX::XMFLOAT3& normal)const;
+
+	float mCellSize;
+	float mInvCellSize;
+
+	std::vector<Collider> mColliders;
+
+	// Bucket b holds the colliders mBucketColliders[mBucketStart[b]] up to
+	// mBucketColliders[mBucketStart[b+1]].  Different cells can share a bucket.
+	std::uint32_t mBucketMask = 0;
+	std::vector<std::uint32_t> mBucketStart;
+	std::vector<std::uint32_t> mBucketColliders;
+};
+
+#endif // COLLISIONWORLD_H
@@ -0,0 +1,104 @@
+//***************************************************************************************
+// FramePipeline.h
+//
+// Passes frames from a producer thread to a consumer thread through a fixed ring of
+// slots, so the producer can work on the next frame while the consumer handles the
+// last one.
+//
+// Only two counters are shared: how many slots have been written and how many read.
+// Each side only ever advances its own counter, so the handoff needs no locks.  A side
+// that finds nothing to do spins for a short while, then yields and finally sleeps, so a
+// pipeline left idle does not keep a core busy.
+//
+// Slots are reused in place.  What the producer filled a slot with last time is still
+// there when it gets the slot back, so containers in T keep their memory.
+//***************************************************************************************
+
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+template<typename T, unsigned Depth = 2>
+class FramePipeline
+{
+public:
+	FramePipeline() = default;
+	FramePipeline(const FramePipeline& rhs) = delete;
+	FramePipeline& operator=(const FramePipeline& rhs) = delete;
+
+	// Producer side.  Waits for a free slot and returns it, or nullptr once closed.
+	T* BeginWrite()
+	{
+		const std::uint64_t written = mWritten.load(std::memory_order_relaxed);
+		for(unsigned spins = 0; written - mRead.load(std::memory_order_acquire) >= Depth; ++spins)
+		{
+			if(mClosed.load(std::memory_order_acquire))
+				return nullptr;
+			Backoff(spins);
+		}
+
+		return &mSlots[written % Depth];
+	}
+
+	// Hands the slot from BeginWrite() to the consumer.
+	void EndWrite()
+	{
+		mWritten.store(mWritten.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer side.  Waits for a written slot and returns it, or nullptr once the pipeline
+	// is closed and every written slot has been read.
+	T* BeginRead()
+	{
+		const std::uint64_t read = mRead.load(std::memory_order_relaxed);
+		for(unsigned spins = 0; mWritten.load(std::memory_order_acquire) == read; ++spins)
+		{
+			if(mClosed.load(std::memory_order_acquire) && mWritten.load(std::memory_order_acquire) == read)
+				return nullptr;
+			Backoff(spins);
+		}
+
+		return &mSlots[read % Depth];
+	}
+
+	// Gives the slot from BeginRead() back to the producer.
+	void EndRead()
+	{
+		mRead.store(mRead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Makes waiting and later calls return nullptr, once the consumer has read what was
+	// already written.
+	void Close() { mClosed.store(true, std::memory_order_release); }
+
+	// Only while neither side is using the pipeline.
+	void Reopen() { mClosed.store(false, std::memory_order_release); }
+
+	// Frames written but not yet read.
+	unsigned Queued()const
+	{
+		return (unsigned)(mWritten.load(std::memory_order_acquire) - mRead.load(std::memory_order_acquire));
+	}
+
+private:
+	static void Backoff(unsigned spins)
+	{
+		if(spins < 64)
+			return;
+		if(spins < 4096)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	T mSlots[Depth];
+	std::atomic<std::uint64_t> mWritten{ 0 };
+	std::atomic<std::uint64_t> mRead{ 0 };
+	std::atomic<bool> mClosed{ false };
+};
+
+#endif // FRAMEPIPELINE_H
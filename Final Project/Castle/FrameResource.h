@@ -4,10 +4,43 @@
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
 
+// Per-object data, read from a structured buffer by the vertex shaders and indexed with a
+// root constant.  Unlike a constant buffer the elements are not padded to 256 bytes.
 struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+
+	// Where the object's vertices start in the baked lighting buffer.
+	UINT BakedOffset = 0;
+	UINT ObjPad0 = 0;
+	UINT ObjPad1 = 0;
+	UINT ObjPad2 = 0;
+};
+
+// Per-instance data for instanced draws, read from a structured buffer by
+// VSInstanced in Default.hlsl.  The matrices are stored transposed, ready for the GPU.
+struct InstanceData
+{
+	DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+};
+
+// Root constants for drawing one terrain node; matches cbTerrain in Terrain.hlsl.
+struct TerrainConstants
+{
+	DirectX::XMFLOAT2 NodeMin = { 0.0f, 0.0f };
+	float NodeSize = 0.0f;
+	float MorphStart = 0.0f;
+	float MorphInvRange = 0.0f;
+	DirectX::XMFLOAT3 Pad0 = { 0.0f, 0.0f, 0.0f };
+
+	DirectX::XMFLOAT2 TerrainMin = { 0.0f, 0.0f };
+	DirectX::XMFLOAT2 TerrainSize = { 0.0f, 0.0f };
+	float HeightScale = 0.0f;
+	float HeightOffset = 0.0f;
+	float PatchSize = 0.0f;
+	float Pad1 = 0.0f;
 };
 
 struct PassConstants
@@ -48,13 +81,19 @@ struct Vertex
 	DirectX::XMFLOAT2 TexC;
 };
 
+struct TreeSpriteVertex
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::XMFLOAT2 Size;
+};
+
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT waveVertCount, UINT treeSpriteCount, UINT instanceCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -68,11 +107,13 @@ public:
    // std::unique_ptr<UploadBuffer<FrameConstants>> FrameCB = nullptr;
     std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
     std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
-    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
+    std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectBuffer = nullptr;
+    std::unique_ptr<UploadBuffer<InstanceData>> InstanceBuffer = nullptr;
 
     // We cannot update a dynamic vertex buffer until the GPU is done processing
     // the commands that reference it.  So each frame needs their own.
     std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
+    std::unique_ptr<UploadBuffer<TreeSpriteVertex>> TreeSpritesVB = nullptr;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
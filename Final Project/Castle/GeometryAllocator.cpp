@@ -0,0 +1,294 @@
+//***************************************************************************************
+// GeometryAllocator.cpp
+//***************************************************************************************
+
+#include "GeometryAllocator.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	// Index of the highest and lowest set bit; v must not be 0.
+	std::uint32_t HighestBit(std::uint32_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanReverse(&i, v);
+		return i;
+#else
+		return 31 - __builtin_clz(v);
+#endif
+	}
+
+	std::uint32_t LowestBit(std::uint32_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanForward(&i, v);
+		return i;
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+}
+
+GeometryAllocator::GeometryAllocator(std::uint32_t capacity)
+	: mCapacity(capacity)
+{
+	ResetFreeSpace(Invalid, 0);
+}
+
+std::uint32_t GeometryAllocator::Allocate(std::uint32_t count)
+{
+	if(count == 0)
+		return Invalid;
+
+	std::uint32_t block = FindFree(count);
+	if(block == Invalid)
+		return Invalid;
+
+	RemoveFree(block);
+
+	// Give what is left back as a free range of its own.
+	if(mBlocks[block].Count > count)
+	{
+		std::uint32_t rest = NewBlock(mBlocks[block].Offset + count, mBlocks[block].Count - count);
+		mBlocks[rest].PrevPhysical = block;
+		mBlocks[rest].NextPhysical = mBlocks[block].NextPhysical;
+		if(mBlocks[block].NextPhysical != Invalid)
+			mBlocks[mBlocks[block].NextPhysical].PrevPhysical = rest;
+		mBlocks[block].NextPhysical = rest;
+		mBlocks[block].Count = count;
+		InsertFree(rest);
+	}
+
+	mBlocks[block].Free = false;
+	mUsed += count;
+	++mAllocations;
+	return block;
+}
+
+void GeometryAllocator::Free(std::uint32_t handle)
+{
+	std::uint32_t block = handle;
+	mUsed -= mBlocks[block].Count;
+	--mAllocations;
+	mBlocks[block].Free = true;
+
+	std::uint32_t next = mBlocks[block].NextPhysical;
+	if(next != Invalid && mBlocks[next].Free)
+	{
+		RemoveFree(next);
+		mBlocks[block].Count += mBlocks[next].Count;
+		mBlocks[block].NextPhysical = mBlocks[next].NextPhysical;
+		if(mBlocks[next].NextPhysical != Invalid)
+			mBlocks[mBlocks[next].NextPhysical].PrevPhysical = block;
+		ReleaseBlock(next);
+	}
+
+	std::uint32_t prev = mBlocks[block].PrevPhysical;
+	if(prev != Invalid && mBlocks[prev].Free)
+	{
+		RemoveFree(prev);
+		mBlocks[prev].Count += mBlocks[block].Count;
+		mBlocks[prev].NextPhysical = mBlocks[block].NextPhysical;
+		if(mBlocks[block].NextPhysical != Invalid)
+			mBlocks[mBlocks[block].NextPhysical].PrevPhysical = prev;
+		ReleaseBlock(block);
+		block = prev;
+	}
+
+	InsertFree(block);
+}
+
+std::vector<GeometryAllocator::Move> GeometryAllocator::Defragment(std::uint32_t newCapacity)
+{
+	std::vector<Move> moves;
+
+	std::uint32_t offset = 0;
+	std::uint32_t last = Invalid;
+	std::uint32_t block = mFirstPhysical;
+	mFirstPhysical = Invalid;
+
+	while(block != Invalid)
+	{
+		std::uint32_t next = mBlocks[block].NextPhysical;
+
+		if(mBlocks[block].Free)
+		{
+			ReleaseBlock(block);
+		}
+		else
+		{
+			Block& b = mBlocks[block];
+			if(!moves.empty() && moves.back().From + moves.back().Count == b.Offset &&
+				moves.back().To + moves.back().Count == offset)
+			{
+				moves.back().Count += b.Count;
+			}
+			else
+			{
+				moves.push_back({ b.Offset, offset, b.Count });
+			}
+
+			b.Offset = offset;
+			b.PrevPhysical = last;
+			b.NextPhysical = Invalid;
+			if(last != Invalid)
+				mBlocks[last].NextPhysical = block;
+			else
+				mFirstPhysical = block;
+
+			offset += b.Count;
+			last = block;
+		}
+
+		block = next;
+	}
+
+	mCapacity = newCapacity;
+	ResetFreeSpace(last, offset);
+	return moves;
+}
+
+std::uint32_t GeometryAllocator::LargestFree()const
+{
+	if(mFirstLevelBitmap == 0)
+		return 0;
+
+	// Only the top non-empty list can hold the largest range, but its ranges differ in
+	// size.
+	std::uint32_t fl = HighestBit(mFirstLevelBitmap);
+	std::uint32_t sl = HighestBit(mSecondLevelBitmap[fl]);
+
+	std::uint32_t largest = 0;
+	for(std::uint32_t block = mFreeHeads[fl][sl]; block != Invalid; block = mBlocks[block].NextFree)
+		largest = mBlocks[block].Count > largest ? mBlocks[block].Count : largest;
+	return largest;
+}
+
+void GeometryAllocator::Mapping(std::uint32_t count, std::uint32_t& fl, std::uint32_t& sl)
+{
+	// Below SecondLevelCount every size has a list of its own.
+	if(count < SecondLevelCount)
+	{
+		fl = 0;
+		sl = count;
+		return;
+	}
+
+	std::uint32_t msb = HighestBit(count);
+	fl = msb - SecondLevelBits + 1;
+	sl = (count >> (msb - SecondLevelBits)) - SecondLevelCount;
+}
+
+std::uint32_t GeometryAllocator::NewBlock(std::uint32_t offset, std::uint32_t count)
+{
+	Block b = { offset, count, Invalid, Invalid, Invalid, Invalid, true };
+
+	if(!mUnusedBlocks.empty())
+	{
+		std::uint32_t block = mUnusedBlocks.back();
+		mUnusedBlocks.pop_back();
+		mBlocks[block] = b;
+		return block;
+	}
+
+	mBlocks.push_back(b);
+	return (std::uint32_t)mBlocks.size() - 1;
+}
+
+void GeometryAllocator::ReleaseBlock(std::uint32_t block)
+{
+	mUnusedBlocks.push_back(block);
+}
+
+void GeometryAllocator::InsertFree(std::uint32_t block)
+{
+	std::uint32_t fl, sl;
+	Mapping(mBlocks[block].Count, fl, sl);
+
+	std::uint32_t head = mFreeHeads[fl][sl];
+	mBlocks[block].Free = true;
+	mBlocks[block].PrevFree = Invalid;
+	mBlocks[block].NextFree = head;
+	if(head != Invalid)
+		mBlocks[head].PrevFree = block;
+	mFreeHeads[fl][sl] = block;
+
+	mFirstLevelBitmap |= 1u << fl;
+	mSecondLevelBitmap[fl] |= 1u << sl;
+}
+
+void GeometryAllocator::RemoveFree(std::uint32_t block)
+{
+	std::uint32_t fl, sl;
+	Mapping(mBlocks[block].Count, fl, sl);
+
+	Block& b = mBlocks[block];
+	if(b.PrevFree != Invalid)
+		mBlocks[b.PrevFree].NextFree = b.NextFree;
+	else
+		mFreeHeads[fl][sl] = b.NextFree;
+	if(b.NextFree != Invalid)
+		mBlocks[b.NextFree].PrevFree = b.PrevFree;
+
+	if(mFreeHeads[fl][sl] == Invalid)
+	{
+		mSecondLevelBitmap[fl] &= ~(1u << sl);
+		if(mSecondLevelBitmap[fl] == 0)
+			mFirstLevelBitmap &= ~(1u << fl);
+	}
+}
+
+std::uint32_t GeometryAllocator::FindFree(std::uint32_t count)const
+{
+	// Round count up to the next list boundary, so every range in the list found is big
+	// enough and the first one can be taken without looking at the rest.
+	std::uint64_t rounded = count;
+	if(count >= SecondLevelCount)
+		rounded += (1ull << (HighestBit(count) - SecondLevelBits)) - 1;
+	if(rounded > 0xffffffffull)
+		return Invalid;
+
+	std::uint32_t fl, sl;
+	Mapping((std::uint32_t)rounded, fl, sl);
+
+	std::uint32_t slMap = mSecondLevelBitmap[fl] & (~0u << sl);
+	if(slMap == 0)
+	{
+		std::uint32_t flMap = fl + 1 < 32 ? mFirstLevelBitmap & (~0u << (fl + 1)) : 0;
+		if(flMap == 0)
+			return Invalid;
+
+		fl = LowestBit(flMap);
+		slMap = mSecondLevelBitmap[fl];
+	}
+
+	return mFreeHeads[fl][LowestBit(slMap)];
+}
+
+void GeometryAllocator::ResetFreeSpace(std::uint32_t last, std::uint32_t offset)
+{
+	mFirstLevelBitmap = 0;
+	for(std::uint32_t fl = 0; fl < FirstLevelCount; ++fl)
+	{
+		mSecondLevelBitmap[fl] = 0;
+		for(std::uint32_t sl = 0; sl < SecondLevelCount; ++sl)
+			mFreeHeads[fl][sl] = Invalid;
+	}
+
+	if(offset >= mCapacity)
+		return;
+
+	std::uint32_t block = NewBlock(offset, mCapacity - offset);
+	mBlocks[block].PrevPhysical = last;
+	if(last != Invalid)
+		mBlocks[last].NextPhysical = block;
+	else
+		mFirstPhysical = block;
+
+	InsertFree(block);
+}
@@ -0,0 +1,104 @@
+//***************************************************************************************
+// GeometryAllocator.h
+//
+// Suballocates ranges of elements, vertices or indices, out of one fixed size arena.
+//
+// Free ranges are kept in two-level segregated fit (TLSF) lists: the first level is the
+// power of two a range's size falls in, the second splits that power of two into 16
+// steps, and a bitmap per level records which lists are non-empty.  Allocating looks up
+// the smallest list whose ranges are all big enough and splits its first range, and
+// freeing merges a range with free neighbours, so both take constant time however many
+// ranges there are.
+//
+// Ranges are referred to by handle rather than offset, because Defragment() slides
+// every live range to the front of the arena and so changes their offsets.
+//***************************************************************************************
+
+#ifndef GEOMETRYALLOCATOR_H
+#define GEOMETRYALLOCATOR_H
+
+#include <vector>
+#include <cstdint>
+
+class GeometryAllocator
+{
+public:
+	static const std::uint32_t Invalid = ~0u;
+
+	// An arena range that holds the same elements before and after Defragment().
+	struct Move
+	{
+		std::uint32_t From;
+		std::uint32_t To;
+		std::uint32_t Count;
+	};
+
+	GeometryAllocator(std::uint32_t capacity);
+	GeometryAllocator(const GeometryAllocator& rhs) = delete;
+	GeometryAllocator& operator=(const GeometryAllocator& rhs) = delete;
+
+	// Returns the handle of a range of count elements, or Invalid if no free range is
+	// big enough.
+	std::uint32_t Allocate(std::uint32_t count);
+	void Free(std::uint32_t handle);
+
+	std::uint32_t Offset(std::uint32_t handle)const { return mBlocks[handle].Offset; }
+	std::uint32_t Count(std::uint32_t handle)const { return mBlocks[handle].Count; }
+
+	// Packs the live ranges, in arena order, at the start of an arena of newCapacity
+	// elements, which must hold them all.  Returns where each range's elements were and
+	// where they are now, with ranges that were and stay next to each other merged.
+	// Handles stay valid.
+	std::vector<Move> Defragment(std::uint32_t newCapacity);
+
+	std::uint32_t Capacity()const { return mCapacity; }
+	std::uint32_t UsedCount()const { return mUsed; }
+	std::uint32_t AllocationCount()const { return mAllocations; }
+
+	// The largest range that can be allocated right now.
+	std::uint32_t LargestFree()const;
+
+private:
+	static const std::uint32_t SecondLevelBits = 4;
+	static const std::uint32_t SecondLevelCount = 1 << SecondLevelBits;
+	static const std::uint32_t FirstLevelCount = 32 - SecondLevelBits + 1;
+
+	struct Block
+	{
+		std::uint32_t Offset;
+		std::uint32_t Count;
+
+		// Neighbours in the arena, and in the free list while Free is set.
+		std::uint32_t PrevPhysical;
+		std::uint32_t NextPhysical;
+		std::uint32_t PrevFree;
+		std::uint32_t NextFree;
+		bool Free;
+	};
+
+	static void Mapping(std::uint32_t count, std::uint32_t& fl, std::uint32_t& sl);
+
+	std::uint32_t NewBlock(std::uint32_t offset, std::uint32_t count);
+	void ReleaseBlock(std::uint32_t block);
+
+	void InsertFree(std::uint32_t block);
+	void RemoveFree(std::uint32_t block);
+	std::uint32_t FindFree(std::uint32_t count)const;
+
+	// Empties the free lists and makes [offset, mCapacity) one free range after last.
+	void ResetFreeSpace(std::uint32_t last, std::uint32_t offset);
+
+	std::uint32_t mCapacity;
+	std::uint32_t mUsed = 0;
+	std::uint32_t mAllocations = 0;
+
+	std::vector<Block> mBlocks;
+	std::vector<std::uint32_t> mUnusedBlocks;
+	std::uint32_t mFirstPhysical = Invalid;
+
+	std::uint32_t mFirstLevelBitmap = 0;
+	std::uint32_t mSecondLevelBitmap[FirstLevelCount];
+	std::uint32_t mFreeHeads[FirstLevelCount][SecondLevelCount];
+};
+
+#endif // GEOMETRYALLOCATOR_H
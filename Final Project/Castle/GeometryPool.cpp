@@ -0,0 +1,142 @@
+//***************************************************************************************
+// GeometryPool.cpp
+//***************************************************************************************
+
+#include "GeometryPool.h"
+#include <algorithm>
+
+using Microsoft::WRL::ComPtr;
+
+GeometryPool::GeometryPool(ID3D12Device* device, StagingRing& staging, UINT vertexStride,
+	UINT vertexCapacity, UINT indexCapacity)
+	: mDevice(device), mStaging(staging), mVertexStride(vertexStride),
+	mVertexAllocator(vertexCapacity), mIndexAllocator(indexCapacity)
+{
+	mVertexBuffer = CreateBuffer((UINT64)vertexCapacity * vertexStride);
+	mIndexBuffer = CreateBuffer((UINT64)indexCapacity * sizeof(std::uint32_t));
+}
+
+bool GeometryPool::Add(const void* vertices, UINT vertexCount, const std::uint32_t* indices, UINT indexCount,
+	PooledMesh& mesh)
+{
+	PooledMesh added;
+	if(vertexCount > 0)
+	{
+		added.Vertices = mVertexAllocator.Allocate(vertexCount);
+		if(added.Vertices == GeometryAllocator::Invalid)
+			return false;
+	}
+
+	if(indexCount > 0)
+	{
+		added.Indices = mIndexAllocator.Allocate(indexCount);
+		if(added.Indices == GeometryAllocator::Invalid)
+		{
+			Remove(added);
+			return false;
+		}
+	}
+
+	if(added.Vertices != GeometryAllocator::Invalid)
+	{
+		mStaging.UploadBuffer(mVertexBuffer.Get(), (UINT64)VertexOffset(added) * mVertexStride,
+			vertices, (UINT64)vertexCount * mVertexStride, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+	}
+
+	if(added.Indices != GeometryAllocator::Invalid)
+	{
+		mStaging.UploadBuffer(mIndexBuffer.Get(), (UINT64)IndexOffset(added) * sizeof(std::uint32_t),
+			indices, (UINT64)indexCount * sizeof(std::uint32_t), D3D12_RESOURCE_STATE_INDEX_BUFFER);
+	}
+
+	mesh = added;
+	return true;
+}
+
+void GeometryPool::Remove(const PooledMesh& mesh)
+{
+	if(mesh.Vertices != GeometryAllocator::Invalid)
+		mVertexAllocator.Free(mesh.Vertices);
+	if(mesh.Indices != GeometryAllocator::Invalid)
+		mIndexAllocator.Free(mesh.Indices);
+}
+
+void GeometryPool::Place(MeshGeometry& geo, const PooledMesh& mesh)const
+{
+	if(mesh.Vertices != GeometryAllocator::Invalid)
+	{
+		geo.VertexBufferGPU = mVertexBuffer;
+		geo.VertexByteStride = mVertexStride;
+		geo.VertexBufferByteSize = VertexCapacity() * mVertexStride;
+	}
+
+	if(mesh.Indices != GeometryAllocator::Invalid)
+	{
+		geo.IndexBufferGPU = mIndexBuffer;
+		geo.IndexFormat = DXGI_FORMAT_R32_UINT;
+		geo.IndexBufferByteSize = IndexCapacity() * sizeof(std::uint32_t);
+	}
+
+	for(auto& e : geo.DrawArgs)
+	{
+		if(mesh.Vertices != GeometryAllocator::Invalid)
+			e.second.BaseVertexLocation += (INT)VertexOffset(mesh);
+		if(mesh.Indices != GeometryAllocator::Invalid)
+			e.second.StartIndexLocation += IndexOffset(mesh);
+	}
+}
+
+void GeometryPool::Defragment(ID3D12GraphicsCommandList* cmdList, UINT64 fence,
+	UINT vertexCapacity, UINT indexCapacity)
+{
+	MoveArena(cmdList, fence, mVertexAllocator, mVertexBuffer, mVertexStride,
+		vertexCapacity != 0 ? vertexCapacity : VertexCapacity());
+	MoveArena(cmdList, fence, mIndexAllocator, mIndexBuffer, sizeof(std::uint32_t),
+		indexCapacity != 0 ? indexCapacity : IndexCapacity());
+}
+
+void GeometryPool::Reclaim(UINT64 completedFence)
+{
+	mRetired.erase(std::remove_if(mRetired.begin(), mRetired.end(),
+		[&](const Retired& r) { return r.Fence <= completedFence; }), mRetired.end());
+}
+
+ComPtr<ID3D12Resource> GeometryPool::CreateBuffer(UINT64 byteSize)
+{
+	ComPtr<ID3D12Resource> buffer;
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&buffer)));
+
+	return buffer;
+}
+
+void GeometryPool::MoveArena(ID3D12GraphicsCommandList* cmdList, UINT64 fence, GeometryAllocator& allocator,
+	ComPtr<ID3D12Resource>& buffer, UINT elementSize, UINT newCapacity)
+{
+	newCapacity = std::max(newCapacity, allocator.UsedCount());
+
+	ComPtr<ID3D12Resource> newBuffer = CreateBuffer((UINT64)newCapacity * elementSize);
+	std::vector<GeometryAllocator::Move> moves = allocator.Defragment(newCapacity);
+
+	// Buffers start every command list in the common state, and the copies promote the
+	// old buffer to COPY_SOURCE and the new one to COPY_DEST.
+	for(const GeometryAllocator::Move& move : moves)
+	{
+		cmdList->CopyBufferRegion(newBuffer.Get(), (UINT64)move.To * elementSize,
+			buffer.Get(), (UINT64)move.From * elementSize, (UINT64)move.Count * elementSize);
+	}
+
+	if(!moves.empty())
+	{
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(newBuffer.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ));
+	}
+
+	mRetired.push_back({ buffer, fence });
+	buffer = newBuffer;
+}
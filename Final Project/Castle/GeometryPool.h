@@ -0,0 +1,98 @@
+//***************************************************************************************
+// GeometryPool.h
+//
+// One vertex buffer and one 32-bit index buffer shared by all static meshes.
+//
+// Each mesh gets a range of vertices and a range of indices from a GeometryAllocator.
+// Drawing a mesh from the pool then only needs its offsets as BaseVertexLocation and
+// StartIndexLocation, so consecutive draws of different meshes keep the same vertex and
+// index buffer bound.
+//
+// Data is uploaded through a StagingRing.  Defragment() moves the live ranges into new
+// buffers with the gaps closed, after which mesh offsets must be looked up again.
+//***************************************************************************************
+
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include "../../Common/d3dUtil.h"
+#include "GeometryAllocator.h"
+#include "StagingRing.h"
+#include <vector>
+
+// A mesh's ranges in a GeometryPool.  Either may be Invalid, e.g. for meshes whose
+// vertices are written every frame.
+struct PooledMesh
+{
+	std::uint32_t Vertices = GeometryAllocator::Invalid;
+	std::uint32_t Indices = GeometryAllocator::Invalid;
+};
+
+class GeometryPool
+{
+public:
+	GeometryPool(ID3D12Device* device, StagingRing& staging, UINT vertexStride,
+		UINT vertexCapacity, UINT indexCapacity);
+	GeometryPool(const GeometryPool& rhs) = delete;
+	GeometryPool& operator=(const GeometryPool& rhs) = delete;
+
+	// Allocates and uploads vertexCount vertices of the pool's stride and indexCount
+	// indices.  Returns false, adding nothing, if either does not fit.
+	bool Add(const void* vertices, UINT vertexCount, const std::uint32_t* indices, UINT indexCount,
+		PooledMesh& mesh);
+
+	// The ranges are handed out again straight away, so the GPU must be done with any
+	// draws of the mesh.
+	void Remove(const PooledMesh& mesh);
+
+	UINT VertexOffset(const PooledMesh& mesh)const { return mVertexAllocator.Offset(mesh.Vertices); }
+	UINT IndexOffset(const PooledMesh& mesh)const { return mIndexAllocator.Offset(mesh.Indices); }
+
+	// Points geo at the pool's buffers and shifts its submeshes by mesh's offsets.  Call it
+	// once, right after Add().
+	void Place(MeshGeometry& geo, const PooledMesh& mesh)const;
+
+	ID3D12Resource* VertexBuffer()const { return mVertexBuffer.Get(); }
+	ID3D12Resource* IndexBuffer()const { return mIndexBuffer.Get(); }
+
+	// Copies the live ranges, packed together, into new buffers with room for the given
+	// number of elements, or the current capacity when 0.  The copies are recorded on
+	// cmdList straight away, so uploads queued in the staging ring must be flushed
+	// first.  fence is the value signalled once cmdList has executed, after which
+	// Reclaim() releases the old buffers.
+	void Defragment(ID3D12GraphicsCommandList* cmdList, UINT64 fence,
+		UINT vertexCapacity = 0, UINT indexCapacity = 0);
+	void Reclaim(UINT64 completedFence);
+
+	UINT VertexCount()const { return mVertexAllocator.UsedCount(); }
+	UINT IndexCount()const { return mIndexAllocator.UsedCount(); }
+	UINT VertexCapacity()const { return mVertexAllocator.Capacity(); }
+	UINT IndexCapacity()const { return mIndexAllocator.Capacity(); }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateBuffer(UINT64 byteSize);
+
+	// Copies allocator's live ranges from buffer into a new buffer of newCapacity
+	// elements and swaps it in.
+	void MoveArena(ID3D12GraphicsCommandList* cmdList, UINT64 fence, GeometryAllocator& allocator,
+		Microsoft::WRL::ComPtr<ID3D12Resource>& buffer, UINT elementSize, UINT newCapacity);
+
+	struct Retired
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Buffer;
+		UINT64 Fence;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	StagingRing& mStaging;
+	UINT mVertexStride;
+
+	GeometryAllocator mVertexAllocator;
+	GeometryAllocator mIndexAllocator;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mVertexBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mIndexBuffer;
+
+	std::vector<Retired> mRetired;
+};
+
+#endif // GEOMETRYPOOL_H
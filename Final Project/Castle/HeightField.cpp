@@ -0,0 +1,177 @@
+//***************************************************************************************
+// HeightField.cpp
+//***************************************************************************************
+
+#include "HeightField.h"
+#include <ppl.h>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	// Batches are split into blocks of this many points, and only batches of at least
+	// ParallelThreshold points are spread over threads.
+	const std::size_t BlockSize = 4096;
+	const std::size_t ParallelThreshold = 4*BlockSize;
+}
+
+void HeightField::SampleHeights(const XMFLOAT2* xz, float* heights, std::size_t count)const
+{
+	const std::size_t count4 = count & ~(std::size_t)3;
+
+	if(count4 >= ParallelThreshold)
+	{
+		const int blocks = (int)((count4 + BlockSize - 1) / BlockSize);
+		concurrency::parallel_for(0, blocks, [&](int b)
+		{
+			std::size_t first = (std::size_t)b*BlockSize;
+			std::size_t n = count4 - first < BlockSize ? count4 - first : BlockSize;
+			SampleHeightsBlock(xz + first, heights + first, n);
+		});
+	}
+	else if(count4 > 0)
+	{
+		SampleHeightsBlock(xz, heights, count4);
+	}
+
+	// Pad the last few points out to a full vector.
+	if(count4 != count)
+	{
+		XMFLOAT2 tailXZ[4];
+		float tailHeights[4];
+		for(std::size_t i = 0; i < 4; ++i)
+			tailXZ[i] = xz[count4 + (i < count - count4 ? i : 0)];
+
+		SampleHeightsBlock(tailXZ, tailHeights, 4);
+
+		for(std::size_t i = 0; i < count - count4; ++i)
+			heights[count4 + i] = tailHeights[i];
+	}
+}
+
+void HeightField::SampleNormals(const XMFLOAT2* xz, XMFLOAT3* normals, std::size_t count)const
+{
+	const std::size_t count4 = count & ~(std::size_t)3;
+
+	if(count4 >= ParallelThreshold)
+	{
+		const int blocks = (int)((count4 + BlockSize - 1) / BlockSize);
+		concurrency::parallel_for(0, blocks, [&](int b)
+		{
+			std::size_t first = (std::size_t)b*BlockSize;
+			std::size_t n = count4 - first < BlockSize ? count4 - first : BlockSize;
+			SampleNormalsBlock(xz + first, normals + first, n);
+		});
+	}
+	else if(count4 > 0)
+	{
+		SampleNormalsBlock(xz, normals, count4);
+	}
+
+	if(count4 != count)
+	{
+		XMFLOAT2 tailXZ[4];
+		XMFLOAT3 tailNormals[4];
+		for(std::size_t i = 0; i < 4; ++i)
+			tailXZ[i] = xz[count4 + (i < count - count4 ? i : 0)];
+
+		SampleNormalsBlock(tailXZ, tailNormals, 4);
+
+		for(std::size_t i = 0; i < count - count4; ++i)
+			normals[count4 + i] = tailNormals[i];
+	}
+}
+
+void HeightField::LoadXZ4(const XMFLOAT2* xz, XMVECTOR& x, XMVECTOR& z)
+{
+	// Two unaligned loads of (x0 z0 x1 z1) and (x2 z2 x3 z3), then deinterleave.
+	XMVECTOR a = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(xz));
+	XMVECTOR b = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(xz + 2));
+
+	x = XMVectorPermute<XM_PERMUTE_0X, XM_PERMUTE_0Z, XM_PERMUTE_1X, XM_PERMUTE_1Z>(a, b);
+	z = XMVectorPermute<XM_PERMUTE_0Y, XM_PERMUTE_0W, XM_PERMUTE_1Y, XM_PERMUTE_1W>(a, b);
+}
+
+void HeightField::StoreNormals4(XMFLOAT3* normals, FXMVECTOR nx, FXMVECTOR ny, FXMVECTOR nz)
+{
+	XMFLOAT4A x, y, z;
+	XMStoreFloat4A(&x, nx);
+	XMStoreFloat4A(&y, ny);
+	XMStoreFloat4A(&z, nz);
+
+	normals[0] = XMFLOAT3(x.x, y.x, z.x);
+	normals[1] = XMFLOAT3(x.y, y.y, z.y);
+	normals[2] = XMFLOAT3(x.z, y.z, z.z);
+	normals[3] = XMFLOAT3(x.w, y.w, z.w);
+}
+
+HillsHeightField::HillsHeightField(float amplitude, float frequency)
+	: mAmplitude(amplitude), mFrequency(frequency)
+{
+}
+
+float HillsHeightField::GetHeight(float x, float z)const
+{
+	return mAmplitude*(z*sinf(mFrequency*x) + x*cosf(mFrequency*z));
+}
+
+XMFLOAT3 HillsHeightField::GetNormal(float x, float z)const
+{
+	// n = (-df/dx, 1, -df/dz)
+	float dhdx = mAmplitude*(mFrequency*z*cosf(mFrequency*x) + cosf(mFrequency*z));
+	float dhdz = mAmplitude*(sinf(mFrequency*x) - mFrequency*x*sinf(mFrequency*z));
+
+	XMFLOAT3 n(-dhdx, 1.0f, -dhdz);
+	XMVECTOR unitNormal = XMVector3Normalize(XMLoadFloat3(&n));
+	XMStoreFloat3(&n, unitNormal);
+
+	return n;
+}
+
+void HillsHeightField::SampleHeightsBlock(const XMFLOAT2* xz, float* heights, std::size_t count)const
+{
+	const XMVECTOR a = XMVectorReplicate(mAmplitude);
+	const XMVECTOR f = XMVectorReplicate(mFrequency);
+
+	for(std::size_t i = 0; i < count; i += 4)
+	{
+		XMVECTOR x, z;
+		LoadXZ4(xz + i, x, z);
+
+		XMVECTOR sinX = XMVectorSin(XMVectorMultiply(f, x));
+		XMVECTOR cosZ = XMVectorCos(XMVectorMultiply(f, z));
+
+		XMVECTOR h = XMVectorMultiply(a, XMVectorMultiplyAdd(z, sinX, XMVectorMultiply(x, cosZ)));
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(heights + i), h);
+	}
+}
+
+void HillsHeightField::SampleNormalsBlock(const XMFLOAT2* xz, XMFLOAT3* normals, std::size_t count)const
+{
+	const XMVECTOR a = XMVectorReplicate(mAmplitude);
+	const XMVECTOR f = XMVectorReplicate(mFrequency);
+	const XMVECTOR one = XMVectorSplatOne();
+
+	for(std::size_t i = 0; i < count; i += 4)
+	{
+		XMVECTOR x, z;
+		LoadXZ4(xz + i, x, z);
+
+		XMVECTOR sinX, cosX, sinZ, cosZ;
+		XMVectorSinCos(&sinX, &cosX, XMVectorMultiply(f, x));
+		XMVectorSinCos(&sinZ, &cosZ, XMVectorMultiply(f, z));
+
+		// -df/dx and -df/dz.
+		XMVECTOR nx = XMVectorNegate(XMVectorMultiply(a,
+			XMVectorMultiplyAdd(XMVectorMultiply(f, z), cosX, cosZ)));
+		XMVECTOR nz = XMVectorNegate(XMVectorMultiply(a,
+			XMVectorSubtract(sinX, XMVectorMultiply(XMVectorMultiply(f, x), sinZ))));
+
+		XMVECTOR invLength = XMVectorReciprocalSqrt(
+			XMVectorMultiplyAdd(nx, nx, XMVectorMultiplyAdd(nz, nz, one)));
+
+		StoreNormals4(normals + i, XMVectorMultiply(nx, invLength), invLength,
+			XMVectorMultiply(nz, invLength));
+	}
+}
@@ -0,0 +1,59 @@
+//***************************************************************************************
+// HeightField.h
+//
+// Batch height and normal queries over the ground.  Points are given as (x, z) pairs
+// and processed four at a time with DirectXMath vectors; large batches are also split
+// across threads.  Use these instead of calling a per-point function in a loop when
+// placing many instances or testing many points for collision.
+//
+// Backends implement SampleHeightsBlock/SampleNormalsBlock, which are only ever given
+// runs of points that are a multiple of four long.
+//***************************************************************************************
+
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include <cstddef>
+#include <DirectXMath.h>
+
+class HeightField
+{
+public:
+	virtual ~HeightField() = default;
+
+	// heights[i] is the height of the ground at xz[i].x, xz[i].y.
+	void SampleHeights(const DirectX::XMFLOAT2* xz, float* heights, std::size_t count)const;
+
+	// normals[i] is the unit normal of the ground at xz[i].x, xz[i].y.
+	void SampleNormals(const DirectX::XMFLOAT2* xz, DirectX::XMFLOAT3* normals, std::size_t count)const;
+
+protected:
+	// count is a multiple of 4.
+	virtual void SampleHeightsBlock(const DirectX::XMFLOAT2* xz, float* heights, std::size_t count)const = 0;
+	virtual void SampleNormalsBlock(const DirectX::XMFLOAT2* xz, DirectX::XMFLOAT3* normals, std::size_t count)const = 0;
+
+	// Helpers for the backends: split four points into their x and z coordinates, and
+	// write four normals given as separate x, y and z components.
+	static void LoadXZ4(const DirectX::XMFLOAT2* xz, DirectX::XMVECTOR& x, DirectX::XMVECTOR& z);
+	static void StoreNormals4(DirectX::XMFLOAT3* normals, DirectX::FXMVECTOR nx, DirectX::FXMVECTOR ny, DirectX::FXMVECTOR nz);
+};
+
+// The sine wave hills of the original land grid: y = a*(z*sin(f*x) + x*cos(f*z)).
+class HillsHeightField : public HeightField
+{
+public:
+	HillsHeightField(float amplitude = 0.1f, float frequency = 0.1f);
+
+	float GetHeight(float x, float z)const;
+	DirectX::XMFLOAT3 GetNormal(float x, float z)const;
+
+protected:
+	void SampleHeightsBlock(const DirectX::XMFLOAT2* xz, float* heights, std::size_t count)const override;
+	void SampleNormalsBlock(const DirectX::XMFLOAT2* xz, DirectX::XMFLOAT3* normals, std::size_t count)const override;
+
+private:
+	float mAmplitude;
+	float mFrequency;
+};
+
+#endif // HEIGHTFIELD_H
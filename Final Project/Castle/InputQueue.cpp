@@ -0,0 +1,96 @@
+//***************************************************************************************
+// InputQueue.cpp
+//***************************************************************************************
+
+#include "InputQueue.h"
+#include <algorithm>
+
+InputQueue::InputQueue(std::uint32_t capacity)
+{
+	std::uint32_t size = 2;
+	while(size < capacity)
+		size *= 2;
+
+	mCells.reset(new Cell[size]);
+	mMask = size - 1;
+
+	// A cell is free to write at position p while its sequence is p, and ready to read at
+	// position p once it is p + 1.
+	for(std::uint32_t i = 0; i < size; ++i)
+		mCells[i].Sequence.store(i, std::memory_order_relaxed);
+}
+
+bool InputQueue::Push(InputEvent e)
+{
+	e.Time = InputEvent::Clock::now();
+
+	std::uint64_t pos = mWritePos.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		Cell& cell = mCells[pos & mMask];
+		std::uint64_t sequence = cell.Sequence.load(std::memory_order_acquire);
+
+		if(sequence == pos)
+		{
+			// On failure pos is reloaded and the claim is retried.
+			if(mWritePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.Event = e;
+				cell.Sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if(sequence < pos)
+		{
+			// The consumer has not got round to this cell's last event yet.
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{
+			// Another producer claimed pos first.
+			pos = mWritePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+std::size_t InputQueue::PopAll(std::vector<InputEvent>& events)
+{
+	std::size_t count = 0;
+	for(;;)
+	{
+		Cell& cell = mCells[mReadPos & mMask];
+		if(cell.Sequence.load(std::memory_order_acquire) != mReadPos + 1)
+			break;
+
+		events.push_back(cell.Event);
+		cell.Sequence.store(mReadPos + mMask + 1, std::memory_order_release);
+		++mReadPos;
+		++count;
+	}
+
+	return count;
+}
+
+void InputLatency::Record(const std::vector<InputEvent>& events, InputEvent::Clock::time_point consumed)
+{
+	for(const InputEvent& e : events)
+	{
+		double ms = std::chrono::duration<double, std::milli>(consumed - e.Time).count();
+		mWindowTotalMs += ms;
+		mWindowMaxMs = std::max(mWindowMaxMs, ms);
+	}
+
+	mWindowEvents += events.size();
+}
+
+void InputLatency::EndWindow()
+{
+	mEvents = mWindowEvents;
+	mAverageMs = mWindowEvents > 0 ? mWindowTotalMs / mWindowEvents : 0.0;
+	mMaxMs = mWindowMaxMs;
+
+	mWindowEvents = 0;
+	mWindowTotalMs = 0.0;
+	mWindowMaxMs = 0.0;
+}
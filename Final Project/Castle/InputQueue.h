@@ -0,0 +1,114 @@
+//***************************************************************************************
+// InputQueue.h
+//
+// Carries keyboard and mouse events from the window procedure to the game update, so the
+// update does not have to run on the thread that owns the window or poll key state.
+//
+// The queue is a bounded ring of cells, each with a sequence number saying whether it is
+// free to write or ready to read.  Producers claim a cell by advancing the write position
+// with a compare-exchange and publish it by bumping its sequence, so any number of threads
+// may push at once without locks.  There is a single consumer, which takes everything
+// that is ready in one batch per frame.  When the ring is full new events are dropped and
+// counted rather than making the window procedure wait.
+//
+// Every event is stamped with the time it was pushed.  InputLatency turns the stamps of a
+// consumed batch into how long events waited for the frame that handled them.
+//***************************************************************************************
+
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class InputEventType : std::uint8_t
+{
+	KeyDown,
+	KeyUp,
+	MouseDown,
+	MouseUp,
+	MouseMove,
+
+	// The window lost focus, so the key and button ups that follow may never arrive.
+	FocusLost
+};
+
+struct InputEvent
+{
+	typedef std::chrono::steady_clock Clock;
+
+	InputEventType Type = InputEventType::MouseMove;
+
+	// The virtual key for key events, the MK_ button flags for mouse events.
+	std::uint32_t Key = 0;
+	int X = 0;
+	int Y = 0;
+
+	// Set by InputQueue::Push().
+	Clock::time_point Time;
+};
+
+class InputQueue
+{
+public:
+	// capacity is rounded up to a power of two.
+	explicit InputQueue(std::uint32_t capacity = 1024);
+	InputQueue(const InputQueue& rhs) = delete;
+	InputQueue& operator=(const InputQueue& rhs) = delete;
+
+	// Producer side, from any thread.  Stamps the event with the current time and returns
+	// false if the queue was full and the event was dropped.
+	bool Push(InputEvent e);
+
+	// Consumer side, from one thread.  Appends every event that is ready, oldest first, and
+	// returns how many there were.
+	std::size_t PopAll(std::vector<InputEvent>& events);
+
+	std::uint32_t Capacity()const { return mMask + 1; }
+	std::uint64_t Dropped()const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+	struct Cell
+	{
+		std::atomic<std::uint64_t> Sequence;
+		InputEvent Event;
+	};
+
+	std::unique_ptr<Cell[]> mCells;
+	std::uint32_t mMask;
+
+	// Written positions are claimed by producers; the read position is the consumer's own.
+	std::atomic<std::uint64_t> mWritePos{ 0 };
+	std::uint64_t mReadPos = 0;
+
+	std::atomic<std::uint64_t> mDropped{ 0 };
+};
+
+// How long consumed events waited, averaged over windows of frames.
+class InputLatency
+{
+public:
+	// Counts a batch consumed at time consumed.
+	void Record(const std::vector<InputEvent>& events, InputEvent::Clock::time_point consumed);
+
+	// Ends the current window; the getters below then describe it.
+	void EndWindow();
+
+	std::uint64_t Events()const { return mEvents; }
+	double AverageMs()const { return mAverageMs; }
+	double MaxMs()const { return mMaxMs; }
+
+private:
+	std::uint64_t mWindowEvents = 0;
+	double mWindowTotalMs = 0.0;
+	double mWindowMaxMs = 0.0;
+
+	std::uint64_t mEvents = 0;
+	double mAverageMs = 0.0;
+	double mMaxMs = 0.0;
+};
+
+#endif // INPUTQUEUE_H
@@ -0,0 +1,161 @@
+//***************************************************************************************
+// LightBaker.cpp
+//***************************************************************************************
+
+#include "LightBaker.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+	XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+	}
+
+	XMFLOAT3 Normalize(const XMFLOAT3& v)
+	{
+		const float length = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+		return XMFLOAT3(v.x / length, v.y / length, v.z / length);
+	}
+
+	int BitCount(int mask)
+	{
+		return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+}
+
+void LightBaker::Bake(const LightBakeDesc& desc, const XMFLOAT3* positions, const XMFLOAT3* normals,
+	std::size_t count, XMFLOAT4* results)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	const int packets = (MathHelper::Max(1, desc.OcclusionRays) + 3) / 4;
+	const int occlusionRays = 4*packets;
+
+	// A few batches per core, as points in the open cost more than points in corners.
+	const std::size_t threads = MathHelper::Max(1u, std::thread::hardware_concurrency());
+	const std::size_t batchCount = MathHelper::Max((std::size_t)1, MathHelper::Min(count, 4*threads));
+	const std::size_t batchSize = (count + batchCount - 1) / batchCount;
+	std::atomic<std::uint64_t> raysCast{ 0 };
+
+	concurrency::parallel_for((std::size_t)0, batchCount, [&](std::size_t batch)
+	{
+		const std::size_t first = batch*batchSize;
+		const std::size_t last = MathHelper::Min(count, first + batchSize);
+		std::uint64_t batchRays = 0;
+
+		XMFLOAT3 origins[4];
+		XMFLOAT3 directions[4];
+		float distances[4];
+		XMFLOAT3 strengths[4];
+
+		for(std::size_t i = first; i < last; ++i)
+		{
+			RandomStream random(((std::uint64_t)desc.Seed << 32) ^ (std::uint64_t)(i + 1));
+
+			const XMFLOAT3& p = positions[i];
+			const XMFLOAT3& n = normals[i];
+			const XMFLOAT3 origin(p.x + n.x*desc.SurfaceOffset, p.y + n.y*desc.SurfaceOffset, p.z + n.z*desc.SurfaceOffset);
+
+			// Shadow rays to up to four lights at a time; the lights they reach add on.
+			XMFLOAT3 light(0.0f, 0.0f, 0.0f);
+			int pending = 0;
+			auto castShadowRays = [&]()
+			{
+				for(int k = pending; k < 4; ++k)
+				{
+					origins[k] = origins[0];
+					directions[k] = directions[0];
+					distances[k] = distances[0];
+				}
+
+				const int blocked = mScene.Occluded4(origins, directions, distances);
+				for(int k = 0; k < pending; ++k)
+				{
+					if((blocked & (1 << k)) == 0)
+					{
+						light.x += strengths[k].x;
+						light.y += strengths[k].y;
+						light.z += strengths[k].z;
+					}
+				}
+
+				batchRays += pending;
+				pending = 0;
+			};
+
+			for(const BakedLight& l : mLights)
+			{
+				const XMFLOAT3 toLight(l.Position.x - p.x, l.Position.y - p.y, l.Position.z - p.z);
+				const float d = sqrtf(toLight.x*toLight.x + toLight.y*toLight.y + toLight.z*toLight.z);
+				if(d > l.FalloffEnd || d < 1.0e-6f)
+					continue;
+
+				const XMFLOAT3 lightVec(toLight.x / d, toLight.y / d, toLight.z / d);
+				float factor = MathHelper::Max(lightVec.x*n.x + lightVec.y*n.y + lightVec.z*n.z, 0.0f);
+				factor *= MathHelper::Clamp((l.FalloffEnd - d) / (l.FalloffEnd - l.FalloffStart), 0.0f, 1.0f);
+				if(l.Spot)
+				{
+					const float cosine = -(lightVec.x*l.Direction.x + lightVec.y*l.Direction.y + lightVec.z*l.Direction.z);
+					factor *= powf(MathHelper::Max(cosine, 0.0f), l.SpotPower);
+				}
+
+				if(factor <= 0.0f)
+					continue;
+
+				// The ray's direction reaches the light at a distance of 1.
+				origins[pending] = origin;
+				directions[pending] = XMFLOAT3(l.Position.x - origin.x, l.Position.y - origin.y, l.Position.z - origin.z);
+				distances[pending] = 1.0f;
+				strengths[pending] = XMFLOAT3(l.Strength.x*factor, l.Strength.y*factor, l.Strength.z*factor);
+				if(++pending == 4)
+					castShadowRays();
+			}
+
+			if(pending > 0)
+				castShadowRays();
+
+			// Cosine weighted rays over the hemisphere, spread evenly around the normal with
+			// a random jitter each.
+			const XMFLOAT3 axis = fabsf(n.x) < 0.9f ? XMFLOAT3(1.0f, 0.0f, 0.0f) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+			const XMFLOAT3 tangent = Normalize(Cross(axis, n));
+			const XMFLOAT3 bitangent = Cross(n, tangent);
+
+			int open = 0;
+			for(int packet = 0; packet < packets; ++packet)
+			{
+				for(int k = 0; k < 4; ++k)
+				{
+					const float r2 = random.NextFloat();
+					const float r = sqrtf(r2);
+					const float phi = 2.0f*MathHelper::Pi*(4*packet + k + random.NextFloat()) / occlusionRays;
+					const float x = r*cosf(phi);
+					const float y = r*sinf(phi);
+					const float z = sqrtf(MathHelper::Max(0.0f, 1.0f - r2));
+
+					origins[k] = origin;
+					directions[k] = XMFLOAT3(tangent.x*x + bitangent.x*y + n.x*z, tangent.y*x + bitangent.y*y + n.y*z,
+						tangent.z*x + bitangent.z*y + n.z*z);
+					distances[k] = desc.OcclusionDistance;
+				}
+
+				open += 4 - BitCount(mScene.Occluded4(origins, directions, distances));
+			}
+
+			batchRays += occlusionRays;
+			results[i] = XMFLOAT4(light.x, light.y, light.z, (float)open / occlusionRays);
+		}
+
+		raysCast += batchRays;
+	});
+
+	mRaysCast = raysCast;
+	mBakeSeconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - t0).count();
+}
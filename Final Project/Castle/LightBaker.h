@@ -0,0 +1,82 @@
+//***************************************************************************************
+// LightBaker.h
+//
+// Bakes the light that never changes, from lights that never move onto surfaces that
+// never move, so the shaders read it back instead of working it out every pixel.
+//
+// Bake() takes surface points, in practice the vertices of the static meshes, and casts
+// rays from each against a TriangleBvh of the static scene.  A point gets, from each
+// light that reaches it, the light's strength after the same Lambert, distance and spot
+// falloff as ComputePointLight() and ComputeSpotLight() in LightingUtil.hlsl, if a shadow
+// ray gets to the light.  It also gets ambient occlusion: the fraction of cosine weighted
+// rays over the hemisphere around its normal that go a given distance without hitting
+// anything.  Rays from a point are cast as packets of four, and points are baked in
+// parallel, each from a random stream of its own so the result does not depend on which
+// thread bakes it.
+//
+// Only light straight from the lights is baked; nothing bounces.
+//***************************************************************************************
+
+#ifndef LIGHTBAKER_H
+#define LIGHTBAKER_H
+
+#include "TriangleBvh.h"
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+
+// Laid out like Light in LightingUtil.hlsl.  SpotPower is only used by spot lights.
+struct BakedLight
+{
+	DirectX::XMFLOAT3 Strength = { 0.5f, 0.5f, 0.5f };
+	float FalloffStart = 1.0f;
+	DirectX::XMFLOAT3 Direction = { 0.0f, -1.0f, 0.0f };
+	float FalloffEnd = 10.0f;
+	DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+	float SpotPower = 64.0f;
+	bool Spot = false;
+};
+
+struct LightBakeDesc
+{
+	// Hemisphere rays per point, rounded up to whole packets, and how far they look.
+	// Whatever is farther away does not darken the point.
+	int OcclusionRays = 64;
+	float OcclusionDistance = 8.0f;
+
+	// How far along its normal each ray starts off the surface, so it does not hit the
+	// triangles it starts on.
+	float SurfaceOffset = 0.01f;
+
+	std::uint32_t Seed = 1;
+};
+
+class LightBaker
+{
+public:
+	// scene must outlive the baker.
+	explicit LightBaker(const TriangleBvh& scene) : mScene(scene) {}
+	LightBaker(const LightBaker& rhs) = delete;
+	LightBaker& operator=(const LightBaker& rhs) = delete;
+
+	void AddLight(const BakedLight& light) { mLights.push_back(light); }
+	std::size_t LightCount()const { return mLights.size(); }
+
+	// For each of count points, with a unit normal, the light falling on it in xyz and
+	// its ambient occlusion, 1 for open sky, in w.
+	void Bake(const LightBakeDesc& desc, const DirectX::XMFLOAT3* positions, const DirectX::XMFLOAT3* normals,
+		std::size_t count, DirectX::XMFLOAT4* results);
+
+	// What the last Bake() cost.
+	float LastBakeSeconds()const { return mBakeSeconds; }
+	std::uint64_t LastRaysCast()const { return mRaysCast; }
+
+private:
+	const TriangleBvh& mScene;
+	std::vector<BakedLight> mLights;
+
+	float mBakeSeconds = 0.0f;
+	std::uint64_t mRaysCast = 0;
+};
+
+#endif // LIGHTBAKER_H
@@ -0,0 +1,152 @@
+//***************************************************************************************
+// MazeGenerator.cpp
+//***************************************************************************************
+
+#include "MazeGenerator.h"
+#include "../../Common/MathHelper.h"
+#include <chrono>
+
+void MazeGenerator::Generate(const MazeDesc& desc)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	mDesc = desc;
+
+	const std::uint32_t w = mDesc.Width;
+	const std::uint32_t d = mDesc.Depth;
+
+	// Start with every wall standing.
+	mCells.assign((std::size_t)w*d, WallPosX | WallPosZ);
+	if(w == 0 || d == 0)
+		return;
+
+	RandomStream rng(mDesc.Seed);
+
+	// Iterative recursive backtracker: walk to a random unvisited neighbour, knocking down
+	// the wall in between, and back up when there is none.
+	std::vector<std::uint32_t> stack;
+	stack.reserve((std::size_t)w*d);
+
+	std::uint32_t start = (std::uint32_t)rng.NextInt(0, (int)(w*d) - 1);
+	mCells[start] |= Visited;
+	stack.push_back(start);
+
+	while(!stack.empty())
+	{
+		const std::uint32_t cell = stack.back();
+		const std::uint32_t x = cell % w;
+		const std::uint32_t z = cell / w;
+
+		std::uint32_t neighbours[4];
+		int count = 0;
+		if(x > 0 && !(mCells[cell - 1] & Visited))     neighbours[count++] = cell - 1;
+		if(x + 1 < w && !(mCells[cell + 1] & Visited)) neighbours[count++] = cell + 1;
+		if(z > 0 && !(mCells[cell - w] & Visited))     neighbours[count++] = cell - w;
+		if(z + 1 < d && !(mCells[cell + w] & Visited)) neighbours[count++] = cell + w;
+
+		if(count == 0)
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		const std::uint32_t next = neighbours[count == 1 ? 0 : rng.NextInt(0, count - 1)];
+
+		// Each wall belongs to the cell on its -x or -z side.
+		if(next == cell + 1)
+			mCells[cell] &= ~WallPosX;
+		else if(next + 1 == cell)
+			mCells[next] &= ~WallPosX;
+		else if(next == cell + w)
+			mCells[cell] &= ~WallPosZ;
+		else
+			mCells[next] &= ~WallPosZ;
+
+		mCells[next] |= Visited;
+		stack.push_back(next);
+	}
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	mGenerateSeconds = std::chrono::duration<float>(t1 - t0).count();
+}
+
+bool MazeGenerator::HasWallPosX(std::uint32_t x, std::uint32_t z)const
+{
+	return (mCells[(std::size_t)z*mDesc.Width + x] & WallPosX) != 0;
+}
+
+bool MazeGenerator::HasWallPosZ(std::uint32_t x, std::uint32_t z)const
+{
+	return (mCells[(std::size_t)z*mDesc.Width + x] & WallPosZ) != 0;
+}
+
+bool MazeGenerator::SegmentAlongX(std::uint32_t x, std::uint32_t z)const
+{
+	// Lattice line z is the +z wall of the cells in row z-1.
+	if(z == 0 || z == mDesc.Depth)
+		return mDesc.Border;
+
+	return HasWallPosZ(x, z - 1);
+}
+
+bool MazeGenerator::SegmentAlongZ(std::uint32_t x, std::uint32_t z)const
+{
+	// Lattice line x is the +x wall of the cells in column x-1.
+	if(x == 0 || x == mDesc.Width)
+		return mDesc.Border;
+
+	return HasWallPosX(x - 1, z);
+}
+
+void MazeGenerator::MergeWalls(std::vector<MazeWallRun>& runs)const
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	runs.clear();
+
+	const std::int32_t w = (std::int32_t)mDesc.Width;
+	const std::int32_t d = (std::int32_t)mDesc.Depth;
+	if(w == 0 || d == 0)
+		return;
+
+	// Runs along z are tracked for every lattice column at once so the cells are still
+	// read row by row.  -1 means no run is open in that column.
+	std::vector<std::int32_t> openZ(w + 1, -1);
+
+	for(std::int32_t z = 0; z <= d; ++z)
+	{
+		// Runs along x on lattice line z.
+		std::int32_t openX = -1;
+		for(std::int32_t x = 0; x <= w; ++x)
+		{
+			bool wall = x < w && SegmentAlongX(x, z);
+			if(wall && openX < 0)
+			{
+				openX = x;
+			}
+			else if(!wall && openX >= 0)
+			{
+				runs.push_back({ openX, z, x, z });
+				openX = -1;
+			}
+		}
+
+		// Runs along z through lattice row z.
+		for(std::int32_t x = 0; x <= w; ++x)
+		{
+			bool wall = z < d && SegmentAlongZ(x, z);
+			if(wall && openZ[x] < 0)
+			{
+				openZ[x] = z;
+			}
+			else if(!wall && openZ[x] >= 0)
+			{
+				runs.push_back({ x, openZ[x], x, z });
+				openZ[x] = -1;
+			}
+		}
+	}
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	mMergeSeconds = std::chrono::duration<float>(t1 - t0).count();
+}
@@ -0,0 +1,85 @@
+//***************************************************************************************
+// MazeGenerator.h
+//
+// Generates perfect mazes (exactly one path between any two cells) on a grid of square
+// cells with an iterative recursive backtracker, so any seed and size can be rebuilt
+// on demand.
+//
+// Walls sit on the lattice lines between cells.  MergeWalls() joins collinear wall
+// segments into maximal runs; each run becomes one box, which is the fewest boxes that
+// can cover the walls since a box one wall thick can only cover a straight run.
+//***************************************************************************************
+
+#ifndef MAZEGENERATOR_H
+#define MAZEGENERATOR_H
+
+#include <vector>
+#include <cstdint>
+
+struct MazeDesc
+{
+	// Number of cells along x and z.
+	std::uint32_t Width = 8;
+	std::uint32_t Depth = 8;
+
+	std::uint32_t Seed = 1;
+
+	// Whether MergeWalls() includes the outer boundary.  Turn off when the maze is placed
+	// inside existing walls.
+	bool Border = true;
+};
+
+// A straight run of wall between two lattice points.  Lattice point (x, z) is the corner
+// shared by cells (x-1, z-1) and (x, z).  Either X0 == X1 (the run goes along z) or
+// Z0 == Z1 (the run goes along x), and the run is at least one cell long.
+struct MazeWallRun
+{
+	std::int32_t X0;
+	std::int32_t Z0;
+	std::int32_t X1;
+	std::int32_t Z1;
+};
+
+class MazeGenerator
+{
+public:
+	MazeGenerator() = default;
+	MazeGenerator(const MazeGenerator& rhs) = delete;
+	MazeGenerator& operator=(const MazeGenerator& rhs) = delete;
+
+	void Generate(const MazeDesc& desc);
+
+	// Fills runs with the merged walls of the last generated maze.
+	void MergeWalls(std::vector<MazeWallRun>& runs)const;
+
+	std::uint32_t Width()const { return mDesc.Width; }
+	std::uint32_t Depth()const { return mDesc.Depth; }
+
+	// Walls between cell (x, z) and its +x and +z neighbours.  Walls on the outer boundary
+	// are always reported.
+	bool HasWallPosX(std::uint32_t x, std::uint32_t z)const;
+	bool HasWallPosZ(std::uint32_t x, std::uint32_t z)const;
+
+	float LastGenerateSeconds()const { return mGenerateSeconds; }
+	float LastMergeSeconds()const { return mMergeSeconds; }
+
+private:
+	enum CellFlags : std::uint8_t
+	{
+		WallPosX = 0x1,
+		WallPosZ = 0x2,
+		Visited = 0x4
+	};
+
+	// Whether the lattice segment from (x, z) to (x+1, z), or (x, z) to (x, z+1), is wall.
+	bool SegmentAlongX(std::uint32_t x, std::uint32_t z)const;
+	bool SegmentAlongZ(std::uint32_t x, std::uint32_t z)const;
+
+	MazeDesc mDesc;
+	std::vector<std::uint8_t> mCells;
+
+	float mGenerateSeconds = 0.0f;
+	mutable float mMergeSeconds = 0.0f;
+};
+
+#endif // MAZEGENERATOR_H
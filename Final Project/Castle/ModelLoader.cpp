@@ -0,0 +1,49 @@
+//***************************************************************************************
+// ModelLoader.cpp
+//***************************************************************************************
+
+#include "ModelLoader.h"
+#include <fstream>
+
+using namespace DirectX;
+
+bool LoadTextModel(const std::string& filename, ModelData& model)
+{
+	model = ModelData();
+
+	std::ifstream fin(filename);
+	if(!fin)
+		return false;
+
+	std::string ignore;
+	std::size_t vertexCount = 0;
+	std::size_t triangleCount = 0;
+	fin >> ignore >> vertexCount;
+	fin >> ignore >> triangleCount;
+	fin >> ignore >> ignore >> ignore >> ignore;
+	if(!fin)
+		return false;
+
+	model.Positions.resize(vertexCount);
+	model.Normals.resize(vertexCount);
+	for(std::size_t i = 0; i < vertexCount; ++i)
+	{
+		XMFLOAT3& p = model.Positions[i];
+		XMFLOAT3& n = model.Normals[i];
+		fin >> p.x >> p.y >> p.z >> n.x >> n.y >> n.z;
+	}
+
+	fin >> ignore >> ignore >> ignore;
+
+	model.Indices.resize(3*triangleCount);
+	for(std::size_t i = 0; i < model.Indices.size(); ++i)
+		fin >> model.Indices[i];
+
+	bool valid = (bool)fin;
+	for(std::size_t i = 0; i < model.Indices.size() && valid; ++i)
+		valid = model.Indices[i] < vertexCount;
+
+	if(!valid)
+		model = ModelData();
+	return valid;
+}
@@ -0,0 +1,37 @@
+//***************************************************************************************
+// ModelLoader.h
+//
+// Reads the text meshes in Models/, such as skull.txt:
+//
+//   VertexCount: n
+//   TriangleCount: m
+//   VertexList (pos, normal)
+//   {
+//       x y z nx ny nz          n lines
+//   }
+//   TriangleList
+//   {
+//       i0 i1 i2                m lines
+//   }
+//***************************************************************************************
+
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+
+struct ModelData
+{
+	std::vector<DirectX::XMFLOAT3> Positions;
+	std::vector<DirectX::XMFLOAT3> Normals;
+	std::vector<std::uint32_t> Indices;
+};
+
+// False, with model left empty, if the file is missing, cut short or has an index out
+// of range.
+bool LoadTextModel(const std::string& filename, ModelData& model);
+
+#endif // MODELLOADER_H
@@ -0,0 +1,570 @@
+//***************************************************************************************
+// Navigation.cpp
+//***************************************************************************************
+
+#include "Navigation.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	const float Sqrt2 = 1.41421356f;
+
+	const int DirX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+	const int DirZ[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+	typedef std::pair<float, std::uint32_t> HeapEntry;
+
+	void HeapPush(std::vector<HeapEntry>& heap, float key, std::uint32_t cell)
+	{
+		heap.push_back(HeapEntry(key, cell));
+		std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+	}
+
+	HeapEntry HeapPop(std::vector<HeapEntry>& heap)
+	{
+		std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+		HeapEntry top = heap.back();
+		heap.pop_back();
+		return top;
+	}
+
+	int Sign(int v)
+	{
+		return (v > 0) - (v < 0);
+	}
+
+	// Octile distance, the exact path length on an empty 8-connected grid.
+	float Octile(int dx, int dz)
+	{
+		dx = abs(dx);
+		dz = abs(dz);
+		return (float)(dx + dz) + (Sqrt2 - 2.0f)*(float)MathHelper::Min(dx, dz);
+	}
+
+	// A diagonal step may not cut the corner of a blocked cell.
+	bool CanStep(const NavGrid& grid, int x, int z, int dx, int dz)
+	{
+		if(grid.IsBlocked(x + dx, z + dz))
+			return false;
+
+		return dx == 0 || dz == 0 || (!grid.IsBlocked(x + dx, z) && !grid.IsBlocked(x, z + dz));
+	}
+}
+
+//
+// NavGrid
+//
+
+NavGrid::NavGrid(const NavGridDesc& desc)
+	: mDesc(desc)
+{
+	mDesc.CellSize = MathHelper::Max(mDesc.CellSize, 0.001f);
+	mWidth = MathHelper::Max(1, (int)ceilf((mDesc.MaxX - mDesc.MinX) / mDesc.CellSize));
+	mDepth = MathHelper::Max(1, (int)ceilf((mDesc.MaxZ - mDesc.MinZ) / mDesc.CellSize));
+
+	mBlocked.assign((std::size_t)mWidth*mDepth, 0);
+}
+
+void NavGrid::BlockBox(const BoundingBox& box, float radius)
+{
+	float minX = box.Center.x - box.Extents.x - radius;
+	float minZ = box.Center.z - box.Extents.z - radius;
+	float maxX = box.Center.x + box.Extents.x + radius;
+	float maxZ = box.Center.z + box.Extents.z + radius;
+
+	// Cells whose centers fall inside [min, max].
+	int x0 = MathHelper::Max(0, (int)ceilf((minX - mDesc.MinX) / mDesc.CellSize - 0.5f));
+	int z0 = MathHelper::Max(0, (int)ceilf((minZ - mDesc.MinZ) / mDesc.CellSize - 0.5f));
+	int x1 = MathHelper::Min(mWidth - 1, (int)floorf((maxX - mDesc.MinX) / mDesc.CellSize - 0.5f));
+	int z1 = MathHelper::Min(mDepth - 1, (int)floorf((maxZ - mDesc.MinZ) / mDesc.CellSize - 0.5f));
+
+	for(int z = z0; z <= z1; ++z)
+	{
+		for(int x = x0; x <= x1; ++x)
+			mBlocked[(std::size_t)z*mWidth + x] = 1;
+	}
+
+	mVersion++;
+}
+
+void NavGrid::SetBlocked(int x, int z, bool blocked)
+{
+	if(x < 0 || z < 0 || x >= mWidth || z >= mDepth)
+		return;
+
+	mBlocked[(std::size_t)z*mWidth + x] = blocked ? 1 : 0;
+	mVersion++;
+}
+
+bool NavGrid::WorldToCell(const XMFLOAT2& p, int& x, int& z)const
+{
+	x = (int)floorf((p.x - mDesc.MinX) / mDesc.CellSize);
+	z = (int)floorf((p.y - mDesc.MinZ) / mDesc.CellSize);
+
+	return x >= 0 && z >= 0 && x < mWidth && z < mDepth;
+}
+
+XMFLOAT2 NavGrid::CellCenter(int x, int z)const
+{
+	return XMFLOAT2(mDesc.MinX + (x + 0.5f)*mDesc.CellSize, mDesc.MinZ + (z + 0.5f)*mDesc.CellSize);
+}
+
+//
+// NavSearch
+//
+
+// Scratch memory for one search at a time.  Cells are marked with the id of the search
+// that last touched them, so nothing has to be cleared between searches.
+class NavSearch
+{
+public:
+	NavSearch(const NavGrid& grid);
+
+	bool Search(const XMFLOAT2& start, const XMFLOAT2& goal, NavAlgorithm algorithm, NavPath& path);
+
+private:
+	void Relax(std::uint32_t cell, std::uint32_t parent, float cost);
+	int Jump(int x, int z, int dx, int dz)const;
+	void BuildPath(std::uint32_t startCell, const XMFLOAT2& start, const XMFLOAT2& goal, NavPath& path);
+
+	const NavGrid& mGrid;
+	int mGoalX = 0;
+	int mGoalZ = 0;
+
+	std::vector<float> mCost;
+	std::vector<std::uint32_t> mParent;
+	std::vector<std::uint32_t> mSeen;
+	std::vector<std::uint32_t> mClosed;
+	std::uint32_t mSearchId = 0;
+
+	std::vector<HeapEntry> mHeap;
+	std::vector<std::uint32_t> mCells;
+};
+
+NavSearch::NavSearch(const NavGrid& grid)
+	: mGrid(grid)
+{
+	std::size_t cellCount = (std::size_t)grid.Width()*grid.Depth();
+	mCost.resize(cellCount);
+	mParent.resize(cellCount);
+	mSeen.assign(cellCount, 0);
+	mClosed.assign(cellCount, 0);
+}
+
+void NavSearch::Relax(std::uint32_t cell, std::uint32_t parent, float cost)
+{
+	if(mSeen[cell] == mSearchId && cost >= mCost[cell])
+		return;
+
+	mSeen[cell] = mSearchId;
+	mCost[cell] = cost;
+	mParent[cell] = parent;
+
+	int x = (int)(cell % mGrid.Width());
+	int z = (int)(cell / mGrid.Width());
+	HeapPush(mHeap, cost + Octile(mGoalX - x, mGoalZ - z), cell);
+}
+
+int NavSearch::Jump(int x, int z, int dx, int dz)const
+{
+	// Walks from (x, z) in the direction (dx, dz) until it reaches the goal, a cell with
+	// a forced neighbour or a dead end.  These are the jump rules for a grid where
+	// diagonal moves may not cut corners.
+	for(;;)
+	{
+		if(mGrid.IsBlocked(x, z))
+			return -1;
+
+		const int cell = z*mGrid.Width() + x;
+		if(x == mGoalX && z == mGoalZ)
+			return cell;
+
+		if(dx != 0 && dz != 0)
+		{
+			// A diagonal move stops where a straight jump from it would find something.
+			if(Jump(x + dx, z, dx, 0) >= 0 || Jump(x, z + dz, 0, dz) >= 0)
+				return cell;
+
+			if(mGrid.IsBlocked(x + dx, z) || mGrid.IsBlocked(x, z + dz))
+				return -1;
+		}
+		else if(dx != 0)
+		{
+			if((!mGrid.IsBlocked(x, z - 1) && mGrid.IsBlocked(x - dx, z - 1)) ||
+				(!mGrid.IsBlocked(x, z + 1) && mGrid.IsBlocked(x - dx, z + 1)))
+				return cell;
+		}
+		else
+		{
+			if((!mGrid.IsBlocked(x - 1, z) && mGrid.IsBlocked(x - 1, z - dz)) ||
+				(!mGrid.IsBlocked(x + 1, z) && mGrid.IsBlocked(x + 1, z - dz)))
+				return cell;
+		}
+
+		x += dx;
+		z += dz;
+	}
+}
+
+bool NavSearch::Search(const XMFLOAT2& start, const XMFLOAT2& goal, NavAlgorithm algorithm, NavPath& path)
+{
+	path.Found = false;
+	path.Waypoints.clear();
+	path.Length = 0.0f;
+	path.ExpandedNodes = 0;
+
+	int startX, startZ;
+	if(!mGrid.WorldToCell(start, startX, startZ) || !mGrid.WorldToCell(goal, mGoalX, mGoalZ))
+		return false;
+
+	if(mGrid.IsBlocked(startX, startZ) || mGrid.IsBlocked(mGoalX, mGoalZ))
+		return false;
+
+	if(++mSearchId == 0)
+	{
+		std::fill(mSeen.begin(), mSeen.end(), 0);
+		std::fill(mClosed.begin(), mClosed.end(), 0);
+		mSearchId = 1;
+	}
+
+	const int w = mGrid.Width();
+	const std::uint32_t startCell = (std::uint32_t)(startZ*w + startX);
+	const std::uint32_t goalCell = (std::uint32_t)(mGoalZ*w + mGoalX);
+
+	mHeap.clear();
+	Relax(startCell, startCell, 0.0f);
+
+	while(!mHeap.empty())
+	{
+		const std::uint32_t cell = HeapPop(mHeap).second;
+		if(mClosed[cell] == mSearchId)
+			continue;
+
+		mClosed[cell] = mSearchId;
+		path.ExpandedNodes++;
+
+		if(cell == goalCell)
+		{
+			BuildPath(startCell, start, goal, path);
+			return true;
+		}
+
+		const int x = (int)(cell % w);
+		const int z = (int)(cell / w);
+		const float cost = mCost[cell];
+
+		if(algorithm == NavAlgorithm::AStar)
+		{
+			for(int d = 0; d < 8; ++d)
+			{
+				if(CanStep(mGrid, x, z, DirX[d], DirZ[d]))
+					Relax(cell + DirZ[d]*w + DirX[d], cell, cost + (d < 4 ? 1.0f : Sqrt2));
+			}
+			continue;
+		}
+
+		// Jump Point Search: only look in the directions the parent's move can't already
+		// cover at the same cost, and jump along each one.
+		int dirs[8][2];
+		int dirCount = 0;
+
+		if(cell == startCell)
+		{
+			for(int d = 0; d < 8; ++d)
+			{
+				if(CanStep(mGrid, x, z, DirX[d], DirZ[d]))
+				{
+					dirs[dirCount][0] = DirX[d];
+					dirs[dirCount][1] = DirZ[d];
+					dirCount++;
+				}
+			}
+		}
+		else
+		{
+			const int parent = (int)mParent[cell];
+			const int dx = Sign(x - parent % w);
+			const int dz = Sign(z - parent / w);
+
+			if(dx != 0 && dz != 0)
+			{
+				bool openZ = !mGrid.IsBlocked(x, z + dz);
+				bool openX = !mGrid.IsBlocked(x + dx, z);
+				if(openZ) { dirs[dirCount][0] = 0; dirs[dirCount][1] = dz; dirCount++; }
+				if(openX) { dirs[dirCount][0] = dx; dirs[dirCount][1] = 0; dirCount++; }
+				if(openZ && openX) { dirs[dirCount][0] = dx; dirs[dirCount][1] = dz; dirCount++; }
+			}
+			else if(dx != 0)
+			{
+				bool openNext = !mGrid.IsBlocked(x + dx, z);
+				bool openUp = !mGrid.IsBlocked(x, z + 1);
+				bool openDown = !mGrid.IsBlocked(x, z - 1);
+				if(openNext)
+				{
+					dirs[dirCount][0] = dx; dirs[dirCount][1] = 0; dirCount++;
+					if(openUp) { dirs[dirCount][0] = dx; dirs[dirCount][1] = 1; dirCount++; }
+					if(openDown) { dirs[dirCount][0] = dx; dirs[dirCount][1] = -1; dirCount++; }
+				}
+				if(openUp) { dirs[dirCount][0] = 0; dirs[dirCount][1] = 1; dirCount++; }
+				if(openDown) { dirs[dirCount][0] = 0; dirs[dirCount][1] = -1; dirCount++; }
+			}
+			else
+			{
+				bool openNext = !mGrid.IsBlocked(x, z + dz);
+				bool openRight = !mGrid.IsBlocked(x + 1, z);
+				bool openLeft = !mGrid.IsBlocked(x - 1, z);
+				if(openNext)
+				{
+					dirs[dirCount][0] = 0; dirs[dirCount][1] = dz; dirCount++;
+					if(openRight) { dirs[dirCount][0] = 1; dirs[dirCount][1] = dz; dirCount++; }
+					if(openLeft) { dirs[dirCount][0] = -1; dirs[dirCount][1] = dz; dirCount++; }
+				}
+				if(openRight) { dirs[dirCount][0] = 1; dirs[dirCount][1] = 0; dirCount++; }
+				if(openLeft) { dirs[dirCount][0] = -1; dirs[dirCount][1] = 0; dirCount++; }
+			}
+		}
+
+		for(int i = 0; i < dirCount; ++i)
+		{
+			int jumpCell = Jump(x + dirs[i][0], z + dirs[i][1], dirs[i][0], dirs[i][1]);
+			if(jumpCell < 0)
+				continue;
+
+			int jx = jumpCell % w;
+			int jz = jumpCell / w;
+			Relax((std::uint32_t)jumpCell, cell, cost + Octile(jx - x, jz - z));
+		}
+	}
+
+	return false;
+}
+
+void NavSearch::BuildPath(std::uint32_t startCell, const XMFLOAT2& start, const XMFLOAT2& goal, NavPath& path)
+{
+	const int w = mGrid.Width();
+	const std::uint32_t goalCell = (std::uint32_t)(mGoalZ*w + mGoalX);
+
+	mCells.clear();
+	for(std::uint32_t cell = goalCell; ; cell = mParent[cell])
+	{
+		mCells.push_back(cell);
+		if(cell == startCell)
+			break;
+	}
+	std::reverse(mCells.begin(), mCells.end());
+
+	// Keep only the cells where the direction changes.
+	path.Waypoints.push_back(start);
+	for(std::size_t i = 1; i + 1 < mCells.size(); ++i)
+	{
+		int x0 = (int)(mCells[i - 1] % w), z0 = (int)(mCells[i - 1] / w);
+		int x1 = (int)(mCells[i] % w), z1 = (int)(mCells[i] / w);
+		int x2 = (int)(mCells[i + 1] % w), z2 = (int)(mCells[i + 1] / w);
+
+		if(Sign(x1 - x0) != Sign(x2 - x1) || Sign(z1 - z0) != Sign(z2 - z1))
+			path.Waypoints.push_back(mGrid.CellCenter(x1, z1));
+	}
+	path.Waypoints.push_back(goal);
+
+	path.Found = true;
+	path.Length = mCost[goalCell] * mGrid.Desc().CellSize;
+}
+
+//
+// NavPathfinder
+//
+
+NavPathfinder::NavPathfinder(const NavGrid& grid)
+	: mGrid(grid)
+{
+}
+
+NavPathfinder::~NavPathfinder()
+{
+}
+
+bool NavPathfinder::FindPath(const XMFLOAT2& start, const XMFLOAT2& goal, NavAlgorithm algorithm, NavPath& path)
+{
+	if(!mSearch)
+		mSearch = std::make_unique<NavSearch>(mGrid);
+
+	return mSearch->Search(start, goal, algorithm, path);
+}
+
+void NavPathfinder::FindPaths(const NavQuery* queries, std::size_t count, NavAlgorithm algorithm, NavPath* paths)const
+{
+	if(count == 0)
+		return;
+
+	// A few batches per core so uneven queries still balance; each batch gets its own
+	// scratch memory.
+	const std::size_t threads = MathHelper::Max(1u, std::thread::hardware_concurrency());
+	const std::size_t batchCount = MathHelper::Min(count, 4*threads);
+	const std::size_t batchSize = (count + batchCount - 1) / batchCount;
+
+	concurrency::parallel_for((std::size_t)0, batchCount, [&](std::size_t b)
+	{
+		std::size_t first = b*batchSize;
+		std::size_t last = MathHelper::Min(count, first + batchSize);
+		if(first >= last)
+			return;
+
+		NavSearch search(mGrid);
+		for(std::size_t i = first; i < last; ++i)
+			search.Search(queries[i].Start, queries[i].Goal, algorithm, paths[i]);
+	});
+}
+
+//
+// NavFlowField
+//
+
+NavFlowField::NavFlowField(const NavGrid& grid, int goalX, int goalZ)
+	: mGrid(grid), mGoalX(goalX), mGoalZ(goalZ), mGridVersion(grid.Version())
+{
+	std::size_t cellCount = (std::size_t)grid.Width()*grid.Depth();
+	mDistance.assign(cellCount, FLT_MAX);
+	mNext.assign(cellCount, -1);
+	mSettled.assign(cellCount, 0);
+
+	if(!grid.IsBlocked(goalX, goalZ))
+	{
+		std::uint32_t goalCell = (std::uint32_t)(goalZ*grid.Width() + goalX);
+		mDistance[goalCell] = 0.0f;
+		mNext[goalCell] = (std::int32_t)goalCell;
+		HeapPush(mHeap, 0.0f, goalCell);
+	}
+}
+
+std::uint32_t NavFlowField::Expand(std::uint32_t maxCells)
+{
+	// Dijkstra outwards from the goal.  Moves are symmetric, so the cell a neighbour was
+	// reached from is the next step on its way back to the goal.
+	const int w = mGrid.Width();
+	std::uint32_t settled = 0;
+
+	while(!mHeap.empty() && (maxCells == 0 || settled < maxCells))
+	{
+		HeapEntry top = HeapPop(mHeap);
+		const std::uint32_t cell = top.second;
+		if(mSettled[cell])
+			continue;
+
+		mSettled[cell] = 1;
+		settled++;
+
+		const int x = (int)(cell % w);
+		const int z = (int)(cell / w);
+		for(int d = 0; d < 8; ++d)
+		{
+			if(!CanStep(mGrid, x, z, DirX[d], DirZ[d]))
+				continue;
+
+			std::uint32_t n = cell + DirZ[d]*w + DirX[d];
+			float distance = top.first + (d < 4 ? 1.0f : Sqrt2);
+			if(!mSettled[n] && distance < mDistance[n])
+			{
+				mDistance[n] = distance;
+				mNext[n] = (std::int32_t)cell;
+				HeapPush(mHeap, distance, n);
+			}
+		}
+	}
+
+	return settled;
+}
+
+bool NavFlowField::Direction(const XMFLOAT2& p, XMFLOAT2& dir)const
+{
+	int x, z;
+	if(!mGrid.WorldToCell(p, x, z) || mGrid.IsBlocked(x, z))
+		return false;
+
+	const std::size_t cell = (std::size_t)z*mGrid.Width() + x;
+	if(!mSettled[cell])
+		return false;
+
+	const int next = mNext[cell];
+	XMFLOAT2 target = mGrid.CellCenter(next % mGrid.Width(), next / mGrid.Width());
+
+	float dx = target.x - p.x;
+	float dz = target.y - p.y;
+	float length = sqrtf(dx*dx + dz*dz);
+
+	dir = length > 1.0e-5f ? XMFLOAT2(dx / length, dz / length) : XMFLOAT2(0.0f, 0.0f);
+	return true;
+}
+
+float NavFlowField::Distance(int x, int z)const
+{
+	if(x < 0 || z < 0 || x >= mGrid.Width() || z >= mGrid.Depth())
+		return -1.0f;
+
+	const std::size_t cell = (std::size_t)z*mGrid.Width() + x;
+	return mSettled[cell] ? mDistance[cell] * mGrid.Desc().CellSize : -1.0f;
+}
+
+//
+// NavFlowFieldCache
+//
+
+NavFlowFieldCache::NavFlowFieldCache(const NavGrid& grid, std::size_t maxFields)
+	: mGrid(grid), mMaxFields(MathHelper::Max(maxFields, (std::size_t)1))
+{
+}
+
+NavFlowField* NavFlowFieldCache::Get(const XMFLOAT2& goal)
+{
+	int x, z;
+	if(!mGrid.WorldToCell(goal, x, z) || mGrid.IsBlocked(x, z))
+		return nullptr;
+
+	for(auto it = mFields.begin(); it != mFields.end(); ++it)
+	{
+		if((*it)->GoalX() != x || (*it)->GoalZ() != z)
+			continue;
+
+		std::unique_ptr<NavFlowField> field = std::move(*it);
+		mFields.erase(it);
+
+		// Start over if the walls have moved since the field was built.
+		if(field->GridVersion() != mGrid.Version())
+			field = std::make_unique<NavFlowField>(mGrid, x, z);
+
+		mFields.push_back(std::move(field));
+		return mFields.back().get();
+	}
+
+	if(mFields.size() >= mMaxFields)
+		mFields.erase(mFields.begin());
+
+	mFields.push_back(std::make_unique<NavFlowField>(mGrid, x, z));
+	return mFields.back().get();
+}
+
+void NavFlowFieldCache::Expand(std::uint32_t maxCells)
+{
+	// Most recently used first.
+	std::uint32_t budget = maxCells;
+	for(auto it = mFields.rbegin(); it != mFields.rend(); ++it)
+	{
+		if((*it)->Complete())
+			continue;
+
+		std::uint32_t settled = (*it)->Expand(budget);
+		if(maxCells != 0)
+		{
+			budget -= MathHelper::Min(settled, budget);
+			if(budget == 0)
+				break;
+		}
+	}
+}
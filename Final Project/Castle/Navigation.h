@@ -0,0 +1,183 @@
+//***************************************************************************************
+// Navigation.h
+//
+// Grid based navigation for agents walking the grounds.
+//
+// NavGrid is an occupancy grid in the xz-plane that walls are rasterized into.  Agents
+// move between the eight neighbouring cells but never cut the corner of a blocked
+// cell.
+//
+// NavPathfinder answers point to point queries with A* or Jump Point Search, one at a
+// time or as a batch spread over all cores.  Paths are returned as waypoints where the
+// direction changes.
+//
+// NavFlowField stores, for every cell, the next cell on the shortest path to one goal,
+// so any number of agents heading to that goal can steer with a lookup.  Fields are
+// built a slice at a time with Expand() and cached per goal by NavFlowFieldCache.
+//***************************************************************************************
+
+#ifndef NAVIGATION_H
+#define NAVIGATION_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct NavGridDesc
+{
+	// Area covered by the grid in the xz-plane.
+	float MinX = 0.0f;
+	float MinZ = 0.0f;
+	float MaxX = 0.0f;
+	float MaxZ = 0.0f;
+
+	float CellSize = 1.0f;
+};
+
+class NavGrid
+{
+public:
+	NavGrid(const NavGridDesc& desc);
+	NavGrid(const NavGrid& rhs) = delete;
+	NavGrid& operator=(const NavGrid& rhs) = delete;
+
+	// Blocks every cell whose center is inside the box's xz footprint grown by radius.
+	// Growing walls by the agent radius keeps agents from brushing against them.
+	void BlockBox(const DirectX::BoundingBox& box, float radius = 0.0f);
+
+	void SetBlocked(int x, int z, bool blocked);
+
+	// Cells outside the grid count as blocked.
+	bool IsBlocked(int x, int z)const
+	{
+		return x < 0 || z < 0 || x >= mWidth || z >= mDepth || mBlocked[(std::size_t)z*mWidth + x] != 0;
+	}
+
+	// Returns false if p is outside the grid.
+	bool WorldToCell(const DirectX::XMFLOAT2& p, int& x, int& z)const;
+	DirectX::XMFLOAT2 CellCenter(int x, int z)const;
+
+	int Width()const { return mWidth; }
+	int Depth()const { return mDepth; }
+	const NavGridDesc& Desc()const { return mDesc; }
+
+	// Changes every time a cell changes, so cached results can tell they are stale.
+	std::uint32_t Version()const { return mVersion; }
+
+private:
+	NavGridDesc mDesc;
+	int mWidth = 0;
+	int mDepth = 0;
+	std::vector<std::uint8_t> mBlocked;
+	std::uint32_t mVersion = 0;
+};
+
+enum class NavAlgorithm
+{
+	AStar,
+	JumpPoint
+};
+
+struct NavQuery
+{
+	DirectX::XMFLOAT2 Start;
+	DirectX::XMFLOAT2 Goal;
+};
+
+struct NavPath
+{
+	bool Found = false;
+
+	// Start, the cell centers where the path turns, then goal.
+	std::vector<DirectX::XMFLOAT2> Waypoints;
+	float Length = 0.0f;
+
+	// Number of nodes taken off the open list, to compare the algorithms.
+	std::uint32_t ExpandedNodes = 0;
+};
+
+class NavSearch;
+
+class NavPathfinder
+{
+public:
+	NavPathfinder(const NavGrid& grid);
+	~NavPathfinder();
+	NavPathfinder(const NavPathfinder& rhs) = delete;
+	NavPathfinder& operator=(const NavPathfinder& rhs) = delete;
+
+	// Uses the pathfinder's own scratch memory, so only one thread may call this at a time.
+	bool FindPath(const DirectX::XMFLOAT2& start, const DirectX::XMFLOAT2& goal, NavAlgorithm algorithm,
+		NavPath& path);
+
+	// Answers count queries on all cores, each worker with its own scratch memory.
+	// paths must hold count elements.
+	void FindPaths(const NavQuery* queries, std::size_t count, NavAlgorithm algorithm, NavPath* paths)const;
+
+private:
+	const NavGrid& mGrid;
+	std::unique_ptr<NavSearch> mSearch;
+};
+
+class NavFlowField
+{
+public:
+	NavFlowField(const NavGrid& grid, int goalX, int goalZ);
+	NavFlowField(const NavFlowField& rhs) = delete;
+	NavFlowField& operator=(const NavFlowField& rhs) = delete;
+
+	// Settles up to maxCells more cells, closest to the goal first, so agents near the goal
+	// can move before the whole field is done.  0 finishes the field.  Returns the number
+	// of cells settled.
+	std::uint32_t Expand(std::uint32_t maxCells);
+	bool Complete()const { return mHeap.empty(); }
+
+	// Unit direction in the xz-plane to walk from p.  Returns false if p is blocked, not
+	// yet settled or cannot reach the goal.
+	bool Direction(const DirectX::XMFLOAT2& p, DirectX::XMFLOAT2& dir)const;
+
+	// Path length from the cell to the goal, or -1 if not known (yet).
+	float Distance(int x, int z)const;
+
+	int GoalX()const { return mGoalX; }
+	int GoalZ()const { return mGoalZ; }
+	std::uint32_t GridVersion()const { return mGridVersion; }
+
+private:
+	const NavGrid& mGrid;
+	int mGoalX;
+	int mGoalZ;
+	std::uint32_t mGridVersion;
+
+	std::vector<float> mDistance;
+	std::vector<std::int32_t> mNext;
+	std::vector<std::uint8_t> mSettled;
+	std::vector<std::pair<float, std::uint32_t>> mHeap;
+};
+
+class NavFlowFieldCache
+{
+public:
+	NavFlowFieldCache(const NavGrid& grid, std::size_t maxFields = 8);
+	NavFlowFieldCache(const NavFlowFieldCache& rhs) = delete;
+	NavFlowFieldCache& operator=(const NavFlowFieldCache& rhs) = delete;
+
+	// Returns the flow field towards the cell holding goal, starting a new one if there is
+	// none or the grid has changed since it was built.  The least recently used field is
+	// dropped when the cache is full.  Returns nullptr if goal is blocked or off the grid.
+	NavFlowField* Get(const DirectX::XMFLOAT2& goal);
+
+	// Shares a budget of maxCells between the fields that are not complete yet.
+	void Expand(std::uint32_t maxCells);
+
+private:
+	const NavGrid& mGrid;
+	std::size_t mMaxFields;
+
+	// Most recently used last.
+	std::vector<std::unique_ptr<NavFlowField>> mFields;
+};
+
+#endif // NAVIGATION_H
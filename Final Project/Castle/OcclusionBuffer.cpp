@@ -0,0 +1,447 @@
+//***************************************************************************************
+// OcclusionBuffer.cpp
+//***************************************************************************************
+
+#include "OcclusionBuffer.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <xmmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+	// The corners of each box face, counterclockwise seen from outside, split in two.
+	// Corners are numbered as BoundingBox::GetCorners() returns them.
+	const int BoxTriangles[12][3] =
+	{
+		{ 0, 1, 2 }, { 0, 2, 3 },	// +z
+		{ 4, 7, 6 }, { 4, 6, 5 },	// -z
+		{ 1, 5, 6 }, { 1, 6, 2 },	// +x
+		{ 0, 3, 7 }, { 0, 7, 4 },	// -x
+		{ 3, 2, 6 }, { 3, 6, 7 },	// +y
+		{ 0, 4, 5 }, { 0, 5, 1 }	// -y
+	};
+
+	// Triangles are clipped to this many times the screen's size, which keeps their screen
+	// coordinates small enough for float edge functions without clipping at every edge.
+	const float GuardBand = 4.0f;
+	const int ClipPlaneCount = 5;
+
+	// How much nearer an occluder has to be than a box to hide it, relative to the box's
+	// 1/w.  Covers rounding in the depth planes, so walls do not hide themselves.
+	const float DepthBias = 1.0e-3f;
+
+	// Distance of v inside clip plane i: the near plane, then the guard band's sides.
+	float PlaneDistance(const XMFLOAT4& v, int i)
+	{
+		switch(i)
+		{
+		case 0: return v.z;
+		case 1: return GuardBand*v.w - v.x;
+		case 2: return GuardBand*v.w + v.x;
+		case 3: return GuardBand*v.w - v.y;
+		default: return GuardBand*v.w + v.y;
+		}
+	}
+
+	std::uint32_t OutsidePlanes(const XMFLOAT4& v)
+	{
+		std::uint32_t planes = 0;
+		for(int i = 0; i < ClipPlaneCount; ++i)
+		{
+			if(PlaneDistance(v, i) < 0.0f)
+				planes |= 1u << i;
+		}
+		return planes;
+	}
+
+	// Which sides of the view frustum v is beyond.
+	std::uint32_t OutsideFrustum(const XMFLOAT4& v)
+	{
+		return (v.x < -v.w ? 0x01u : 0u) | (v.x > v.w ? 0x02u : 0u) | (v.y < -v.w ? 0x04u : 0u) |
+			(v.y > v.w ? 0x08u : 0u) | (v.z < 0.0f ? 0x10u : 0u) | (v.z > v.w ? 0x20u : 0u);
+	}
+
+	XMFLOAT4 Lerp(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+	{
+		return XMFLOAT4(a.x + (b.x - a.x)*t, a.y + (b.y - a.y)*t, a.z + (b.z - a.z)*t, a.w + (b.w - a.w)*t);
+	}
+
+	float HorizontalMin(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(v);
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+{
+	mTilesX = MathHelper::Max(1, (width + TileWidth - 1) / TileWidth);
+	mTilesY = MathHelper::Max(1, (height + TileHeight - 1) / TileHeight);
+	mWidth = mTilesX*TileWidth;
+	mHeight = mTilesY*TileHeight;
+
+	mBins.resize(mTilesX*mTilesY);
+	mDepth.assign(mWidth*mHeight, 0.0f);
+	mTileFarthest.assign(mTilesX*mTilesY, 0.0f);
+	XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+}
+
+void OcclusionBuffer::AddOccluder(const BoundingBox& box)
+{
+	XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+	box.GetCorners(corners);
+	mCorners.insert(mCorners.end(), corners, corners + BoundingBox::CORNER_COUNT);
+}
+
+void OcclusionBuffer::AddOccluder(const BoundingOrientedBox& box)
+{
+	XMFLOAT3 corners[BoundingOrientedBox::CORNER_COUNT];
+	box.GetCorners(corners);
+	mCorners.insert(mCorners.end(), corners, corners + BoundingOrientedBox::CORNER_COUNT);
+}
+
+void OcclusionBuffer::ClearOccluders()
+{
+	mCorners.clear();
+}
+
+void OcclusionBuffer::Render(FXMMATRIX viewProj)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	XMStoreFloat4x4(&mViewProj, viewProj);
+	mClipCorners.resize(mCorners.size());
+	mTriangles.clear();
+	mOccludersDrawn = 0;
+
+	for(std::size_t first = 0; first < mCorners.size(); first += 8)
+	{
+		XMFLOAT4* clip = &mClipCorners[first];
+
+		// Boxes wholly beyond one side of the frustum are skipped.
+		std::uint32_t outside = ~0u;
+		for(int i = 0; i < 8; ++i)
+		{
+			XMStoreFloat4(&clip[i], XMVector3Transform(XMLoadFloat3(&mCorners[first + i]), viewProj));
+			outside &= OutsideFrustum(clip[i]);
+		}
+
+		if(outside != 0)
+			continue;
+
+		++mOccludersDrawn;
+		for(const int* tri : BoxTriangles)
+			ClipTriangle(clip[tri[0]], clip[tri[1]], clip[tri[2]]);
+	}
+
+	BinTriangles();
+
+	concurrency::parallel_for(0, mTilesX*mTilesY, [this](int tile)
+	{
+		RasterizeTile(tile);
+	});
+
+	mRenderMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+void OcclusionBuffer::ClipTriangle(const XMFLOAT4& a, const XMFLOAT4& b, const XMFLOAT4& c)
+{
+	const std::uint32_t outA = OutsidePlanes(a);
+	const std::uint32_t outB = OutsidePlanes(b);
+	const std::uint32_t outC = OutsidePlanes(c);
+
+	if((outA | outB | outC) == 0)
+	{
+		SetupTriangle(a, b, c);
+		return;
+	}
+
+	if((outA & outB & outC) != 0)
+		return;
+
+	// Sutherland-Hodgman against each plane the triangle crosses.  A triangle clipped by
+	// five planes has at most eight corners.
+	XMFLOAT4 polygons[2][8];
+	int counts[2] = { 3, 0 };
+	polygons[0][0] = a;
+	polygons[0][1] = b;
+	polygons[0][2] = c;
+
+	int current = 0;
+	const std::uint32_t crossed = outA | outB | outC;
+	for(int plane = 0; plane < ClipPlaneCount; ++plane)
+	{
+		if((crossed & (1u << plane)) == 0)
+			continue;
+
+		const XMFLOAT4* in = polygons[current];
+		XMFLOAT4* out = polygons[current ^ 1];
+		const int inCount = counts[current];
+		int outCount = 0;
+
+		for(int i = 0; i < inCount; ++i)
+		{
+			const XMFLOAT4& p = in[i];
+			const XMFLOAT4& q = in[(i + 1) % inCount];
+			const float dp = PlaneDistance(p, plane);
+			const float dq = PlaneDistance(q, plane);
+
+			if(dp >= 0.0f)
+				out[outCount++] = p;
+			if((dp >= 0.0f) != (dq >= 0.0f))
+				out[outCount++] = Lerp(p, q, dp / (dp - dq));
+		}
+
+		counts[current ^ 1] = outCount;
+		current ^= 1;
+		if(outCount < 3)
+			return;
+	}
+
+	const XMFLOAT4* polygon = polygons[current];
+	for(int i = 1; i + 1 < counts[current]; ++i)
+		SetupTriangle(polygon[0], polygon[i], polygon[i + 1]);
+}
+
+void OcclusionBuffer::SetupTriangle(const XMFLOAT4& a, const XMFLOAT4& b, const XMFLOAT4& c)
+{
+	const XMFLOAT4* v[3] = { &a, &b, &c };
+
+	Triangle tri;
+	float depth[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		depth[i] = 1.0f / v[i]->w;
+		tri.X[i] = (0.5f*v[i]->x*depth[i] + 0.5f)*mWidth;
+		tri.Y[i] = (0.5f - 0.5f*v[i]->y*depth[i])*mHeight;
+	}
+
+	// Faces that point away from the camera come out wound the other way.  The front of
+	// the same box always covers them, so they are not drawn.
+	const float area = (tri.X[1] - tri.X[0])*(tri.Y[2] - tri.Y[0]) - (tri.X[2] - tri.X[0])*(tri.Y[1] - tri.Y[0]);
+	if(area <= 0.0f)
+		return;
+
+	const float dx1 = tri.X[1] - tri.X[0];
+	const float dy1 = tri.Y[1] - tri.Y[0];
+	const float dx2 = tri.X[2] - tri.X[0];
+	const float dy2 = tri.Y[2] - tri.Y[0];
+	const float dd1 = depth[1] - depth[0];
+	const float dd2 = depth[2] - depth[0];
+
+	tri.DepthX = (dd1*dy2 - dd2*dy1) / area;
+	tri.DepthY = (dd2*dx1 - dd1*dx2) / area;
+	tri.Depth0 = depth[0] - tri.DepthX*tri.X[0] - tri.DepthY*tri.Y[0];
+
+	mTriangles.push_back(tri);
+}
+
+void OcclusionBuffer::BinTriangles()
+{
+	for(std::vector<std::uint32_t>& bin : mBins)
+		bin.clear();
+
+	for(std::uint32_t t = 0; t < (std::uint32_t)mTriangles.size(); ++t)
+	{
+		const Triangle& tri = mTriangles[t];
+		const float minX = MathHelper::Min(tri.X[0], MathHelper::Min(tri.X[1], tri.X[2]));
+		const float maxX = MathHelper::Max(tri.X[0], MathHelper::Max(tri.X[1], tri.X[2]));
+		const float minY = MathHelper::Min(tri.Y[0], MathHelper::Min(tri.Y[1], tri.Y[2]));
+		const float maxY = MathHelper::Max(tri.Y[0], MathHelper::Max(tri.Y[1], tri.Y[2]));
+
+		const int x0 = MathHelper::Max(0, (int)floorf(minX));
+		const int x1 = MathHelper::Min(mWidth, (int)ceilf(maxX));
+		const int y0 = MathHelper::Max(0, (int)floorf(minY));
+		const int y1 = MathHelper::Min(mHeight, (int)ceilf(maxY));
+		if(x0 >= x1 || y0 >= y1)
+			continue;
+
+		for(int ty = y0 / TileHeight; ty <= (y1 - 1) / TileHeight; ++ty)
+		{
+			for(int tx = x0 / TileWidth; tx <= (x1 - 1) / TileWidth; ++tx)
+				mBins[ty*mTilesX + tx].push_back(t);
+		}
+	}
+}
+
+void OcclusionBuffer::RasterizeTile(int tile)
+{
+	const int tileX = (tile % mTilesX)*TileWidth;
+	const int tileY = (tile / mTilesX)*TileHeight;
+	float* const tileDepth = &mDepth[tileY*mWidth + tileX];
+
+	for(int y = 0; y < TileHeight; ++y)
+		std::fill_n(tileDepth + y*mWidth, TileWidth, 0.0f);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+	for(std::uint32_t t : mBins[tile])
+	{
+		const Triangle& tri = mTriangles[t];
+
+		// The pixels of the tile whose centers may be inside, widened to whole vectors.
+		const float minX = MathHelper::Min(tri.X[0], MathHelper::Min(tri.X[1], tri.X[2]));
+		const float maxX = MathHelper::Max(tri.X[0], MathHelper::Max(tri.X[1], tri.X[2]));
+		const float minY = MathHelper::Min(tri.Y[0], MathHelper::Min(tri.Y[1], tri.Y[2]));
+		const float maxY = MathHelper::Max(tri.Y[0], MathHelper::Max(tri.Y[1], tri.Y[2]));
+
+		const int x0 = MathHelper::Max(tileX, (int)floorf(minX)) & ~3;
+		const int x1 = MathHelper::Min(tileX + TileWidth, (int)ceilf(maxX));
+		const int y0 = MathHelper::Max(tileY, (int)floorf(minY));
+		const int y1 = MathHelper::Min(tileY + TileHeight, (int)ceilf(maxY));
+
+		// Edge i runs from corner i to corner i+1: e = a*x + b*y + c, positive inside.  Each
+		// edge is moved in by half a pixel, (|a| + |b|)/2, so a pixel center passes only if
+		// the whole pixel is inside, and the depth plane is moved back by its largest change
+		// over half a pixel, so each pixel gets the farthest depth the triangle has in it.
+		__m128 edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		for(int i = 0; i < 3; ++i)
+		{
+			const int j = (i + 1) % 3;
+			const float a = tri.Y[i] - tri.Y[j];
+			edgeA[i] = _mm_set1_ps(a);
+			edgeB[i] = tri.X[j] - tri.X[i];
+			edgeC[i] = tri.X[i]*tri.Y[j] - tri.X[j]*tri.Y[i] - 0.5f*(fabsf(a) + fabsf(edgeB[i]));
+		}
+		const __m128 depthA = _mm_set1_ps(tri.DepthX);
+		const float depthInset = 0.5f*(fabsf(tri.DepthX) + fabsf(tri.DepthY));
+
+		for(int y = y0; y < y1; ++y)
+		{
+			const float py = y + 0.5f;
+			const __m128 row0 = _mm_set1_ps(edgeB[0]*py + edgeC[0]);
+			const __m128 row1 = _mm_set1_ps(edgeB[1]*py + edgeC[1]);
+			const __m128 row2 = _mm_set1_ps(edgeB[2]*py + edgeC[2]);
+			const __m128 rowDepth = _mm_set1_ps(tri.DepthY*py + tri.Depth0 - depthInset);
+			float* depthRow = &mDepth[y*mWidth];
+
+			for(int x = x0; x < x1; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(edgeA[0], px), row0);
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(edgeA[1], px), row1);
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(edgeA[2], px), row2);
+				const __m128 inside = _mm_cmpge_ps(_mm_min_ps(e0, _mm_min_ps(e1, e2)), zero);
+				if(_mm_movemask_ps(inside) == 0)
+					continue;
+
+				// Depth is never negative, so masked out lanes of 0 leave the buffer alone.
+				const __m128 depth = _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(depthA, px), rowDepth));
+				_mm_storeu_ps(depthRow + x, _mm_max_ps(_mm_loadu_ps(depthRow + x), depth));
+			}
+		}
+	}
+
+	__m128 farthest = _mm_set1_ps(FLT_MAX);
+	for(int y = 0; y < TileHeight; ++y)
+	{
+		const float* depthRow = tileDepth + y*mWidth;
+		for(int x = 0; x < TileWidth; x += 4)
+			farthest = _mm_min_ps(farthest, _mm_loadu_ps(depthRow + x));
+	}
+	mTileFarthest[tile] = HorizontalMin(farthest);
+}
+
+bool OcclusionBuffer::IsVisible(const BoundingBox& box)const
+{
+	XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+	box.GetCorners(corners);
+
+	const XMMATRIX viewProj = XMLoadFloat4x4(&mViewProj);
+	XMVECTOR minNdc = XMVectorReplicate(FLT_MAX);
+	XMVECTOR maxNdc = XMVectorReplicate(-FLT_MAX);
+	float nearest = 0.0f;
+	for(const XMFLOAT3& corner : corners)
+	{
+		XMVECTOR clip = XMVector3Transform(XMLoadFloat3(&corner), viewProj);
+		if(XMVectorGetZ(clip) < 0.0f)
+			return true;
+
+		const float depth = 1.0f / XMVectorGetW(clip);
+		XMVECTOR ndc = XMVectorScale(clip, depth);
+		minNdc = XMVectorMin(minNdc, ndc);
+		maxNdc = XMVectorMax(maxNdc, ndc);
+		nearest = MathHelper::Max(nearest, depth);
+	}
+
+	const float minX = (0.5f*XMVectorGetX(minNdc) + 0.5f)*mWidth;
+	const float maxX = (0.5f*XMVectorGetX(maxNdc) + 0.5f)*mWidth;
+	const float minY = (0.5f - 0.5f*XMVectorGetY(maxNdc))*mHeight;
+	const float maxY = (0.5f - 0.5f*XMVectorGetY(minNdc))*mHeight;
+	if(maxX < 0.0f || minX > mWidth || maxY < 0.0f || minY > mHeight)
+		return true;
+
+	// Every pixel the rectangle touches, at least one.
+	const int x0 = MathHelper::Clamp((int)floorf(minX), 0, mWidth - 1);
+	const int x1 = MathHelper::Clamp((int)ceilf(maxX), x0 + 1, mWidth);
+	const int y0 = MathHelper::Clamp((int)floorf(minY), 0, mHeight - 1);
+	const int y1 = MathHelper::Clamp((int)ceilf(maxY), y0 + 1, mHeight);
+
+	const float limit = nearest*(1.0f + DepthBias);
+	const __m128 limit4 = _mm_set1_ps(limit);
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 first = _mm_set1_ps((float)x0);
+	const __m128 last = _mm_set1_ps((float)x1);
+
+	for(int ty = y0 / TileHeight; ty <= (y1 - 1) / TileHeight; ++ty)
+	{
+		for(int tx = x0 / TileWidth; tx <= (x1 - 1) / TileWidth; ++tx)
+		{
+			// The whole tile is nearer than the box.
+			if(mTileFarthest[ty*mTilesX + tx] > limit)
+				continue;
+
+			const int tileX0 = MathHelper::Max(x0, tx*TileWidth) & ~3;
+			const int tileX1 = MathHelper::Min(x1, (tx + 1)*TileWidth);
+			const int tileY0 = MathHelper::Max(y0, ty*TileHeight);
+			const int tileY1 = MathHelper::Min(y1, (ty + 1)*TileHeight);
+
+			for(int y = tileY0; y < tileY1; ++y)
+			{
+				const float* depthRow = &mDepth[y*mWidth];
+				for(int x = tileX0; x < tileX1; x += 4)
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+					const __m128 inRect = _mm_and_ps(_mm_cmpge_ps(px, first), _mm_cmplt_ps(px, last));
+					const __m128 open = _mm_cmple_ps(_mm_loadu_ps(depthRow + x), limit4);
+					if(_mm_movemask_ps(_mm_and_ps(inRect, open)) != 0)
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+std::size_t OcclusionBuffer::TestBoxes(const BoundingBox* boxes, std::size_t count, std::uint8_t* visible)const
+{
+	if(count == 0)
+		return 0;
+
+	// A few batches per core, as tests vary a lot in cost.
+	const std::size_t threads = MathHelper::Max(1u, std::thread::hardware_concurrency());
+	const std::size_t batchCount = MathHelper::Min(count, 4*threads);
+	const std::size_t batchSize = (count + batchCount - 1) / batchCount;
+
+	concurrency::parallel_for((std::size_t)0, batchCount, [&](std::size_t b)
+	{
+		std::size_t first = b*batchSize;
+		std::size_t last = MathHelper::Min(count, first + batchSize);
+		for(std::size_t i = first; i < last; ++i)
+			visible[i] = IsVisible(boxes[i]) ? 1 : 0;
+	});
+
+	return (std::size_t)std::count(visible, visible + count, (std::uint8_t)1);
+}
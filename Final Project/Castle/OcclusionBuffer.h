@@ -0,0 +1,117 @@
+//***************************************************************************************
+// OcclusionBuffer.h
+//
+// A small depth buffer drawn on the CPU from a handful of big, simple occluders, the
+// castle and maze walls, and used to skip drawing whatever is hidden behind them.
+//
+// Each pixel holds 1/w of the nearest occluder, so nearer is larger and 0 is empty.  The
+// screen is cut into tiles.  Render() drops the faces of each occluder that point away
+// from the camera, clips the rest against the near plane, sorts them into the tiles they
+// touch and then fills the tiles in parallel, four pixels at a time with SSE.  Each tile
+// also keeps its farthest depth, a one level hierarchy that lets most tests pass or fail
+// a whole tile without looking at its pixels.
+//
+// Occluders are drawn conservatively: a triangle fills only the pixels it covers whole,
+// with the farthest depth it has in each.  A box is hidden if every pixel its screen
+// rectangle touches has an occluder nearer than the nearest point of the box.  The
+// rectangle and nearest depth bound the box from the camera's side, so a box is never
+// reported hidden when any of it shows.  The price is a pixel wide gap along the edges of
+// each occluder triangle, even where two meet, so a box that is only just hidden may be
+// reported visible.
+//
+// Nothing here touches the GPU, so it runs, and is benchmarked, on any platform.
+//***************************************************************************************
+
+#ifndef OCCLUSIONBUFFER_H
+#define OCCLUSIONBUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class OcclusionBuffer
+{
+public:
+	// Tile rows are whole SSE vectors.
+	static const int TileWidth = 32;
+	static const int TileHeight = 8;
+
+	// width and height are rounded up to whole tiles.  The buffer only needs enough pixels
+	// for the gaps between occluders to show; a few hundred across is plenty.
+	OcclusionBuffer(int width = 320, int height = 192);
+	OcclusionBuffer(const OcclusionBuffer& rhs) = delete;
+	OcclusionBuffer& operator=(const OcclusionBuffer& rhs) = delete;
+
+	// Occluders must be solid all the way through their bounds.
+	void AddOccluder(const DirectX::BoundingBox& box);
+	void AddOccluder(const DirectX::BoundingOrientedBox& box);
+	void ClearOccluders();
+
+	std::size_t OccluderCount()const { return mCorners.size() / 8; }
+
+	// Clears the buffer and draws the occluders as seen through viewProj, which takes world
+	// space to clip space like the pass constants' ViewProj before it is transposed.
+	void Render(DirectX::FXMMATRIX viewProj);
+
+	// False only if the box is hidden behind what the last Render() drew.  Boxes that
+	// reach in front of the near plane or off the screen count as visible.  Tests do not
+	// change the buffer, so any number of threads may test at once.
+	bool IsVisible(const DirectX::BoundingBox& box)const;
+
+	// Tests count boxes in parallel, setting visible[i] to IsVisible(boxes[i]), and returns
+	// how many are visible.
+	std::size_t TestBoxes(const DirectX::BoundingBox* boxes, std::size_t count, std::uint8_t* visible)const;
+
+	int Width()const { return mWidth; }
+	int Height()const { return mHeight; }
+
+	// 1/w of the nearest occluder at pixel (x, y), 0 where there is none.
+	float Depth(int x, int y)const { return mDepth[y*mWidth + x]; }
+
+	// What the last Render() did.
+	double LastRenderMs()const { return mRenderMs; }
+	std::size_t LastOccludersDrawn()const { return mOccludersDrawn; }
+	std::size_t LastTrianglesDrawn()const { return mTriangles.size(); }
+
+private:
+	// A screen space triangle, wound so its edge functions are positive inside, with its
+	// depth as a plane over the screen.
+	struct Triangle
+	{
+		float X[3];
+		float Y[3];
+		float DepthX;
+		float DepthY;
+		float Depth0;
+	};
+
+	// Clip space in, screen space triangles out.
+	void ClipTriangle(const DirectX::XMFLOAT4& a, const DirectX::XMFLOAT4& b, const DirectX::XMFLOAT4& c);
+	void SetupTriangle(const DirectX::XMFLOAT4& a, const DirectX::XMFLOAT4& b, const DirectX::XMFLOAT4& c);
+
+	void BinTriangles();
+	void RasterizeTile(int tile);
+
+	int mWidth;
+	int mHeight;
+	int mTilesX;
+	int mTilesY;
+
+	// Eight world space corners per occluder, and the same in clip space while rendering.
+	std::vector<DirectX::XMFLOAT3> mCorners;
+	std::vector<DirectX::XMFLOAT4> mClipCorners;
+
+	std::vector<Triangle> mTriangles;
+	std::vector<std::vector<std::uint32_t>> mBins;
+
+	std::vector<float> mDepth;
+	std::vector<float> mTileFarthest;
+
+	DirectX::XMFLOAT4X4 mViewProj;
+
+	double mRenderMs = 0.0;
+	std::size_t mOccludersDrawn = 0;
+};
+
+#endif // OCCLUSIONBUFFER_H
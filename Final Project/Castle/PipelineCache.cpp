@@ -0,0 +1,57 @@
+//***************************************************************************************
+// PipelineCache.cpp
+//***************************************************************************************
+
+#include "PipelineCache.h"
+#include <cstdio>
+
+PipelineCache::PipelineCache(CreateFunc create)
+	: mCreate(create)
+{
+}
+
+void PipelineCache::AddRootSignature(ID3D12RootSignature* rootSignature, const void* serialized, std::size_t size)
+{
+	mRootSignatures[rootSignature].assign(static_cast<const char*>(serialized), size);
+}
+
+ID3D12PipelineState* PipelineCache::Get(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+	++mRequests;
+
+	PipelineKey key = Key(desc);
+	auto it = mPipelines.find(key);
+	if(it != mPipelines.end())
+		return it->second.Get();
+
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> pso = mCreate(desc, Name(key.Hash()));
+	if(pso == nullptr)
+		return nullptr;
+
+	return mPipelines.emplace(std::move(key), pso).first->second.Get();
+}
+
+PipelineKey PipelineCache::Key(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)const
+{
+	PipelineKey key;
+
+	auto rootSignature = mRootSignatures.find(desc.pRootSignature);
+	if(rootSignature != mRootSignatures.end())
+	{
+		key.Write(desc, rootSignature->second);
+	}
+	else
+	{
+		std::uintptr_t address = reinterpret_cast<std::uintptr_t>(desc.pRootSignature);
+		key.Write(desc, std::string(reinterpret_cast<const char*>(&address), sizeof(address)));
+	}
+
+	return key;
+}
+
+std::wstring PipelineCache::Name(std::uint64_t hash)
+{
+	wchar_t name[32];
+	std::swprintf(name, sizeof(name) / sizeof(name[0]), L"PSO_%016llx", (unsigned long long)hash);
+	return name;
+}
@@ -0,0 +1,69 @@
+//***************************************************************************************
+// PipelineCache.h
+//
+// Hands out one pipeline state object per distinct D3D12_GRAPHICS_PIPELINE_STATE_DESC.
+//
+// A desc is reduced to a PipelineKey: the bytes of everything the driver compiles it
+// from, read field by field and following pointers.  Two descs built separately that say
+// the same thing share a PSO, and keys are the same from one run to the next, so the
+// key's hash is usable as the name under which a PipelineLibrary stores the compiled PSO.
+// PSOs are looked up by the whole key, so two descs whose hashes collide still get PSOs
+// of their own.  They would share a name in the library, where the runtime checks the
+// desc on loading, so the loser of the two is compiled every run rather than loaded.
+//
+// Root signatures are the one exception: a root signature object says nothing about its
+// contents, so AddRootSignature() registers the serialized blob it was created from.  An
+// unregistered root signature is keyed by address and still dedups within a run.
+//
+// The cache never touches the device.  Creating a PSO is passed in as a function, so
+// the dedup can be exercised without a GPU, and PipelineKey builds without D3D at all.
+//***************************************************************************************
+
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include "PipelineKey.h"
+#include <d3d12.h>
+#include <wrl.h>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+class PipelineCache
+{
+public:
+	// Creates the PSO for desc.  name is unique to desc and stable across runs.  Returns
+	// null on failure.
+	typedef std::function<Microsoft::WRL::ComPtr<ID3D12PipelineState>(
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, const std::wstring& name)> CreateFunc;
+
+	PipelineCache(CreateFunc create);
+	PipelineCache(const PipelineCache& rhs) = delete;
+	PipelineCache& operator=(const PipelineCache& rhs) = delete;
+
+	// serialized is the blob passed to CreateRootSignature.
+	void AddRootSignature(ID3D12RootSignature* rootSignature, const void* serialized, std::size_t size);
+
+	// The PSO for desc, created the first time a desc with its key is seen.  Returns null
+	// if it could not be created.
+	ID3D12PipelineState* Get(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+
+	PipelineKey Key(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)const;
+	std::uint64_t Hash(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)const { return Key(desc).Hash(); }
+	static std::wstring Name(std::uint64_t hash);
+
+	std::uint32_t Requests()const { return mRequests; }
+	std::size_t UniqueCount()const { return mPipelines.size(); }
+
+private:
+	CreateFunc mCreate;
+
+	// Serialized blob of each registered root signature.
+	std::unordered_map<ID3D12RootSignature*, std::string> mRootSignatures;
+	std::unordered_map<PipelineKey, Microsoft::WRL::ComPtr<ID3D12PipelineState>, PipelineKey::Hasher> mPipelines;
+
+	std::uint32_t mRequests = 0;
+};
+
+#endif // PIPELINECACHE_H
@@ -0,0 +1,26 @@
+//***************************************************************************************
+// PipelineKey.cpp
+//***************************************************************************************
+
+#include "PipelineKey.h"
+
+void PipelineKey::Bytes(const void* data, std::size_t size)
+{
+	if(size == 0)
+		return;
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	mBytes.append(reinterpret_cast<const char*>(bytes), size);
+	for(std::size_t i = 0; i < size; ++i)
+	{
+		mHash ^= bytes[i];
+		mHash *= 0x100000001b3ull;
+	}
+}
+
+void PipelineKey::String(const char* s)
+{
+	std::uint64_t size = s != nullptr ? std::strlen(s) + 1 : 0;
+	Value(size);
+	Bytes(s, s != nullptr ? (std::size_t)size : 0);
+}
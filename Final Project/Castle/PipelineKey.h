@@ -0,0 +1,237 @@
+//***************************************************************************************
+// PipelineKey.h
+//
+// The part of PipelineCache that turns a graphics pipeline desc into something to look
+// it up by, kept apart so it builds and can be checked without d3d12.h.
+//
+// Write() copies everything the driver compiles a PSO from into a flat string of bytes,
+// one field at a time: the root signature, shader bytecode, stream output, blend,
+// rasterizer and depth stencil state, input layout, topology, formats and sample desc.
+// Padding and the fields a desc leaves unused, such as the blend state of render targets
+// past the first without independent blending, never get in, so two descs that say the
+// same thing give the same bytes however they were filled in.  Pointers are followed,
+// so the bytes are the same from one run to the next.
+//
+// Keys compare equal only if their bytes do.  The 64-bit hash just spreads them over a
+// hash table and names the PSO in a PipelineLibrary.
+//
+// Write() is a template over the desc so a stand-in with D3D12's field names works as
+// well as D3D12_GRAPHICS_PIPELINE_STATE_DESC.
+//***************************************************************************************
+
+#ifndef PIPELINEKEY_H
+#define PIPELINEKEY_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+class PipelineKey
+{
+public:
+	// Hashes a key for std::unordered_map.
+	struct Hasher
+	{
+		std::size_t operator()(const PipelineKey& key)const { return (std::size_t)key.Hash(); }
+	};
+
+	// rootSignature is whatever identifies the desc's root signature, normally the blob
+	// it was serialized to.  The desc's own pRootSignature is not looked at.
+	template<typename Desc>
+	void Write(const Desc& desc, const std::string& rootSignature);
+
+	void Bytes(const void* data, std::size_t size);
+
+	// Length first so a null string and an empty one differ and strings cannot run into
+	// what follows.
+	void String(const char* s);
+
+	// Scalars only; a struct would bring its padding along.
+	template<typename T>
+	void Value(const T& value)
+	{
+		static_assert(std::is_scalar<T>::value, "write structs one field at a time");
+		Bytes(&value, sizeof(value));
+	}
+
+	// 64-bit FNV-1a of the bytes.
+	std::uint64_t Hash()const { return mHash; }
+	const std::string& Data()const { return mBytes; }
+
+	bool operator==(const PipelineKey& rhs)const { return mHash == rhs.mHash && mBytes == rhs.mBytes; }
+	bool operator!=(const PipelineKey& rhs)const { return !(*this == rhs); }
+
+private:
+	template<typename Shader> void WriteShader(const Shader& shader);
+	template<typename Blend> void WriteBlend(const Blend& blend);
+	template<typename Rasterizer> void WriteRasterizer(const Rasterizer& raster);
+	template<typename StencilOp> void WriteStencilOp(const StencilOp& op);
+	template<typename DepthStencil> void WriteDepthStencil(const DepthStencil& depth);
+	template<typename InputLayout> void WriteInputLayout(const InputLayout& layout);
+	template<typename StreamOutput> void WriteStreamOutput(const StreamOutput& so);
+
+	std::string mBytes;
+	std::uint64_t mHash = 0xcbf29ce484222325ull;
+};
+
+template<typename Desc>
+void PipelineKey::Write(const Desc& desc, const std::string& rootSignature)
+{
+	Value((std::uint64_t)rootSignature.size());
+	Bytes(rootSignature.data(), rootSignature.size());
+
+	WriteShader(desc.VS);
+	WriteShader(desc.PS);
+	WriteShader(desc.DS);
+	WriteShader(desc.HS);
+	WriteShader(desc.GS);
+	WriteStreamOutput(desc.StreamOutput);
+	WriteBlend(desc.BlendState);
+	Value(desc.SampleMask);
+	WriteRasterizer(desc.RasterizerState);
+	WriteDepthStencil(desc.DepthStencilState);
+	WriteInputLayout(desc.InputLayout);
+	Value(desc.IBStripCutValue);
+	Value(desc.PrimitiveTopologyType);
+
+	Value(desc.NumRenderTargets);
+	for(std::uint32_t i = 0; i < desc.NumRenderTargets && i < 8; ++i)
+		Value(desc.RTVFormats[i]);
+
+	Value(desc.DSVFormat);
+	Value(desc.SampleDesc.Count);
+	Value(desc.SampleDesc.Quality);
+	Value(desc.NodeMask);
+	Value(desc.Flags);
+
+	// A cached PSO blob is left out: it only speeds up creation and does not change the
+	// result.
+}
+
+template<typename Shader>
+void PipelineKey::WriteShader(const Shader& shader)
+{
+	Value((std::uint64_t)shader.BytecodeLength);
+	if(shader.pShaderBytecode == nullptr)
+		return;
+
+	// Compiled shaders are DXBC containers, which start with "DXBC" and a 16 byte digest
+	// of the rest of the container.  The digest stands in for the bytecode so large
+	// shaders are not copied and compared byte by byte.  Unsigned containers have a zero
+	// digest and go in whole.
+	const unsigned char* bytes = static_cast<const unsigned char*>(shader.pShaderBytecode);
+	static const unsigned char zero[16] = {};
+	if(shader.BytecodeLength >= 20 && std::memcmp(bytes, "DXBC", 4) == 0 &&
+		std::memcmp(bytes + 4, zero, sizeof(zero)) != 0)
+	{
+		Bytes(bytes + 4, 16);
+	}
+	else
+	{
+		Bytes(bytes, shader.BytecodeLength);
+	}
+}
+
+template<typename Blend>
+void PipelineKey::WriteBlend(const Blend& blend)
+{
+	Value(blend.AlphaToCoverageEnable);
+	Value(blend.IndependentBlendEnable);
+
+	// Without independent blending only the first target's state is used.
+	std::uint32_t targets = blend.IndependentBlendEnable ? 8 : 1;
+	for(std::uint32_t i = 0; i < targets; ++i)
+	{
+		const auto& rt = blend.RenderTarget[i];
+		Value(rt.BlendEnable);
+		Value(rt.LogicOpEnable);
+		Value(rt.SrcBlend);
+		Value(rt.DestBlend);
+		Value(rt.BlendOp);
+		Value(rt.SrcBlendAlpha);
+		Value(rt.DestBlendAlpha);
+		Value(rt.BlendOpAlpha);
+		Value(rt.LogicOp);
+		Value(rt.RenderTargetWriteMask);
+	}
+}
+
+template<typename Rasterizer>
+void PipelineKey::WriteRasterizer(const Rasterizer& raster)
+{
+	Value(raster.FillMode);
+	Value(raster.CullMode);
+	Value(raster.FrontCounterClockwise);
+	Value(raster.DepthBias);
+	Value(raster.DepthBiasClamp);
+	Value(raster.SlopeScaledDepthBias);
+	Value(raster.DepthClipEnable);
+	Value(raster.MultisampleEnable);
+	Value(raster.AntialiasedLineEnable);
+	Value(raster.ForcedSampleCount);
+	Value(raster.ConservativeRaster);
+}
+
+template<typename StencilOp>
+void PipelineKey::WriteStencilOp(const StencilOp& op)
+{
+	Value(op.StencilFailOp);
+	Value(op.StencilDepthFailOp);
+	Value(op.StencilPassOp);
+	Value(op.StencilFunc);
+}
+
+template<typename DepthStencil>
+void PipelineKey::WriteDepthStencil(const DepthStencil& depth)
+{
+	Value(depth.DepthEnable);
+	Value(depth.DepthWriteMask);
+	Value(depth.DepthFunc);
+	Value(depth.StencilEnable);
+	Value(depth.StencilReadMask);
+	Value(depth.StencilWriteMask);
+	WriteStencilOp(depth.FrontFace);
+	WriteStencilOp(depth.BackFace);
+}
+
+template<typename InputLayout>
+void PipelineKey::WriteInputLayout(const InputLayout& layout)
+{
+	Value(layout.NumElements);
+	for(std::uint32_t i = 0; i < layout.NumElements; ++i)
+	{
+		const auto& e = layout.pInputElementDescs[i];
+		String(e.SemanticName);
+		Value(e.SemanticIndex);
+		Value(e.Format);
+		Value(e.InputSlot);
+		Value(e.AlignedByteOffset);
+		Value(e.InputSlotClass);
+		Value(e.InstanceDataStepRate);
+	}
+}
+
+template<typename StreamOutput>
+void PipelineKey::WriteStreamOutput(const StreamOutput& so)
+{
+	Value(so.NumEntries);
+	for(std::uint32_t i = 0; i < so.NumEntries; ++i)
+	{
+		const auto& e = so.pSODeclaration[i];
+		Value(e.Stream);
+		String(e.SemanticName);
+		Value(e.SemanticIndex);
+		Value(e.StartComponent);
+		Value(e.ComponentCount);
+		Value(e.OutputSlot);
+	}
+
+	Value(so.NumStrides);
+	for(std::uint32_t i = 0; i < so.NumStrides; ++i)
+		Value(so.pBufferStrides[i]);
+
+	Value(so.RasterizedStream);
+}
+
+#endif // PIPELINEKEY_H
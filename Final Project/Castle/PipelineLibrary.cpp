@@ -0,0 +1,94 @@
+//***************************************************************************************
+// PipelineLibrary.cpp
+//***************************************************************************************
+
+#include "PipelineLibrary.h"
+#include "../../Common/d3dUtil.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+using Microsoft::WRL::ComPtr;
+
+PipelineLibrary::PipelineLibrary(ID3D12Device* device, const std::string& filename)
+	: mDevice(device), mFilename(filename)
+{
+	// Pipeline libraries came with ID3D12Device1.
+	if(FAILED(mDevice.As(&mDevice1)))
+		return;
+
+	std::ifstream fin(filename, std::ios::binary);
+	if(fin)
+		mData.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+	HRESULT hr = E_FAIL;
+	if(!mData.empty())
+		hr = mDevice1->CreatePipelineLibrary(mData.data(), mData.size(), IID_PPV_ARGS(&mLibrary));
+
+	// No file yet, or one written by another driver or adapter, so start over.
+	if(FAILED(hr))
+	{
+		mData.clear();
+		mLibrary.Reset();
+		if(FAILED(mDevice1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&mLibrary))))
+		{
+			mLibrary.Reset();
+			OutputDebugStringA("Pipeline libraries are not supported; PSOs will be compiled every run.\n");
+		}
+	}
+}
+
+ComPtr<ID3D12PipelineState> PipelineLibrary::Create(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+	const std::wstring& name)
+{
+	ComPtr<ID3D12PipelineState> pso;
+	if(mLibrary != nullptr && SUCCEEDED(mLibrary->LoadGraphicsPipeline(name.c_str(), &desc, IID_PPV_ARGS(&pso))))
+	{
+		++mLoaded;
+		return pso;
+	}
+
+	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pso)));
+	++mCompiled;
+
+	// Storing only fails if name is already taken, which means it was not unique to its
+	// desc.  The PSO is fine to use either way.
+	if(mLibrary != nullptr)
+	{
+		if(SUCCEEDED(mLibrary->StorePipeline(name.c_str(), pso.Get())))
+			mDirty = true;
+		else
+			OutputDebugStringA("PipelineLibrary: could not store a PSO.\n");
+	}
+
+	return pso;
+}
+
+void PipelineLibrary::Save()
+{
+	if(mLibrary == nullptr || !mDirty)
+		return;
+
+	std::vector<char> data(mLibrary->GetSerializedSize());
+	if(FAILED(mLibrary->Serialize(data.data(), data.size())))
+		return;
+
+	// Same as the shader cache: write a temporary file and rename it, so a crash never
+	// leaves a truncated library behind.
+	std::string tempPath = mFilename + ".tmp";
+	{
+		std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+		fout.write(data.data(), data.size());
+		if(!fout)
+			return;
+	}
+
+	std::remove(mFilename.c_str());
+	if(std::rename(tempPath.c_str(), mFilename.c_str()) != 0)
+	{
+		std::remove(tempPath.c_str());
+		return;
+	}
+
+	mDirty = false;
+}
@@ -0,0 +1,55 @@
+//***************************************************************************************
+// PipelineLibrary.h
+//
+// Keeps compiled pipeline state objects in a file between runs, using
+// ID3D12PipelineLibrary.
+//
+// The file is a driver-specific blob.  After a driver update or on a different GPU the
+// runtime rejects it, and the library starts out empty and is rebuilt.  On a runtime
+// without pipeline libraries every PSO is simply compiled.
+//***************************************************************************************
+
+#ifndef PIPELINELIBRARY_H
+#define PIPELINELIBRARY_H
+
+#include <d3d12.h>
+#include <wrl.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class PipelineLibrary
+{
+public:
+	PipelineLibrary(ID3D12Device* device, const std::string& filename);
+	PipelineLibrary(const PipelineLibrary& rhs) = delete;
+	PipelineLibrary& operator=(const PipelineLibrary& rhs) = delete;
+
+	// Loads the PSO stored under name, or compiles desc and stores it under name.  name
+	// must identify desc, e.g. PipelineCache::Name().  Throws if compiling fails.
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> Create(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+		const std::wstring& name);
+
+	// Writes the library to the file if anything was stored since it was loaded.
+	void Save();
+
+	bool Supported()const { return mLibrary != nullptr; }
+
+	std::uint32_t Loaded()const { return mLoaded; }
+	std::uint32_t Compiled()const { return mCompiled; }
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D12Device1> mDevice1;
+	Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> mLibrary;
+	std::string mFilename;
+
+	// The library reads from this memory for as long as it exists.
+	std::vector<char> mData;
+
+	bool mDirty = false;
+	std::uint32_t mLoaded = 0;
+	std::uint32_t mCompiled = 0;
+};
+
+#endif // PIPELINELIBRARY_H
@@ -0,0 +1,307 @@
+//***************************************************************************************
+// PortalVisibility.cpp
+//***************************************************************************************
+
+#include "PortalVisibility.h"
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	// How many zones deep Update() goes, and the most corners a clipped portal keeps.
+	// Clipping stops early rather than overflow, which leaves the portal larger than it
+	// needs to be but never smaller.
+	const std::uint32_t MaxDepth = 8;
+	const std::uint32_t MaxCorners = 32;
+
+	float PlaneDistance(const XMFLOAT4& plane, const XMFLOAT3& p)
+	{
+		return plane.x*p.x + plane.y*p.y + plane.z*p.z + plane.w;
+	}
+
+	// The plane with normal n through p, scaled to unit length, or false if n is too short
+	// to give one.
+	bool MakePlane(const XMFLOAT3& n, const XMFLOAT3& p, XMFLOAT4& plane)
+	{
+		const float length = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+		if(length < 1.0e-6f)
+			return false;
+
+		plane = XMFLOAT4(n.x / length, n.y / length, n.z / length, 0.0f);
+		plane.w = -(plane.x*p.x + plane.y*p.y + plane.z*p.z);
+		return true;
+	}
+
+	XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+	}
+
+	XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	XMFLOAT4 NormalizePlane(float a, float b, float c, float d)
+	{
+		const float length = sqrtf(a*a + b*b + c*c);
+		return XMFLOAT4(a / length, b / length, c / length, d / length);
+	}
+
+	bool BoxInside(const BoundingBox& inner, const BoundingBox& outer)
+	{
+		return fabsf(inner.Center.x - outer.Center.x) + inner.Extents.x <= outer.Extents.x &&
+			fabsf(inner.Center.y - outer.Center.y) + inner.Extents.y <= outer.Extents.y &&
+			fabsf(inner.Center.z - outer.Center.z) + inner.Extents.z <= outer.Extents.z;
+	}
+
+	bool BoxesOverlap(const BoundingBox& a, const BoundingBox& b)
+	{
+		return fabsf(a.Center.x - b.Center.x) < a.Extents.x + b.Extents.x &&
+			fabsf(a.Center.y - b.Center.y) < a.Extents.y + b.Extents.y &&
+			fabsf(a.Center.z - b.Center.z) < a.Extents.z + b.Extents.z;
+	}
+}
+
+PortalVisibility::PortalVisibility()
+{
+	// The outside has no bounds of its own.
+	mZones.push_back(Zone());
+	mEye = XMFLOAT3(0.0f, 0.0f, 0.0f);
+}
+
+std::uint32_t PortalVisibility::AddZone(const BoundingBox& bounds)
+{
+	Zone zone;
+	zone.Bounds = bounds;
+	mZones.push_back(zone);
+	return (std::uint32_t)mZones.size() - 1;
+}
+
+void PortalVisibility::AddPortal(std::uint32_t zoneA, std::uint32_t zoneB, const XMFLOAT3* corners, std::uint32_t cornerCount)
+{
+	assert(zoneA < mZones.size() && zoneB < mZones.size() && zoneA != zoneB);
+	assert(cornerCount >= 3 && cornerCount <= MaxCorners);
+
+	Portal portal;
+	portal.Zones[0] = zoneA;
+	portal.Zones[1] = zoneB;
+	portal.FirstCorner = (std::uint32_t)mCorners.size();
+	portal.CornerCount = cornerCount;
+	mCorners.insert(mCorners.end(), corners, corners + cornerCount);
+
+	mZones[zoneA].Portals.push_back((std::uint32_t)mPortals.size());
+	mZones[zoneB].Portals.push_back((std::uint32_t)mPortals.size());
+	mPortals.push_back(portal);
+}
+
+std::uint32_t PortalVisibility::ZoneOf(const XMFLOAT3& point)const
+{
+	for(std::uint32_t i = 1; i < (std::uint32_t)mZones.size(); ++i)
+	{
+		const BoundingBox& bounds = mZones[i].Bounds;
+		if(fabsf(point.x - bounds.Center.x) <= bounds.Extents.x &&
+			fabsf(point.y - bounds.Center.y) <= bounds.Extents.y &&
+			fabsf(point.z - bounds.Center.z) <= bounds.Extents.z)
+		{
+			return i;
+		}
+	}
+	return Outside;
+}
+
+std::uint32_t PortalVisibility::ZoneOf(const BoundingBox& box)const
+{
+	for(std::uint32_t i = 1; i < (std::uint32_t)mZones.size(); ++i)
+	{
+		if(BoxInside(box, mZones[i].Bounds))
+			return i;
+		if(BoxesOverlap(box, mZones[i].Bounds))
+			return NoZone;
+	}
+	return Outside;
+}
+
+void PortalVisibility::Update(const XMFLOAT3& eye, FXMMATRIX viewProj)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	mPlanes.clear();
+	mOnPath.assign(mZones.size(), 0);
+	for(Zone& zone : mZones)
+		zone.Views.clear();
+
+	// The frustum's planes from the columns of viewProj: -w <= x, y <= w and 0 <= z <= w.
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, viewProj);
+	auto column = [&m](int j) { return XMFLOAT4(m.m[0][j], m.m[1][j], m.m[2][j], m.m[3][j]); };
+	const XMFLOAT4 cx = column(0);
+	const XMFLOAT4 cy = column(1);
+	const XMFLOAT4 cz = column(2);
+	const XMFLOAT4 cw = column(3);
+	mPlanes.push_back(NormalizePlane(cw.x + cx.x, cw.y + cx.y, cw.z + cx.z, cw.w + cx.w));
+	mPlanes.push_back(NormalizePlane(cw.x - cx.x, cw.y - cx.y, cw.z - cx.z, cw.w - cx.w));
+	mPlanes.push_back(NormalizePlane(cw.x + cy.x, cw.y + cy.y, cw.z + cy.z, cw.w + cy.w));
+	mPlanes.push_back(NormalizePlane(cw.x - cy.x, cw.y - cy.y, cw.z - cy.z, cw.w - cy.w));
+	mPlanes.push_back(NormalizePlane(cz.x, cz.y, cz.z, cz.w));
+	mPlanes.push_back(NormalizePlane(cw.x - cz.x, cw.y - cz.y, cw.z - cz.z, cw.w - cz.w));
+
+	mEye = eye;
+	mEyeZone = ZoneOf(eye);
+
+	View frustum;
+	frustum.FirstPlane = 0;
+	frustum.PlaneCount = 6;
+	frustum.ClipPlaneCount = 4;
+	Enter(mEyeZone, frustum, 0);
+
+	mZonesReached = 0;
+	mViewCount = 0;
+	for(const Zone& zone : mZones)
+	{
+		mZonesReached += zone.Views.empty() ? 0 : 1;
+		mViewCount += zone.Views.size();
+	}
+
+	mUpdateMicros = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+void PortalVisibility::Enter(std::uint32_t zoneIndex, const View& view, std::uint32_t depth)
+{
+	Zone& zone = mZones[zoneIndex];
+	zone.Views.push_back(view);
+	if(depth == MaxDepth)
+		return;
+
+	mOnPath[zoneIndex] = 1;
+
+	for(std::size_t p = 0; p < zone.Portals.size(); ++p)
+	{
+		const Portal& portal = mPortals[zone.Portals[p]];
+		const std::uint32_t next = portal.Zones[0] == zoneIndex ? portal.Zones[1] : portal.Zones[0];
+		if(mOnPath[next])
+			continue;
+
+		// Clip the portal to the view, Sutherland-Hodgman style, one plane at a time.
+		XMFLOAT3 buffers[2][MaxCorners];
+		std::uint32_t count = portal.CornerCount;
+		for(std::uint32_t i = 0; i < count; ++i)
+			buffers[0][i] = mCorners[portal.FirstCorner + i];
+
+		int current = 0;
+		for(std::uint32_t k = 0; k < view.ClipPlaneCount && count >= 3; ++k)
+		{
+			const XMFLOAT4 plane = mPlanes[view.FirstPlane + k];
+			const XMFLOAT3* in = buffers[current];
+			XMFLOAT3* out = buffers[1 - current];
+
+			std::uint32_t outCount = 0;
+			bool overflow = false;
+			for(std::uint32_t i = 0; i < count; ++i)
+			{
+				const XMFLOAT3& a = in[i];
+				const XMFLOAT3& b = in[(i + 1) % count];
+				const float da = PlaneDistance(plane, a);
+				const float db = PlaneDistance(plane, b);
+
+				if(outCount + 2 > MaxCorners)
+				{
+					overflow = true;
+					break;
+				}
+
+				if(da >= 0.0f)
+					out[outCount++] = a;
+				if((da >= 0.0f) != (db >= 0.0f))
+				{
+					const float t = da / (da - db);
+					out[outCount++] = XMFLOAT3(a.x + t*(b.x - a.x), a.y + t*(b.y - a.y), a.z + t*(b.z - a.z));
+				}
+			}
+
+			if(overflow)
+				break;
+
+			count = outCount;
+			current = 1 - current;
+		}
+
+		if(count < 3)
+			continue;
+
+		const XMFLOAT3* polygon = buffers[current];
+		const XMFLOAT3* corners = &mCorners[portal.FirstCorner];
+
+		XMFLOAT4 portalPlane;
+		if(!MakePlane(Cross(Subtract(corners[1], corners[0]), Subtract(corners[2], corners[0])), corners[0], portalPlane))
+			continue;
+
+		// Looking along the portal there is no narrower frustum to give; the view goes
+		// through as it is.
+		const float eyeDistance = PlaneDistance(portalPlane, mEye);
+		if(fabsf(eyeDistance) < 1.0e-3f)
+		{
+			Enter(next, view, depth + 1);
+			continue;
+		}
+
+		// The portal's plane, facing away from the eye, in place of the near plane, and a
+		// plane through the eye and each edge of what is left of the portal.
+		View narrowed;
+		narrowed.FirstPlane = (std::uint32_t)mPlanes.size();
+		if(eyeDistance > 0.0f)
+			portalPlane = XMFLOAT4(-portalPlane.x, -portalPlane.y, -portalPlane.z, -portalPlane.w);
+		mPlanes.push_back(portalPlane);
+
+		XMFLOAT3 centroid(0.0f, 0.0f, 0.0f);
+		for(std::uint32_t i = 0; i < count; ++i)
+		{
+			centroid.x += polygon[i].x / count;
+			centroid.y += polygon[i].y / count;
+			centroid.z += polygon[i].z / count;
+		}
+
+		for(std::uint32_t i = 0; i < count; ++i)
+		{
+			XMFLOAT4 edgePlane;
+			if(!MakePlane(Cross(Subtract(polygon[i], mEye), Subtract(polygon[(i + 1) % count], mEye)), mEye, edgePlane))
+				continue;
+
+			if(PlaneDistance(edgePlane, centroid) < 0.0f)
+				edgePlane = XMFLOAT4(-edgePlane.x, -edgePlane.y, -edgePlane.z, -edgePlane.w);
+			mPlanes.push_back(edgePlane);
+		}
+
+		narrowed.PlaneCount = (std::uint32_t)mPlanes.size() - narrowed.FirstPlane;
+		narrowed.ClipPlaneCount = narrowed.PlaneCount;
+		Enter(next, narrowed, depth + 1);
+	}
+
+	mOnPath[zoneIndex] = 0;
+}
+
+bool PortalVisibility::IsVisible(std::uint32_t zone, const BoundingBox& box)const
+{
+	if(zone == NoZone || zone == mEyeZone)
+		return true;
+
+	for(const View& view : mZones[zone].Views)
+	{
+		bool inside = true;
+		for(std::uint32_t k = 0; k < view.PlaneCount && inside; ++k)
+		{
+			// The corner of the box farthest along the plane's normal.
+			const XMFLOAT4& plane = mPlanes[view.FirstPlane + k];
+			const float reach = fabsf(plane.x)*box.Extents.x + fabsf(plane.y)*box.Extents.y + fabsf(plane.z)*box.Extents.z;
+			inside = PlaneDistance(plane, box.Center) + reach >= 0.0f;
+		}
+
+		if(inside)
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,112 @@
+//***************************************************************************************
+// PortalVisibility.h
+//
+// Zones joined by portals: closed-off parts of the world, like the castle courtyard and
+// the maze, and the openings between them.  Zone 0 is the outside, everywhere not in
+// another zone; the others are boxes.  Each portal is a convex polygon, a gate or the
+// open top of a walled yard, and is seen through from either side.
+//
+// Update() starts from the view frustum in the zone the eye is in.  For each portal of
+// that zone on screen it clips the portal against the frustum, builds a narrower frustum
+// from the eye through what is left and carries on into the zone beyond, so a zone is
+// reached only through portals that show.  Zones already on the way there are not
+// entered again.  Each zone keeps every frustum it was reached with, and an item in it is
+// visible if it touches any of them.
+//
+// The walls between zones must be solid apart from the portals; an item straddling two
+// zones, or a zone and a wall, belongs to no zone and is never culled here.
+//***************************************************************************************
+
+#ifndef PORTALVISIBILITY_H
+#define PORTALVISIBILITY_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class PortalVisibility
+{
+public:
+	static const std::uint32_t Outside = 0;
+	static const std::uint32_t NoZone = ~0u;
+
+	PortalVisibility();
+	PortalVisibility(const PortalVisibility& rhs) = delete;
+	PortalVisibility& operator=(const PortalVisibility& rhs) = delete;
+
+	// Zones must not overlap.  Returns the zone's index.
+	std::uint32_t AddZone(const DirectX::BoundingBox& bounds);
+
+	// corners go around the portal's edge in either order and must lie in a plane.
+	void AddPortal(std::uint32_t zoneA, std::uint32_t zoneB, const DirectX::XMFLOAT3* corners, std::uint32_t cornerCount);
+
+	std::size_t ZoneCount()const { return mZones.size(); }
+	std::size_t PortalCount()const { return mPortals.size(); }
+
+	// The zone the point is in, and the zone that holds all of box, NoZone if none does.
+	std::uint32_t ZoneOf(const DirectX::XMFLOAT3& point)const;
+	std::uint32_t ZoneOf(const DirectX::BoundingBox& box)const;
+
+	// Finds what is seen from eye through viewProj, which takes world space to clip space
+	// like the pass constants' ViewProj before it is transposed.
+	void Update(const DirectX::XMFLOAT3& eye, DirectX::FXMMATRIX viewProj);
+
+	std::uint32_t EyeZone()const { return mEyeZone; }
+	bool IsReached(std::uint32_t zone)const { return zone == NoZone || !mZones[zone].Views.empty(); }
+
+	// False only if box, which is in zone, is outside every frustum the zone was reached
+	// with.  Items in the eye's zone are left to the ordinary frustum test and always pass.
+	// Tests do not change anything, so any number of threads may test at once.
+	bool IsVisible(std::uint32_t zone, const DirectX::BoundingBox& box)const;
+
+	// What the last Update() did.
+	double LastUpdateMicros()const { return mUpdateMicros; }
+	std::size_t LastZonesReached()const { return mZonesReached; }
+	std::size_t LastViews()const { return mViewCount; }
+
+private:
+	// Planes are (a, b, c, d) with a*x + b*y + c*z + d >= 0 on the inside.  The first
+	// ClipPlaneCount bound the rays from the eye and clip the portals; the rest, the view
+	// frustum's near and far planes, only cull items.  A ray that crosses a portal before
+	// the near plane still goes on to what is beyond it.
+	struct View
+	{
+		std::uint32_t FirstPlane;
+		std::uint32_t PlaneCount;
+		std::uint32_t ClipPlaneCount;
+	};
+
+	struct Zone
+	{
+		DirectX::BoundingBox Bounds;
+		std::vector<std::uint32_t> Portals;
+		std::vector<View> Views;
+	};
+
+	struct Portal
+	{
+		std::uint32_t Zones[2];
+		std::uint32_t FirstCorner;
+		std::uint32_t CornerCount;
+	};
+
+	void Enter(std::uint32_t zone, const View& view, std::uint32_t depth);
+
+	std::vector<Zone> mZones;
+	std::vector<Portal> mPortals;
+	std::vector<DirectX::XMFLOAT3> mCorners;
+
+	// Per Update(): every view's planes, one view after another, and the zones on the way
+	// to the one being entered.
+	std::vector<DirectX::XMFLOAT4> mPlanes;
+	std::vector<std::uint8_t> mOnPath;
+	DirectX::XMFLOAT3 mEye;
+	std::uint32_t mEyeZone = Outside;
+
+	double mUpdateMicros = 0.0;
+	std::size_t mZonesReached = 0;
+	std::size_t mViewCount = 0;
+};
+
+#endif // PORTALVISIBILITY_H
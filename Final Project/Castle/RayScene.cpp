@@ -0,0 +1,276 @@
+//***************************************************************************************
+// RayScene.cpp
+//***************************************************************************************
+
+#include "RayScene.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+	// Instances a leaf is left with, and how deep the tree may go, which bounds the
+	// traversal stack.
+	const std::uint32_t MaxLeafInstances = 2;
+	const std::uint32_t MaxDepth = 48;
+	const std::uint32_t StackSize = 64;
+
+	float SafeInverse(float d)
+	{
+		if(fabsf(d) > 1.0e-20f)
+			return 1.0f / d;
+		return d >= 0.0f ? 1.0e30f : -1.0e30f;
+	}
+
+	float Axis(const XMFLOAT3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+
+	inline bool RayBox(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, const XMFLOAT3& o,
+		const XMFLOAT3& invD, float maxT)
+	{
+		const float x0 = (boxMin.x - o.x)*invD.x;
+		const float x1 = (boxMax.x - o.x)*invD.x;
+		const float y0 = (boxMin.y - o.y)*invD.y;
+		const float y1 = (boxMax.y - o.y)*invD.y;
+		const float z0 = (boxMin.z - o.z)*invD.z;
+		const float z1 = (boxMax.z - o.z)*invD.z;
+
+		const float tMin = MathHelper::Max(MathHelper::Max(MathHelper::Min(x0, x1), MathHelper::Min(y0, y1)),
+			MathHelper::Max(MathHelper::Min(z0, z1), 0.0f));
+		const float tMax = MathHelper::Min(MathHelper::Min(MathHelper::Max(x0, x1), MathHelper::Max(y0, y1)),
+			MathHelper::Min(MathHelper::Max(z0, z1), maxT));
+
+		return tMin <= tMax;
+	}
+}
+
+std::uint32_t RayScene::AddMesh(const XMFLOAT3* positions, std::size_t vertexCount,
+	const std::uint32_t* indices, std::size_t triangleCount)
+{
+	auto mesh = std::make_unique<TriangleBvh>();
+	mesh->Build(positions, vertexCount, indices, triangleCount);
+	mMeshes.push_back(std::move(mesh));
+	return (std::uint32_t)mMeshes.size() - 1;
+}
+
+std::uint32_t RayScene::AddInstance(std::uint32_t mesh, const XMFLOAT4X4& world)
+{
+	XMMATRIX w = XMLoadFloat4x4(&world);
+	XMVECTOR det = XMMatrixDeterminant(w);
+
+	Instance instance;
+	instance.World = world;
+	XMStoreFloat4x4(&instance.InvWorld, XMMatrixInverse(&det, w));
+	mMeshes[mesh]->Bounds().Transform(instance.Bounds, w);
+	instance.Mesh = mesh;
+	mInstances.push_back(instance);
+	return (std::uint32_t)mInstances.size() - 1;
+}
+
+void RayScene::Build()
+{
+	mNodes.clear();
+	mOrder.resize(mInstances.size());
+	for(std::uint32_t i = 0; i < (std::uint32_t)mOrder.size(); ++i)
+		mOrder[i] = i;
+
+	if(mInstances.empty())
+		return;
+
+	mNodes.reserve(2*mInstances.size());
+	mNodes.push_back(Node());
+	Split(0, 0, (std::uint32_t)mInstances.size(), 0);
+}
+
+void RayScene::Split(std::uint32_t node, std::uint32_t first, std::uint32_t count, std::uint32_t depth)
+{
+	XMFLOAT3 boxMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	XMFLOAT3 centreMin = boxMin;
+	XMFLOAT3 centreMax = boxMax;
+	for(std::uint32_t i = first; i < first + count; ++i)
+	{
+		const BoundingBox& b = mInstances[mOrder[i]].Bounds;
+		boxMin = XMFLOAT3(MathHelper::Min(boxMin.x, b.Center.x - b.Extents.x), MathHelper::Min(boxMin.y, b.Center.y - b.Extents.y),
+			MathHelper::Min(boxMin.z, b.Center.z - b.Extents.z));
+		boxMax = XMFLOAT3(MathHelper::Max(boxMax.x, b.Center.x + b.Extents.x), MathHelper::Max(boxMax.y, b.Center.y + b.Extents.y),
+			MathHelper::Max(boxMax.z, b.Center.z + b.Extents.z));
+		centreMin = XMFLOAT3(MathHelper::Min(centreMin.x, b.Center.x), MathHelper::Min(centreMin.y, b.Center.y),
+			MathHelper::Min(centreMin.z, b.Center.z));
+		centreMax = XMFLOAT3(MathHelper::Max(centreMax.x, b.Center.x), MathHelper::Max(centreMax.y, b.Center.y),
+			MathHelper::Max(centreMax.z, b.Center.z));
+	}
+
+	mNodes[node].Min = boxMin;
+	mNodes[node].Max = boxMax;
+
+	if(count <= MaxLeafInstances || depth == MaxDepth)
+	{
+		mNodes[node].First = first;
+		mNodes[node].Count = count;
+		return;
+	}
+
+	const XMFLOAT3 spread(centreMax.x - centreMin.x, centreMax.y - centreMin.y, centreMax.z - centreMin.z);
+	const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+
+	const std::uint32_t half = count / 2;
+	std::nth_element(mOrder.begin() + first, mOrder.begin() + first + half, mOrder.begin() + first + count,
+		[this, axis](std::uint32_t a, std::uint32_t b)
+	{
+		return Axis(mInstances[a].Bounds.Center, axis) < Axis(mInstances[b].Bounds.Center, axis);
+	});
+
+	const std::uint32_t children = (std::uint32_t)mNodes.size();
+	mNodes.push_back(Node());
+	mNodes.push_back(Node());
+	mNodes[node].First = children;
+	mNodes[node].Count = 0;
+
+	Split(children, first, half, depth + 1);
+	Split(children + 1, first + half, count - half, depth + 1);
+}
+
+std::size_t RayScene::MeshTriangleCount()const
+{
+	std::size_t count = 0;
+	for(const auto& mesh : mMeshes)
+		count += mesh->TriangleCount();
+	return count;
+}
+
+std::size_t RayScene::WorldTriangleCount()const
+{
+	std::size_t count = 0;
+	for(const Instance& instance : mInstances)
+		count += mMeshes[instance.Mesh]->TriangleCount();
+	return count;
+}
+
+std::size_t RayScene::Bytes()const
+{
+	std::size_t bytes = mInstances.size()*sizeof(Instance) + mNodes.size()*sizeof(Node) + mOrder.size()*sizeof(std::uint32_t);
+	for(const auto& mesh : mMeshes)
+		bytes += mesh->Bytes();
+	return bytes;
+}
+
+template<typename Visit>
+void RayScene::Traverse(const SceneRay& ray, Visit visit)const
+{
+	if(mNodes.empty())
+		return;
+
+	const XMFLOAT3 invD(SafeInverse(ray.Direction.x), SafeInverse(ray.Direction.y), SafeInverse(ray.Direction.z));
+	float maxDistance = ray.MaxDistance;
+
+	std::uint32_t stack[StackSize];
+	std::uint32_t size = 0;
+	stack[size++] = 0;
+
+	while(size > 0)
+	{
+		const Node& node = mNodes[stack[--size]];
+		if(!RayBox(node.Min, node.Max, ray.Origin, invD, maxDistance))
+			continue;
+
+		if(node.Count == 0)
+		{
+			stack[size++] = node.First + 1;
+			stack[size++] = node.First;
+			continue;
+		}
+
+		for(std::uint32_t i = node.First; i < node.First + node.Count; ++i)
+		{
+			maxDistance = visit(mOrder[i], maxDistance);
+			if(maxDistance < 0.0f)
+				return;
+		}
+	}
+}
+
+bool RayScene::Intersect(const SceneRay& ray, SceneHit& hit)const
+{
+	bool found = false;
+	Traverse(ray, [&](std::uint32_t index, float maxDistance)
+	{
+		// Affine maps keep points along the ray at the same multiples of its direction,
+		// so maxDistance and the hit's distance need no converting.
+		const Instance& instance = mInstances[index];
+		const XMMATRIX invWorld = XMLoadFloat4x4(&instance.InvWorld);
+		XMFLOAT3 origin;
+		XMFLOAT3 direction;
+		XMStoreFloat3(&origin, XMVector3TransformCoord(XMLoadFloat3(&ray.Origin), invWorld));
+		XMStoreFloat3(&direction, XMVector3TransformNormal(XMLoadFloat3(&ray.Direction), invWorld));
+
+		BvhHit meshHit;
+		if(!mMeshes[instance.Mesh]->Intersect(origin, direction, maxDistance, meshHit))
+			return maxDistance;
+
+		hit.Distance = meshHit.Distance;
+		hit.Instance = index;
+		hit.Triangle = meshHit.Triangle;
+		hit.U = meshHit.U;
+		hit.V = meshHit.V;
+		found = true;
+		return meshHit.Distance;
+	});
+
+	return found;
+}
+
+bool RayScene::Occluded(const SceneRay& ray)const
+{
+	bool blocked = false;
+	Traverse(ray, [&](std::uint32_t index, float maxDistance)
+	{
+		const Instance& instance = mInstances[index];
+		const XMMATRIX invWorld = XMLoadFloat4x4(&instance.InvWorld);
+		XMFLOAT3 origin;
+		XMFLOAT3 direction;
+		XMStoreFloat3(&origin, XMVector3TransformCoord(XMLoadFloat3(&ray.Origin), invWorld));
+		XMStoreFloat3(&direction, XMVector3TransformNormal(XMLoadFloat3(&ray.Direction), invWorld));
+
+		blocked = mMeshes[instance.Mesh]->Occluded(origin, direction, maxDistance);
+		return blocked ? -1.0f : maxDistance;
+	});
+
+	return blocked;
+}
+
+void RayScene::IntersectBatch(const SceneRay* rays, std::size_t count, SceneHit* hits)const
+{
+	if(count == 0)
+		return;
+
+	// A few batches per core, as rays into the open finish long before rays into the
+	// busier parts of the scene.
+	const std::size_t threads = MathHelper::Max(1u, std::thread::hardware_concurrency());
+	const std::size_t batchCount = MathHelper::Min(count, 4*threads);
+	const std::size_t batchSize = (count + batchCount - 1) / batchCount;
+
+	concurrency::parallel_for((std::size_t)0, batchCount, [&](std::size_t batch)
+	{
+		const std::size_t first = batch*batchSize;
+		const std::size_t last = MathHelper::Min(count, first + batchSize);
+		for(std::size_t i = first; i < last; ++i)
+		{
+			if(!Intersect(rays[i], hits[i]))
+			{
+				hits[i].Distance = rays[i].MaxDistance;
+				hits[i].Instance = NoInstance;
+				hits[i].Triangle = TriangleBvh::NoTriangle;
+				hits[i].U = 0.0f;
+				hits[i].V = 0.0f;
+			}
+		}
+	});
+}
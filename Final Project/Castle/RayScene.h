@@ -0,0 +1,122 @@
+//***************************************************************************************
+// RayScene.h
+//
+// Casts rays against the triangles of a scene made of meshes placed any number of times,
+// for picking and other queries that need the actual surfaces rather than boxes.
+//
+// Each mesh gets a TriangleBvh of its own, in its own space, built once however many
+// instances it has.  An instance places a mesh with a world matrix, and Build() puts a
+// second, smaller tree over the instances' world bounds.  A ray goes down that tree and,
+// at each instance it reaches, into the mesh's tree after being taken into the mesh's
+// space by the inverse of the world matrix.  That keeps distances along the ray in the
+// same multiples of its direction in either space, so the nearest hit found so far
+// carries over from one instance to the next.
+//
+// Nothing is changed by casting rays, so any number of threads may cast at once, and
+// IntersectBatch() spreads a batch of rays over the cores itself.
+//***************************************************************************************
+
+#ifndef RAYSCENE_H
+#define RAYSCENE_H
+
+#include "TriangleBvh.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct SceneRay
+{
+	// Direction need not be unit length; hits are reported in multiples of it, no farther
+	// than MaxDistance.
+	DirectX::XMFLOAT3 Origin;
+	float MaxDistance;
+	DirectX::XMFLOAT3 Direction;
+};
+
+struct SceneHit
+{
+	float Distance;
+	std::uint32_t Instance;
+	std::uint32_t Triangle;
+	float U;
+	float V;
+};
+
+class RayScene
+{
+public:
+	static const std::uint32_t NoInstance = ~0u;
+
+	RayScene() = default;
+	RayScene(const RayScene& rhs) = delete;
+	RayScene& operator=(const RayScene& rhs) = delete;
+
+	// Builds the mesh's tree straight away and returns its index.  A hit's Triangle
+	// counts the triangles of its instance's mesh.
+	std::uint32_t AddMesh(const DirectX::XMFLOAT3* positions, std::size_t vertexCount,
+		const std::uint32_t* indices, std::size_t triangleCount);
+
+	// Places a mesh in the world and returns the instance's index, which is what hits
+	// report.  Only seen by rays once Build() has been called.
+	std::uint32_t AddInstance(std::uint32_t mesh, const DirectX::XMFLOAT4X4& world);
+
+	// Builds the tree over the instances added so far.
+	void Build();
+
+	std::size_t MeshCount()const { return mMeshes.size(); }
+	std::size_t InstanceCount()const { return mInstances.size(); }
+	std::uint32_t InstanceMesh(std::uint32_t instance)const { return mInstances[instance].Mesh; }
+	const TriangleBvh& Mesh(std::uint32_t mesh)const { return *mMeshes[mesh]; }
+
+	// Triangles in the meshes, and in the world once each is counted for every instance.
+	std::size_t MeshTriangleCount()const;
+	std::size_t WorldTriangleCount()const;
+	std::size_t Bytes()const;
+
+	// The nearest hit, or false with hit untouched.
+	bool Intersect(const SceneRay& ray, SceneHit& hit)const;
+
+	// Whether anything is hit.  Stops at the first triangle found.
+	bool Occluded(const SceneRay& ray)const;
+
+	// Intersect() for count rays, spread over the cores.  A ray that hits nothing gets
+	// NoInstance.
+	void IntersectBatch(const SceneRay* rays, std::size_t count, SceneHit* hits)const;
+
+private:
+	struct Instance
+	{
+		DirectX::XMFLOAT4X4 World;
+		DirectX::XMFLOAT4X4 InvWorld;
+		DirectX::BoundingBox Bounds;
+		std::uint32_t Mesh;
+	};
+
+	// As in TriangleBvh: an inner node's children are at First and First + 1, a leaf has
+	// Count instances from mOrder[First] on.
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		std::uint32_t First;
+		DirectX::XMFLOAT3 Max;
+		std::uint32_t Count;
+	};
+
+	// Splits node, which holds count instances from mOrder[first] on, at the median of
+	// their centres along the widest axis, until each leaf has a couple.
+	void Split(std::uint32_t node, std::uint32_t first, std::uint32_t count, std::uint32_t depth);
+
+	// Calls visit(instance) for each instance whose bounds the ray reaches within the
+	// distance it returns; visit returns the new distance, or a negative one to stop.
+	template<typename Visit>
+	void Traverse(const SceneRay& ray, Visit visit)const;
+
+	std::vector<std::unique_ptr<TriangleBvh>> mMeshes;
+	std::vector<Instance> mInstances;
+	std::vector<Node> mNodes;
+	std::vector<std::uint32_t> mOrder;
+};
+
+#endif // RAYSCENE_H
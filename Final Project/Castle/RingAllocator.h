@@ -0,0 +1,125 @@
+//***************************************************************************************
+// RingAllocator.h
+//
+// Hands out ranges of a fixed size buffer in order and takes them back in the same
+// order, once the GPU is done with them.
+//
+// Allocations are made at the head and never wrap: one that does not fit before the end
+// starts again at offset 0 and the bytes it skips stay in use until the tail passes
+// them.  Retire() closes off everything allocated since the last call under a fence
+// value, and Reclaim() frees every closed off group whose fence has completed.
+//
+// The allocator only does the offset arithmetic, so it has no D3D dependency.
+//***************************************************************************************
+
+#ifndef RINGALLOCATOR_H
+#define RINGALLOCATOR_H
+
+#include <cstdint>
+#include <deque>
+
+class RingAllocator
+{
+public:
+	static const std::uint64_t Invalid = ~0ull;
+
+	RingAllocator(std::uint64_t capacity)
+		: mCapacity(capacity)
+	{
+	}
+
+	// Returns the offset of size free bytes at a multiple of alignment, which must be a
+	// power of two, or Invalid if there is no room.
+	std::uint64_t Allocate(std::uint64_t size, std::uint64_t alignment)
+	{
+		if(size == 0 || size > mCapacity)
+			return Invalid;
+
+		if(mUsed == 0)
+			mHead = mTail = 0;
+		else if(mHead == mTail)
+			return Invalid;
+
+		std::uint64_t offset = (mHead + alignment - 1) & ~(alignment - 1);
+		std::uint64_t used = 0;
+
+		if(mHead >= mTail)
+		{
+			// Free space is [head, capacity) and then [0, tail).
+			if(offset + size <= mCapacity)
+			{
+				used = offset + size - mHead;
+			}
+			else if(size <= mTail)
+			{
+				used = mCapacity - mHead + size;
+				offset = 0;
+			}
+			else
+			{
+				return Invalid;
+			}
+		}
+		else
+		{
+			// Free space is [head, tail).
+			if(offset + size > mTail)
+				return Invalid;
+			used = offset + size - mHead;
+		}
+
+		mHead = offset + size;
+		mUsed += used;
+		mPeak = mUsed > mPeak ? mUsed : mPeak;
+		return offset;
+	}
+
+	// Everything allocated since the last Retire() stays in use until fence completes.
+	void Retire(std::uint64_t fence)
+	{
+		std::uint64_t bytes = mUsed - mRetiredBytes;
+		if(bytes == 0)
+			return;
+
+		mRetired.push_back({ fence, mHead, bytes });
+		mRetiredBytes = mUsed;
+	}
+
+	// Frees the groups retired with fences up to completedFence.
+	void Reclaim(std::uint64_t completedFence)
+	{
+		while(!mRetired.empty() && mRetired.front().Fence <= completedFence)
+		{
+			mTail = mRetired.front().End;
+			mUsed -= mRetired.front().Bytes;
+			mRetiredBytes -= mRetired.front().Bytes;
+			mRetired.pop_front();
+		}
+	}
+
+	std::uint64_t Capacity()const { return mCapacity; }
+
+	// Bytes in use, counting alignment padding and bytes skipped at the end.
+	std::uint64_t Used()const { return mUsed; }
+	std::uint64_t Peak()const { return mPeak; }
+
+private:
+	struct Group
+	{
+		std::uint64_t Fence;
+		std::uint64_t End;
+		std::uint64_t Bytes;
+	};
+
+	std::uint64_t mCapacity;
+	std::uint64_t mHead = 0;
+	std::uint64_t mTail = 0;
+	std::uint64_t mUsed = 0;
+	std::uint64_t mPeak = 0;
+
+	// Groups waiting on their fence, oldest first, and the bytes they hold between them.
+	std::deque<Group> mRetired;
+	std::uint64_t mRetiredBytes = 0;
+};
+
+#endif // RINGALLOCATOR_H
@@ -0,0 +1,189 @@
+//***************************************************************************************
+// ShaderCache.cpp
+//***************************************************************************************
+
+#include "ShaderCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	// Bump when the key layout changes so old blobs are not picked up.
+	const char* const CacheVersion = "ShaderCache 1";
+
+	// 64-bit FNV-1a.
+	const std::uint64_t HashSeed = 0xcbf29ce484222325ull;
+
+	void HashBytes(std::uint64_t& hash, const void* data, std::size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for(std::size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	// The length goes in first so "ab" + "c" and "a" + "bc" hash differently.
+	void HashString(std::uint64_t& hash, const std::string& s)
+	{
+		std::uint64_t size = s.size();
+		HashBytes(hash, &size, sizeof(size));
+		HashBytes(hash, s.data(), s.size());
+	}
+
+	std::string DirectoryOf(const std::string& file)
+	{
+		std::size_t slash = file.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : file.substr(0, slash + 1);
+	}
+
+	void MakeDirectory(const std::string& directory)
+	{
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+}
+
+ShaderCache::ShaderCache(const std::string& directory, CompileFunc compile)
+	: mDirectory(directory), mCompile(compile)
+{
+	MakeDirectory(mDirectory);
+}
+
+std::string ShaderCache::Get(const ShaderDesc& desc)
+{
+	std::uint64_t key = Key(desc);
+	if(key == 0)
+		return std::string();
+
+	std::string path = BlobPath(key);
+	if(std::ifstream(path, std::ios::binary).good())
+	{
+		++mHits;
+		return path;
+	}
+
+	std::vector<char> bytecode;
+	if(!mCompile(desc, bytecode))
+		return std::string();
+
+	++mMisses;
+
+	// Write to a temporary file and rename it so a crash never leaves a truncated blob
+	// under a valid key.
+	std::string tempPath = path + "." + std::to_string(mNextTemp++) + ".tmp";
+	{
+		std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+		fout.write(bytecode.data(), bytecode.size());
+		if(!fout)
+			return std::string();
+	}
+
+	std::remove(path.c_str());
+	if(std::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tempPath.c_str());
+		return std::string();
+	}
+
+	return path;
+}
+
+std::uint64_t ShaderCache::Key(const ShaderDesc& desc)
+{
+	std::uint64_t hash = HashSeed;
+	HashString(hash, CacheVersion);
+
+	std::vector<std::string> visited;
+	if(!HashFile(desc.File, hash, visited))
+		return 0;
+
+	HashString(hash, desc.EntryPoint);
+	HashString(hash, desc.Target);
+	HashBytes(hash, &desc.Flags, sizeof(desc.Flags));
+
+	for(const ShaderDefine& define : desc.Defines)
+	{
+		HashString(hash, define.Name);
+		HashString(hash, define.Value);
+	}
+
+	// 0 means failure.
+	return hash != 0 ? hash : 1;
+}
+
+std::string ShaderCache::BlobPath(std::uint64_t key)const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.cso", (unsigned long long)key);
+	return mDirectory + "/" + name;
+}
+
+bool ShaderCache::HashFile(const std::string& file, std::uint64_t& hash, std::vector<std::string>& visited)
+{
+	// An include guard in the shader does not stop us from recursing, so track the files
+	// already hashed.
+	if(std::find(visited.begin(), visited.end(), file) != visited.end())
+		return true;
+	visited.push_back(file);
+
+	const std::string* cached = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mSourcesMutex);
+		auto it = mSources.find(file);
+		if(it != mSources.end())
+			cached = &it->second;
+	}
+
+	if(cached == nullptr)
+	{
+		std::ifstream fin(file, std::ios::binary);
+		if(!fin)
+			return false;
+
+		std::ostringstream contents;
+		contents << fin.rdbuf();
+
+		// Another thread may have read the file meanwhile, in which case its copy is kept.
+		std::lock_guard<std::mutex> lock(mSourcesMutex);
+		cached = &mSources.emplace(file, contents.str()).first->second;
+	}
+
+	const std::string& source = *cached;
+	HashString(hash, file);
+	HashString(hash, source);
+
+	// Follow #include "name", which the standard include handler resolves relative to
+	// the including file.
+	const std::string directory = DirectoryOf(file);
+	std::istringstream lines(source);
+	std::string line;
+	while(std::getline(lines, line))
+	{
+		std::size_t pos = line.find_first_not_of(" \t");
+		if(pos == std::string::npos || line.compare(pos, 8, "#include") != 0)
+			continue;
+
+		std::size_t open = line.find('"', pos + 8);
+		std::size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if(close == std::string::npos)
+			continue;
+
+		if(!HashFile(directory + line.substr(open + 1, close - open - 1), hash, visited))
+			return false;
+	}
+
+	return true;
+}
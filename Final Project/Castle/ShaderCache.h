@@ -0,0 +1,89 @@
+//***************************************************************************************
+// ShaderCache.h
+//
+// On-disk cache of compiled shader bytecode, so a warm start loads blobs instead of
+// running the compiler.
+//
+// Each blob is stored under a hash of everything its bytecode depends on: the source
+// file and every file it #includes, the defines, the entry point, the target and the
+// compile flags.  Editing a shader or one of its includes changes the hash, so stale
+// blobs are never loaded; they are simply left behind.
+//
+// The cache has no D3D dependency.  The compiler is passed in as a function, so the app
+// uses D3DCompileFromFile and anything else can use a stand-in.
+//
+// Get() may be called from several threads at once, as long as the compile function is
+// safe to call that way too.
+//***************************************************************************************
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+
+struct ShaderDefine
+{
+	std::string Name;
+	std::string Value;
+};
+
+struct ShaderDesc
+{
+	std::string File;
+	std::vector<ShaderDefine> Defines;
+	std::string EntryPoint;
+	std::string Target;
+	std::uint32_t Flags = 0;
+};
+
+class ShaderCache
+{
+public:
+	// Compiles desc into bytecode.  Returns false if compilation failed.
+	typedef std::function<bool(const ShaderDesc& desc, std::vector<char>& bytecode)> CompileFunc;
+
+	// directory is created if it does not exist.
+	ShaderCache(const std::string& directory, CompileFunc compile);
+	ShaderCache(const ShaderCache& rhs) = delete;
+	ShaderCache& operator=(const ShaderCache& rhs) = delete;
+
+	// Returns the path of the blob holding desc's bytecode, compiling and storing it
+	// first if there is none.  Returns an empty string if the source cannot be read or
+	// does not compile.
+	std::string Get(const ShaderDesc& desc);
+
+	// Hash of everything desc's bytecode depends on, or 0 if a file cannot be read.
+	// Source files are read once per cache and remembered.
+	std::uint64_t Key(const ShaderDesc& desc);
+
+	std::string BlobPath(std::uint64_t key)const;
+
+	std::uint32_t Hits()const { return mHits; }
+	std::uint32_t Misses()const { return mMisses; }
+
+private:
+	// Hashes file and, recursively, the files it #includes with quotes.
+	bool HashFile(const std::string& file, std::uint64_t& hash, std::vector<std::string>& visited);
+
+	std::string mDirectory;
+	CompileFunc mCompile;
+
+	// Contents of every source file read so far.  Entries are never removed, so a
+	// reference stays valid after the lock is released.
+	std::unordered_map<std::string, std::string> mSources;
+	std::mutex mSourcesMutex;
+
+	std::atomic<std::uint32_t> mHits{ 0 };
+	std::atomic<std::uint32_t> mMisses{ 0 };
+
+	// Numbers temporary files so two threads storing blobs never write the same one.
+	std::atomic<std::uint32_t> mNextTemp{ 0 };
+};
+
+#endif // SHADERCACHE_H
@@ -0,0 +1,172 @@
+//***************************************************************************************
+// ShaderPermutations.cpp
+//***************************************************************************************
+
+#include "ShaderPermutations.h"
+#include <ppl.h>
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+	// Define for each ShaderFeature bit, in bit order.
+	const char* const FeatureDefines[ShaderFeatureCount] =
+	{
+		"FOG",
+		"ALPHA_TEST",
+		"BAKED_LIGHTING",
+	};
+}
+
+ShaderPermutations::ShaderPermutations(ShaderCache& cache, std::uint32_t flags)
+	: mCache(cache), mFlags(flags)
+{
+}
+
+std::uint32_t ShaderPermutations::AddProgram(const ShaderProgram& program)
+{
+	mPrograms.push_back(program);
+	return (std::uint32_t)mPrograms.size() - 1;
+}
+
+ShaderPermutation ShaderPermutations::Minimal(std::uint32_t program, const ShaderPermutation& permutation)const
+{
+	const ShaderProgram& p = mPrograms[program];
+
+	ShaderPermutation minimal;
+	minimal.Features = permutation.Features & p.Features;
+	if(p.Lit)
+	{
+		minimal.DirLights = permutation.DirLights;
+		minimal.PointLights = permutation.PointLights;
+		minimal.SpotLights = permutation.SpotLights;
+	}
+
+	return minimal;
+}
+
+void ShaderPermutations::Precompile(const std::vector<std::pair<std::uint32_t, ShaderPermutation>>& requests)
+{
+	std::vector<std::uint64_t> keys;
+	std::vector<ShaderDesc> descs;
+	{
+		std::lock_guard<std::mutex> lock(mVariantsMutex);
+		for(const auto& request : requests)
+		{
+			std::uint64_t key = VariantKey(request.first, request.second);
+			if(mVariants.count(key) != 0 || std::find(keys.begin(), keys.end(), key) != keys.end())
+				continue;
+
+			keys.push_back(key);
+			descs.push_back(MakeDesc(request.first, request.second));
+		}
+	}
+
+	// The compiler is the slow part and each variant is independent, so they are all
+	// compiled at once and only added to the map afterwards.
+	std::vector<std::string> paths(descs.size());
+	concurrency::parallel_for((std::size_t)0, descs.size(), [&](std::size_t i)
+	{
+		paths[i] = mCache.Get(descs[i]);
+	});
+
+	std::lock_guard<std::mutex> lock(mVariantsMutex);
+	for(std::size_t i = 0; i < keys.size(); ++i)
+	{
+		ShaderVariant variant;
+		variant.Desc = std::move(descs[i]);
+		variant.Path = std::move(paths[i]);
+		mVariants.emplace(keys[i], std::move(variant));
+	}
+}
+
+const ShaderVariant& ShaderPermutations::Get(std::uint32_t program, const ShaderPermutation& permutation)
+{
+	std::uint64_t key = VariantKey(program, permutation);
+	{
+		std::lock_guard<std::mutex> lock(mVariantsMutex);
+		auto it = mVariants.find(key);
+		if(it != mVariants.end())
+		{
+			++it->second.Uses;
+			return it->second;
+		}
+	}
+
+	// Not precompiled.  Compile outside the lock so other lookups are not held up; if
+	// another thread gets there first its variant is kept and this one is dropped.
+	ShaderVariant variant;
+	variant.Desc = MakeDesc(program, permutation);
+	variant.Path = mCache.Get(variant.Desc);
+
+	std::lock_guard<std::mutex> lock(mVariantsMutex);
+	ShaderVariant& stored = mVariants.emplace(key, std::move(variant)).first->second;
+	++stored.Uses;
+	return stored;
+}
+
+std::string ShaderPermutations::Report()const
+{
+	std::lock_guard<std::mutex> lock(mVariantsMutex);
+
+	std::vector<std::pair<std::uint64_t, const ShaderVariant*>> sorted;
+	for(const auto& e : mVariants)
+		sorted.push_back({ e.first, &e.second });
+	std::sort(sorted.begin(), sorted.end(),
+		[](const std::pair<std::uint64_t, const ShaderVariant*>& a, const std::pair<std::uint64_t, const ShaderVariant*>& b)
+		{
+			return a.first < b.first;
+		});
+
+	std::ostringstream out;
+	out << "Shader permutations: " << sorted.size() << " variants\n";
+	for(const auto& e : sorted)
+	{
+		const ShaderVariant& v = *e.second;
+		out << "  " << v.Desc.File << " " << v.Desc.EntryPoint;
+		for(const ShaderDefine& define : v.Desc.Defines)
+			out << " " << define.Name << "=" << define.Value;
+		out << ": " << v.Uses << (v.Uses == 1 ? " use" : " uses");
+		if(v.Path.empty())
+			out << " (failed)";
+		out << "\n";
+	}
+
+	return out.str();
+}
+
+std::uint64_t ShaderPermutations::VariantKey(std::uint32_t program, const ShaderPermutation& permutation)const
+{
+	ShaderPermutation minimal = Minimal(program, permutation);
+
+	std::uint32_t bits = (minimal.Features & 0xff) << 24 | (std::uint32_t)minimal.DirLights << 16 |
+		(std::uint32_t)minimal.PointLights << 8 | (std::uint32_t)minimal.SpotLights;
+	return (std::uint64_t)program << 32 | bits;
+}
+
+ShaderDesc ShaderPermutations::MakeDesc(std::uint32_t program, const ShaderPermutation& permutation)const
+{
+	const ShaderProgram& p = mPrograms[program];
+	ShaderPermutation minimal = Minimal(program, permutation);
+
+	ShaderDesc desc;
+	desc.File = p.File;
+	desc.EntryPoint = p.EntryPoint;
+	desc.Target = p.Target;
+	desc.Flags = mFlags;
+
+	for(std::uint32_t i = 0; i < ShaderFeatureCount; ++i)
+	{
+		if(minimal.Features & (1u << i))
+			desc.Defines.push_back({ FeatureDefines[i], "1" });
+	}
+
+	if(p.Lit)
+	{
+		desc.Defines.push_back({ "NUM_DIR_LIGHTS", std::to_string(minimal.DirLights) });
+		desc.Defines.push_back({ "NUM_POINT_LIGHTS", std::to_string(minimal.PointLights) });
+		desc.Defines.push_back({ "NUM_SPOT_LIGHTS", std::to_string(minimal.SpotLights) });
+	}
+
+	return desc;
+}
@@ -0,0 +1,110 @@
+//***************************************************************************************
+// ShaderPermutations.h
+//
+// Compiles each shader once per combination of features it is asked for.
+//
+// A permutation is a set of feature bits (fog, alpha test, baked lighting) plus the
+// number of directional, point and spot lights the lighting loop is unrolled for.  Each
+// program declares which of those its source actually reads, and a request is first
+// reduced to just those, so the fog bit never splits a vertex shader into two identical
+// variants and unlit stages ignore the light counts.
+//
+// Variants are compiled through a ShaderCache.  Precompile() builds a list of them on
+// worker threads; Get() looks one up, compiling it on the spot if it was not in the list,
+// and counts the request so Report() can show which variants are used and how often.
+//***************************************************************************************
+
+#ifndef SHADERPERMUTATIONS_H
+#define SHADERPERMUTATIONS_H
+
+#include "ShaderCache.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+enum ShaderFeature : std::uint32_t
+{
+	ShaderFeatureFog = 1 << 0,
+	ShaderFeatureAlphaTest = 1 << 1,
+	ShaderFeatureBakedLighting = 1 << 2,
+
+	ShaderFeatureCount = 3
+};
+
+struct ShaderPermutation
+{
+	std::uint32_t Features = 0;
+	std::uint8_t DirLights = 0;
+	std::uint8_t PointLights = 0;
+	std::uint8_t SpotLights = 0;
+};
+
+// One entry point and the permutation inputs its source depends on.
+struct ShaderProgram
+{
+	std::string File;
+	std::string EntryPoint;
+	std::string Target;
+
+	// ShaderFeature bits the source tests with #ifdef.
+	std::uint32_t Features = 0;
+
+	// True if the source is compiled with the NUM_*_LIGHTS counts.
+	bool Lit = false;
+};
+
+struct ShaderVariant
+{
+	ShaderDesc Desc;
+
+	// Blob holding the bytecode, or empty if the variant did not compile.
+	std::string Path;
+
+	// Number of Get() calls that resolved to this variant.
+	std::uint32_t Uses = 0;
+};
+
+class ShaderPermutations
+{
+public:
+	// Each variant's defines are added on top of flags.
+	ShaderPermutations(ShaderCache& cache, std::uint32_t flags);
+	ShaderPermutations(const ShaderPermutations& rhs) = delete;
+	ShaderPermutations& operator=(const ShaderPermutations& rhs) = delete;
+
+	// Returns the id used to ask for the program's variants.
+	std::uint32_t AddProgram(const ShaderProgram& program);
+
+	// permutation with everything program does not read cleared.
+	ShaderPermutation Minimal(std::uint32_t program, const ShaderPermutation& permutation)const;
+
+	// Compiles the variant of every (program, permutation) pair, several at a time.
+	// Pairs that reduce to the same variant are only compiled once.
+	void Precompile(const std::vector<std::pair<std::uint32_t, ShaderPermutation>>& requests);
+
+	// The variant of program for permutation.  The reference stays valid for the life of
+	// this object.
+	const ShaderVariant& Get(std::uint32_t program, const ShaderPermutation& permutation);
+
+	std::size_t VariantCount()const { return mVariants.size(); }
+
+	// One line per variant with its defines and use count, ordered by program.
+	std::string Report()const;
+
+private:
+	std::uint64_t VariantKey(std::uint32_t program, const ShaderPermutation& permutation)const;
+	ShaderDesc MakeDesc(std::uint32_t program, const ShaderPermutation& permutation)const;
+
+	ShaderCache& mCache;
+	std::uint32_t mFlags;
+
+	std::vector<ShaderProgram> mPrograms;
+
+	// Keyed by VariantKey().  Nodes never move, so Get() can hand out references.
+	std::unordered_map<std::uint64_t, ShaderVariant> mVariants;
+	mutable std::mutex mVariantsMutex;
+};
+
+#endif // SHADERPERMUTATIONS_H
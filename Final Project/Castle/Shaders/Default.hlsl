@@ -6,15 +6,15 @@
 
 // Defaults for number of lights.
 #ifndef NUM_DIR_LIGHTS
-    #define NUM_DIR_LIGHTS 3
+    #define NUM_DIR_LIGHTS 1
 #endif
 
 #ifndef NUM_POINT_LIGHTS
-    #define NUM_POINT_LIGHTS 0
+    #define NUM_POINT_LIGHTS 6
 #endif
 
 #ifndef NUM_SPOT_LIGHTS
-    #define NUM_SPOT_LIGHTS 0
+    #define NUM_SPOT_LIGHTS 1
 #endif
 
 // Include structures and functions for lighting.
@@ -30,13 +30,29 @@ SamplerState gsamLinearClamp      : register(s3);
 SamplerState gsamAnisotropicWrap  : register(s4);
 SamplerState gsamAnisotropicClamp : register(s5);
 
-// Constant data that varies per frame.
+// Which element of gObjectData is being drawn.
 cbuffer cbPerObject : register(b0)
 {
-    float4x4 gWorld;
-	float4x4 gTexTransform;
+	uint gObjectIndex;
 };
 
+// Per-object data, packed densely; matches ObjectConstants in FrameResource.h.
+struct ObjectData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint BakedOffset;
+	uint3 ObjPad;
+};
+
+StructuredBuffer<ObjectData> gObjectData : register(t1, space1);
+
+#ifdef BAKED_LIGHTING
+// Per-vertex light from the point and spot lights in rgb and ambient occlusion in a,
+// baked on the CPU by LightBaker.  An object's vertices start at its BakedOffset.
+StructuredBuffer<float4> gBakedLighting : register(t2, space1);
+#endif
+
 // Constant data that varies per material.
 cbuffer cbPass : register(b1)
 {
@@ -76,6 +92,15 @@ cbuffer cbMaterial : register(b2)
 	float4x4 gMatTransform;
 };
 
+// Per-instance data for instanced draws; matches InstanceData in FrameResource.h.
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+};
+
+StructuredBuffer<InstanceData> gInstanceData : register(t0, space1);
+
 struct VertexIn
 {
 	float3 PosL    : POSITION;
@@ -89,24 +114,61 @@ struct VertexOut
     float3 PosW    : POSITION;
     float3 NormalW : NORMAL;
 	float2 TexC    : TEXCOORD;
+#ifdef BAKED_LIGHTING
+	float4 Baked   : COLOR;
+#endif
 };
 
-VertexOut VS(VertexIn vin)
+// For indexed draws SV_VertexID is the index from the index buffer, before the draw's
+// BaseVertexLocation is added, so it numbers the vertices of the object's own mesh.
+VertexOut VS(VertexIn vin, uint vertexID : SV_VertexID)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+	ObjectData objData = gObjectData[gObjectIndex];
 	
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(vin.PosL, 1.0f), objData.World);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(vin.NormalL, (float3x3)objData.World);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
 	
 	// Output vertex attributes for interpolation across triangle.
-	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), gTexTransform);
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), objData.TexTransform);
+	vout.TexC = mul(texC, gMatTransform).xy;
+
+#ifdef BAKED_LIGHTING
+	vout.Baked = gBakedLighting[objData.BakedOffset + vertexID];
+#endif
+
+    return vout;
+}
+
+// Same as VS, but the world and texture transforms come from the instance buffer.
+VertexOut VSInstanced(VertexIn vin, uint instanceID : SV_InstanceID)
+{
+	VertexOut vout = (VertexOut)0.0f;
+
+	InstanceData instData = gInstanceData[instanceID];
+	float4x4 world = instData.World;
+	float4x4 texTransform = instData.TexTransform;
+
+    // Transform to world space.
+    float4 posW = mul(float4(vin.PosL, 1.0f), world);
+    vout.PosW = posW.xyz;
+
+    // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
+    vout.NormalW = mul(vin.NormalL, (float3x3)world);
+
+    // Transform to homogeneous clip space.
+    vout.PosH = mul(posW, gViewProj);
+
+	// Output vertex attributes for interpolation across triangle.
+	float4 texC = mul(float4(vin.TexC, 0.0f, 1.0f), texTransform);
 	vout.TexC = mul(texC, gMatTransform).xy;
 
     return vout;
@@ -140,6 +202,13 @@ float4 PS(VertexOut pin) : SV_Target
     float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
 
+#ifdef BAKED_LIGHTING
+	// The lights left out of ComputeLighting were baked, shadows and all, without their
+	// highlights.
+	ambient *= pin.Baked.a;
+	directLight.rgb += pin.Baked.rgb*diffuseAlbedo.rgb;
+#endif
+
     float4 litColor = ambient + directLight;
 
 #ifdef FOG
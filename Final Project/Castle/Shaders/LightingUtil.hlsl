@@ -5,10 +5,6 @@
 //***************************************************************************************
 
 #define MaxLights 16
-//defining amount of each light source
-#define NUM_DIR_LIGHTS 1
-#define NUM_POINT_LIGHTS 6
-#define NUM_SPOT_LIGHTS 1
 
 struct Light
 {
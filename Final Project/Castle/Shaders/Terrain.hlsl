@@ -0,0 +1,210 @@
+//***************************************************************************************
+// Terrain.hlsl
+//
+// Draws one CDLOD terrain node.  Every node uses the same flat patch mesh whose
+// vertices span [0,1] in x and z; the vertex shader places the patch with the node
+// constants, morphs vertices towards the next coarser grid and displaces them with
+// the heightmap.
+//***************************************************************************************
+
+// Defaults for number of lights.
+#ifndef NUM_DIR_LIGHTS
+    #define NUM_DIR_LIGHTS 1
+#endif
+
+#ifndef NUM_POINT_LIGHTS
+    #define NUM_POINT_LIGHTS 6
+#endif
+
+#ifndef NUM_SPOT_LIGHTS
+    #define NUM_SPOT_LIGHTS 1
+#endif
+
+// Include structures and functions for lighting.
+#include "LightingUtil.hlsl"
+
+Texture2D    gDiffuseMap : register(t0);
+Texture2D    gHeightMap  : register(t1);
+
+
+SamplerState gsamPointWrap        : register(s0);
+SamplerState gsamPointClamp       : register(s1);
+SamplerState gsamLinearWrap       : register(s2);
+SamplerState gsamLinearClamp      : register(s3);
+SamplerState gsamAnisotropicWrap  : register(s4);
+SamplerState gsamAnisotropicClamp : register(s5);
+
+// Which element of gObjectData is being drawn.
+cbuffer cbPerObject : register(b0)
+{
+	uint gObjectIndex;
+};
+
+// Per-object data, packed densely; matches ObjectConstants in FrameResource.h.
+struct ObjectData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint BakedOffset;
+	uint3 ObjPad;
+};
+
+StructuredBuffer<ObjectData> gObjectData : register(t1, space1);
+
+// Constant data that varies per material.
+cbuffer cbPass : register(b1)
+{
+    float4x4 gView;
+    float4x4 gInvView;
+    float4x4 gProj;
+    float4x4 gInvProj;
+    float4x4 gViewProj;
+    float4x4 gInvViewProj;
+    float3 gEyePosW;
+    float cbPerObjectPad1;
+    float2 gRenderTargetSize;
+    float2 gInvRenderTargetSize;
+    float gNearZ;
+    float gFarZ;
+    float gTotalTime;
+    float gDeltaTime;
+    float4 gAmbientLight;
+
+	float4 gFogColor;
+	float gFogStart;
+	float gFogRange;
+	float2 cbPerObjectPad2;
+
+    // Indices [0, NUM_DIR_LIGHTS) are directional lights;
+    // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
+    // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
+    // are spot lights for a maximum of MaxLights per object.
+    Light gLights[MaxLights];
+};
+
+cbuffer cbMaterial : register(b2)
+{
+	float4   gDiffuseAlbedo;
+    float3   gFresnelR0;
+    float    gRoughness;
+	float4x4 gMatTransform;
+};
+
+// Root constants; the node half changes every draw, the terrain half once per frame.
+cbuffer cbTerrain : register(b3)
+{
+	float2 gNodeMin;
+	float  gNodeSize;
+	float  gMorphStart;
+	float  gMorphInvRange;
+	float3 cbTerrainPad0;
+
+	float2 gTerrainMin;
+	float2 gTerrainSize;
+	float  gHeightScale;
+	float  gHeightOffset;
+	float  gPatchSize;
+	float  cbTerrainPad1;
+};
+
+struct VertexIn
+{
+	float3 PosL    : POSITION;
+    float3 NormalL : NORMAL;
+	float2 TexC    : TEXCOORD;
+};
+
+struct VertexOut
+{
+	float4 PosH    : SV_POSITION;
+    float3 PosW    : POSITION;
+    float3 NormalW : NORMAL;
+	float2 TexC    : TEXCOORD;
+};
+
+float2 TerrainUV(float2 posXZ)
+{
+	return (posXZ - gTerrainMin) / gTerrainSize;
+}
+
+float SampleHeight(float2 posXZ)
+{
+	// Map [0,1] onto the texel centers so the edges line up with the CPU sampling.
+	float2 dim;
+	gHeightMap.GetDimensions(dim.x, dim.y);
+	float2 uv = (saturate(TerrainUV(posXZ))*(dim - 1.0f) + 0.5f) / dim;
+
+	return gHeightOffset + gHeightScale*gHeightMap.SampleLevel(gsamLinearClamp, uv, 0.0f).r;
+}
+
+VertexOut VS(VertexIn vin)
+{
+	VertexOut vout = (VertexOut)0.0f;
+
+	// Place the patch over the node.
+	float2 gridPos = vin.PosL.xz;
+	float2 posXZ = gNodeMin + gridPos*gNodeSize;
+
+	// Morph towards the next coarser grid as the vertex approaches the end of its level's
+	// range.  Odd vertices slide onto their even neighbours, so at full morph the patch
+	// matches the parent level and there are no cracks between levels.
+	float3 approxPosW = float3(posXZ.x, SampleHeight(posXZ), posXZ.y);
+	float morphK = saturate((distance(gEyePosW, approxPosW) - gMorphStart)*gMorphInvRange);
+
+	float2 fracPart = frac(gridPos*gPatchSize*0.5f)*2.0f / gPatchSize;
+	posXZ -= fracPart*gNodeSize*morphK;
+
+	float3 posW = float3(posXZ.x, SampleHeight(posXZ), posXZ.y);
+	vout.PosW = posW;
+
+	// Normal from central differences one grid step apart.
+	float step = gNodeSize / gPatchSize;
+	float hL = SampleHeight(posXZ - float2(step, 0.0f));
+	float hR = SampleHeight(posXZ + float2(step, 0.0f));
+	float hD = SampleHeight(posXZ - float2(0.0f, step));
+	float hU = SampleHeight(posXZ + float2(0.0f, step));
+	vout.NormalW = normalize(float3(hL - hR, 2.0f*step, hD - hU));
+
+	// Transform to homogeneous clip space.
+	vout.PosH = mul(float4(posW, 1.0f), gViewProj);
+
+	// Output vertex attributes for interpolation across triangle.
+	float4 texC = mul(float4(TerrainUV(posXZ), 0.0f, 1.0f), gObjectData[gObjectIndex].TexTransform);
+	vout.TexC = mul(texC, gMatTransform).xy;
+
+	return vout;
+}
+
+float4 PS(VertexOut pin) : SV_Target
+{
+    float4 diffuseAlbedo = gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+
+    // Interpolating normal can unnormalize it, so renormalize it.
+    pin.NormalW = normalize(pin.NormalW);
+
+    // Vector from point being lit to eye.
+	float3 toEyeW = gEyePosW - pin.PosW;
+	float distToEye = length(toEyeW);
+	toEyeW /= distToEye; // normalize
+
+    // Light terms.
+    float4 ambient = gAmbientLight*diffuseAlbedo;
+
+    const float shininess = 1.0f - gRoughness;
+    Material mat = { diffuseAlbedo, gFresnelR0, shininess };
+    float3 shadowFactor = 1.0f;
+    float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
+        pin.NormalW, toEyeW, shadowFactor);
+
+    float4 litColor = ambient + directLight;
+
+#ifdef FOG
+	float fogAmount = saturate((distToEye - gFogStart) / gFogRange);
+	litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
+    // Common convention to take alpha from diffuse albedo.
+    litColor.a = diffuseAlbedo.a;
+
+    return litColor;
+}
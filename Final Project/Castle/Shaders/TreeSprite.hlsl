@@ -4,15 +4,15 @@
 
 // Defaults for number of lights.
 #ifndef NUM_DIR_LIGHTS
-    #define NUM_DIR_LIGHTS 3
+    #define NUM_DIR_LIGHTS 1
 #endif
 
 #ifndef NUM_POINT_LIGHTS
-    #define NUM_POINT_LIGHTS 0
+    #define NUM_POINT_LIGHTS 6
 #endif
 
 #ifndef NUM_SPOT_LIGHTS
-    #define NUM_SPOT_LIGHTS 0
+    #define NUM_SPOT_LIGHTS 1
 #endif
 
 // Include structures and functions for lighting.
@@ -28,13 +28,23 @@ SamplerState gsamLinearClamp      : register(s3);
 SamplerState gsamAnisotropicWrap  : register(s4);
 SamplerState gsamAnisotropicClamp : register(s5);
 
-// Constant data that varies per frame.
+// Which element of gObjectData is being drawn.
 cbuffer cbPerObject : register(b0)
 {
-    float4x4 gWorld;
-	float4x4 gTexTransform;
+	uint gObjectIndex;
 };
 
+// Per-object data, packed densely; matches ObjectConstants in FrameResource.h.
+struct ObjectData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	uint BakedOffset;
+	uint3 ObjPad;
+};
+
+StructuredBuffer<ObjectData> gObjectData : register(t1, space1);
+
 // Constant data that varies per material.
 cbuffer cbPass : register(b1)
 {
@@ -149,6 +159,10 @@ void GS(point VertexOut gin[1],
 		float2(1.0f, 0.0f)
 	};
 	
+	// The visible trees change order from frame to frame, so pick the texture from the
+	// tree's position rather than from its primitive ID.
+	uint treeID = asuint(gin[0].CenterW.x) ^ asuint(gin[0].CenterW.z);
+
 	GeoOut gout;
 	[unroll]
 	for(int i = 0; i < 4; ++i)
@@ -157,7 +171,7 @@ void GS(point VertexOut gin[1],
 		gout.PosW     = v[i].xyz;
 		gout.NormalW  = look;
 		gout.TexC     = texC[i];
-		gout.PrimID   = primID;
+		gout.PrimID   = treeID;
 		
 		triStream.Append(gout);
 	}
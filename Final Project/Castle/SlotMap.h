@@ -0,0 +1,188 @@
+//***************************************************************************************
+// SlotMap.h
+//
+// Keeps objects of one type packed together in a single array and hands out handles to
+// them that stay valid, and safe to check, however many objects come and go.
+//
+// The objects live densely in insertion order, apart from removals, which move the last
+// object into the hole, so iterating over them walks memory front to back.  A handle is a
+// slot index and a generation.  Each slot records where its object currently is in the
+// dense array and how often the slot has been reused; removing an object bumps the
+// generation, so old handles to the slot no longer resolve.  Adding, removing and looking
+// up are all O(1).
+//
+// Pointers and references to the objects are only good until the next Add() or Remove();
+// keep handles instead.
+//***************************************************************************************
+
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+struct SlotHandle
+{
+	std::uint32_t Index = ~0u;
+	std::uint32_t Generation = 0;
+
+	bool operator==(const SlotHandle& rhs)const { return Index == rhs.Index && Generation == rhs.Generation; }
+	bool operator!=(const SlotHandle& rhs)const { return !(*this == rhs); }
+	bool operator<(const SlotHandle& rhs)const { return Index < rhs.Index; }
+};
+
+// Lists of handles into a SlotMap, such as the render items drawn with one PSO, are kept
+// sorted by slot index.  A slot freed by Remove() is handed out again by the next Add(),
+// so appending would leave the list out of order; kept sorted, walking it looks up the
+// map's slots front to back.
+inline void InsertHandle(std::vector<SlotHandle>& handles, SlotHandle handle)
+{
+	handles.insert(std::lower_bound(handles.begin(), handles.end(), handle), handle);
+}
+
+// Returns false if the handle was not in the list.
+inline bool EraseHandle(std::vector<SlotHandle>& handles, SlotHandle handle)
+{
+	auto it = std::lower_bound(handles.begin(), handles.end(), handle);
+	if(it == handles.end() || *it != handle)
+		return false;
+
+	handles.erase(it);
+	return true;
+}
+
+template<typename T>
+class SlotMap
+{
+public:
+	typedef typename std::vector<T>::iterator iterator;
+	typedef typename std::vector<T>::const_iterator const_iterator;
+
+	SlotMap() = default;
+	SlotMap(const SlotMap& rhs) = delete;
+	SlotMap& operator=(const SlotMap& rhs) = delete;
+
+	void Reserve(std::size_t count)
+	{
+		mItems.reserve(count);
+		mItemSlots.reserve(count);
+		mSlots.reserve(count);
+	}
+
+	// Freed slots are reused before new ones are made, so slot indices stay below the
+	// most objects ever held at once.
+	SlotHandle Add(T item)
+	{
+		std::uint32_t slot;
+		if(mFreeHead != ~0u)
+		{
+			slot = mFreeHead;
+			mFreeHead = mSlots[slot].Next;
+		}
+		else
+		{
+			slot = (std::uint32_t)mSlots.size();
+			mSlots.push_back(Slot());
+		}
+
+		mSlots[slot].Next = (std::uint32_t)mItems.size();
+		mItems.push_back(std::move(item));
+		mItemSlots.push_back(slot);
+
+		SlotHandle handle;
+		handle.Index = slot;
+		handle.Generation = mSlots[slot].Generation;
+		return handle;
+	}
+
+	// Returns false if the handle was already stale.
+	bool Remove(SlotHandle handle)
+	{
+		if(!Contains(handle))
+			return false;
+
+		Slot& slot = mSlots[handle.Index];
+		std::uint32_t dense = slot.Next;
+		std::uint32_t last = (std::uint32_t)mItems.size() - 1;
+		if(dense != last)
+		{
+			mItems[dense] = std::move(mItems[last]);
+			mItemSlots[dense] = mItemSlots[last];
+			mSlots[mItemSlots[dense]].Next = dense;
+		}
+		mItems.pop_back();
+		mItemSlots.pop_back();
+
+		++slot.Generation;
+		slot.Next = mFreeHead;
+		mFreeHead = handle.Index;
+		return true;
+	}
+
+	bool Contains(SlotHandle handle)const
+	{
+		return handle.Index < mSlots.size() && mSlots[handle.Index].Generation == handle.Generation;
+	}
+
+	// nullptr if the handle is stale.
+	T* Get(SlotHandle handle)
+	{
+		return Contains(handle) ? &mItems[mSlots[handle.Index].Next] : nullptr;
+	}
+
+	const T* Get(SlotHandle handle)const
+	{
+		return Contains(handle) ? &mItems[mSlots[handle.Index].Next] : nullptr;
+	}
+
+	T& operator[](SlotHandle handle)
+	{
+		assert(Contains(handle));
+		return mItems[mSlots[handle.Index].Next];
+	}
+
+	const T& operator[](SlotHandle handle)const
+	{
+		assert(Contains(handle));
+		return mItems[mSlots[handle.Index].Next];
+	}
+
+	std::size_t Size()const { return mItems.size(); }
+	bool Empty()const { return mItems.empty(); }
+
+	// One more than the highest slot index handed out so far.
+	std::size_t SlotCount()const { return mSlots.size(); }
+
+	// The objects in dense order.
+	iterator begin() { return mItems.begin(); }
+	iterator end() { return mItems.end(); }
+	const_iterator begin()const { return mItems.begin(); }
+	const_iterator end()const { return mItems.end(); }
+
+	// Handle of the object at position i in dense order.
+	SlotHandle HandleAt(std::size_t i)const
+	{
+		SlotHandle handle;
+		handle.Index = mItemSlots[i];
+		handle.Generation = mSlots[handle.Index].Generation;
+		return handle;
+	}
+
+private:
+	struct Slot
+	{
+		// Where the slot's object is in mItems while the slot is in use, and the next free
+		// slot while it is not.
+		std::uint32_t Next = ~0u;
+		std::uint32_t Generation = 0;
+	};
+
+	std::vector<T> mItems;
+	std::vector<std::uint32_t> mItemSlots;
+	std::vector<Slot> mSlots;
+	std::uint32_t mFreeHead = ~0u;
+};
+
+#endif // SLOTMAP_H
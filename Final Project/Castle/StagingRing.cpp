@@ -0,0 +1,236 @@
+//***************************************************************************************
+// StagingRing.cpp
+//***************************************************************************************
+
+#include "StagingRing.h"
+#include <algorithm>
+
+using Microsoft::WRL::ComPtr;
+
+StagingRing::StagingRing(ID3D12Device* device, UINT64 capacity)
+	: mDevice(device), mRing(capacity)
+{
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(capacity),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&mBuffer)));
+
+	// Upload heaps can stay mapped for as long as they exist.
+	ThrowIfFailed(mBuffer->Map(0, nullptr, reinterpret_cast<void**>(&mMappedData)));
+}
+
+StagingRing::~StagingRing()
+{
+	if(mBuffer != nullptr)
+		mBuffer->Unmap(0, nullptr);
+
+	mMappedData = nullptr;
+}
+
+ComPtr<ID3D12Resource> StagingRing::CreateBuffer(const void* data, UINT64 byteSize,
+	D3D12_RESOURCE_STATES finalState)
+{
+	ComPtr<ID3D12Resource> buffer;
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&buffer)));
+
+	UploadBuffer(buffer.Get(), 0, data, byteSize, finalState);
+	return buffer;
+}
+
+void StagingRing::UploadBuffer(ID3D12Resource* dest, UINT64 destOffset, const void* data, UINT64 byteSize,
+	D3D12_RESOURCE_STATES finalState)
+{
+	if(byteSize == 0)
+		return;
+
+	// Buffer copies have no alignment rules, and packing uploads tightly lets copies to
+	// neighbouring ranges of one buffer merge.
+	ID3D12Resource* source = nullptr;
+	UINT64 sourceOffset = 0;
+	BYTE* dst = Allocate(byteSize, 1, source, sourceOffset);
+	CopyMemory(dst, data, (SIZE_T)byteSize);
+
+	PendingCopy copy = {};
+	copy.Dest = dest;
+	copy.DestOffset = destOffset;
+	copy.Source = source;
+	copy.SourceOffset = sourceOffset;
+	copy.ByteSize = byteSize;
+	copy.Texture = false;
+	copy.FinalState = finalState;
+	mPending.push_back(copy);
+	++mUploads;
+}
+
+void StagingRing::UploadTexture(ID3D12Resource* dest, const D3D12_SUBRESOURCE_DATA& data,
+	D3D12_RESOURCE_STATES finalState)
+{
+	D3D12_RESOURCE_DESC desc = dest->GetDesc();
+
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+	UINT numRows = 0;
+	UINT64 rowSize = 0;
+	UINT64 byteSize = 0;
+	mDevice->GetCopyableFootprints(&desc, 0, 1, 0, &footprint, &numRows, &rowSize, &byteSize);
+
+	ID3D12Resource* source = nullptr;
+	UINT64 sourceOffset = 0;
+	BYTE* dst = Allocate(byteSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, source, sourceOffset);
+
+	// The footprint's rows are padded out to D3D12_TEXTURE_DATA_PITCH_ALIGNMENT.
+	D3D12_MEMCPY_DEST memcpyDest = { dst, footprint.Footprint.RowPitch,
+		(SIZE_T)footprint.Footprint.RowPitch * numRows };
+	MemcpySubresource(&memcpyDest, &data, (SIZE_T)rowSize, numRows, footprint.Footprint.Depth);
+
+	footprint.Offset = sourceOffset;
+
+	PendingCopy copy = {};
+	copy.Dest = dest;
+	copy.Source = source;
+	copy.SourceOffset = sourceOffset;
+	copy.ByteSize = byteSize;
+	copy.Texture = true;
+	copy.Footprint = footprint;
+	copy.FinalState = finalState;
+	mPending.push_back(copy);
+	++mUploads;
+}
+
+void StagingRing::Flush(ID3D12GraphicsCommandList* cmdList, UINT64 fence)
+{
+	if(mPending.empty())
+		return;
+
+	// Copies to different resources can go in any order, so grouping them by destination
+	// lets interleaved uploads, such as a mesh's vertices then its indices, still merge.
+	// The sort is stable so copies to the same resource keep their order.
+	std::stable_sort(mPending.begin(), mPending.end(),
+		[](const PendingCopy& a, const PendingCopy& b) { return a.Dest.Get() < b.Dest.Get(); });
+
+	for(std::size_t i = 0; i < mPending.size(); )
+	{
+		const PendingCopy& first = mPending[i];
+
+		if(first.Texture)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION dst(first.Dest.Get(), 0);
+			CD3DX12_TEXTURE_COPY_LOCATION src(first.Source, first.Footprint);
+			cmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+			++mCopies;
+			++i;
+			continue;
+		}
+
+		// Extend the copy while the next one carries on where it stops, on both sides.
+		UINT64 byteSize = first.ByteSize;
+		std::size_t j = i + 1;
+		for(; j < mPending.size(); ++j)
+		{
+			const PendingCopy& next = mPending[j];
+			if(next.Texture || next.Dest != first.Dest || next.Source != first.Source ||
+				next.DestOffset != first.DestOffset + byteSize || next.SourceOffset != first.SourceOffset + byteSize)
+				break;
+
+			byteSize += next.ByteSize;
+		}
+
+		cmdList->CopyBufferRegion(first.Dest.Get(), first.DestOffset, first.Source, first.SourceOffset, byteSize);
+		++mCopies;
+		i = j;
+	}
+
+	// One transition per destination, into the state of its last upload.
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+	std::vector<ID3D12Resource*> dests;
+	for(auto it = mPending.rbegin(); it != mPending.rend(); ++it)
+	{
+		if(std::find(dests.begin(), dests.end(), it->Dest.Get()) != dests.end())
+			continue;
+
+		dests.push_back(it->Dest.Get());
+		if(it->FinalState != D3D12_RESOURCE_STATE_COPY_DEST)
+		{
+			barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(it->Dest.Get(),
+				D3D12_RESOURCE_STATE_COPY_DEST, it->FinalState));
+		}
+	}
+
+	if(!barriers.empty())
+		cmdList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+
+	mPending.clear();
+
+	mRing.Retire(fence);
+	for(Overflow& overflow : mOverflowBuffers)
+	{
+		if(overflow.Fence == 0)
+			overflow.Fence = fence;
+	}
+}
+
+void StagingRing::Reclaim(UINT64 completedFence)
+{
+	mRing.Reclaim(completedFence);
+
+	auto done = std::remove_if(mOverflowBuffers.begin(), mOverflowBuffers.end(),
+		[&](const Overflow& overflow)
+		{
+			if(overflow.Fence == 0 || overflow.Fence > completedFence)
+				return false;
+
+			mOverflowBytes -= overflow.ByteSize;
+			return true;
+		});
+	mOverflowBuffers.erase(done, mOverflowBuffers.end());
+}
+
+BYTE* StagingRing::Allocate(UINT64 byteSize, UINT64 alignment, ID3D12Resource*& source, UINT64& sourceOffset)
+{
+	UINT64 offset = mRing.Allocate(byteSize, alignment);
+	if(offset != RingAllocator::Invalid)
+	{
+		source = mBuffer.Get();
+		sourceOffset = offset;
+		UpdatePeak();
+		return mMappedData + offset;
+	}
+
+	// The ring is full or the upload is bigger than the whole ring.
+	Overflow overflow;
+	overflow.ByteSize = byteSize;
+	overflow.Fence = 0;
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&overflow.Buffer)));
+
+	// Stays mapped until it is released, as the ring does.
+	BYTE* mappedData = nullptr;
+	ThrowIfFailed(overflow.Buffer->Map(0, nullptr, reinterpret_cast<void**>(&mappedData)));
+
+	mOverflowBuffers.push_back(overflow);
+	mOverflowBytes += byteSize;
+	++mOverflows;
+	UpdatePeak();
+
+	source = overflow.Buffer.Get();
+	sourceOffset = 0;
+	return mappedData;
+}
+
+void StagingRing::UpdatePeak()
+{
+	mPeakBytes = std::max(mPeakBytes, mRing.Used() + mOverflowBytes);
+}
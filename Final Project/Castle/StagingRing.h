@@ -0,0 +1,105 @@
+//***************************************************************************************
+// StagingRing.h
+//
+// Uploads static buffer and texture data through one persistently mapped upload heap.
+//
+// Upload calls copy the data into the ring straight away and queue the GPU copy.
+// Flush() records all queued copies at once, grouped by destination: copies that
+// continue one another in both the ring and the destination are merged into a single
+// CopyBufferRegion, and one barrier call then moves every destination to the state it
+// will be read in.  Destinations are expected to start out in the common state, which
+// the copies promote to COPY_DEST.
+//
+// Ring space is freed by Reclaim() once the fence passed to Flush() has completed.  An
+// upload that does not fit gets an upload buffer of its own, freed the same way.
+//***************************************************************************************
+
+#ifndef STAGINGRING_H
+#define STAGINGRING_H
+
+#include "../../Common/d3dUtil.h"
+#include "RingAllocator.h"
+#include <vector>
+
+class StagingRing
+{
+public:
+	StagingRing(ID3D12Device* device, UINT64 capacity);
+	StagingRing(const StagingRing& rhs) = delete;
+	StagingRing& operator=(const StagingRing& rhs) = delete;
+	~StagingRing();
+
+	// Creates a default heap buffer and queues data to be copied into it.
+	Microsoft::WRL::ComPtr<ID3D12Resource> CreateBuffer(const void* data, UINT64 byteSize,
+		D3D12_RESOURCE_STATES finalState = D3D12_RESOURCE_STATE_GENERIC_READ);
+
+	// Queues data to be copied to dest at destOffset.
+	void UploadBuffer(ID3D12Resource* dest, UINT64 destOffset, const void* data, UINT64 byteSize,
+		D3D12_RESOURCE_STATES finalState = D3D12_RESOURCE_STATE_GENERIC_READ);
+
+	// Queues data to be copied to subresource 0 of a texture with one mip level.
+	void UploadTexture(ID3D12Resource* dest, const D3D12_SUBRESOURCE_DATA& data,
+		D3D12_RESOURCE_STATES finalState);
+
+	// Records the queued copies on cmdList.  fence is the value the queue signals once
+	// cmdList has executed.
+	void Flush(ID3D12GraphicsCommandList* cmdList, UINT64 fence);
+
+	// Frees the staging memory of every flush whose fence is at most completedFence.
+	void Reclaim(UINT64 completedFence);
+
+	UINT64 Capacity()const { return mRing.Capacity(); }
+
+	// Most staging memory in use at once, in the ring and in overflow buffers.
+	UINT64 PeakBytes()const { return mPeakBytes; }
+
+	UINT Uploads()const { return mUploads; }
+	UINT Copies()const { return mCopies; }
+	UINT Overflows()const { return mOverflows; }
+
+private:
+	struct PendingCopy
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Dest;
+		UINT64 DestOffset;
+		ID3D12Resource* Source;
+		UINT64 SourceOffset;
+		UINT64 ByteSize;
+
+		// Only for textures; Footprint.Offset is the offset in Source.
+		bool Texture;
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT Footprint;
+
+		D3D12_RESOURCE_STATES FinalState;
+	};
+
+	struct Overflow
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Buffer;
+		UINT64 ByteSize;
+		UINT64 Fence;
+	};
+
+	// Finds room for byteSize bytes and returns where to write them.
+	BYTE* Allocate(UINT64 byteSize, UINT64 alignment, ID3D12Resource*& source, UINT64& sourceOffset);
+
+	void UpdatePeak();
+
+	Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mBuffer;
+	BYTE* mMappedData = nullptr;
+	RingAllocator mRing;
+
+	std::vector<PendingCopy> mPending;
+
+	// Overflow buffers not yet flushed have a fence of 0.
+	std::vector<Overflow> mOverflowBuffers;
+	UINT64 mOverflowBytes = 0;
+
+	UINT64 mPeakBytes = 0;
+	UINT mUploads = 0;
+	UINT mCopies = 0;
+	UINT mOverflows = 0;
+};
+
+#endif // STAGINGRING_H
@@ -0,0 +1,238 @@
+//***************************************************************************************
+// TaskGraph.cpp
+//***************************************************************************************
+
+#include "TaskGraph.h"
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <sstream>
+
+TaskGraph::TaskId TaskGraph::Add(const std::string& name, std::function<void()> work,
+	std::initializer_list<TaskId> dependencies, bool mainThread)
+{
+	return AddTask(name, std::move(work), std::vector<TaskId>(dependencies), mainThread);
+}
+
+TaskGraph::TaskId TaskGraph::AddWithAccess(const std::string& name, std::function<void()> work,
+	std::initializer_list<const char*> reads, std::initializer_list<const char*> writes, bool mainThread)
+{
+	TaskId id = (TaskId)mTasks.size();
+	std::vector<TaskId> dependencies;
+	auto dependOn = [&](TaskId task)
+	{
+		if(task != ~0u && std::find(dependencies.begin(), dependencies.end(), task) == dependencies.end())
+			dependencies.push_back(task);
+	};
+
+	// Read after write.
+	for(const char* read : reads)
+		dependOn(mAccess[read].Writer);
+
+	// Write after write and write after read.
+	for(const char* write : writes)
+	{
+		Access& access = mAccess[write];
+		dependOn(access.Writer);
+		for(TaskId reader : access.Readers)
+			dependOn(reader);
+	}
+
+	for(const char* read : reads)
+		mAccess[read].Readers.push_back(id);
+	for(const char* write : writes)
+	{
+		Access& access = mAccess[write];
+		access.Writer = id;
+		access.Readers.clear();
+	}
+
+	return AddTask(name, std::move(work), dependencies, mainThread);
+}
+
+TaskGraph::TaskId TaskGraph::AddTask(const std::string& name, std::function<void()> work,
+	const std::vector<TaskId>& dependencies, bool mainThread)
+{
+	TaskId id = (TaskId)mTasks.size();
+
+	Task task;
+	task.Name = name;
+	task.Work = std::move(work);
+	task.MainThread = mainThread;
+	for(TaskId dependency : dependencies)
+	{
+		assert(dependency < id);
+		task.Dependencies.push_back(dependency);
+		mTasks[dependency].Dependents.push_back(id);
+	}
+
+	mTasks.push_back(std::move(task));
+	return id;
+}
+
+void TaskGraph::Run()
+{
+	mStart = Clock::now();
+	if(mTasks.empty())
+	{
+		mTotalMs = 0.0;
+		return;
+	}
+
+	mWaitingOn.reset(new std::atomic<std::uint32_t>[mTasks.size()]);
+	for(std::size_t i = 0; i < mTasks.size(); ++i)
+	{
+		mWaitingOn[i] = (std::uint32_t)mTasks[i].Dependencies.size();
+		mTasks[i].StartMs = mTasks[i].EndMs = 0.0;
+	}
+	mUnfinished = mTasks.size();
+	mFailed = false;
+	mException = nullptr;
+	mMainThreadQueue.clear();
+
+	concurrency::task_group group;
+	mGroup = &group;
+
+	for(TaskId i = 0; i < (TaskId)mTasks.size(); ++i)
+	{
+		if(mTasks[i].Dependencies.empty())
+			Launch(i);
+	}
+
+	// Run main thread tasks as they become ready until everything is done.
+	for(;;)
+	{
+		TaskId task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this]() { return !mMainThreadQueue.empty() || mUnfinished == 0 || mFailed; });
+			if(mMainThreadQueue.empty() || mFailed)
+				break;
+
+			task = mMainThreadQueue.front();
+			mMainThreadQueue.erase(mMainThreadQueue.begin());
+		}
+
+		Execute(task);
+	}
+
+	// A failed graph stops launching tasks, but the running ones have to finish before
+	// the group goes out of scope.
+	group.wait();
+	mGroup = nullptr;
+
+	mTotalMs = std::chrono::duration<double, std::milli>(Clock::now() - mStart).count();
+
+	if(mException)
+		std::rethrow_exception(mException);
+}
+
+void TaskGraph::Launch(TaskId task)
+{
+	if(mTasks[task].MainThread)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mMainThreadQueue.push_back(task);
+		mWake.notify_one();
+		return;
+	}
+
+	mGroup->run([this, task]() { Execute(task); });
+}
+
+void TaskGraph::Execute(TaskId task)
+{
+	Task& t = mTasks[task];
+	t.StartMs = std::chrono::duration<double, std::milli>(Clock::now() - mStart).count();
+
+	try
+	{
+		t.Work();
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(!mFailed)
+			mException = std::current_exception();
+		mFailed = true;
+		mWake.notify_one();
+	}
+
+	t.EndMs = std::chrono::duration<double, std::milli>(Clock::now() - mStart).count();
+
+	if(mFailed)
+		return;
+
+	for(TaskId dependent : t.Dependents)
+	{
+		if(--mWaitingOn[dependent] == 0)
+			Launch(dependent);
+	}
+
+	// Take the lock so the wake-up can't slip in between the calling thread's check and
+	// its wait.
+	if(--mUnfinished == 0)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWake.notify_one();
+	}
+}
+
+std::vector<TaskGraph::TaskId> TaskGraph::CriticalPath()const
+{
+	// Tasks only depend on earlier ones, so one pass in order sees every dependency first.
+	std::vector<double> finish(mTasks.size(), 0.0);
+	std::vector<TaskId> previous(mTasks.size(), ~0u);
+	for(std::size_t i = 0; i < mTasks.size(); ++i)
+	{
+		double start = 0.0;
+		for(TaskId dependency : mTasks[i].Dependencies)
+		{
+			if(finish[dependency] > start)
+			{
+				start = finish[dependency];
+				previous[i] = dependency;
+			}
+		}
+
+		finish[i] = start + (mTasks[i].EndMs - mTasks[i].StartMs);
+	}
+
+	std::vector<TaskId> path;
+	if(mTasks.empty())
+		return path;
+
+	TaskId last = (TaskId)(std::max_element(finish.begin(), finish.end()) - finish.begin());
+	for(TaskId task = last; task != ~0u; task = previous[task])
+		path.push_back(task);
+	std::reverse(path.begin(), path.end());
+	return path;
+}
+
+double TaskGraph::CriticalPathMs()const
+{
+	double ms = 0.0;
+	for(TaskId task : CriticalPath())
+		ms += mTasks[task].EndMs - mTasks[task].StartMs;
+	return ms;
+}
+
+std::string TaskGraph::Report(const std::string& title)const
+{
+	std::vector<TaskId> path = CriticalPath();
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2);
+	out << title << ": " << mTotalMs << " ms, critical path " << CriticalPathMs() << " ms\n";
+
+	for(std::size_t i = 0; i < mTasks.size(); ++i)
+	{
+		const Task& t = mTasks[i];
+		bool critical = std::find(path.begin(), path.end(), (TaskId)i) != path.end();
+		out << (critical ? "* " : "  ") << std::left << std::setw(28) << t.Name << std::right
+			<< std::setw(9) << t.StartMs << " -> " << std::setw(9) << t.EndMs << " ms  ("
+			<< (t.EndMs - t.StartMs) << " ms)\n";
+	}
+
+	return out.str();
+}
@@ -0,0 +1,118 @@
+//***************************************************************************************
+// TaskGraph.h
+//
+// Runs a set of tasks with declared dependencies, each as soon as everything it depends
+// on has finished.
+//
+// Tasks run on the concurrency runtime's worker threads, except those added with
+// mainThread set, which run on the thread that called Run().  That is for work which has
+// to stay on one thread, such as recording into a command list or drawing from the
+// calling thread's random stream.  A task may only depend on tasks added before it, so
+// the graph cannot have cycles.
+//
+// Instead of listing dependencies, AddWithAccess() takes the names of the data a task
+// reads and writes, and makes it wait for the earlier tasks that write what it reads or
+// touch what it writes.  Tasks are then ordered as they were added wherever their data
+// overlaps and free to run side by side everywhere else.
+//
+// Run() returns once every task has finished, and rethrows the first exception a task
+// threw after waiting for the tasks already running.  Each task's start and end time are
+// kept until the next Run() for Report() and CriticalPathMs().
+//***************************************************************************************
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <ppl.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TaskGraph
+{
+public:
+	typedef std::uint32_t TaskId;
+
+	TaskGraph() = default;
+	TaskGraph(const TaskGraph& rhs) = delete;
+	TaskGraph& operator=(const TaskGraph& rhs) = delete;
+
+	TaskId Add(const std::string& name, std::function<void()> work,
+		std::initializer_list<TaskId> dependencies = {}, bool mainThread = false);
+	TaskId AddWithAccess(const std::string& name, std::function<void()> work,
+		std::initializer_list<const char*> reads, std::initializer_list<const char*> writes,
+		bool mainThread = false);
+
+	void Run();
+
+	std::size_t TaskCount()const { return mTasks.size(); }
+	const std::string& Name(TaskId task)const { return mTasks[task].Name; }
+
+	// Times of the last Run(), in milliseconds from its start.
+	double StartMs(TaskId task)const { return mTasks[task].StartMs; }
+	double EndMs(TaskId task)const { return mTasks[task].EndMs; }
+	double TotalMs()const { return mTotalMs; }
+
+	// The longest chain of dependent tasks in the last Run(), by how long each took.  No
+	// number of threads can finish the graph sooner.
+	double CriticalPathMs()const;
+	std::vector<TaskId> CriticalPath()const;
+
+	// One line per task with its start, end and duration, and the critical path.
+	std::string Report(const std::string& title)const;
+
+private:
+	struct Task
+	{
+		std::string Name;
+		std::function<void()> Work;
+		std::vector<TaskId> Dependencies;
+		std::vector<TaskId> Dependents;
+		bool MainThread = false;
+
+		double StartMs = 0.0;
+		double EndMs = 0.0;
+	};
+
+	// The tasks added with AddWithAccess() that last used a piece of data.
+	struct Access
+	{
+		TaskId Writer = ~0u;
+		std::vector<TaskId> Readers;
+	};
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	TaskId AddTask(const std::string& name, std::function<void()> work,
+		const std::vector<TaskId>& dependencies, bool mainThread);
+
+	// Queues task to run, on a worker or for the calling thread.
+	void Launch(TaskId task);
+	void Execute(TaskId task);
+
+	std::vector<Task> mTasks;
+	std::unordered_map<std::string, Access> mAccess;
+	double mTotalMs = 0.0;
+
+	// State of the Run() in progress.
+	Clock::time_point mStart;
+	std::unique_ptr<std::atomic<std::uint32_t>[]> mWaitingOn;
+	std::atomic<std::size_t> mUnfinished;
+	std::atomic<bool> mFailed;
+	std::exception_ptr mException;
+	std::vector<TaskId> mMainThreadQueue;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	concurrency::task_group* mGroup = nullptr;
+};
+
+#endif // TASKGRAPH_H
@@ -0,0 +1,366 @@
+//***************************************************************************************
+// Terrain.cpp
+//***************************************************************************************
+
+#include "Terrain.h"
+#include "../../Common/MathHelper.h"
+#include <fstream>
+#include <cmath>
+#include <cfloat>
+
+using namespace DirectX;
+
+Terrain::Terrain(const TerrainDesc& desc)
+	: mDesc(desc)
+{
+	mDesc.HeightmapWidth = MathHelper::Max(mDesc.HeightmapWidth, 2u);
+	mDesc.HeightmapHeight = MathHelper::Max(mDesc.HeightmapHeight, 2u);
+	mDesc.PatchSize = MathHelper::Max(mDesc.PatchSize, 2u);
+	mDesc.LodCount = MathHelper::Max(mDesc.LodCount, 1u);
+
+	mHeightmapLoaded = LoadHeightmap();
+	if(!mHeightmapLoaded)
+		mHeights.assign((size_t)mDesc.HeightmapWidth*mDesc.HeightmapHeight, 0);
+
+	// Distance ranges of the LOD levels.
+	mLodRanges.resize(mDesc.LodCount);
+	float range = mDesc.FirstLodDistance;
+	for(std::uint32_t i = 0; i < mDesc.LodCount; ++i)
+	{
+		mLodRanges[i] = range;
+		range *= mDesc.LodDistanceRatio;
+	}
+
+	// Cover the terrain with a grid of quadtree roots.
+	const float rootSize = mDesc.LeafNodeSize * (float)(1u << (mDesc.LodCount - 1));
+	const int rootsX = MathHelper::Max(1, (int)ceilf(mDesc.Width / rootSize));
+	const int rootsZ = MathHelper::Max(1, (int)ceilf(mDesc.Depth / rootSize));
+
+	for(int j = 0; j < rootsZ; ++j)
+	{
+		for(int i = 0; i < rootsX; ++i)
+		{
+			int root = (int)mNodes.size();
+			mNodes.push_back(Node());
+			BuildNode(root, mDesc.MinX + i*rootSize, mDesc.MinZ + j*rootSize, rootSize, mDesc.LodCount - 1);
+			mRoots.push_back(root);
+		}
+	}
+}
+
+bool Terrain::LoadHeightmap()
+{
+	if(mDesc.HeightmapFilename.empty())
+		return false;
+
+	std::ifstream fin(mDesc.HeightmapFilename, std::ios::binary);
+	if(!fin)
+		return false;
+
+	mHeights.resize((size_t)mDesc.HeightmapWidth*mDesc.HeightmapHeight);
+	fin.read((char*)mHeights.data(), mHeights.size()*sizeof(std::uint16_t));
+
+	if((size_t)fin.gcount() != mHeights.size()*sizeof(std::uint16_t))
+	{
+		mHeights.clear();
+		return false;
+	}
+
+	return true;
+}
+
+float Terrain::SampleHeight(int x, int z)const
+{
+	x = MathHelper::Clamp(x, 0, (int)mDesc.HeightmapWidth - 1);
+	z = MathHelper::Clamp(z, 0, (int)mDesc.HeightmapHeight - 1);
+
+	return mDesc.HeightOffset +
+		mDesc.HeightScale * (mHeights[(size_t)z*mDesc.HeightmapWidth + x] / 65535.0f);
+}
+
+float Terrain::GetHeight(float x, float z)const
+{
+	// Transform from world space to heightmap samples.
+	float u = (x - mDesc.MinX) / mDesc.Width * (mDesc.HeightmapWidth - 1);
+	float v = (z - mDesc.MinZ) / mDesc.Depth * (mDesc.HeightmapHeight - 1);
+	u = MathHelper::Clamp(u, 0.0f, (float)(mDesc.HeightmapWidth - 1));
+	v = MathHelper::Clamp(v, 0.0f, (float)(mDesc.HeightmapHeight - 1));
+
+	int x0 = (int)u;
+	int z0 = (int)v;
+	float s = u - x0;
+	float t = v - z0;
+
+	// A B
+	// C D
+	float A = SampleHeight(x0, z0);
+	float B = SampleHeight(x0 + 1, z0);
+	float C = SampleHeight(x0, z0 + 1);
+	float D = SampleHeight(x0 + 1, z0 + 1);
+
+	return MathHelper::Lerp(MathHelper::Lerp(A, B, s), MathHelper::Lerp(C, D, s), t);
+}
+
+XMFLOAT3 Terrain::GetNormal(float x, float z)const
+{
+	// Central differences one heightmap sample apart.
+	float dx = mDesc.Width / (mDesc.HeightmapWidth - 1);
+	float dz = mDesc.Depth / (mDesc.HeightmapHeight - 1);
+
+	float dhdx = (GetHeight(x + dx, z) - GetHeight(x - dx, z)) / (2.0f*dx);
+	float dhdz = (GetHeight(x, z + dz) - GetHeight(x, z - dz)) / (2.0f*dz);
+
+	XMFLOAT3 n(-dhdx, 1.0f, -dhdz);
+	XMVECTOR unitNormal = XMVector3Normalize(XMLoadFloat3(&n));
+	XMStoreFloat3(&n, unitNormal);
+
+	return n;
+}
+
+XMVECTOR Terrain::SampleHeight4(FXMVECTOR x, FXMVECTOR z)const
+{
+	// Same filtering as GetHeight, for four points at once.
+	const float maxU = (float)(mDesc.HeightmapWidth - 1);
+	const float maxV = (float)(mDesc.HeightmapHeight - 1);
+
+	XMVECTOR u = XMVectorMultiply(XMVectorSubtract(x, XMVectorReplicate(mDesc.MinX)),
+		XMVectorReplicate(maxU / mDesc.Width));
+	XMVECTOR v = XMVectorMultiply(XMVectorSubtract(z, XMVectorReplicate(mDesc.MinZ)),
+		XMVectorReplicate(maxV / mDesc.Depth));
+	u = XMVectorClamp(u, XMVectorZero(), XMVectorReplicate(maxU));
+	v = XMVectorClamp(v, XMVectorZero(), XMVectorReplicate(maxV));
+
+	// Keep the top left sample one away from the far edges so its neighbours are always
+	// in the heightmap; a point on the edge then has s or t equal to 1.
+	XMVECTOR x0 = XMVectorMin(XMVectorFloor(u), XMVectorReplicate(maxU - 1.0f));
+	XMVECTOR z0 = XMVectorMin(XMVectorFloor(v), XMVectorReplicate(maxV - 1.0f));
+	XMVECTOR s = XMVectorSubtract(u, x0);
+	XMVECTOR t = XMVectorSubtract(v, z0);
+
+	// Index of the top left sample, exact in floating point for any sensible heightmap.
+	XMFLOAT4A index;
+	XMStoreFloat4A(&index, XMVectorMultiplyAdd(z0, XMVectorReplicate((float)mDesc.HeightmapWidth), x0));
+
+	// There is no gather in SSE, so fetch the four corners one point at a time.
+	XMFLOAT4A A, B, C, D;
+	float* corners[4] = { &A.x, &B.x, &C.x, &D.x };
+	const std::uint16_t* heights = mHeights.data();
+	const std::size_t w = mDesc.HeightmapWidth;
+	const float* indices = &index.x;
+	for(int i = 0; i < 4; ++i)
+	{
+		const std::uint16_t* h = heights + (std::size_t)indices[i];
+		corners[0][i] = h[0];
+		corners[1][i] = h[1];
+		corners[2][i] = h[w];
+		corners[3][i] = h[w + 1];
+	}
+
+	XMVECTOR top = XMVectorLerpV(XMLoadFloat4A(&A), XMLoadFloat4A(&B), s);
+	XMVECTOR bottom = XMVectorLerpV(XMLoadFloat4A(&C), XMLoadFloat4A(&D), s);
+	XMVECTOR h = XMVectorLerpV(top, bottom, t);
+
+	return XMVectorMultiplyAdd(h, XMVectorReplicate(mDesc.HeightScale / 65535.0f),
+		XMVectorReplicate(mDesc.HeightOffset));
+}
+
+void Terrain::SampleHeightsBlock(const XMFLOAT2* xz, float* heights, std::size_t count)const
+{
+	for(std::size_t i = 0; i < count; i += 4)
+	{
+		XMVECTOR x, z;
+		LoadXZ4(xz + i, x, z);
+
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(heights + i), SampleHeight4(x, z));
+	}
+}
+
+void Terrain::SampleNormalsBlock(const XMFLOAT2* xz, XMFLOAT3* normals, std::size_t count)const
+{
+	// Central differences one heightmap sample apart, as in GetNormal.
+	const float dx = mDesc.Width / (mDesc.HeightmapWidth - 1);
+	const float dz = mDesc.Depth / (mDesc.HeightmapHeight - 1);
+	const XMVECTOR vdx = XMVectorReplicate(dx);
+	const XMVECTOR vdz = XMVectorReplicate(dz);
+	const XMVECTOR one = XMVectorSplatOne();
+
+	for(std::size_t i = 0; i < count; i += 4)
+	{
+		XMVECTOR x, z;
+		LoadXZ4(xz + i, x, z);
+
+		XMVECTOR hL = SampleHeight4(XMVectorSubtract(x, vdx), z);
+		XMVECTOR hR = SampleHeight4(XMVectorAdd(x, vdx), z);
+		XMVECTOR hD = SampleHeight4(x, XMVectorSubtract(z, vdz));
+		XMVECTOR hU = SampleHeight4(x, XMVectorAdd(z, vdz));
+
+		// -dh/dx and -dh/dz.
+		XMVECTOR nx = XMVectorMultiply(XMVectorSubtract(hL, hR), XMVectorReplicate(0.5f / dx));
+		XMVECTOR nz = XMVectorMultiply(XMVectorSubtract(hD, hU), XMVectorReplicate(0.5f / dz));
+
+		XMVECTOR invLength = XMVectorReciprocalSqrt(
+			XMVectorMultiplyAdd(nx, nx, XMVectorMultiplyAdd(nz, nz, one)));
+
+		StoreNormals4(normals + i, XMVectorMultiply(nx, invLength), invLength,
+			XMVectorMultiply(nz, invLength));
+	}
+}
+
+void Terrain::ComputeHeightRange(float minX, float minZ, float size, float& minY, float& maxY)const
+{
+	// All samples under the node, including the ones on its far edges.
+	int x0 = (int)floorf((minX - mDesc.MinX) / mDesc.Width * (mDesc.HeightmapWidth - 1));
+	int z0 = (int)floorf((minZ - mDesc.MinZ) / mDesc.Depth * (mDesc.HeightmapHeight - 1));
+	int x1 = (int)ceilf((minX + size - mDesc.MinX) / mDesc.Width * (mDesc.HeightmapWidth - 1));
+	int z1 = (int)ceilf((minZ + size - mDesc.MinZ) / mDesc.Depth * (mDesc.HeightmapHeight - 1));
+
+	x0 = MathHelper::Clamp(x0, 0, (int)mDesc.HeightmapWidth - 1);
+	z0 = MathHelper::Clamp(z0, 0, (int)mDesc.HeightmapHeight - 1);
+	x1 = MathHelper::Clamp(x1, 0, (int)mDesc.HeightmapWidth - 1);
+	z1 = MathHelper::Clamp(z1, 0, (int)mDesc.HeightmapHeight - 1);
+
+	std::uint16_t lo = 0xffff;
+	std::uint16_t hi = 0;
+	for(int z = z0; z <= z1; ++z)
+	{
+		const std::uint16_t* row = &mHeights[(size_t)z*mDesc.HeightmapWidth];
+		for(int x = x0; x <= x1; ++x)
+		{
+			lo = MathHelper::Min(lo, row[x]);
+			hi = MathHelper::Max(hi, row[x]);
+		}
+	}
+
+	minY = mDesc.HeightOffset + mDesc.HeightScale*(lo / 65535.0f);
+	maxY = mDesc.HeightOffset + mDesc.HeightScale*(hi / 65535.0f);
+}
+
+void Terrain::BuildNode(int index, float minX, float minZ, float size, std::uint32_t lod)
+{
+	Node node;
+	node.MinX = minX;
+	node.MinZ = minZ;
+	node.Size = size;
+	node.Lod = lod;
+	node.FirstChild = -1;
+
+	if(lod == 0)
+	{
+		ComputeHeightRange(minX, minZ, size, node.MinY, node.MaxY);
+	}
+	else
+	{
+		// The children are stored next to each other so one index finds all four.
+		float half = 0.5f*size;
+		node.FirstChild = (int)mNodes.size();
+		mNodes.resize(mNodes.size() + 4);
+
+		node.MinY = FLT_MAX;
+		node.MaxY = -FLT_MAX;
+		for(int i = 0; i < 4; ++i)
+		{
+			BuildNode(node.FirstChild + i, minX + (i & 1)*half, minZ + (i >> 1)*half, half, lod - 1);
+
+			node.MinY = MathHelper::Min(node.MinY, mNodes[node.FirstChild + i].MinY);
+			node.MaxY = MathHelper::Max(node.MaxY, mNodes[node.FirstChild + i].MaxY);
+		}
+	}
+
+	mNodes[index] = node;
+}
+
+BoundingBox Terrain::NodeBounds(float minX, float minZ, float size, float minY, float maxY)
+{
+	BoundingBox box;
+	box.Center = XMFLOAT3(minX + 0.5f*size, 0.5f*(minY + maxY), minZ + 0.5f*size);
+	box.Extents = XMFLOAT3(0.5f*size, MathHelper::Max(0.5f*(maxY - minY), 0.01f), 0.5f*size);
+	return box;
+}
+
+bool Terrain::IntersectsSphere(const BoundingBox& box, const XMFLOAT3& center, float radius)
+{
+	float dx = MathHelper::Max(fabsf(center.x - box.Center.x) - box.Extents.x, 0.0f);
+	float dy = MathHelper::Max(fabsf(center.y - box.Center.y) - box.Extents.y, 0.0f);
+	float dz = MathHelper::Max(fabsf(center.z - box.Center.z) - box.Extents.z, 0.0f);
+
+	return dx*dx + dy*dy + dz*dz <= radius*radius;
+}
+
+void Terrain::AddNode(const Node& node, float minX, float minZ, float size, std::vector<TerrainNode>& nodes)const
+{
+	TerrainNode n;
+	n.MinX = minX;
+	n.MinZ = minZ;
+	n.Size = size;
+	n.Lod = node.Lod;
+
+	// The coarsest level has nothing to morph into.
+	if(node.Lod + 1 == mDesc.LodCount)
+	{
+		n.MorphStart = FLT_MAX;
+		n.MorphEnd = FLT_MAX;
+	}
+	else
+	{
+		float prevRange = node.Lod > 0 ? mLodRanges[node.Lod - 1] : 0.0f;
+		n.MorphEnd = mLodRanges[node.Lod];
+		n.MorphStart = MathHelper::Lerp(prevRange, n.MorphEnd, mDesc.MorphStartRatio);
+	}
+
+	nodes.push_back(n);
+}
+
+bool Terrain::SelectNode(int index, const XMFLOAT3& eyePos, const BoundingFrustum& frustumW,
+	std::vector<TerrainNode>& nodes)const
+{
+	const Node& node = mNodes[index];
+	BoundingBox box = NodeBounds(node.MinX, node.MinZ, node.Size, node.MinY, node.MaxY);
+
+	// Out of this level's range; the parent covers the area at its own level.
+	if(!IntersectsSphere(box, eyePos, mLodRanges[node.Lod]))
+		return false;
+
+	// Not visible, but the area is handled.
+	if(frustumW.Contains(box) == DISJOINT)
+		return true;
+
+	if(node.FirstChild < 0 || !IntersectsSphere(box, eyePos, mLodRanges[node.Lod - 1]))
+	{
+		AddNode(node, node.MinX, node.MinZ, node.Size, nodes);
+		return true;
+	}
+
+	// Children in range of the finer level select themselves; the parent draws the
+	// quadrants of the others at its own level.
+	const float half = 0.5f*node.Size;
+	for(int i = 0; i < 4; ++i)
+	{
+		if(!SelectNode(node.FirstChild + i, eyePos, frustumW, nodes))
+		{
+			const Node& child = mNodes[node.FirstChild + i];
+			BoundingBox childBox = NodeBounds(child.MinX, child.MinZ, half, child.MinY, child.MaxY);
+			if(frustumW.Contains(childBox) != DISJOINT)
+				AddNode(node, child.MinX, child.MinZ, half, nodes);
+		}
+	}
+
+	return true;
+}
+
+void Terrain::Select(const XMFLOAT3& eyePos, const BoundingFrustum& frustumW,
+	std::vector<TerrainNode>& nodes)const
+{
+	nodes.clear();
+
+	for(int root : mRoots)
+	{
+		// Roots beyond the coarsest range are still drawn at that level.
+		if(!SelectNode(root, eyePos, frustumW, nodes))
+		{
+			const Node& node = mNodes[root];
+			BoundingBox box = NodeBounds(node.MinX, node.MinZ, node.Size, node.MinY, node.MaxY);
+			if(frustumW.Contains(box) != DISJOINT)
+				AddNode(node, node.MinX, node.MinZ, node.Size, nodes);
+		}
+	}
+}
@@ -0,0 +1,141 @@
+//***************************************************************************************
+// Terrain.h
+//
+// Heightmap terrain drawn with continuous distance-dependent LOD (CDLOD).
+//
+// The heightmap is a 16-bit RAW file.  The terrain is covered by a grid of quadtree
+// roots; every node of every tree is drawn with the same patch mesh, placed and scaled
+// in the vertex shader, so the size of the terrain is not limited by an index buffer.
+// Each frame Select() walks the quadtrees and picks the nodes to draw together with the
+// distance range over which their vertices morph into the next coarser level.
+//
+// The terrain is also a HeightField, so heights and normals can be queried in batches.
+//***************************************************************************************
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include "HeightField.h"
+
+struct TerrainDesc
+{
+	// 16-bit little-endian RAW heightmap, row 0 at MinZ.  If the file cannot be read the
+	// terrain is flat at HeightOffset.
+	std::wstring HeightmapFilename;
+	std::uint32_t HeightmapWidth = 257;
+	std::uint32_t HeightmapHeight = 257;
+
+	// World space extents of the terrain in the xz-plane.
+	float MinX = 0.0f;
+	float MinZ = 0.0f;
+	float Width = 512.0f;
+	float Depth = 512.0f;
+
+	// A heightmap value of 65535 maps to HeightOffset + HeightScale.
+	float HeightScale = 64.0f;
+	float HeightOffset = 0.0f;
+
+	// Number of quads along each side of the patch mesh every node is drawn with.
+	std::uint32_t PatchSize = 16;
+
+	// Number of LOD levels, so the quadtrees are LodCount levels deep.  The leaf nodes
+	// are LeafNodeSize wide and the roots LeafNodeSize*2^(LodCount-1).
+	std::uint32_t LodCount = 5;
+	float LeafNodeSize = 16.0f;
+
+	// Level 0 is drawn up to FirstLodDistance from the eye and every further level
+	// reaches LodDistanceRatio times further.
+	float FirstLodDistance = 40.0f;
+	float LodDistanceRatio = 2.0f;
+
+	// Vertices start morphing into the next level at this fraction of the way through
+	// their level's range.
+	float MorphStartRatio = 0.7f;
+};
+
+struct TerrainNode
+{
+	float MinX;
+	float MinZ;
+	float Size;
+	std::uint32_t Lod;
+
+	// Distances from the eye over which the node's vertices morph into the next level.
+	float MorphStart;
+	float MorphEnd;
+};
+
+class Terrain : public HeightField
+{
+public:
+	Terrain(const TerrainDesc& desc);
+	Terrain(const Terrain& rhs) = delete;
+	Terrain& operator=(const Terrain& rhs) = delete;
+
+	// Bilinearly filtered height and normal.  Points outside the terrain are clamped to
+	// its edge.
+	float GetHeight(float x, float z)const;
+	DirectX::XMFLOAT3 GetNormal(float x, float z)const;
+
+	// Picks the nodes to draw this frame.  frustumW is in world space.
+	void Select(const DirectX::XMFLOAT3& eyePos, const DirectX::BoundingFrustum& frustumW,
+		std::vector<TerrainNode>& nodes)const;
+
+	bool HeightmapLoaded()const { return mHeightmapLoaded; }
+	const TerrainDesc& Desc()const { return mDesc; }
+
+	// Raw heightmap samples, row by row starting at MinZ.
+	const std::vector<std::uint16_t>& Heights()const { return mHeights; }
+	std::uint32_t HeightmapWidth()const { return mDesc.HeightmapWidth; }
+	std::uint32_t HeightmapHeight()const { return mDesc.HeightmapHeight; }
+
+	float LodRange(std::uint32_t lod)const { return mLodRanges[lod]; }
+
+protected:
+	void SampleHeightsBlock(const DirectX::XMFLOAT2* xz, float* heights, std::size_t count)const override;
+	void SampleNormalsBlock(const DirectX::XMFLOAT2* xz, DirectX::XMFLOAT3* normals, std::size_t count)const override;
+
+private:
+	struct Node
+	{
+		float MinX;
+		float MinZ;
+		float Size;
+		float MinY;
+		float MaxY;
+		std::uint32_t Lod;
+
+		// Index of the first of the four children, or -1 for a leaf.
+		int FirstChild;
+	};
+
+	bool LoadHeightmap();
+	float SampleHeight(int x, int z)const;
+	DirectX::XMVECTOR SampleHeight4(DirectX::FXMVECTOR x, DirectX::FXMVECTOR z)const;
+	void BuildNode(int index, float minX, float minZ, float size, std::uint32_t lod);
+	void ComputeHeightRange(float minX, float minZ, float size, float& minY, float& maxY)const;
+
+	bool SelectNode(int index, const DirectX::XMFLOAT3& eyePos, const DirectX::BoundingFrustum& frustumW,
+		std::vector<TerrainNode>& nodes)const;
+	void AddNode(const Node& node, float minX, float minZ, float size, std::vector<TerrainNode>& nodes)const;
+
+	static DirectX::BoundingBox NodeBounds(float minX, float minZ, float size, float minY, float maxY);
+	static bool IntersectsSphere(const DirectX::BoundingBox& box, const DirectX::XMFLOAT3& center, float radius);
+
+	TerrainDesc mDesc;
+	bool mHeightmapLoaded = false;
+
+	std::vector<std::uint16_t> mHeights;
+
+	std::vector<Node> mNodes;
+	std::vector<int> mRoots;
+
+	std::vector<float> mLodRanges;
+};
+
+#endif // TERRAIN_H
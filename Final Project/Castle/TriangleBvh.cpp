@@ -0,0 +1,560 @@
+//***************************************************************************************
+// TriangleBvh.cpp
+//***************************************************************************************
+
+#include "TriangleBvh.h"
+#include "../../Common/MathHelper.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	// Centroid bins per axis, the most triangles a leaf is left with when no split pays,
+	// and how deep the tree may go, which bounds the traversal stacks.
+	const int BinCount = 12;
+	const std::uint32_t MaxLeafTriangles = 16;
+	const std::uint32_t MaxDepth = 48;
+	const std::uint32_t StackSize = 64;
+
+	// What visiting a node costs, next to testing one block of triangles.
+	const float TraversalCost = 1.0f;
+
+	struct Bounds3
+	{
+		XMFLOAT3 Min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		XMFLOAT3 Max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		void Grow(const XMFLOAT3& p)
+		{
+			Min = XMFLOAT3(MathHelper::Min(Min.x, p.x), MathHelper::Min(Min.y, p.y), MathHelper::Min(Min.z, p.z));
+			Max = XMFLOAT3(MathHelper::Max(Max.x, p.x), MathHelper::Max(Max.y, p.y), MathHelper::Max(Max.z, p.z));
+		}
+
+		void Grow(const Bounds3& b)
+		{
+			Grow(b.Min);
+			Grow(b.Max);
+		}
+
+		float Area()const
+		{
+			if(Max.x < Min.x)
+				return 0.0f;
+
+			const float dx = Max.x - Min.x;
+			const float dy = Max.y - Min.y;
+			const float dz = Max.z - Min.z;
+			return 2.0f*(dx*dy + dy*dz + dz*dx);
+		}
+	};
+
+	struct BuildTriangle
+	{
+		Bounds3 Bounds;
+		XMFLOAT3 Centroid;
+	};
+
+	struct BuildTask
+	{
+		std::uint32_t Node;
+		std::uint32_t Begin;
+		std::uint32_t End;
+		std::uint32_t Depth;
+	};
+
+	std::uint32_t BlockCount(std::uint32_t triangles)
+	{
+		return (triangles + 3) / 4;
+	}
+
+	float Axis(const XMFLOAT3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+
+	// 1/d, with zero components made huge so the slab tests still work.
+	float SafeInverse(float d)
+	{
+		if(fabsf(d) > 1.0e-20f)
+			return 1.0f / d;
+		return d >= 0.0f ? 1.0e30f : -1.0e30f;
+	}
+
+	// Moller-Trumbore for four ray and triangle pairs, one per lane.  Returns the lanes
+	// where the ray hits the triangle, from either side, no farther than maxT, with the
+	// distance in t and where on the triangle in u and v.
+	inline __m128 RayTriangle4(const __m128 o[3], const __m128 d[3], const __m128 c[3],
+		const __m128 e1[3], const __m128 e2[3], __m128 maxT, __m128& t, __m128& u, __m128& v)
+	{
+		const __m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1]));
+		const __m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2]));
+		const __m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]));
+		const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz));
+		const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+		const __m128 sx = _mm_sub_ps(o[0], c[0]);
+		const __m128 sy = _mm_sub_ps(o[1], c[1]);
+		const __m128 sz = _mm_sub_ps(o[2], c[2]);
+		u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1[2]), _mm_mul_ps(sz, e1[1]));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1[0]), _mm_mul_ps(sx, e1[2]));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1[1]), _mm_mul_ps(sy, e1[0]));
+		v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), inv);
+
+		// A zero determinant, an empty lane or a ray along the triangle's plane, makes the
+		// rest infinite or NaN, which fails the other tests anyway.
+		const __m128 zero = _mm_setzero_ps();
+		__m128 hit = _mm_cmpneq_ps(det, zero);
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(t, maxT));
+		return hit;
+	}
+
+	// Whether the ray crosses the box between 0 and maxT, and where it enters.
+	inline bool RayBox(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, const XMFLOAT3& o,
+		const XMFLOAT3& invD, float maxT, float& entry)
+	{
+		const float x0 = (boxMin.x - o.x)*invD.x;
+		const float x1 = (boxMax.x - o.x)*invD.x;
+		const float y0 = (boxMin.y - o.y)*invD.y;
+		const float y1 = (boxMax.y - o.y)*invD.y;
+		const float z0 = (boxMin.z - o.z)*invD.z;
+		const float z1 = (boxMax.z - o.z)*invD.z;
+
+		const float tMin = MathHelper::Max(MathHelper::Max(MathHelper::Min(x0, x1), MathHelper::Min(y0, y1)),
+			MathHelper::Max(MathHelper::Min(z0, z1), 0.0f));
+		const float tMax = MathHelper::Min(MathHelper::Min(MathHelper::Max(x0, x1), MathHelper::Max(y0, y1)),
+			MathHelper::Min(MathHelper::Max(z0, z1), maxT));
+
+		entry = tMin;
+		return tMin <= tMax;
+	}
+}
+
+void TriangleBvh::Build(const XMFLOAT3* positions, std::size_t vertexCount,
+	const std::uint32_t* indices, std::size_t triangleCount)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	mNodes.clear();
+	mBlocks.clear();
+	mTriangleCount = triangleCount;
+	if(triangleCount == 0)
+	{
+		mBuildMs = 0.0f;
+		return;
+	}
+
+	std::vector<BuildTriangle> triangles(triangleCount);
+	for(std::size_t i = 0; i < triangleCount; ++i)
+	{
+		BuildTriangle& tri = triangles[i];
+		for(int k = 0; k < 3; ++k)
+		{
+			assert(indices[3*i + k] < vertexCount);
+			tri.Bounds.Grow(positions[indices[3*i + k]]);
+		}
+
+		tri.Centroid = XMFLOAT3(0.5f*(tri.Bounds.Min.x + tri.Bounds.Max.x), 0.5f*(tri.Bounds.Min.y + tri.Bounds.Max.y),
+			0.5f*(tri.Bounds.Min.z + tri.Bounds.Max.z));
+	}
+
+	std::vector<std::uint32_t> order(triangleCount);
+	std::iota(order.begin(), order.end(), 0u);
+
+	mNodes.reserve(2*BlockCount((std::uint32_t)triangleCount));
+	mBlocks.reserve(BlockCount((std::uint32_t)triangleCount) + triangleCount / 8);
+	mNodes.push_back(Node());
+
+	std::vector<BuildTask> tasks;
+	tasks.push_back({ 0, 0, (std::uint32_t)triangleCount, 0 });
+
+	while(!tasks.empty())
+	{
+		const BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		const std::uint32_t count = task.End - task.Begin;
+		Bounds3 bounds;
+		Bounds3 centroids;
+		for(std::uint32_t i = task.Begin; i < task.End; ++i)
+		{
+			bounds.Grow(triangles[order[i]].Bounds);
+			centroids.Grow(triangles[order[i]].Centroid);
+		}
+
+		mNodes[task.Node].Min = bounds.Min;
+		mNodes[task.Node].Max = bounds.Max;
+
+		// Costs are scaled by the node's area, which saves dividing by it.
+		const float area = bounds.Area();
+		float bestCost = area*BlockCount(count);
+		int bestAxis = -1;
+		int bestSplit = 0;
+
+		if(count > 4 && task.Depth < MaxDepth)
+		{
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				const float lo = Axis(centroids.Min, axis);
+				const float extent = Axis(centroids.Max, axis) - lo;
+				if(extent <= 0.0f)
+					continue;
+
+				Bounds3 binBounds[BinCount];
+				std::uint32_t binCounts[BinCount] = {};
+				const float scale = BinCount / extent;
+				for(std::uint32_t i = task.Begin; i < task.End; ++i)
+				{
+					const BuildTriangle& tri = triangles[order[i]];
+					const int bin = MathHelper::Min(BinCount - 1, (int)((Axis(tri.Centroid, axis) - lo)*scale));
+					binBounds[bin].Grow(tri.Bounds);
+					++binCounts[bin];
+				}
+
+				// The cost of the right side of each split, from the right, then of the left
+				// side on the way back.
+				float rightCosts[BinCount];
+				Bounds3 right;
+				std::uint32_t rightCount = 0;
+				for(int split = BinCount - 1; split > 0; --split)
+				{
+					right.Grow(binBounds[split]);
+					rightCount += binCounts[split];
+					rightCosts[split] = right.Area()*BlockCount(rightCount);
+				}
+
+				Bounds3 left;
+				std::uint32_t leftCount = 0;
+				for(int split = 1; split < BinCount; ++split)
+				{
+					left.Grow(binBounds[split - 1]);
+					leftCount += binCounts[split - 1];
+					if(leftCount == 0 || leftCount == count)
+						continue;
+
+					const float cost = TraversalCost*area + left.Area()*BlockCount(leftCount) + rightCosts[split];
+					if(cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = split;
+					}
+				}
+			}
+		}
+
+		std::uint32_t middle = task.Begin;
+		if(bestAxis >= 0)
+		{
+			const float lo = Axis(centroids.Min, bestAxis);
+			const float scale = BinCount / (Axis(centroids.Max, bestAxis) - lo);
+			middle = (std::uint32_t)(std::partition(order.begin() + task.Begin, order.begin() + task.End,
+				[&](std::uint32_t t)
+				{
+					const int bin = MathHelper::Min(BinCount - 1, (int)((Axis(triangles[t].Centroid, bestAxis) - lo)*scale));
+					return bin < bestSplit;
+				}) - order.begin());
+		}
+		else if(count > MaxLeafTriangles && task.Depth < MaxDepth)
+		{
+			// No split pays, yet the leaf would be large: halve it along the widest axis.
+			const float ex = centroids.Max.x - centroids.Min.x;
+			const float ey = centroids.Max.y - centroids.Min.y;
+			const float ez = centroids.Max.z - centroids.Min.z;
+			const int axis = ex >= ey && ex >= ez ? 0 : (ey >= ez ? 1 : 2);
+
+			middle = task.Begin + count / 2;
+			std::nth_element(order.begin() + task.Begin, order.begin() + middle, order.begin() + task.End,
+				[&](std::uint32_t a, std::uint32_t b)
+				{
+					return Axis(triangles[a].Centroid, axis) < Axis(triangles[b].Centroid, axis);
+				});
+		}
+
+		if(middle == task.Begin || middle == task.End)
+		{
+			Node& leaf = mNodes[task.Node];
+			leaf.First = (std::uint32_t)mBlocks.size();
+			leaf.Count = BlockCount(count);
+
+			for(std::uint32_t first = task.Begin; first < task.End; first += 4)
+			{
+				TriangleBlock block = {};
+				for(std::uint32_t lane = 0; lane < 4; ++lane)
+				{
+					if(first + lane >= task.End)
+					{
+						block.Triangles[lane] = NoTriangle;
+						continue;
+					}
+
+					const std::uint32_t t = order[first + lane];
+					const XMFLOAT3& a = positions[indices[3*t + 0]];
+					const XMFLOAT3& b = positions[indices[3*t + 1]];
+					const XMFLOAT3& c = positions[indices[3*t + 2]];
+					block.Corner[0][lane] = a.x;
+					block.Corner[1][lane] = a.y;
+					block.Corner[2][lane] = a.z;
+					block.Edge1[0][lane] = b.x - a.x;
+					block.Edge1[1][lane] = b.y - a.y;
+					block.Edge1[2][lane] = b.z - a.z;
+					block.Edge2[0][lane] = c.x - a.x;
+					block.Edge2[1][lane] = c.y - a.y;
+					block.Edge2[2][lane] = c.z - a.z;
+					block.Triangles[lane] = t;
+				}
+				mBlocks.push_back(block);
+			}
+			continue;
+		}
+
+		const std::uint32_t children = (std::uint32_t)mNodes.size();
+		mNodes.push_back(Node());
+		mNodes.push_back(Node());
+		mNodes[task.Node].First = children;
+		mNodes[task.Node].Count = 0;
+
+		tasks.push_back({ children, task.Begin, middle, task.Depth + 1 });
+		tasks.push_back({ children + 1, middle, task.End, task.Depth + 1 });
+	}
+
+	mBuildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+BoundingBox TriangleBvh::Bounds()const
+{
+	if(mNodes.empty())
+		return BoundingBox();
+
+	const Node& root = mNodes[0];
+	BoundingBox box;
+	BoundingBox::CreateFromPoints(box, XMLoadFloat3(&root.Min), XMLoadFloat3(&root.Max));
+	return box;
+}
+
+bool TriangleBvh::Intersect(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, BvhHit& hit)const
+{
+	if(mNodes.empty())
+		return false;
+
+	const XMFLOAT3 invD(SafeInverse(direction.x), SafeInverse(direction.y), SafeInverse(direction.z));
+	const __m128 o[3] = { _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z) };
+	const __m128 d[3] = { _mm_set1_ps(direction.x), _mm_set1_ps(direction.y), _mm_set1_ps(direction.z) };
+
+	float entry;
+	if(!RayBox(mNodes[0].Min, mNodes[0].Max, origin, invD, maxDistance, entry))
+		return false;
+
+	// Nodes still to visit, with where the ray enters them, so those beyond the nearest
+	// hit found since they were pushed are skipped.
+	std::uint32_t stack[StackSize];
+	float stackEntry[StackSize];
+	std::uint32_t size = 0;
+	stack[size] = 0;
+	stackEntry[size++] = entry;
+
+	bool found = false;
+	float nearest = maxDistance;
+	while(size > 0)
+	{
+		--size;
+		if(stackEntry[size] > nearest)
+			continue;
+
+		const Node& node = mNodes[stack[size]];
+		if(node.Count > 0)
+		{
+			for(std::uint32_t b = node.First; b < node.First + node.Count; ++b)
+			{
+				const TriangleBlock& block = mBlocks[b];
+				const __m128 c[3] = { _mm_load_ps(block.Corner[0]), _mm_load_ps(block.Corner[1]), _mm_load_ps(block.Corner[2]) };
+				const __m128 e1[3] = { _mm_load_ps(block.Edge1[0]), _mm_load_ps(block.Edge1[1]), _mm_load_ps(block.Edge1[2]) };
+				const __m128 e2[3] = { _mm_load_ps(block.Edge2[0]), _mm_load_ps(block.Edge2[1]), _mm_load_ps(block.Edge2[2]) };
+
+				__m128 t, u, v;
+				const int mask = _mm_movemask_ps(RayTriangle4(o, d, c, e1, e2, _mm_set1_ps(nearest), t, u, v));
+				if(mask == 0)
+					continue;
+
+				float ts[4], us[4], vs[4];
+				_mm_storeu_ps(ts, t);
+				_mm_storeu_ps(us, u);
+				_mm_storeu_ps(vs, v);
+				for(int lane = 0; lane < 4; ++lane)
+				{
+					if((mask & (1 << lane)) && ts[lane] <= nearest)
+					{
+						nearest = ts[lane];
+						hit.Distance = ts[lane];
+						hit.Triangle = block.Triangles[lane];
+						hit.U = us[lane];
+						hit.V = vs[lane];
+						found = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		// The nearer child goes on top, to be visited first.
+		float entryA, entryB;
+		const Node& a = mNodes[node.First];
+		const Node& b = mNodes[node.First + 1];
+		const bool hitA = RayBox(a.Min, a.Max, origin, invD, nearest, entryA);
+		const bool hitB = RayBox(b.Min, b.Max, origin, invD, nearest, entryB);
+		if(hitA && hitB)
+		{
+			const bool aFirst = entryA <= entryB;
+			stack[size] = aFirst ? node.First + 1 : node.First;
+			stackEntry[size++] = aFirst ? entryB : entryA;
+			stack[size] = aFirst ? node.First : node.First + 1;
+			stackEntry[size++] = aFirst ? entryA : entryB;
+		}
+		else if(hitA || hitB)
+		{
+			stack[size] = hitA ? node.First : node.First + 1;
+			stackEntry[size++] = hitA ? entryA : entryB;
+		}
+	}
+
+	return found;
+}
+
+bool TriangleBvh::Occluded(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance)const
+{
+	if(mNodes.empty())
+		return false;
+
+	const XMFLOAT3 invD(SafeInverse(direction.x), SafeInverse(direction.y), SafeInverse(direction.z));
+	const __m128 o[3] = { _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z) };
+	const __m128 d[3] = { _mm_set1_ps(direction.x), _mm_set1_ps(direction.y), _mm_set1_ps(direction.z) };
+	const __m128 maxT = _mm_set1_ps(maxDistance);
+
+	std::uint32_t stack[StackSize];
+	std::uint32_t size = 0;
+	stack[size++] = 0;
+
+	while(size > 0)
+	{
+		const Node& node = mNodes[stack[--size]];
+
+		float entry;
+		if(!RayBox(node.Min, node.Max, origin, invD, maxDistance, entry))
+			continue;
+
+		if(node.Count == 0)
+		{
+			stack[size++] = node.First + 1;
+			stack[size++] = node.First;
+			continue;
+		}
+
+		for(std::uint32_t b = node.First; b < node.First + node.Count; ++b)
+		{
+			const TriangleBlock& block = mBlocks[b];
+			const __m128 c[3] = { _mm_load_ps(block.Corner[0]), _mm_load_ps(block.Corner[1]), _mm_load_ps(block.Corner[2]) };
+			const __m128 e1[3] = { _mm_load_ps(block.Edge1[0]), _mm_load_ps(block.Edge1[1]), _mm_load_ps(block.Edge1[2]) };
+			const __m128 e2[3] = { _mm_load_ps(block.Edge2[0]), _mm_load_ps(block.Edge2[1]), _mm_load_ps(block.Edge2[2]) };
+
+			__m128 t, u, v;
+			if(_mm_movemask_ps(RayTriangle4(o, d, c, e1, e2, maxT, t, u, v)) != 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+int TriangleBvh::Occluded4(const XMFLOAT3 origins[4], const XMFLOAT3 directions[4], const float maxDistances[4])const
+{
+	if(mNodes.empty())
+		return 0;
+
+	const __m128 o[3] = {
+		_mm_setr_ps(origins[0].x, origins[1].x, origins[2].x, origins[3].x),
+		_mm_setr_ps(origins[0].y, origins[1].y, origins[2].y, origins[3].y),
+		_mm_setr_ps(origins[0].z, origins[1].z, origins[2].z, origins[3].z) };
+	const __m128 d[3] = {
+		_mm_setr_ps(directions[0].x, directions[1].x, directions[2].x, directions[3].x),
+		_mm_setr_ps(directions[0].y, directions[1].y, directions[2].y, directions[3].y),
+		_mm_setr_ps(directions[0].z, directions[1].z, directions[2].z, directions[3].z) };
+	const __m128 invD[3] = {
+		_mm_setr_ps(SafeInverse(directions[0].x), SafeInverse(directions[1].x), SafeInverse(directions[2].x), SafeInverse(directions[3].x)),
+		_mm_setr_ps(SafeInverse(directions[0].y), SafeInverse(directions[1].y), SafeInverse(directions[2].y), SafeInverse(directions[3].y)),
+		_mm_setr_ps(SafeInverse(directions[0].z), SafeInverse(directions[1].z), SafeInverse(directions[2].z), SafeInverse(directions[3].z)) };
+	const __m128 maxT = _mm_loadu_ps(maxDistances);
+	const __m128 zero = _mm_setzero_ps();
+
+	// Rays drop out of the packet as they are blocked.
+	int blocked = 0;
+	__m128 active = _mm_cmpeq_ps(zero, zero);
+
+	std::uint32_t stack[StackSize];
+	std::uint32_t size = 0;
+	stack[size++] = 0;
+
+	while(size > 0)
+	{
+		const Node& node = mNodes[stack[--size]];
+
+		// The node's box against each ray still going.
+		__m128 tMin = zero;
+		__m128 tMax = maxT;
+		const float* boxMin = &node.Min.x;
+		const float* boxMax = &node.Max.x;
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMin[axis]), o[axis]), invD[axis]);
+			const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boxMax[axis]), o[axis]), invD[axis]);
+			tMin = _mm_max_ps(tMin, _mm_min_ps(t0, t1));
+			tMax = _mm_min_ps(tMax, _mm_max_ps(t0, t1));
+		}
+
+		if(_mm_movemask_ps(_mm_and_ps(active, _mm_cmple_ps(tMin, tMax))) == 0)
+			continue;
+
+		if(node.Count == 0)
+		{
+			stack[size++] = node.First + 1;
+			stack[size++] = node.First;
+			continue;
+		}
+
+		// Each triangle against the whole packet.
+		for(std::uint32_t b = node.First; b < node.First + node.Count; ++b)
+		{
+			const TriangleBlock& block = mBlocks[b];
+			for(int lane = 0; lane < 4 && block.Triangles[lane] != NoTriangle; ++lane)
+			{
+				const __m128 c[3] = { _mm_set1_ps(block.Corner[0][lane]), _mm_set1_ps(block.Corner[1][lane]), _mm_set1_ps(block.Corner[2][lane]) };
+				const __m128 e1[3] = { _mm_set1_ps(block.Edge1[0][lane]), _mm_set1_ps(block.Edge1[1][lane]), _mm_set1_ps(block.Edge1[2][lane]) };
+				const __m128 e2[3] = { _mm_set1_ps(block.Edge2[0][lane]), _mm_set1_ps(block.Edge2[1][lane]), _mm_set1_ps(block.Edge2[2][lane]) };
+
+				__m128 t, u, v;
+				const __m128 hit = _mm_and_ps(active, RayTriangle4(o, d, c, e1, e2, maxT, t, u, v));
+				if(_mm_movemask_ps(hit) == 0)
+					continue;
+
+				blocked |= _mm_movemask_ps(hit);
+				if(blocked == 0xf)
+					return blocked;
+				active = _mm_andnot_ps(hit, active);
+			}
+		}
+	}
+
+	return blocked;
+}
@@ -0,0 +1,102 @@
+//***************************************************************************************
+// TriangleBvh.h
+//
+// A bounding volume hierarchy over a triangle mesh, for casting rays against the actual
+// triangles rather than boxes around them.
+//
+// Build() splits the triangles by the surface area heuristic, binning their centroids
+// along each axis and picking the cheapest split, until a node is cheaper to leave as a
+// leaf.  Leaves hold whole blocks of four triangles, stored side by side so one SSE
+// Moller-Trumbore test covers the block; the heuristic counts blocks, not triangles, so
+// it knows a leaf of three costs the same as a leaf of four.  Each triangle is kept as a
+// corner and two edges, ready for the test.
+//
+// Rays are tested one at a time, nearest hit or any hit, or as packets of four that go
+// down the tree together.  A packet suits rays that start from the same point, like the
+// shadow and occlusion rays from one surface point, since those visit mostly the same
+// nodes; each triangle they reach is then tested against all four at once.  Triangles
+// are hit from either side.
+//
+// Nothing is changed by casting rays, so any number of threads may cast at once.
+//***************************************************************************************
+
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct BvhHit
+{
+	// Along the ray in multiples of its direction, and where on the triangle, as weights of
+	// its second and third corners.
+	float Distance;
+	std::uint32_t Triangle;
+	float U;
+	float V;
+};
+
+class TriangleBvh
+{
+public:
+	static const std::uint32_t NoTriangle = ~0u;
+
+	TriangleBvh() = default;
+	TriangleBvh(const TriangleBvh& rhs) = delete;
+	TriangleBvh& operator=(const TriangleBvh& rhs) = delete;
+
+	// Three indices into positions per triangle; a hit's Triangle counts triangles, so its
+	// corners are indices[3*Triangle] on.  Replaces whatever the tree held.  The mesh is
+	// copied, so it may go after.
+	void Build(const DirectX::XMFLOAT3* positions, std::size_t vertexCount,
+		const std::uint32_t* indices, std::size_t triangleCount);
+
+	std::size_t TriangleCount()const { return mTriangleCount; }
+	std::size_t NodeCount()const { return mNodes.size(); }
+	std::size_t Bytes()const { return mNodes.size()*sizeof(Node) + mBlocks.size()*sizeof(TriangleBlock); }
+	DirectX::BoundingBox Bounds()const;
+	float BuildMs()const { return mBuildMs; }
+
+	// The nearest triangle hit by the ray from origin along direction, no farther than
+	// maxDistance multiples of direction, which need not be unit length.
+	bool Intersect(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+		float maxDistance, BvhHit& hit)const;
+
+	// Whether anything is hit before maxDistance.  Stops at the first triangle found.
+	bool Occluded(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+		float maxDistance)const;
+
+	// Occluded() for four rays at once.  Bit i of the result is set if ray i is blocked.
+	int Occluded4(const DirectX::XMFLOAT3 origins[4], const DirectX::XMFLOAT3 directions[4],
+		const float maxDistances[4])const;
+
+private:
+	// An inner node's children are next to each other, at First and First + 1.  A leaf
+	// has Count blocks of triangles, starting at First.
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		std::uint32_t First;
+		DirectX::XMFLOAT3 Max;
+		std::uint32_t Count;
+	};
+
+	// Four triangles, one per SSE lane.  Lanes left over in a leaf's last block have no
+	// triangle, and zero edges that nothing hits.
+	struct alignas(16) TriangleBlock
+	{
+		float Corner[3][4];
+		float Edge1[3][4];
+		float Edge2[3][4];
+		std::uint32_t Triangles[4];
+	};
+
+	std::vector<Node> mNodes;
+	std::vector<TriangleBlock> mBlocks;
+	std::size_t mTriangleCount = 0;
+	float mBuildMs = 0.0f;
+};
+
+#endif // TRIANGLEBVH_H
@@ -0,0 +1,64 @@
+//***************************************************************************************
+// TripleBuffer.h
+//
+// Hands the latest value from one writer thread to one reader thread without either
+// waiting on the other.
+//
+// There are three slots: the writer fills the back slot, the reader reads the front slot,
+// and the third holds the newest published value.  Publish() swaps the back slot with
+// that middle slot and Acquire() swaps the middle slot with the front one, each with a
+// single atomic exchange.  A flag in the exchanged word tells the reader whether the
+// middle slot is newer than what it already has, so values the reader was too slow to
+// see are simply overwritten.
+//***************************************************************************************
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer& rhs) = delete;
+	TripleBuffer& operator=(const TripleBuffer& rhs) = delete;
+
+	// Writer side.  The slot keeps whatever was written to it three publishes ago, so
+	// buffers in it can be reused without reallocating.
+	T& Back() { return mSlots[mBack]; }
+
+	void Publish()
+	{
+		unsigned old = mMiddle.exchange(mBack | Fresh, std::memory_order_acq_rel);
+		mBack = old & IndexMask;
+	}
+
+	// Reader side.  Takes the newest published value if there is one the reader has not
+	// seen, and returns whether it did.
+	bool Acquire()
+	{
+		if((mMiddle.load(std::memory_order_relaxed) & Fresh) == 0)
+			return false;
+
+		unsigned old = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+		mFront = old & IndexMask;
+		return true;
+	}
+
+	const T& Front()const { return mSlots[mFront]; }
+
+private:
+	static const unsigned IndexMask = 3;
+	static const unsigned Fresh = 4;
+
+	T mSlots[3];
+
+	// mBack is only used by the writer and mFront only by the reader.
+	unsigned mBack = 0;
+	std::atomic<unsigned> mMiddle{ 1 };
+	unsigned mFront = 2;
+};
+
+#endif // TRIPLEBUFFER_H
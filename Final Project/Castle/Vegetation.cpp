@@ -0,0 +1,386 @@
+//***************************************************************************************
+// Vegetation.cpp
+//***************************************************************************************
+
+#include "Vegetation.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	// Marks an empty cell in the background grid.
+	const float EmptyCell = -FLT_MAX;
+
+	// Width of a tile in grid cells.  A tile must be wider than the neighbourhood a
+	// sample looks at (two cells on each side) so that tiles of the same pass never
+	// read cells another tile of that pass is writing.
+	const int TileCells = 32;
+
+	std::uint32_t HashCombine(std::uint32_t a, std::uint32_t b)
+	{
+		std::uint32_t h = a ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2));
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// Stable random number in [0,1) for a grid cell.  Used for thinning so the result
+	// does not depend on the order cells are visited in.
+	float CellRandom(std::uint32_t seed, std::uint32_t cell)
+	{
+		return (HashCombine(seed, cell) >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+void VegetationScatter::AddExclusionBox(float minX, float minZ, float maxX, float maxZ)
+{
+	ExclusionBox box;
+	box.MinX = MathHelper::Min(minX, maxX);
+	box.MinZ = MathHelper::Min(minZ, maxZ);
+	box.MaxX = MathHelper::Max(minX, maxX);
+	box.MaxZ = MathHelper::Max(minZ, maxZ);
+
+	mExclusionBoxes.push_back(box);
+}
+
+void VegetationScatter::AddExclusionPolygon(const std::vector<XMFLOAT2>& points)
+{
+	if(points.size() < 3)
+		return;
+
+	ExclusionPolygon poly;
+	poly.Points = points;
+	poly.MinX = poly.MaxX = points[0].x;
+	poly.MinZ = poly.MaxZ = points[0].y;
+	for(const XMFLOAT2& p : points)
+	{
+		poly.MinX = MathHelper::Min(poly.MinX, p.x);
+		poly.MinZ = MathHelper::Min(poly.MinZ, p.y);
+		poly.MaxX = MathHelper::Max(poly.MaxX, p.x);
+		poly.MaxZ = MathHelper::Max(poly.MaxZ, p.y);
+	}
+
+	mExclusionPolygons.push_back(std::move(poly));
+}
+
+void VegetationScatter::ClearExclusions()
+{
+	mExclusionBoxes.clear();
+	mExclusionPolygons.clear();
+}
+
+void VegetationScatter::SetDensityMap(std::uint32_t width, std::uint32_t height, const std::vector<float>& density)
+{
+	if(width == 0 || height == 0 || density.size() < (size_t)width*height)
+	{
+		ClearDensityMap();
+		return;
+	}
+
+	mDensityWidth = width;
+	mDensityHeight = height;
+	mDensity.assign(density.begin(), density.begin() + (size_t)width*height);
+}
+
+void VegetationScatter::ClearDensityMap()
+{
+	mDensityWidth = 0;
+	mDensityHeight = 0;
+	mDensity.clear();
+}
+
+bool VegetationScatter::IsExcluded(float x, float z)const
+{
+	for(const ExclusionBox& b : mExclusionBoxes)
+	{
+		if(x >= b.MinX && x <= b.MaxX && z >= b.MinZ && z <= b.MaxZ)
+			return true;
+	}
+
+	for(const ExclusionPolygon& poly : mExclusionPolygons)
+	{
+		if(x < poly.MinX || x > poly.MaxX || z < poly.MinZ || z > poly.MaxZ)
+			continue;
+
+		// Crossing test: count the edges a ray along +x crosses.
+		bool inside = false;
+		const size_t n = poly.Points.size();
+		for(size_t i = 0, j = n - 1; i < n; j = i++)
+		{
+			const XMFLOAT2& a = poly.Points[i];
+			const XMFLOAT2& b = poly.Points[j];
+			if((a.y > z) != (b.y > z) &&
+				x < (b.x - a.x) * (z - a.y) / (b.y - a.y) + a.x)
+			{
+				inside = !inside;
+			}
+		}
+
+		if(inside)
+			return true;
+	}
+
+	return false;
+}
+
+float VegetationScatter::SampleDensity(const VegetationScatterDesc& desc, float x, float z)const
+{
+	if(mDensity.empty())
+		return 1.0f;
+
+	// Map [Min,Max] onto texel centers.
+	float u = (x - desc.MinX) / (desc.MaxX - desc.MinX) * mDensityWidth - 0.5f;
+	float v = (z - desc.MinZ) / (desc.MaxZ - desc.MinZ) * mDensityHeight - 0.5f;
+	u = MathHelper::Clamp(u, 0.0f, (float)(mDensityWidth - 1));
+	v = MathHelper::Clamp(v, 0.0f, (float)(mDensityHeight - 1));
+
+	std::uint32_t x0 = (std::uint32_t)u;
+	std::uint32_t z0 = (std::uint32_t)v;
+	std::uint32_t x1 = MathHelper::Min(x0 + 1, mDensityWidth - 1);
+	std::uint32_t z1 = MathHelper::Min(z0 + 1, mDensityHeight - 1);
+	float s = u - x0;
+	float t = v - z0;
+
+	float d00 = mDensity[z0*mDensityWidth + x0];
+	float d10 = mDensity[z0*mDensityWidth + x1];
+	float d01 = mDensity[z1*mDensityWidth + x0];
+	float d11 = mDensity[z1*mDensityWidth + x1];
+
+	return (d00*(1.0f - s) + d10*s)*(1.0f - t) + (d01*(1.0f - s) + d11*s)*t;
+}
+
+std::vector<XMFLOAT2> VegetationScatter::Generate(const VegetationScatterDesc& desc)const
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::vector<XMFLOAT2> result;
+
+	const float width = desc.MaxX - desc.MinX;
+	const float depth = desc.MaxZ - desc.MinZ;
+	if(width <= 0.0f || depth <= 0.0f || desc.MinDistance <= 0.0f)
+		return result;
+
+	const float r = desc.MinDistance;
+	const float r2 = r*r;
+
+	// With this cell size a cell's diagonal equals r, so each cell holds at most one sample.
+	const float cellSize = r / sqrtf(2.0f);
+	const float invCellSize = 1.0f / cellSize;
+	const int gridW = MathHelper::Max(1, (int)ceilf(width*invCellSize));
+	const int gridH = MathHelper::Max(1, (int)ceilf(depth*invCellSize));
+
+	// The grid has a border of two empty cells on every side so the neighbour test needs
+	// no bounds checks.
+	const int stride = gridW + 4;
+	std::vector<XMFLOAT2> grid((size_t)stride*(gridH + 4), XMFLOAT2(EmptyCell, EmptyCell));
+
+	auto cellIndex = [&](int cx, int cz)->size_t
+	{
+		return (size_t)(cz + 2)*stride + (cx + 2);
+	};
+
+	// Offsets of the cells that can hold a sample closer than r, nearest first so that
+	// rejected candidates exit early.  The corners of the 5x5 block are always at least
+	// r away and are skipped.
+	std::vector<std::ptrdiff_t> neighbours;
+	for(int d2 = 1; d2 <= 5; ++d2)
+	{
+		for(int dz = -2; dz <= 2; ++dz)
+		{
+			for(int dx = -2; dx <= 2; ++dx)
+			{
+				if(dx*dx + dz*dz == d2)
+					neighbours.push_back((std::ptrdiff_t)dz*stride + dx);
+			}
+		}
+	}
+
+	const int tilesX = (gridW + TileCells - 1) / TileCells;
+	const int tilesZ = (gridH + TileCells - 1) / TileCells;
+
+	// Candidate directions are spread evenly around the annulus and rotated by a random
+	// angle per visit.  Precompute them once.
+	const std::uint32_t k = MathHelper::Max(1u, desc.CandidatesPerSample);
+	std::vector<XMFLOAT2> directions(k);
+	for(std::uint32_t i = 0; i < k; ++i)
+	{
+		float theta = 2.0f*XM_PI*i / k;
+		directions[i] = XMFLOAT2(cosf(theta), sinf(theta));
+	}
+
+	// Candidates sit just outside r, which packs samples tightly and needs far fewer
+	// tries than drawing from the whole [r,2r] annulus.
+	const float candidateRadius = r*1.0001f;
+
+	auto cellOf = [&](float x, float z, int& cx, int& cz)
+	{
+		cx = MathHelper::Min((int)((x - desc.MinX)*invCellSize), gridW - 1);
+		cz = MathHelper::Min((int)((z - desc.MinZ)*invCellSize), gridH - 1);
+	};
+
+	auto fits = [&](float x, float z)->bool
+	{
+		int cx, cz;
+		cellOf(x, z, cx, cz);
+
+		const XMFLOAT2* cell = &grid[cellIndex(cx, cz)];
+		if(cell->x != EmptyCell)
+			return false;
+
+		for(std::ptrdiff_t offset : neighbours)
+		{
+			const XMFLOAT2& q = cell[offset];
+
+			// Empty cells hold -FLT_MAX, which is never within r.
+			float dx = q.x - x;
+			float dz = q.y - z;
+			if(dx*dx + dz*dz < r2)
+				return false;
+		}
+
+		return !IsExcluded(x, z);
+	};
+
+	auto fillTile = [&](int tx, int tz)
+	{
+		const int cx0 = tx*TileCells;
+		const int cz0 = tz*TileCells;
+		const int cx1 = MathHelper::Min(cx0 + TileCells, gridW);
+		const int cz1 = MathHelper::Min(cz0 + TileCells, gridH);
+
+		const float tileMinX = desc.MinX + cx0*cellSize;
+		const float tileMinZ = desc.MinZ + cz0*cellSize;
+		const float tileMaxX = MathHelper::Min(desc.MinX + cx1*cellSize, desc.MaxX);
+		const float tileMaxZ = MathHelper::Min(desc.MinZ + cz1*cellSize, desc.MaxZ);
+
+		RandomStream rng(HashCombine(desc.Seed, (std::uint32_t)(tz*tilesX + tx)));
+		std::vector<XMFLOAT2> active;
+
+		auto insert = [&](float x, float z)
+		{
+			int cx, cz;
+			cellOf(x, z, cx, cz);
+			grid[cellIndex(cx, cz)] = XMFLOAT2(x, z);
+			active.push_back(XMFLOAT2(x, z));
+		};
+
+		// Sweep the tile and throw one dart into every cell that is still empty.  Each
+		// accepted dart seeds Bridson's algorithm, which grows outward until it runs out
+		// of room; the sweep then picks up any pockets it could not reach.
+		for(int cz = cz0; cz < cz1; ++cz)
+		{
+			for(int cx = cx0; cx < cx1; ++cx)
+			{
+				if(grid[cellIndex(cx, cz)].x != EmptyCell)
+					continue;
+
+				float x = desc.MinX + (cx + rng.NextFloat())*cellSize;
+				float z = desc.MinZ + (cz + rng.NextFloat())*cellSize;
+				if(x >= tileMaxX || z >= tileMaxZ || !fits(x, z))
+					continue;
+
+				insert(x, z);
+
+				while(!active.empty())
+				{
+					size_t index = (size_t)rng.NextInt(0, (int)active.size() - 1);
+					XMFLOAT2 p = active[index];
+
+					float theta = 2.0f*XM_PI*rng.NextFloat();
+					float c = cosf(theta);
+					float s = sinf(theta);
+
+					bool found = false;
+					for(std::uint32_t i = 0; i < k; ++i)
+					{
+						const XMFLOAT2& d = directions[i];
+						float qx = p.x + candidateRadius*(d.x*c - d.y*s);
+						float qz = p.y + candidateRadius*(d.x*s + d.y*c);
+
+						if(qx < tileMinX || qx >= tileMaxX || qz < tileMinZ || qz >= tileMaxZ)
+							continue;
+
+						if(fits(qx, qz))
+						{
+							insert(qx, qz);
+							found = true;
+							break;
+						}
+					}
+
+					if(!found)
+					{
+						active[index] = active.back();
+						active.pop_back();
+					}
+				}
+			}
+		}
+	};
+
+	// Four passes over a 2x2 checkerboard of tiles.  Tiles within a pass are at least one
+	// tile apart, so they can be filled concurrently.
+	for(int pass = 0; pass < 4; ++pass)
+	{
+		const int px = pass & 1;
+		const int pz = pass >> 1;
+		const int passTilesX = (tilesX - px + 1) / 2;
+		const int passTilesZ = (tilesZ - pz + 1) / 2;
+		if(passTilesX <= 0 || passTilesZ <= 0)
+			continue;
+
+		concurrency::parallel_for(0, passTilesX*passTilesZ, [&](int t)
+		{
+			fillTile(px + 2*(t % passTilesX), pz + 2*(t / passTilesX));
+		});
+	}
+
+	// Gather the samples in cell order, thinning by the density map.
+	result.reserve((size_t)gridW*gridH / 2);
+	for(int cz = 0; cz < gridH; ++cz)
+	{
+		for(int cx = 0; cx < gridW; ++cx)
+		{
+			const XMFLOAT2& p = grid[cellIndex(cx, cz)];
+			if(p.x == EmptyCell)
+				continue;
+
+			std::uint32_t cell = (std::uint32_t)(cz*gridW + cx);
+			if(!mDensity.empty() && CellRandom(desc.Seed, cell) >= SampleDensity(desc, p.x, p.y))
+				continue;
+
+			result.push_back(p);
+		}
+	}
+
+	// Enforce the instance budget by thinning uniformly rather than cutting off the
+	// last rows of the grid.
+	if(desc.MaxInstances != 0 && result.size() > desc.MaxInstances)
+	{
+		const float keep = (float)desc.MaxInstances / result.size();
+		const std::uint32_t thinSeed = HashCombine(desc.Seed, 0x51ed270bu);
+
+		size_t count = 0;
+		for(size_t i = 0; i < result.size(); ++i)
+		{
+			if(CellRandom(thinSeed, (std::uint32_t)i) < keep)
+				result[count++] = result[i];
+		}
+
+		result.resize(MathHelper::Min(count, (size_t)desc.MaxInstances));
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	mLastGenerateSeconds = std::chrono::duration<float>(endTime - startTime).count();
+
+	return result;
+}
@@ -0,0 +1,93 @@
+//***************************************************************************************
+// Vegetation.h
+//
+// Scatters vegetation instances over the ground using Poisson-disk (blue noise)
+// sampling.  Candidates are tested against a background grid whose cells hold at
+// most one sample, so the neighbour test only looks at a fixed 5x5 block of cells.
+// The domain is split into tiles that are filled in four passes so that tiles
+// running at the same time never touch each other's cells.
+//
+// Exclusion zones (boxes or polygons in the xz-plane) keep instances off the castle
+// and maze grounds, and an optional density map thins the result.
+//***************************************************************************************
+
+#ifndef VEGETATION_H
+#define VEGETATION_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+
+struct VegetationScatterDesc
+{
+	// Bounds of the scatter area in the xz-plane.
+	float MinX = 0.0f;
+	float MinZ = 0.0f;
+	float MaxX = 0.0f;
+	float MaxZ = 0.0f;
+
+	// No two instances are placed closer than this.
+	float MinDistance = 10.0f;
+
+	// Upper limit on the number of instances returned; 0 means no limit.
+	std::uint32_t MaxInstances = 0;
+
+	// Candidates tried around each active sample before it is retired (Bridson's k).
+	std::uint32_t CandidatesPerSample = 30;
+
+	std::uint32_t Seed = 1;
+};
+
+class VegetationScatter
+{
+public:
+	VegetationScatter() = default;
+	VegetationScatter(const VegetationScatter& rhs) = delete;
+	VegetationScatter& operator=(const VegetationScatter& rhs) = delete;
+
+	void AddExclusionBox(float minX, float minZ, float maxX, float maxZ);
+
+	// Points are given in order around the polygon; it does not need to be convex.
+	void AddExclusionPolygon(const std::vector<DirectX::XMFLOAT2>& points);
+
+	void ClearExclusions();
+
+	// The density map stretches over the scatter bounds.  Values are in [0,1] and give
+	// the probability of keeping an instance; they are bilinearly filtered.
+	void SetDensityMap(std::uint32_t width, std::uint32_t height, const std::vector<float>& density);
+	void ClearDensityMap();
+
+	// Returns the xz-positions of the scattered instances.  The result only depends on
+	// the description, the exclusions and the density map, not on thread scheduling.
+	std::vector<DirectX::XMFLOAT2> Generate(const VegetationScatterDesc& desc)const;
+
+	// Wall-clock time of the last Generate call, in seconds.
+	float LastGenerateSeconds()const { return mLastGenerateSeconds; }
+
+	bool IsExcluded(float x, float z)const;
+
+private:
+	struct ExclusionPolygon
+	{
+		std::vector<DirectX::XMFLOAT2> Points;
+		float MinX, MinZ, MaxX, MaxZ;
+	};
+
+	struct ExclusionBox
+	{
+		float MinX, MinZ, MaxX, MaxZ;
+	};
+
+	float SampleDensity(const VegetationScatterDesc& desc, float x, float z)const;
+
+	std::vector<ExclusionBox> mExclusionBoxes;
+	std::vector<ExclusionPolygon> mExclusionPolygons;
+
+	std::uint32_t mDensityWidth = 0;
+	std::uint32_t mDensityHeight = 0;
+	std::vector<float> mDensity;
+
+	mutable float mLastGenerateSeconds = 0.0f;
+};
+
+#endif // VEGETATION_H
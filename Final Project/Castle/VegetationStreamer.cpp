@@ -0,0 +1,174 @@
+//***************************************************************************************
+// VegetationStreamer.cpp
+//***************************************************************************************
+
+#include "VegetationStreamer.h"
+#include "../../Common/MathHelper.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+VegetationStreamer::VegetationStreamer(const VegetationStreamerDesc& desc, ChunkBuilder builder)
+	: mDesc(desc), mBuilder(std::move(builder))
+{
+	mDesc.ChunkSize = MathHelper::Max(mDesc.ChunkSize, 1.0f);
+	mDesc.StreamOutDistance = MathHelper::Max(mDesc.StreamOutDistance, mDesc.StreamInDistance);
+
+	mChunksX = MathHelper::Max(0, (int)ceilf((mDesc.MaxX - mDesc.MinX) / mDesc.ChunkSize));
+	mChunksZ = MathHelper::Max(0, (int)ceilf((mDesc.MaxZ - mDesc.MinZ) / mDesc.ChunkSize));
+}
+
+std::uint64_t VegetationStreamer::ChunkKey(int x, int z)
+{
+	return ((std::uint64_t)(std::uint32_t)z << 32) | (std::uint32_t)x;
+}
+
+float VegetationStreamer::DistanceToChunk(const XMFLOAT3& eyePos, int x, int z)const
+{
+	// Distance in the xz-plane from the eye to the closest point of the chunk.
+	float minX = mDesc.MinX + x*mDesc.ChunkSize;
+	float minZ = mDesc.MinZ + z*mDesc.ChunkSize;
+
+	float dx = MathHelper::Max(MathHelper::Max(minX - eyePos.x, eyePos.x - (minX + mDesc.ChunkSize)), 0.0f);
+	float dz = MathHelper::Max(MathHelper::Max(minZ - eyePos.z, eyePos.z - (minZ + mDesc.ChunkSize)), 0.0f);
+
+	return sqrtf(dx*dx + dz*dz);
+}
+
+void VegetationStreamer::BuildChunk(int x, int z)
+{
+	Chunk chunk;
+	chunk.X = x;
+	chunk.Z = z;
+
+	float minX = mDesc.MinX + x*mDesc.ChunkSize;
+	float minZ = mDesc.MinZ + z*mDesc.ChunkSize;
+	float maxX = MathHelper::Min(minX + mDesc.ChunkSize, mDesc.MaxX);
+	float maxZ = MathHelper::Min(minZ + mDesc.ChunkSize, mDesc.MaxZ);
+
+	mBuilder(minX, minZ, maxX, maxZ, chunk.Instances);
+
+	// Fit the bounds to the instances so tall or floating vegetation is culled correctly.
+	XMFLOAT3 vMin(minX, FLT_MAX, minZ);
+	XMFLOAT3 vMax(maxX, -FLT_MAX, maxZ);
+	for(const VegetationInstance& inst : chunk.Instances)
+	{
+		float halfWidth = 0.5f*inst.Size.x;
+		float halfHeight = 0.5f*inst.Size.y;
+
+		vMin.x = MathHelper::Min(vMin.x, inst.Pos.x - halfWidth);
+		vMin.y = MathHelper::Min(vMin.y, inst.Pos.y - halfHeight);
+		vMin.z = MathHelper::Min(vMin.z, inst.Pos.z - halfWidth);
+		vMax.x = MathHelper::Max(vMax.x, inst.Pos.x + halfWidth);
+		vMax.y = MathHelper::Max(vMax.y, inst.Pos.y + halfHeight);
+		vMax.z = MathHelper::Max(vMax.z, inst.Pos.z + halfWidth);
+	}
+
+	if(chunk.Instances.empty())
+		vMin.y = vMax.y = 0.0f;
+
+	chunk.Bounds.Center = XMFLOAT3(0.5f*(vMin.x + vMax.x), 0.5f*(vMin.y + vMax.y), 0.5f*(vMin.z + vMax.z));
+	chunk.Bounds.Extents = XMFLOAT3(0.5f*(vMax.x - vMin.x), 0.5f*(vMax.y - vMin.y), 0.5f*(vMax.z - vMin.z));
+
+	mChunks[ChunkKey(x, z)] = std::move(chunk);
+	mStats.ChunksBuilt++;
+}
+
+void VegetationStreamer::StreamChunks(const XMFLOAT3& eyePos, std::uint32_t maxBuilds)
+{
+	// Release chunks that have fallen behind the stream-out distance.
+	for(auto it = mChunks.begin(); it != mChunks.end();)
+	{
+		if(DistanceToChunk(eyePos, it->second.X, it->second.Z) > mDesc.StreamOutDistance)
+		{
+			it = mChunks.erase(it);
+			mStats.ChunksReleased++;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	// Only the chunks overlapping the stream-in square around the eye can qualify.
+	const float r = mDesc.StreamInDistance;
+	int x0 = MathHelper::Max(0, (int)floorf((eyePos.x - r - mDesc.MinX) / mDesc.ChunkSize));
+	int z0 = MathHelper::Max(0, (int)floorf((eyePos.z - r - mDesc.MinZ) / mDesc.ChunkSize));
+	int x1 = MathHelper::Min(mChunksX - 1, (int)floorf((eyePos.x + r - mDesc.MinX) / mDesc.ChunkSize));
+	int z1 = MathHelper::Min(mChunksZ - 1, (int)floorf((eyePos.z + r - mDesc.MinZ) / mDesc.ChunkSize));
+
+	mPending.clear();
+	for(int z = z0; z <= z1; ++z)
+	{
+		for(int x = x0; x <= x1; ++x)
+		{
+			float d = DistanceToChunk(eyePos, x, z);
+			if(d <= r && mChunks.find(ChunkKey(x, z)) == mChunks.end())
+				mPending.push_back(std::make_pair(d, ChunkKey(x, z)));
+		}
+	}
+
+	if(maxBuilds != 0 && mPending.size() > maxBuilds)
+	{
+		std::partial_sort(mPending.begin(), mPending.begin() + maxBuilds, mPending.end());
+		mPending.resize(maxBuilds);
+	}
+
+	for(const auto& p : mPending)
+		BuildChunk((int)(std::uint32_t)p.second, (int)(std::uint32_t)(p.second >> 32));
+}
+
+void VegetationStreamer::Prefetch(const XMFLOAT3& eyePos)
+{
+	StreamChunks(eyePos, 0);
+}
+
+void VegetationStreamer::Update(const XMFLOAT3& eyePos, const BoundingFrustum& frustumW)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	mStats.ChunksBuilt = 0;
+	mStats.ChunksReleased = 0;
+	StreamChunks(eyePos, mDesc.MaxChunkBuildsPerUpdate);
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	for(int i = 0; i < (int)VegetationLod::Count; ++i)
+	{
+		mInstances[i].clear();
+		mStats.Instances[i] = 0;
+	}
+	mStats.VisibleChunks = 0;
+
+	for(const auto& entry : mChunks)
+	{
+		const Chunk& chunk = entry.second;
+		if(chunk.Instances.empty() || frustumW.Contains(chunk.Bounds) == DISJOINT)
+			continue;
+
+		mStats.VisibleChunks++;
+
+		float d = DistanceToChunk(eyePos, chunk.X, chunk.Z);
+		VegetationLod lod = VegetationLod::None;
+		if(d < mDesc.FullDistance)
+			lod = VegetationLod::Full;
+		else if(d < mDesc.BillboardDistance)
+			lod = VegetationLod::Billboard;
+
+		mStats.Instances[(int)lod] += (std::uint32_t)chunk.Instances.size();
+		if(lod != VegetationLod::None)
+		{
+			auto& dest = mInstances[(int)lod];
+			dest.insert(dest.end(), chunk.Instances.begin(), chunk.Instances.end());
+		}
+	}
+
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	mStats.ResidentChunks = (std::uint32_t)mChunks.size();
+	mStats.StreamSeconds = std::chrono::duration<float>(t1 - t0).count();
+	mStats.SelectSeconds = std::chrono::duration<float>(t2 - t1).count();
+}
@@ -0,0 +1,131 @@
+//***************************************************************************************
+// VegetationStreamer.h
+//
+// Splits vegetation into square world-space chunks.  Chunks near the camera are built
+// on demand through a callback and dropped again once the camera has moved far enough
+// away.  Every frame the resident chunks are culled against the view frustum and each
+// visible chunk is given a level of detail from its distance to the eye.
+//
+// The streamer only produces instance lists; uploading and drawing them is up to the
+// caller.
+//***************************************************************************************
+
+#ifndef VEGETATIONSTREAMER_H
+#define VEGETATIONSTREAMER_H
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct VegetationInstance
+{
+	DirectX::XMFLOAT3 Pos;
+	DirectX::XMFLOAT2 Size;
+};
+
+enum class VegetationLod : int
+{
+	Full = 0,
+	Billboard,
+	None,
+	Count
+};
+
+struct VegetationStreamerDesc
+{
+	// Bounds of the area vegetation may be streamed in, in the xz-plane.
+	float MinX = 0.0f;
+	float MinZ = 0.0f;
+	float MaxX = 0.0f;
+	float MaxZ = 0.0f;
+
+	float ChunkSize = 64.0f;
+
+	// Chunks closer than FullDistance use the full LOD, chunks closer than
+	// BillboardDistance use billboards and chunks further away are not drawn.
+	float FullDistance = 150.0f;
+	float BillboardDistance = 600.0f;
+
+	// Chunks are built once they come within StreamInDistance and released once they are
+	// further than StreamOutDistance.  The gap stops chunks on the edge from being built
+	// and released every other frame.
+	float StreamInDistance = 650.0f;
+	float StreamOutDistance = 750.0f;
+
+	// Limits how many chunks are built in one Update, nearest first.  0 means no limit.
+	std::uint32_t MaxChunkBuildsPerUpdate = 4;
+};
+
+struct VegetationStreamerStats
+{
+	std::uint32_t ResidentChunks = 0;
+	std::uint32_t VisibleChunks = 0;
+	std::uint32_t ChunksBuilt = 0;
+	std::uint32_t ChunksReleased = 0;
+	std::uint32_t Instances[(int)VegetationLod::Count] = { 0, 0, 0 };
+
+	// Time spent in the last Update, split into building/releasing chunks and choosing
+	// the visible chunks and their LODs.
+	float StreamSeconds = 0.0f;
+	float SelectSeconds = 0.0f;
+};
+
+class VegetationStreamer
+{
+public:
+	// Fills instances for the chunk covering [minX,maxX) x [minZ,maxZ).
+	typedef std::function<void(float minX, float minZ, float maxX, float maxZ,
+		std::vector<VegetationInstance>& instances)> ChunkBuilder;
+
+	VegetationStreamer(const VegetationStreamerDesc& desc, ChunkBuilder builder);
+	VegetationStreamer(const VegetationStreamer& rhs) = delete;
+	VegetationStreamer& operator=(const VegetationStreamer& rhs) = delete;
+
+	// Builds every chunk within the stream-in distance of eyePos, ignoring the per-update
+	// limit.  Useful at start up so the first frame does not pop in.
+	void Prefetch(const DirectX::XMFLOAT3& eyePos);
+
+	// Streams chunks in and out around eyePos and collects the instances of the chunks
+	// that intersect the world space frustum, sorted by LOD.
+	void Update(const DirectX::XMFLOAT3& eyePos, const DirectX::BoundingFrustum& frustumW);
+
+	const std::vector<VegetationInstance>& Instances(VegetationLod lod)const { return mInstances[(int)lod]; }
+
+	const VegetationStreamerStats& Stats()const { return mStats; }
+	const VegetationStreamerDesc& Desc()const { return mDesc; }
+
+private:
+	struct Chunk
+	{
+		int X = 0;
+		int Z = 0;
+		DirectX::BoundingBox Bounds;
+		std::vector<VegetationInstance> Instances;
+	};
+
+	static std::uint64_t ChunkKey(int x, int z);
+
+	float DistanceToChunk(const DirectX::XMFLOAT3& eyePos, int x, int z)const;
+	void BuildChunk(int x, int z);
+	void StreamChunks(const DirectX::XMFLOAT3& eyePos, std::uint32_t maxBuilds);
+
+	VegetationStreamerDesc mDesc;
+	ChunkBuilder mBuilder;
+
+	int mChunksX = 0;
+	int mChunksZ = 0;
+
+	std::unordered_map<std::uint64_t, Chunk> mChunks;
+
+	// Scratch list of chunks waiting to be built, reused between updates.
+	std::vector<std::pair<float, std::uint64_t>> mPending;
+
+	std::vector<VegetationInstance> mInstances[(int)VegetationLod::Count];
+
+	VegetationStreamerStats mStats;
+};
+
+#endif // VEGETATIONSTREAMER_H
@@ -0,0 +1,570 @@
+//***************************************************************************************
+// VisibilitySets.cpp
+//***************************************************************************************
+
+#include "VisibilitySets.h"
+#include "../../Common/MathHelper.h"
+#include <ppl.h>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <map>
+
+using namespace DirectX;
+
+namespace
+{
+	// How far target points sit outside the item's bounds, so an item that is also an
+	// occluder does not block the rays aimed at it.
+	const float TargetOffset = 0.05f;
+
+	struct Occluder
+	{
+		float Center[3];
+		float Axis[3][3];
+		float Extents[3];
+	};
+
+	Occluder MakeOccluder(const BoundingOrientedBox& box)
+	{
+		XMFLOAT3X3 axes;
+		XMStoreFloat3x3(&axes, XMMatrixRotationQuaternion(XMLoadFloat4(&box.Orientation)));
+
+		Occluder o;
+		o.Center[0] = box.Center.x;
+		o.Center[1] = box.Center.y;
+		o.Center[2] = box.Center.z;
+		o.Extents[0] = box.Extents.x;
+		o.Extents[1] = box.Extents.y;
+		o.Extents[2] = box.Extents.z;
+		for(int i = 0; i < 3; ++i)
+		{
+			for(int j = 0; j < 3; ++j)
+				o.Axis[i][j] = axes.m[i][j];
+		}
+		return o;
+	}
+
+	// Whether the segment from p to p + d touches the box.
+	bool SegmentHitsOccluder(const Occluder& o, const float* p, const float* d)
+	{
+		const float rel[3] = { p[0] - o.Center[0], p[1] - o.Center[1], p[2] - o.Center[2] };
+
+		float tMin = 0.0f;
+		float tMax = 1.0f;
+		for(int i = 0; i < 3; ++i)
+		{
+			const float* axis = o.Axis[i];
+			const float start = rel[0]*axis[0] + rel[1]*axis[1] + rel[2]*axis[2];
+			const float dir = d[0]*axis[0] + d[1]*axis[1] + d[2]*axis[2];
+
+			if(fabsf(dir) < 1.0e-8f)
+			{
+				if(fabsf(start) > o.Extents[i])
+					return false;
+				continue;
+			}
+
+			float t0 = (-o.Extents[i] - start) / dir;
+			float t1 = (o.Extents[i] - start) / dir;
+			if(t0 > t1)
+				std::swap(t0, t1);
+
+			tMin = MathHelper::Max(tMin, t0);
+			tMax = MathHelper::Min(tMax, t1);
+			if(tMin > tMax)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool OccluderContains(const Occluder& o, const float* p)
+	{
+		const float rel[3] = { p[0] - o.Center[0], p[1] - o.Center[1], p[2] - o.Center[2] };
+		for(int i = 0; i < 3; ++i)
+		{
+			const float* axis = o.Axis[i];
+			if(fabsf(rel[0]*axis[0] + rel[1]*axis[1] + rel[2]*axis[2]) > o.Extents[i])
+				return false;
+		}
+		return true;
+	}
+
+	// The occluders sorted into a uniform grid of square columns over x and z.  Segments
+	// walk the columns they cross in order.
+	class OccluderGrid
+	{
+	public:
+		OccluderGrid(const std::vector<BoundingOrientedBox>& boxes, float cellSize)
+			: mCellSize(cellSize)
+		{
+			mMinX = mMinZ = FLT_MAX;
+			float maxX = -FLT_MAX;
+			float maxZ = -FLT_MAX;
+
+			std::vector<XMFLOAT4> rects(boxes.size());
+			for(std::size_t i = 0; i < boxes.size(); ++i)
+			{
+				mOccluders.push_back(MakeOccluder(boxes[i]));
+
+				XMFLOAT3 corners[BoundingOrientedBox::CORNER_COUNT];
+				boxes[i].GetCorners(corners);
+				XMFLOAT4 rect(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for(const XMFLOAT3& c : corners)
+				{
+					rect.x = MathHelper::Min(rect.x, c.x);
+					rect.y = MathHelper::Min(rect.y, c.z);
+					rect.z = MathHelper::Max(rect.z, c.x);
+					rect.w = MathHelper::Max(rect.w, c.z);
+				}
+				rects[i] = rect;
+
+				mMinX = MathHelper::Min(mMinX, rect.x);
+				mMinZ = MathHelper::Min(mMinZ, rect.y);
+				maxX = MathHelper::Max(maxX, rect.z);
+				maxZ = MathHelper::Max(maxZ, rect.w);
+			}
+
+			if(boxes.empty())
+			{
+				mMinX = mMinZ = maxX = maxZ = 0.0f;
+			}
+
+			mCellsX = MathHelper::Max(1, (int)ceilf((maxX - mMinX) / mCellSize));
+			mCellsZ = MathHelper::Max(1, (int)ceilf((maxZ - mMinZ) / mCellSize));
+			mMaxX = mMinX + mCellsX*mCellSize;
+			mMaxZ = mMinZ + mCellsZ*mCellSize;
+
+			// Count, then fill, each cell's list.
+			mCellStarts.assign(mCellsX*mCellsZ + 1, 0);
+			for(int pass = 0; pass < 2; ++pass)
+			{
+				std::vector<std::uint32_t> fill(mCellStarts.begin(), mCellStarts.end() - 1);
+				if(pass == 1)
+					mCellOccluders.resize(mCellStarts.back());
+
+				for(std::uint32_t i = 0; i < (std::uint32_t)rects.size(); ++i)
+				{
+					int x0, z0, x1, z1;
+					CellOf(rects[i].x, rects[i].y, x0, z0);
+					CellOf(rects[i].z, rects[i].w, x1, z1);
+					for(int z = z0; z <= z1; ++z)
+					{
+						for(int x = x0; x <= x1; ++x)
+						{
+							if(pass == 0)
+								++mCellStarts[z*mCellsX + x + 1];
+							else
+								mCellOccluders[fill[z*mCellsX + x]++] = i;
+						}
+					}
+				}
+
+				if(pass == 0)
+				{
+					for(std::size_t c = 1; c < mCellStarts.size(); ++c)
+						mCellStarts[c] += mCellStarts[c - 1];
+				}
+			}
+		}
+
+		std::size_t OccluderCount()const { return mOccluders.size(); }
+
+		bool Inside(const float* p)const
+		{
+			int x, z;
+			CellOf(p[0], p[2], x, z);
+			const int cell = z*mCellsX + x;
+			for(std::uint32_t k = mCellStarts[cell]; k < mCellStarts[cell + 1]; ++k)
+			{
+				if(OccluderContains(mOccluders[mCellOccluders[k]], p))
+					return true;
+			}
+			return false;
+		}
+
+		// Whether anything is in the way from a to b.  stamps has a slot per occluder and is
+		// used to test each occluder once however many cells it is in; stamp must be new.
+		bool Blocked(const float* a, const float* b, std::vector<std::uint32_t>& stamps, std::uint32_t stamp)const
+		{
+			const float d[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+
+			// Clip the segment to the grid.
+			float tMin = 0.0f;
+			float tMax = 1.0f;
+			const float lo[2] = { mMinX, mMinZ };
+			const float hi[2] = { mMaxX, mMaxZ };
+			const float start[2] = { a[0], a[2] };
+			const float dir[2] = { d[0], d[2] };
+			for(int i = 0; i < 2; ++i)
+			{
+				if(fabsf(dir[i]) < 1.0e-8f)
+				{
+					if(start[i] < lo[i] || start[i] > hi[i])
+						return false;
+					continue;
+				}
+
+				float t0 = (lo[i] - start[i]) / dir[i];
+				float t1 = (hi[i] - start[i]) / dir[i];
+				if(t0 > t1)
+					std::swap(t0, t1);
+				tMin = MathHelper::Max(tMin, t0);
+				tMax = MathHelper::Min(tMax, t1);
+				if(tMin > tMax)
+					return false;
+			}
+
+			int x, z;
+			CellOf(a[0] + d[0]*tMin, a[2] + d[2]*tMin, x, z);
+
+			const int stepX = d[0] > 0.0f ? 1 : -1;
+			const int stepZ = d[2] > 0.0f ? 1 : -1;
+			const float deltaX = fabsf(d[0]) > 1.0e-8f ? mCellSize / fabsf(d[0]) : FLT_MAX;
+			const float deltaZ = fabsf(d[2]) > 1.0e-8f ? mCellSize / fabsf(d[2]) : FLT_MAX;
+			float nextX = deltaX == FLT_MAX ? FLT_MAX :
+				(mMinX + (x + (stepX > 0 ? 1 : 0))*mCellSize - a[0]) / d[0];
+			float nextZ = deltaZ == FLT_MAX ? FLT_MAX :
+				(mMinZ + (z + (stepZ > 0 ? 1 : 0))*mCellSize - a[2]) / d[2];
+
+			for(;;)
+			{
+				const int cell = z*mCellsX + x;
+				for(std::uint32_t k = mCellStarts[cell]; k < mCellStarts[cell + 1]; ++k)
+				{
+					const std::uint32_t i = mCellOccluders[k];
+					if(stamps[i] == stamp)
+						continue;
+					stamps[i] = stamp;
+
+					if(SegmentHitsOccluder(mOccluders[i], a, d))
+						return true;
+				}
+
+				if(nextX < nextZ)
+				{
+					if(nextX > tMax)
+						return false;
+					x += stepX;
+					nextX += deltaX;
+				}
+				else
+				{
+					if(nextZ > tMax)
+						return false;
+					z += stepZ;
+					nextZ += deltaZ;
+				}
+
+				if(x < 0 || x >= mCellsX || z < 0 || z >= mCellsZ)
+					return false;
+			}
+		}
+
+	private:
+		void CellOf(float px, float pz, int& x, int& z)const
+		{
+			x = MathHelper::Clamp((int)floorf((px - mMinX) / mCellSize), 0, mCellsX - 1);
+			z = MathHelper::Clamp((int)floorf((pz - mMinZ) / mCellSize), 0, mCellsZ - 1);
+		}
+
+		std::vector<Occluder> mOccluders;
+		float mCellSize;
+		float mMinX;
+		float mMinZ;
+		float mMaxX;
+		float mMaxZ;
+		int mCellsX;
+		int mCellsZ;
+		std::vector<std::uint32_t> mCellStarts;
+		std::vector<std::uint32_t> mCellOccluders;
+	};
+
+	// The points on and just outside an item that rays are aimed at.
+	void ItemTargets(const BoundingBox& box, int samples, RandomStream& random, std::vector<XMFLOAT3>& targets)
+	{
+		const float c[3] = { box.Center.x, box.Center.y, box.Center.z };
+		const float e[3] = { box.Extents.x + TargetOffset, box.Extents.y + TargetOffset, box.Extents.z + TargetOffset };
+
+		for(int i = 0; i < 8; ++i)
+		{
+			targets.push_back(XMFLOAT3(c[0] + (i & 1 ? e[0] : -e[0]), c[1] + (i & 2 ? e[1] : -e[1]),
+				c[2] + (i & 4 ? e[2] : -e[2])));
+		}
+
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			for(float side = -1.0f; side <= 1.0f; side += 2.0f)
+			{
+				float p[3] = { c[0], c[1], c[2] };
+				p[axis] += side*e[axis];
+				targets.push_back(XMFLOAT3(p[0], p[1], p[2]));
+			}
+		}
+
+		// Faces are picked in proportion to their area.
+		const float areas[3] = { e[1]*e[2], e[0]*e[2], e[0]*e[1] };
+		const float totalArea = areas[0] + areas[1] + areas[2];
+		for(int s = 0; s < samples; ++s)
+		{
+			const float pick = random.NextFloat(0.0f, totalArea);
+			const int axis = pick < areas[0] ? 0 : (pick < areas[0] + areas[1] ? 1 : 2);
+
+			float p[3];
+			for(int i = 0; i < 3; ++i)
+				p[i] = c[i] + random.NextFloat(-e[i], e[i]);
+			p[axis] = c[axis] + (random.NextFloat() < 0.5f ? -e[axis] : e[axis]);
+			targets.push_back(XMFLOAT3(p[0], p[1], p[2]));
+		}
+	}
+
+	std::size_t PopCount(std::uint64_t bits)
+	{
+		return std::bitset<64>(bits).count();
+	}
+}
+
+//
+// VisibilitySets
+//
+
+const std::uint64_t* VisibilitySets::Find(const XMFLOAT3& eye)const
+{
+	if(mCellSets.empty() || eye.y < mMinY || eye.y > mMaxY)
+		return nullptr;
+
+	const int x = (int)floorf((eye.x - mMinX) / mCellSize);
+	const int z = (int)floorf((eye.z - mMinZ) / mCellSize);
+	if(x < 0 || x >= mCellsX || z < 0 || z >= mCellsZ)
+		return nullptr;
+
+	return &mWords[mCellSets[z*mCellsX + x]];
+}
+
+bool VisibilitySets::Contains(const std::uint64_t* set, std::uint32_t item)const
+{
+	if(item >= mItemCount)
+		return false;
+
+	// The word holding the item's bit is only stored if it is non-zero; its place among
+	// the stored words is how many stored words come before it.
+	const std::uint32_t word = item >> 6;
+	const std::uint32_t presenceWord = word >> 6;
+	const std::uint64_t presence = set[presenceWord];
+	const std::uint64_t wordBit = 1ull << (word & 63);
+	if((presence & wordBit) == 0)
+		return false;
+
+	std::size_t rank = PopCount(presence & (wordBit - 1));
+	for(std::uint32_t i = 0; i < presenceWord; ++i)
+		rank += PopCount(set[i]);
+
+	return (set[mPresenceWords + rank] >> (item & 63)) & 1;
+}
+
+//
+// VisibilityBaker
+//
+
+void VisibilityBaker::AddOccluder(const BoundingBox& box)
+{
+	BoundingOrientedBox oriented;
+	BoundingOrientedBox::CreateFromBoundingBox(oriented, box);
+	mOccluders.push_back(oriented);
+}
+
+void VisibilityBaker::AddOccluder(const BoundingOrientedBox& box)
+{
+	mOccluders.push_back(box);
+}
+
+std::uint32_t VisibilityBaker::AddItem(const BoundingBox& bounds)
+{
+	mItems.push_back(bounds);
+	return (std::uint32_t)mItems.size() - 1;
+}
+
+void VisibilityBaker::Bake(const VisibilityBakeDesc& desc, VisibilitySets& sets)const
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	const OccluderGrid grid(mOccluders, desc.CellSize);
+
+	const int cellsX = MathHelper::Max(1, (int)ceilf((desc.MaxX - desc.MinX) / desc.CellSize));
+	const int cellsZ = MathHelper::Max(1, (int)ceilf((desc.MaxZ - desc.MinZ) / desc.CellSize));
+	const int cellCount = cellsX*cellsZ;
+	const std::uint32_t itemCount = (std::uint32_t)mItems.size();
+	const std::uint32_t itemWords = (itemCount + 63) / 64;
+
+	// Each item's targets, one item after another.
+	std::vector<XMFLOAT3> targets;
+	std::vector<std::uint32_t> targetStarts(itemCount + 1, 0);
+	RandomStream targetRandom(desc.Seed);
+	for(std::uint32_t i = 0; i < itemCount; ++i)
+	{
+		ItemTargets(mItems[i], desc.ItemSamples, targetRandom, targets);
+		targetStarts[i + 1] = (std::uint32_t)targets.size();
+	}
+
+	std::vector<std::uint64_t> cellBits((std::size_t)cellCount*itemWords, 0);
+	std::atomic<std::uint64_t> raysCast{ 0 };
+	std::atomic<std::uint64_t> visiblePairs{ 0 };
+
+	concurrency::parallel_for(0, cellCount, [&](int cell)
+	{
+		const int cellX = cell % cellsX;
+		const int cellZ = cell / cellsX;
+
+		// Jittered within a grid of strata, from a stream of the cell's own so the result
+		// does not depend on which thread bakes it.  Eyes inside walls are dropped.
+		RandomStream random(((std::uint64_t)desc.Seed << 32) ^ (std::uint64_t)(cell + 1));
+		std::vector<XMFLOAT3> eyes;
+		const float cellMinX = desc.MinX + cellX*desc.CellSize;
+		const float cellMinZ = desc.MinZ + cellZ*desc.CellSize;
+		const float stepXZ = desc.CellSize / desc.EyeSamplesXZ;
+		const float stepY = (desc.MaxY - desc.MinY) / desc.EyeSamplesY;
+		auto addEye = [&](const XMFLOAT3& eye)
+		{
+			if(!grid.Inside(&eye.x))
+				eyes.push_back(eye);
+		};
+		for(int sy = 0; sy < desc.EyeSamplesY; ++sy)
+		{
+			for(int sz = 0; sz < desc.EyeSamplesXZ; ++sz)
+			{
+				for(int sx = 0; sx < desc.EyeSamplesXZ; ++sx)
+				{
+					addEye(XMFLOAT3(cellMinX + (sx + random.NextFloat())*stepXZ, desc.MinY + (sy + random.NextFloat())*stepY,
+						cellMinZ + (sz + random.NextFloat())*stepXZ));
+				}
+			}
+		}
+
+		// The corners and edge midpoints at the lowest and highest eye heights, where the
+		// view reaches furthest round the cell's walls and the strata rarely land.
+		for(int sy = 0; sy < 2; ++sy)
+		{
+			for(int sz = 0; sz <= 2; ++sz)
+			{
+				for(int sx = 0; sx <= 2; ++sx)
+				{
+					if(sx == 1 && sz == 1)
+						continue;
+					addEye(XMFLOAT3(cellMinX + 0.5f*sx*desc.CellSize, sy == 0 ? desc.MinY : desc.MaxY,
+						cellMinZ + 0.5f*sz*desc.CellSize));
+				}
+			}
+		}
+
+		std::vector<std::uint32_t> stamps(grid.OccluderCount(), 0);
+		std::uint32_t stamp = 0;
+		std::uint64_t rays = 0;
+		std::uint64_t* bits = &cellBits[(std::size_t)cell*itemWords];
+
+		for(std::uint32_t item = 0; item < itemCount; ++item)
+		{
+			bool seen = false;
+			for(std::size_t e = 0; e < eyes.size() && !seen; ++e)
+			{
+				if(mItems[item].Contains(XMLoadFloat3(&eyes[e])) != DISJOINT)
+				{
+					seen = true;
+					break;
+				}
+
+				for(std::uint32_t t = targetStarts[item]; t < targetStarts[item + 1]; ++t)
+				{
+					++rays;
+					if(!grid.Blocked(&eyes[e].x, &targets[t].x, stamps, ++stamp))
+					{
+						seen = true;
+						break;
+					}
+				}
+			}
+
+			if(seen)
+				bits[item >> 6] |= 1ull << (item & 63);
+		}
+
+		raysCast += rays;
+	});
+
+	// Each cell's set also takes what its eight neighbours see, so an item seen only from
+	// a spot between one cell's eye samples is caught by the samples around it.
+	std::vector<std::uint64_t> paddedBits(cellBits.size(), 0);
+	concurrency::parallel_for(0, cellCount, [&](int cell)
+	{
+		const int cellX = cell % cellsX;
+		const int cellZ = cell / cellsX;
+		std::uint64_t* padded = &paddedBits[(std::size_t)cell*itemWords];
+		std::uint64_t visible = 0;
+
+		for(int z = MathHelper::Max(0, cellZ - 1); z <= MathHelper::Min(cellsZ - 1, cellZ + 1); ++z)
+		{
+			for(int x = MathHelper::Max(0, cellX - 1); x <= MathHelper::Min(cellsX - 1, cellX + 1); ++x)
+			{
+				const std::uint64_t* bits = &cellBits[(std::size_t)(z*cellsX + x)*itemWords];
+				for(std::uint32_t w = 0; w < itemWords; ++w)
+					padded[w] |= bits[w];
+			}
+		}
+
+		for(std::uint32_t w = 0; w < itemWords; ++w)
+			visible += PopCount(padded[w]);
+		visiblePairs += visible;
+	});
+	cellBits.swap(paddedBits);
+
+	// Store each distinct set once.
+	sets.mMinX = desc.MinX;
+	sets.mMinZ = desc.MinZ;
+	sets.mMinY = desc.MinY;
+	sets.mMaxY = desc.MaxY;
+	sets.mCellSize = desc.CellSize;
+	sets.mCellsX = cellsX;
+	sets.mCellsZ = cellsZ;
+	sets.mItemCount = itemCount;
+	sets.mItemWords = itemWords;
+	sets.mPresenceWords = (itemWords + 63) / 64;
+	sets.mCellSets.resize(cellCount);
+	sets.mWords.clear();
+
+	std::map<std::vector<std::uint64_t>, std::uint32_t> distinct;
+	std::vector<std::uint64_t> words(itemWords);
+	for(int cell = 0; cell < cellCount; ++cell)
+	{
+		const std::uint64_t* bits = &cellBits[(std::size_t)cell*itemWords];
+		words.assign(bits, bits + itemWords);
+
+		auto found = distinct.find(words);
+		if(found != distinct.end())
+		{
+			sets.mCellSets[cell] = found->second;
+			continue;
+		}
+
+		const std::uint32_t offset = (std::uint32_t)sets.mWords.size();
+		sets.mWords.resize(offset + sets.mPresenceWords, 0);
+		for(std::uint32_t w = 0; w < itemWords; ++w)
+		{
+			if(words[w] != 0)
+			{
+				sets.mWords[offset + (w >> 6)] |= 1ull << (w & 63);
+				sets.mWords.push_back(words[w]);
+			}
+		}
+
+		distinct.emplace(words, offset);
+		sets.mCellSets[cell] = offset;
+	}
+
+	sets.mSetCount = distinct.size();
+	sets.mVisibleFraction = itemCount > 0 ? (float)((double)visiblePairs / ((double)cellCount*itemCount)) : 0.0f;
+	sets.mRaysCast = raysCast;
+	sets.mBakeSeconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - t0).count();
+}
@@ -0,0 +1,131 @@
+//***************************************************************************************
+// VisibilitySets.h
+//
+// Potentially visible sets: for each cell of a floor area, which items can be seen from
+// somewhere in it.  Built once by VisibilityBaker; after that, finding what may be seen
+// from the eye is a cell lookup, and testing an item against the set is a bit test.
+//
+// The baker casts rays to the corners, face centers and random surface points of each
+// item, against a uniform grid of box occluders, from a handful of jittered eye positions
+// in each cell and from the cell's corners and edge midpoints at the lowest and highest
+// eye heights.  An item is seen from a cell as soon as one ray gets through.  Each
+// cell's set is then what it and its eight neighbours see, so an item visible only from
+// between one cell's samples is still in the set, and the sets are conservative: the
+// benchmark fails if any box left out of a set can be seen.  Sampling can still miss an
+// item seen only through a gap narrower than the samples are apart, so the occluders
+// should be solid walls, not lattices.  Cells are baked in parallel.
+//
+// Neighbouring cells mostly see the same things, so each distinct set is stored once and
+// cells refer to it.  A stored set keeps only its non-zero 64-bit words, with a bitmap
+// of which words those are in front of them.
+//***************************************************************************************
+
+#ifndef VISIBILITYSETS_H
+#define VISIBILITYSETS_H
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+struct VisibilityBakeDesc
+{
+	// The floor area cut into square cells, and the heights the eye may be at.  There are
+	// no sets for eyes outside this box.
+	float MinX = 0.0f;
+	float MinZ = 0.0f;
+	float MaxX = 64.0f;
+	float MaxZ = 64.0f;
+	float MinY = 1.0f;
+	float MaxY = 4.0f;
+	float CellSize = 4.0f;
+
+	// Eye positions per cell along x and z, and along y.
+	int EyeSamplesXZ = 2;
+	int EyeSamplesY = 2;
+
+	// Random surface points aimed at on each item besides its corners and face centers.
+	int ItemSamples = 8;
+
+	std::uint32_t Seed = 1;
+};
+
+class VisibilitySets
+{
+public:
+	VisibilitySets() = default;
+	VisibilitySets(const VisibilitySets& rhs) = delete;
+	VisibilitySets& operator=(const VisibilitySets& rhs) = delete;
+
+	// The set of the cell the eye is in, or nullptr if the eye is outside the baked area.
+	const std::uint64_t* Find(const DirectX::XMFLOAT3& eye)const;
+
+	// Whether item is in a set returned by Find().
+	bool Contains(const std::uint64_t* set, std::uint32_t item)const;
+
+	std::uint32_t ItemCount()const { return mItemCount; }
+	std::size_t CellCount()const { return mCellSets.size(); }
+	std::size_t SetCount()const { return mSetCount; }
+
+	// Bytes taken by the sets and the cells' references to them, and what one plain
+	// bitset per cell would take.
+	std::size_t Bytes()const { return mWords.size()*sizeof(std::uint64_t) + mCellSets.size()*sizeof(std::uint32_t); }
+	std::size_t UncompressedBytes()const { return mCellSets.size()*mItemWords*sizeof(std::uint64_t); }
+
+	// Of every cell and item pair, how many are in the cell's set.
+	float VisibleFraction()const { return mVisibleFraction; }
+
+	// What the bake cost.
+	float BakeSeconds()const { return mBakeSeconds; }
+	std::uint64_t RaysCast()const { return mRaysCast; }
+
+private:
+	friend class VisibilityBaker;
+
+	float mMinX = 0.0f;
+	float mMinZ = 0.0f;
+	float mMinY = 0.0f;
+	float mMaxY = 0.0f;
+	float mCellSize = 1.0f;
+	int mCellsX = 0;
+	int mCellsZ = 0;
+
+	std::uint32_t mItemCount = 0;
+	std::uint32_t mItemWords = 0;
+	std::uint32_t mPresenceWords = 0;
+
+	// Where each cell's set starts in mWords.
+	std::vector<std::uint32_t> mCellSets;
+	std::vector<std::uint64_t> mWords;
+	std::size_t mSetCount = 0;
+
+	float mVisibleFraction = 0.0f;
+	float mBakeSeconds = 0.0f;
+	std::uint64_t mRaysCast = 0;
+};
+
+class VisibilityBaker
+{
+public:
+	VisibilityBaker() = default;
+	VisibilityBaker(const VisibilityBaker& rhs) = delete;
+	VisibilityBaker& operator=(const VisibilityBaker& rhs) = delete;
+
+	void AddOccluder(const DirectX::BoundingBox& box);
+	void AddOccluder(const DirectX::BoundingOrientedBox& box);
+
+	// Returns the item's index in the sets.
+	std::uint32_t AddItem(const DirectX::BoundingBox& bounds);
+
+	std::size_t OccluderCount()const { return mOccluders.size(); }
+	std::size_t ItemCount()const { return mItems.size(); }
+
+	// Replaces whatever sets held.  Any number of threads may bake at once.
+	void Bake(const VisibilityBakeDesc& desc, VisibilitySets& sets)const;
+
+private:
+	std::vector<DirectX::BoundingOrientedBox> mOccluders;
+	std::vector<DirectX::BoundingBox> mItems;
+};
+
+#endif // VISIBILITYSETS_H
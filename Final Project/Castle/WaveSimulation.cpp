@@ -0,0 +1,136 @@
+//***************************************************************************************
+// WaveSimulation.cpp
+//***************************************************************************************
+
+#include "WaveSimulation.h"
+
+using namespace DirectX;
+
+WaveSimulation::WaveSimulation(Waves& waves, const RandomStream& random, float disturbInterval)
+	: mWaves(waves), mRandom(random), mDisturbInterval(disturbInterval), mTimeStep(waves.TimeStep()),
+	mStart(Clock::now())
+{
+	const int vertexCount = mWaves.VertexCount();
+	mGridXZ.resize(vertexCount);
+	mLastHeights.resize(vertexCount);
+	mLastNormals.resize(vertexCount);
+	for(int i = 0; i < vertexCount; ++i)
+	{
+		mGridXZ[i] = XMFLOAT2(mWaves.Position(i).x, mWaves.Position(i).z);
+		mLastHeights[i] = mWaves.Position(i).y;
+		mLastNormals[i] = mWaves.Normal(i);
+	}
+
+	// So the render side has a frame from the start.
+	Publish();
+}
+
+WaveSimulation::~WaveSimulation()
+{
+	Stop();
+}
+
+void WaveSimulation::Start()
+{
+	if(mThread.joinable())
+		return;
+
+	mStop = false;
+	mThread = std::thread([this]() { Run(); });
+}
+
+void WaveSimulation::Stop()
+{
+	mStop = true;
+	if(mThread.joinable())
+		mThread.join();
+}
+
+double WaveSimulation::Now()const
+{
+	return std::chrono::duration<double>(Clock::now() - mStart).count();
+}
+
+const WaveFrame& WaveSimulation::Latest()
+{
+	mFrames.Acquire();
+	return mFrames.Front();
+}
+
+float WaveSimulation::Blend(const WaveFrame& frame, double now)const
+{
+	return MathHelper::Clamp((float)((now - frame.Time) / mTimeStep), 0.0f, 1.0f);
+}
+
+void WaveSimulation::Run()
+{
+	const Clock::duration step = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(mTimeStep));
+
+	Clock::time_point next = Clock::now();
+	Clock::time_point windowStart = next;
+	double windowMs = 0.0;
+	int windowSteps = 0;
+	float sinceDisturb = 0.0f;
+
+	while(!mStop.load())
+	{
+		sinceDisturb += mTimeStep;
+		if(sinceDisturb >= mDisturbInterval)
+		{
+			sinceDisturb -= mDisturbInterval;
+
+			int i = mRandom.NextInt(4, mWaves.RowCount() - 5);
+			int j = mRandom.NextInt(4, mWaves.ColumnCount() - 5);
+			float r = mRandom.NextFloat(0.1f, 0.25f);
+			mWaves.Disturb(i, j, r);
+		}
+
+		Clock::time_point t0 = Clock::now();
+		mWaves.Step();
+		Publish();
+		Clock::time_point t1 = Clock::now();
+
+		mSteps.fetch_add(1, std::memory_order_relaxed);
+		windowMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		++windowSteps;
+		if(t1 - windowStart >= std::chrono::seconds(1))
+		{
+			mStepMs.store((float)(windowMs / windowSteps), std::memory_order_relaxed);
+			windowStart = t1;
+			windowMs = 0.0;
+			windowSteps = 0;
+		}
+
+		// Don't try to catch up after a long stall, e.g. at a breakpoint, by stepping
+		// flat out; just carry on from now.
+		next += step;
+		if(t1 - next > 4*step)
+			next = t1;
+
+		std::this_thread::sleep_until(next);
+	}
+}
+
+void WaveSimulation::Publish()
+{
+	const int vertexCount = mWaves.VertexCount();
+
+	WaveFrame& frame = mFrames.Back();
+	frame.PrevHeights.swap(mLastHeights);
+	frame.PrevNormals.swap(mLastNormals);
+	frame.Heights.resize(vertexCount);
+	frame.Normals.resize(vertexCount);
+	mLastHeights.resize(vertexCount);
+	mLastNormals.resize(vertexCount);
+
+	for(int i = 0; i < vertexCount; ++i)
+	{
+		frame.Heights[i] = mLastHeights[i] = mWaves.Position(i).y;
+		frame.Normals[i] = mLastNormals[i] = mWaves.Normal(i);
+	}
+
+	frame.Time = Now();
+	frame.StepIndex = mStepIndex++;
+	mFrames.Publish();
+}
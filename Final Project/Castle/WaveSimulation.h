@@ -0,0 +1,99 @@
+//***************************************************************************************
+// WaveSimulation.h
+//
+// Steps a Waves grid on a thread of its own at the grid's fixed time step, so the cost of
+// the solver no longer adds to frame time and the frame rate and simulation rate are
+// independent.
+//
+// After every step the thread publishes the new heights and normals, together with the
+// ones from the step before, through a TripleBuffer.  The render side picks up the
+// newest frame without waiting and blends between the two states by how far the clock
+// has moved past the newer one, so the water moves smoothly however the two rates line
+// up.  What is drawn is therefore up to one step behind the simulation.
+//
+// Once Start() has been called the Waves object belongs to the simulation thread: only
+// its dimensions may be read from other threads.
+//***************************************************************************************
+
+#ifndef WAVESIMULATION_H
+#define WAVESIMULATION_H
+
+#include "Waves.h"
+#include "TripleBuffer.h"
+#include "../../Common/MathHelper.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct WaveFrame
+{
+	// Heights and normals of the last two steps, grid point by grid point.
+	std::vector<float> PrevHeights;
+	std::vector<float> Heights;
+	std::vector<DirectX::XMFLOAT3> PrevNormals;
+	std::vector<DirectX::XMFLOAT3> Normals;
+
+	// When the newer step was taken, in seconds on the WaveSimulation's clock.
+	double Time = 0.0;
+	std::uint64_t StepIndex = 0;
+};
+
+class WaveSimulation
+{
+public:
+	// Disturbs a random grid point every disturbInterval seconds of simulated time, picked
+	// with random.
+	WaveSimulation(Waves& waves, const RandomStream& random, float disturbInterval = 0.25f);
+	WaveSimulation(const WaveSimulation& rhs) = delete;
+	WaveSimulation& operator=(const WaveSimulation& rhs) = delete;
+	~WaveSimulation();
+
+	void Start();
+	void Stop();
+
+	// Seconds since the simulation was created.
+	double Now()const;
+
+	// Render side: the newest published frame.  Only call it from one thread.
+	const WaveFrame& Latest();
+
+	// How far to blend from the frame's previous state to its newer one at time now.
+	float Blend(const WaveFrame& frame, double now)const;
+
+	// Grid point positions in the xz plane, which the simulation never changes.
+	const std::vector<DirectX::XMFLOAT2>& GridXZ()const { return mGridXZ; }
+
+	std::uint64_t Steps()const { return mSteps.load(std::memory_order_relaxed); }
+
+	// Average time one step took over the last second.
+	float StepMs()const { return mStepMs.load(std::memory_order_relaxed); }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void Run();
+	void Publish();
+
+	Waves& mWaves;
+	RandomStream mRandom;
+	float mDisturbInterval;
+	float mTimeStep;
+
+	Clock::time_point mStart;
+	std::vector<DirectX::XMFLOAT2> mGridXZ;
+
+	// State of the step before the current one, kept by the simulation thread.
+	std::vector<float> mLastHeights;
+	std::vector<DirectX::XMFLOAT3> mLastNormals;
+	std::uint64_t mStepIndex = 0;
+
+	TripleBuffer<WaveFrame> mFrames;
+
+	std::thread mThread;
+	std::atomic<bool> mStop{ false };
+	std::atomic<std::uint64_t> mSteps{ 0 };
+	std::atomic<float> mStepMs{ 0.0f };
+};
+
+#endif // WAVESIMULATION_H
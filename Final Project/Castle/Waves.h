@@ -26,6 +26,7 @@ public:
 	int TriangleCount()const;
 	float Width()const;
 	float Depth()const;
+	float TimeStep()const { return mTimeStep; }
 
 	// Returns the solution at the ith grid point.
     const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
@@ -37,6 +38,10 @@ public:
     const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
 
 	void Update(float dt);
+
+	// Advances the simulation by one time step.
+	void Step();
+
 	void Disturb(int i, int j, float magnitude);
 
 private: